@@ -1,11 +1,14 @@
 #include "ascon.h"
 #include "word.h"
 #include "constants.h"
+#include "../probes.h"  // For the aead_* USDT probes
+#include "../dispatch.h"  // For DISPATCH_CLONES (permutation inlined)
 
 // ========================================================================
 // AEAD encryption function for ASCON-128a
 // ========================================================================
 
+DISPATCH_CLONES
 int crypto_aead_encrypt(
   uint8_t *c,               // Output ciphertext (encrypted message)
   uint64_t *clen,           // Length of the ciphertext (output)
@@ -16,6 +19,8 @@ int crypto_aead_encrypt(
 ){
 
 
+  ECC_PROBE1(aead_encrypt_entry, mlen);
+
   // =====================================================================
   // Set ciphertext size
   // =====================================================================
@@ -100,7 +105,7 @@ int crypto_aead_encrypt(
   STOREBYTES(c, s.x[3], 8);  // Store tag
   STOREBYTES(c + 8, s.x[4], 8);  // Store second part of tag
 
-
+  ECC_PROBE1(aead_encrypt_return, *clen);
 
   return 0;  // Return success
 }
@@ -108,6 +113,7 @@ int crypto_aead_encrypt(
 // ========================================================================
 // Decryption function for AEAD using ASCON-128a.
 // ========================================================================
+DISPATCH_CLONES
 int crypto_aead_decrypt(
   uint8_t *m,              // Output message (decrypted message)
   uint64_t *mlen,          // Length of the decrypted message (output)
@@ -118,9 +124,13 @@ int crypto_aead_decrypt(
   const uint8_t *k         // Key (same key as encryption)
 ){
   (void)nsec;  // 'nsec' is unused in this function, suppress warning
+  ECC_PROBE1(aead_decrypt_entry, clen);
 
   // Check if the ciphertext length is at least the size of the tag
-  if (clen < CRYPTO_ABYTES) return -1;
+  if (clen < CRYPTO_ABYTES) {
+    ECC_PROBE2(aead_decrypt_return, 0, -1);
+    return -1;
+  }
 
    // =====================================================================
    // Set the size of the decrypted plaintext (m) by subtracting
@@ -244,5 +254,223 @@ int crypto_aead_decrypt(
    // Debugging: Print the decrypted message (m).
    // =====================================================================
 
+  ECC_PROBE2(aead_decrypt_return, *mlen, result);
   return result;  // Return 0 if decryption is successful, else error
 }
+
+// ========================================================================
+// Incremental AEAD for messages held in several buffers
+// ========================================================================
+// The same computation as crypto_aead_encrypt()/crypto_aead_decrypt(),
+// split so that the message can be passed in pieces: every piece but
+// the last must be a multiple of ASCON_128A_RATE bytes, the last one
+// (shorter than the rate) goes to the final call together with the tag.
+
+DISPATCH_CLONES
+void ascon_aead_start(
+  ascon_aead_state_t *a,   // State to initialize
+  const uint8_t *npub,     // Public nonce
+  const uint8_t *k         // Key
+){
+  a->K0 = LOADBYTES(k, 8);
+  a->K1 = LOADBYTES(k + 8, 8);
+  a->s.x[0] = ASCON_128A_IV;
+  a->s.x[1] = a->K0;
+  a->s.x[2] = a->K1;
+  a->s.x[3] = LOADBYTES(npub, 8);
+  a->s.x[4] = LOADBYTES(npub + 8, 8);
+  P12(&a->s);
+  a->s.x[3] ^= a->K0;
+  a->s.x[4] ^= a->K1;
+  a->s.x[4] ^= DSEP();  // No associated data
+}
+
+DISPATCH_CLONES
+void ascon_aead_encrypt_blocks(
+  ascon_aead_state_t *a,   // Running state
+  uint8_t *c,              // Output ciphertext (len bytes)
+  const uint8_t *m,        // Plaintext, a multiple of the rate
+  uint64_t len             // Its length
+){
+  ascon_state_t *s = &a->s;
+  while (len >= ASCON_128A_RATE) {
+    s->x[0] ^= LOADBYTES(m, 8);
+    s->x[1] ^= LOADBYTES(m + 8, 8);
+    STOREBYTES(c, s->x[0], 8);
+    STOREBYTES(c + 8, s->x[1], 8);
+    P8(s);
+    m += ASCON_128A_RATE;
+    c += ASCON_128A_RATE;
+    len -= ASCON_128A_RATE;
+  }
+}
+
+DISPATCH_CLONES
+void ascon_aead_decrypt_blocks(
+  ascon_aead_state_t *a,   // Running state
+  uint8_t *m,              // Output plaintext (len bytes)
+  const uint8_t *c,        // Ciphertext, a multiple of the rate
+  uint64_t len             // Its length
+){
+  ascon_state_t *s = &a->s;
+  while (len >= ASCON_128A_RATE) {
+    uint64_t c0 = LOADBYTES(c, 8);
+    uint64_t c1 = LOADBYTES(c + 8, 8);
+    STOREBYTES(m, s->x[0] ^ c0, 8);
+    STOREBYTES(m + 8, s->x[1] ^ c1, 8);
+    s->x[0] = c0;
+    s->x[1] = c1;
+    P8(s);
+    m += ASCON_128A_RATE;
+    c += ASCON_128A_RATE;
+    len -= ASCON_128A_RATE;
+  }
+}
+
+// Finalization shared by both directions: writes the tag to 't'
+static void ascon_aead_tag(ascon_aead_state_t *a, uint8_t t[CRYPTO_ABYTES])
+{
+  ascon_state_t *s = &a->s;
+  s->x[2] ^= a->K0;
+  s->x[3] ^= a->K1;
+  P12(s);
+  s->x[3] ^= a->K0;
+  s->x[4] ^= a->K1;
+  STOREBYTES(t, s->x[3], 8);
+  STOREBYTES(t + 8, s->x[4], 8);
+}
+
+DISPATCH_CLONES
+void ascon_aead_encrypt_final(
+  ascon_aead_state_t *a,   // Running state
+  uint8_t *c,              // Output: the last ciphertext bytes
+  const uint8_t *m,        // Last plaintext bytes (fewer than the rate)
+  uint64_t len,            // Their number
+  uint8_t *tag             // Output: CRYPTO_ABYTES tag
+){
+  ascon_state_t *s = &a->s;
+  if (len >= 8) {
+    s->x[0] ^= LOADBYTES(m, 8);
+    s->x[1] ^= LOADBYTES(m + 8, len - 8);
+    STOREBYTES(c, s->x[0], 8);
+    STOREBYTES(c + 8, s->x[1], len - 8);
+    s->x[1] ^= PAD(len - 8);
+  } else {
+    s->x[0] ^= LOADBYTES(m, len);
+    STOREBYTES(c, s->x[0], len);
+    s->x[0] ^= PAD(len);
+  }
+  ascon_aead_tag(a, tag);
+}
+
+DISPATCH_CLONES
+int ascon_aead_decrypt_final(
+  ascon_aead_state_t *a,   // Running state
+  uint8_t *m,              // Output: the last plaintext bytes
+  const uint8_t *c,        // Last ciphertext bytes (fewer than the rate)
+  uint64_t len,            // Their number
+  const uint8_t *tag       // Received CRYPTO_ABYTES tag
+){
+  ascon_state_t *s = &a->s;
+  if (len >= 8) {
+    uint64_t c0 = LOADBYTES(c, 8);
+    uint64_t c1 = LOADBYTES(c + 8, len - 8);
+    STOREBYTES(m, s->x[0] ^ c0, 8);
+    STOREBYTES(m + 8, s->x[1] ^ c1, len - 8);
+    s->x[0] = c0;
+    s->x[1] = CLEARBYTES(s->x[1], len - 8);
+    s->x[1] |= c1;
+    s->x[1] ^= PAD(len - 8);
+  } else {
+    uint64_t c0 = LOADBYTES(c, len);
+    STOREBYTES(m, s->x[0] ^ c0, len);
+    s->x[0] = CLEARBYTES(s->x[0], len);
+    s->x[0] |= c0;
+    s->x[0] ^= PAD(len);
+  }
+
+  // Compare in constant time, as crypto_aead_decrypt() does
+  uint8_t t[CRYPTO_ABYTES];
+  ascon_aead_tag(a, t);
+  int result = 0;
+  for (int i = 0; i < CRYPTO_ABYTES; ++i) result |= tag[i] ^ t[i];
+  return (((result - 1) >> 8) & 1) - 1;
+}
+
+// ========================================================================
+// Fused re-encryption: decrypt under 'd' and encrypt under 'e' in one
+// pass. The plaintext of a block only exists in p0 and p1.
+// ========================================================================
+DISPATCH_CLONES
+void ascon_aead_reencrypt_blocks(
+  ascon_aead_state_t *d,   // Running state of the input (decryption)
+  ascon_aead_state_t *e,   // Running state of the output (encryption)
+  uint8_t *out,            // Output ciphertext (len bytes)
+  const uint8_t *in,       // Input ciphertext, a multiple of the rate
+  uint64_t len             // Its length
+){
+  ascon_state_t *sd = &d->s;
+  ascon_state_t *se = &e->s;
+  while (len >= ASCON_128A_RATE) {
+    uint64_t c0 = LOADBYTES(in, 8);
+    uint64_t c1 = LOADBYTES(in + 8, 8);
+    uint64_t p0 = sd->x[0] ^ c0;
+    uint64_t p1 = sd->x[1] ^ c1;
+    sd->x[0] = c0;
+    sd->x[1] = c1;
+    se->x[0] ^= p0;
+    se->x[1] ^= p1;
+    STOREBYTES(out, se->x[0], 8);
+    STOREBYTES(out + 8, se->x[1], 8);
+    P8(sd);
+    P8(se);
+    in += ASCON_128A_RATE;
+    out += ASCON_128A_RATE;
+    len -= ASCON_128A_RATE;
+  }
+}
+
+DISPATCH_CLONES
+int ascon_aead_reencrypt_final(
+  ascon_aead_state_t *d,   // Running state of the input
+  ascon_aead_state_t *e,   // Running state of the output
+  uint8_t *out,            // Output: the last ciphertext bytes
+  const uint8_t *in,       // Last input bytes (fewer than the rate)
+  uint64_t len,            // Their number
+  const uint8_t *tag_in,   // Received CRYPTO_ABYTES tag
+  uint8_t *tag_out         // Output: CRYPTO_ABYTES tag
+){
+  ascon_state_t *sd = &d->s;
+  ascon_state_t *se = &e->s;
+  if (len >= 8) {
+    uint64_t c0 = LOADBYTES(in, 8);
+    uint64_t c1 = LOADBYTES(in + 8, len - 8);
+    uint64_t p0 = sd->x[0] ^ c0;
+    uint64_t p1 = sd->x[1] ^ c1;
+    p1 ^= CLEARBYTES(p1, len - 8);  // Keep the bytes of the message
+    sd->x[0] = c0;
+    sd->x[1] = CLEARBYTES(sd->x[1], len - 8) | c1;
+    sd->x[1] ^= PAD(len - 8);
+    se->x[0] ^= p0;
+    se->x[1] ^= p1;
+    STOREBYTES(out, se->x[0], 8);
+    STOREBYTES(out + 8, se->x[1], len - 8);
+    se->x[1] ^= PAD(len - 8);
+  } else {
+    uint64_t c0 = LOADBYTES(in, len);
+    uint64_t p0 = sd->x[0] ^ c0;
+    p0 ^= CLEARBYTES(p0, len);
+    sd->x[0] = CLEARBYTES(sd->x[0], len) | c0;
+    sd->x[0] ^= PAD(len);
+    se->x[0] ^= p0;
+    STOREBYTES(out, se->x[0], len);
+    se->x[0] ^= PAD(len);
+  }
+  ascon_aead_tag(e, tag_out);
+
+  uint8_t t[CRYPTO_ABYTES];
+  ascon_aead_tag(d, t);
+  int result = 0;
+  for (int i = 0; i < CRYPTO_ABYTES; ++i) result |= tag_in[i] ^ t[i];
+  return (((result - 1) >> 8) & 1) - 1;
+}
@@ -41,4 +41,73 @@ int crypto_aead_decrypt(
   const uint8_t *k         // Key (same key as encryption)
 );
 
+// =====================================================================
+// Incremental AEAD (same output as crypto_aead_encrypt/decrypt)
+// - For a message held in several buffers: start, then pass every
+//   piece but the last to the _blocks function (each piece a multiple
+//   of ASCON_AEAD_RATE bytes), then the rest (shorter than the rate,
+//   possibly empty) to the _final function, which writes or checks
+//   the 16-byte tag. decrypt_final returns 0 or -1 like
+//   crypto_aead_decrypt.
+// =====================================================================
+#define ASCON_AEAD_RATE 16
+
+typedef struct {
+    ascon_state_t s;  // Cipher state
+    uint64_t K0, K1;  // Key, needed again for the tag
+} ascon_aead_state_t;
+
+void ascon_aead_start(ascon_aead_state_t *a, const uint8_t *npub,
+                      const uint8_t *k);
+void ascon_aead_encrypt_blocks(ascon_aead_state_t *a, uint8_t *c,
+                               const uint8_t *m, uint64_t len);
+void ascon_aead_encrypt_final(ascon_aead_state_t *a, uint8_t *c,
+                              const uint8_t *m, uint64_t len,
+                              uint8_t *tag);
+void ascon_aead_decrypt_blocks(ascon_aead_state_t *a, uint8_t *m,
+                               const uint8_t *c, uint64_t len);
+int ascon_aead_decrypt_final(ascon_aead_state_t *a, uint8_t *m,
+                             const uint8_t *c, uint64_t len,
+                             const uint8_t *tag);
+
+// =====================================================================
+// Fused re-encryption (decrypt under 'd', encrypt under 'e')
+// - One pass over the ciphertext: each block is decrypted and the
+//   plaintext block is encrypted again while it is still in registers,
+//   so the plaintext is never written to memory. Same piece rules as
+//   above. reencrypt_final writes the new tag to 'tag_out' and returns
+//   -1 if 'tag_in' does not authenticate the input; the output must
+//   then be discarded.
+// =====================================================================
+void ascon_aead_reencrypt_blocks(ascon_aead_state_t *d,
+                                 ascon_aead_state_t *e, uint8_t *out,
+                                 const uint8_t *in, uint64_t len);
+int ascon_aead_reencrypt_final(ascon_aead_state_t *d,
+                               ascon_aead_state_t *e, uint8_t *out,
+                               const uint8_t *in, uint64_t len,
+                               const uint8_t *tag_in, uint8_t *tag_out);
+
+// =====================================================================
+// Ascon-XOF128: extendable output function
+// - Absorbs 'inlen' bytes of 'in' and squeezes 'outlen' bytes into
+//   'out'. Used to derive keys of any length from a secret.
+// =====================================================================
+int crypto_xof(
+  uint8_t *out,            // Output bytes
+  uint64_t outlen,         // Number of output bytes
+  const uint8_t *in,       // Input message
+  uint64_t inlen           // Length of the input message
+);
+
+// =====================================================================
+// Ascon-Hash256: 32-byte message digest
+// =====================================================================
+#define CRYPTO_HASH_BYTES 32
+
+int crypto_hash(
+  uint8_t *out,            // Output digest (CRYPTO_HASH_BYTES)
+  const uint8_t *in,       // Input message
+  uint64_t inlen           // Length of the input message
+);
+
 #endif /* ASCON_H_ */
\ No newline at end of file
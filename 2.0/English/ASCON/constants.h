@@ -43,6 +43,24 @@
 | ((uint64_t)(ASCON_TAG_SIZE * 8)     << 24)  \
 | ((uint64_t)(ASCON_128A_RATE)        << 40))
 
+// Ascon-XOF128 and Ascon-Hash256 (NIST SP 800-232): 8-byte rate, 12
+// rounds for both permutations, variant 3 and 2 of the same IV layout.
+// The XOF has no fixed output length (0), Hash256 outputs 256 bits.
+#define ASCON_HASH_RATE 8
+
+#define ASCON_XOF128_IV                         \
+(((uint64_t)3                         << 0)   \
+| ((uint64_t)(ASCON_PA_ROUNDS)        << 16)  \
+| ((uint64_t)(ASCON_PA_ROUNDS)        << 20)  \
+| ((uint64_t)(ASCON_HASH_RATE)        << 40))
+
+#define ASCON_HASH256_IV                        \
+(((uint64_t)2                         << 0)   \
+| ((uint64_t)(ASCON_PA_ROUNDS)        << 16)  \
+| ((uint64_t)(ASCON_PA_ROUNDS)        << 20)  \
+| ((uint64_t)256                      << 24)  \
+| ((uint64_t)(ASCON_HASH_RATE)        << 40))
+
 // =====================================================================
 // API for encryption and authentication operations
 // =====================================================================
@@ -0,0 +1,77 @@
+#include "ascon.h"
+#include "word.h"
+#include "constants.h"
+
+// ========================================================================
+// Sponge shared by Ascon-XOF128 and Ascon-Hash256
+// ========================================================================
+// Both functions absorb the message 8 bytes at a time into x[0] with the
+// 12-round permutation in between, pad the last block and then squeeze
+// the output from x[0], again 8 bytes per permutation. They differ only
+// in the IV, which fixes the output length.
+
+static void ascon_hash_sponge(
+  uint64_t iv,             // Variant-specific initial value
+  uint8_t *out,            // Output bytes
+  uint64_t outlen,         // Number of output bytes
+  const uint8_t *in,       // Input message
+  uint64_t inlen           // Length of the input message
+){
+  // =====================================================================
+  // Initialize ASCON state
+  // =====================================================================
+  ascon_state_t s;
+  s.x[0] = iv;  // IV, the rest of the state starts at zero
+  s.x[1] = 0;
+  s.x[2] = 0;
+  s.x[3] = 0;
+  s.x[4] = 0;
+  P12(&s);
+
+  // =====================================================================
+  // Absorb full message blocks
+  // =====================================================================
+  while (inlen >= ASCON_HASH_RATE) {
+    s.x[0] ^= LOADBYTES(in, 8);
+    P12(&s);
+    in += ASCON_HASH_RATE;
+    inlen -= ASCON_HASH_RATE;
+  }
+
+  // =====================================================================
+  // Absorb the final (possibly empty) block with padding
+  // =====================================================================
+  s.x[0] ^= LOADBYTES(in, (int)inlen);
+  s.x[0] ^= PAD(inlen);
+  P12(&s);
+
+  // =====================================================================
+  // Squeeze the output
+  // =====================================================================
+  while (outlen > ASCON_HASH_RATE) {
+    STOREBYTES(out, s.x[0], 8);
+    P12(&s);
+    out += ASCON_HASH_RATE;
+    outlen -= ASCON_HASH_RATE;
+  }
+  STOREBYTES(out, s.x[0], (int)outlen);
+}
+
+// ========================================================================
+// Ascon-XOF128
+// ========================================================================
+int crypto_xof(uint8_t *out, uint64_t outlen, const uint8_t *in,
+               uint64_t inlen)
+{
+  ascon_hash_sponge(ASCON_XOF128_IV, out, outlen, in, inlen);
+  return 0;
+}
+
+// ========================================================================
+// Ascon-Hash256
+// ========================================================================
+int crypto_hash(uint8_t *out, const uint8_t *in, uint64_t inlen)
+{
+  ascon_hash_sponge(ASCON_HASH256_IV, out, CRYPTO_HASH_BYTES, in, inlen);
+  return 0;
+}
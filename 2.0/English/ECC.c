@@ -1,4 +1,6 @@
 #include "ECC.h"
+#include "probes.h"  // For the scalarmult_* USDT probes
+#include "dispatch.h"  // For DISPATCH_CLONES
 
 // Constant parameter of the elliptic curve (121665), used in multiplication
 static gf _121665 = {0xDB41, 1};
@@ -202,12 +204,14 @@ sv pack(uint8_t *o, gf n)
 // ========================================================================
 
 // Accepts scalar n and point p, and computes q = n * p on the elliptic
-// curve.
+// curve. One copy per CPU level, picked at load time (dispatch.h).
+DISPATCH_CLONES
 int crypto_scalarmult(uint8_t *q, const uint8_t *n, const uint8_t *p)
 {
     uint8_t z[32];
     lli x[32];
     int i;
+    ECC_PROBE(scalarmult_entry);
     for (i = 0; i < 31; ++i)
         z[i] = n[i];
     z[31] = (n[31] & 127) | 64;  // Set bits according to X25519
@@ -217,6 +221,7 @@ int crypto_scalarmult(uint8_t *q, const uint8_t *n, const uint8_t *p)
     inv(x + 16, x + 16);  // Invert Z coordinate
     mul(x, x, x + 16);    // Divide X/Z
     pack(q, x);           // Pack result
+    ECC_PROBE(scalarmult_return);
     return 0;
 }
 
@@ -0,0 +1,204 @@
+#include "audio.h"
+#include "log.h"          // For the reason there is no music
+#include <stdio.h>        // For snprintf()
+#include <stdlib.h>       // For getenv()
+
+#ifdef _WIN32
+#include <windows.h>      // For PlaySound(), waveOutSetVolume()
+#include <mmsystem.h>
+
+// ========================================================================
+// Windows: PlaySound() is asynchronous already
+// ========================================================================
+int audio_headless(void)
+{
+    return waveOutGetNumDevs() == 0;
+}
+
+int audio_start(const char *file, int loops)
+{
+    (void)loops;  // PlaySound() loops forever or plays once
+
+    if (audio_headless()) return -1;
+
+    // Master volume of about 10 % for both channels
+    DWORD volume = (0x1999) | (0x1999 << 16);
+    waveOutSetVolume(0, volume);
+    PlaySound(file, NULL, SND_FILENAME | SND_ASYNC | SND_LOOP);
+    return 0;
+}
+
+void audio_stop(void)
+{
+    PlaySound(NULL, 0, 0);
+}
+
+#else
+
+#include <dlfcn.h>        // For dlopen(), dlsym()
+#include <pthread.h>      // For the background thread
+#include <stdint.h>       // For uint16_t, uint32_t
+#include <unistd.h>       // For access()
+
+// The few SDL2 and SDL2_mixer entry points used, resolved at run time
+#define AUDIO_SDL_INIT_AUDIO 0x00000010u
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define AUDIO_FORMAT 0x9010       // AUDIO_S16MSB (MIX_DEFAULT_FORMAT)
+#else
+#define AUDIO_FORMAT 0x8010       // AUDIO_S16LSB (MIX_DEFAULT_FORMAT)
+#endif
+
+typedef struct {
+    int (*init)(uint32_t flags);                          // SDL_Init
+    const char *(*get_error)(void);                       // SDL_GetError
+    int (*open_audio)(int freq, uint16_t format, int channels,
+                      int chunk);                         // Mix_OpenAudio
+    void *(*load)(const char *file);                      // Mix_LoadMUS
+    int (*volume)(int volume);                            // Mix_VolumeMusic
+    int (*play)(void *music, int loops);                  // Mix_PlayMusic
+    int (*halt)(void);                                    // Mix_HaltMusic
+} AudioApi;
+
+// Libraries tried in order
+static const char *const audio_libs[] = {
+    "libSDL2_mixer-2.0.so.0",
+    "libSDL2_mixer.so",
+    "libSDL2_mixer-2.0.0.dylib",
+};
+
+// ========================================================================
+// State shared with the background thread
+// ========================================================================
+static pthread_mutex_t audio_lock = PTHREAD_MUTEX_INITIALIZER;
+static AudioApi audio_api;        // Valid once 'audio_playing' is set
+static int audio_stopped;         // audio_stop() was called
+static int audio_playing;         // Music started, not halted yet
+
+static const char *audio_file;
+static int audio_loops;
+
+// ========================================================================
+// Helpers
+// ========================================================================
+
+// Resolves 'name' in 'lib'. Returns 0, or -1 if it is missing.
+static int audio_sym(void *lib, const char *name, void *fn)
+{
+    void *p = dlsym(lib, name);
+    if (p == NULL) return -1;
+    *(void **)fn = p;
+    return 0;
+}
+
+// Loads SDL2_mixer (and through it SDL2). Returns 0, or -1 with a reason
+// in 'why'.
+static int audio_load(AudioApi *api, char *why, size_t len)
+{
+    void *lib = NULL;
+
+    for (size_t i = 0; lib == NULL &&
+                       i < sizeof(audio_libs) / sizeof(audio_libs[0]); i++) {
+        lib = dlopen(audio_libs[i], RTLD_NOW | RTLD_LOCAL);
+    }
+    if (lib == NULL) {
+        snprintf(why, len, "SDL2_mixer not installed");
+        return -1;
+    }
+    if (audio_sym(lib, "SDL_Init", &api->init) != 0 ||
+        audio_sym(lib, "SDL_GetError", &api->get_error) != 0 ||
+        audio_sym(lib, "Mix_OpenAudio", &api->open_audio) != 0 ||
+        audio_sym(lib, "Mix_LoadMUS", &api->load) != 0 ||
+        audio_sym(lib, "Mix_VolumeMusic", &api->volume) != 0 ||
+        audio_sym(lib, "Mix_PlayMusic", &api->play) != 0 ||
+        audio_sym(lib, "Mix_HaltMusic", &api->halt) != 0) {
+        snprintf(why, len, "SDL2_mixer lacks %s", dlerror());
+        dlclose(lib);
+        return -1;
+    }
+    return 0;  // The library stays loaded for the process
+}
+
+// Background thread: library, device, file, then the music unless the
+// server stopped waiting meanwhile
+static void *audio_thread(void *arg)
+{
+    AudioApi api;
+    char why[128];
+    void *music = NULL;
+
+    (void)arg;
+    if (audio_load(&api, why, sizeof(why)) != 0) {
+        log_warn("No music: %s", why);
+        return NULL;
+    }
+    if (api.init(AUDIO_SDL_INIT_AUDIO) < 0 ||
+        api.open_audio(44100, AUDIO_FORMAT, 2, 2048) < 0 ||
+        (music = api.load(audio_file)) == NULL) {
+        log_warn("No music: %s", api.get_error());
+        return NULL;
+    }
+    api.volume(AUDIO_VOLUME);
+
+    pthread_mutex_lock(&audio_lock);
+    if (!audio_stopped) {
+        if (api.play(music, audio_loops) == -1) {
+            log_warn("No music: %s", api.get_error());
+        } else {
+            audio_api = api;
+            audio_playing = 1;
+        }
+    }
+    pthread_mutex_unlock(&audio_lock);
+    return NULL;
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int audio_headless(void)
+{
+    char path[256];
+    const char *run = getenv("XDG_RUNTIME_DIR");
+
+    // A sound card, or a sound server to talk to
+    if (access("/dev/snd", F_OK) == 0 || getenv("PULSE_SERVER") != NULL) {
+        return 0;
+    }
+    if (run != NULL) {
+        snprintf(path, sizeof(path), "%s/pulse/native", run);
+        if (access(path, F_OK) == 0) return 0;
+        snprintf(path, sizeof(path), "%s/pipewire-0", run);
+        if (access(path, F_OK) == 0) return 0;
+    }
+    return 1;
+}
+
+int audio_start(const char *file, int loops)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    if (audio_headless()) return -1;
+
+    audio_file = file;
+    audio_loops = loops;
+    audio_stopped = 0;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, audio_thread, NULL);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+void audio_stop(void)
+{
+    pthread_mutex_lock(&audio_lock);
+    audio_stopped = 1;
+    if (audio_playing) {
+        audio_api.halt();
+        audio_playing = 0;
+    }
+    pthread_mutex_unlock(&audio_lock);
+}
+
+#endif // _WIN32
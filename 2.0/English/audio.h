@@ -0,0 +1,39 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+// ========================================================================
+// Waiting music of the server
+// ========================================================================
+// The single-client server plays music while it waits for its client.
+// Opening an audio device takes hundreds of milliseconds and fails on
+// hosts without one, so the music is optional and stays off the path to
+// accept():
+//
+// - Linux: SDL2_mixer is not linked. audio_start() returns at once; a
+//   background thread loads libSDL2_mixer with dlopen(), opens the
+//   device and starts the music. Without the library, or on a headless
+//   host (no sound card and no sound server), there is no music and
+//   nothing else changes.
+// - Windows: PlaySound() with SND_ASYNC, as before.
+//
+// ./server --no-audio never calls audio_start().
+// ========================================================================
+
+#define AUDIO_VOLUME 13           // SDL_mixer volume (0-128): about 10 %
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Returns 1 if the host has no audio device to play on
+int audio_headless(void);
+
+// Starts playing 'file' ('loops' times, -1: forever) in the
+// background. Returns 0, or -1 if the host is headless.
+int audio_start(const char *file, int loops);
+
+// Stops the music, or keeps it from starting if the background thread
+// is still opening the device. Does not wait for that thread.
+void audio_stop(void);
+
+#endif // AUDIO_H
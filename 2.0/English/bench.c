@@ -0,0 +1,1637 @@
+#include <stdio.h>        // For printf()
+#include <stdlib.h>       // For atoi(), exit()
+#include <string.h>       // For strcmp()
+#include <pthread.h>      // For the worker threads
+#include <time.h>         // For clock_gettime()
+#include "drng.h"         // For rdrand_get_bytes and DRNG statistics
+#include "reactor.h"      // For the multi-reactor server benchmark
+#include "room.h"         // For the room frame format
+#include "ticket.h"       // For session resumption
+#include "early.h"        // For 0-RTT early data
+#include "zerocopy.h"     // For MSG_ZEROCOPY sends
+#include "relay.h"        // For relay pairs
+#include "timer.h"        // For the timing wheel
+#include <poll.h>         // For poll() on the error queue
+#include <sys/resource.h> // For getrusage()
+
+// ========================================================================
+// Benchmark driver
+// ========================================================================
+// Usage:
+//   ./bench drng [max_threads] [seconds_per_step]
+//   ./bench reactor [max_threads] [seconds_per_step] [client_threads]
+//                   [epoll|uring]
+//   ./bench echo [server_threads] [seconds] [client_threads]
+//                [epoll|uring]
+//   ./bench storm [hs_workers] [seconds] [echo_clients] [storm_clients]
+//                 [epoll|uring]
+//   ./bench fanout [members] [msg_size] [seconds]
+//   ./bench resume [seconds] [clients] [epoll|uring]
+//   ./bench idle [connections] [rounds] [epoll|uring]
+//   ./bench zerocopy [seconds]
+//   ./bench relay [seconds]
+//   ./bench timers [max_timers]
+//   ./bench rekey [seconds]
+//
+// drng: every step doubles the number of threads (1, 2, 4, ... up to
+//       max_threads), each thread pulls random bytes in a tight loop for
+//       'seconds_per_step' seconds, then the aggregate throughput and the
+//       DRNG retry/failure counters of the step are printed.
+//
+// reactor: starts an in-process server pool with 1, 2, 4, ... reactor
+//       threads and lets 'client_threads' clients connect in a loop:
+//       key exchange, one encrypted echo, close. Handshakes/s show how
+//       connection setup scales with the number of event loops.
+//
+// echo: every client keeps one session open and sends encrypted
+//       messages in lock-step (send, wait for the echo). Messages/s
+//       compare the per-message cost of the epoll and io_uring
+//       backends under the same load.
+//
+// storm: one event loop serves 'echo_clients' established sessions
+//       while 'storm_clients' connect and disconnect as fast as they
+//       can. The echo latency percentiles are measured once with the
+//       key exchange computed inside the loop and once with it
+//       offloaded to 'hs_workers' handshake threads.
+//
+// fanout: delivers one room message to 'members' connection queues,
+//       first encrypted per member under its session key and copied into
+//       each queue, then encrypted once under the room key and queued by
+//       reference. No sockets are involved: after every message the
+//       queues are emptied as if they had been written.
+//
+// resume: 'clients' clients reconnect to one event loop as fast as they
+//       can, first with a full key exchange on every connection (a new
+//       key pair, like ./client), then resuming with the ticket of the
+//       previous connection, then with a full key exchange against the
+//       cached server key and the first message sent with the client
+//       key (0-RTT). Prints reconnects/s, the time from connect() to
+//       the first echo and the CPU time the event loop thread spent per
+//       connection.
+//
+// idle: opens 'connections' sessions to one event loop and leaves them
+//       idle, then prints the pool memory each one holds and how much
+//       the process grew per session. Then every session is closed and
+//       opened again 'rounds' times; once the pools have grown to the
+//       peak, this churn should need no new slab.
+//
+// zerocopy: sends frames of 4 KiB to 1 MiB over a loopback TCP
+//       connection, with write() and with MSG_ZEROCOPY (at most
+//       BENCH_ZC_SLOTS frames waiting for their completion), while a
+//       thread reads them. Prints MB/s and the CPU time of the sending
+//       thread and of the whole process per GB.
+//
+// relay: pairs two clients on an event loop in relay mode and streams
+//       messages of 256 bytes to 512 KiB from one to the other, spliced
+//       under the pair key and then re-encrypted from session key to
+//       session key. Prints MB/s and MB per CPU second of the loop
+//       thread (the throughput one core can relay), then the
+//       re-encryption alone, in two passes and in one.
+//
+// timers: arms 10000, 100000, ... up to 'max_timers' session deadlines
+//       spread over a minute on a simulated clock and prints the cost of
+//       arming one, of moving one (cancel and arm, as on input) and of
+//       ten simulated seconds of ticks, in which every expired timer is
+//       armed again a minute later. The same ticks are then run as a
+//       scan over all deadlines, the cost a wheel avoids.
+//
+// rekey: on one core, the cost of moving one direction of a session to
+//       its next key (FRAME_REKEY built and checked) against the key
+//       exchange a reconnect would need, then the cost of sealing a
+//       message when the key is replaced never, every million, ...
+//       down to every single message.
+// ========================================================================
+
+#define BENCH_DRNG_CHUNK 4096   // Bytes requested per rdrand_get_bytes
+
+static volatile int bench_stop = 0;  // Set by main to end a step
+
+// Returns the current monotonic time in seconds
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// ========================================================================
+// DRNG throughput worker: pulls chunks until bench_stop is set
+// ========================================================================
+static void *bench_drng_worker(void *arg)
+{
+    uint64_t *bytes = (uint64_t *)arg;  // Per-thread byte counter
+    uint8_t chunk[BENCH_DRNG_CHUNK];
+
+    while (!bench_stop) {
+        *bytes += rdrand_get_bytes(sizeof(chunk), chunk);
+    }
+    return NULL;
+}
+
+// ========================================================================
+// DRNG scaling benchmark
+// ========================================================================
+static int bench_drng(int max_threads, int seconds)
+{
+    pthread_t *threads = calloc(max_threads, sizeof(pthread_t));
+    uint64_t *bytes = calloc(max_threads, sizeof(uint64_t));
+    if (threads == NULL || bytes == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("%8s %12s %12s %10s %10s %10s\n", "threads", "MB/s",
+           "MB/s/thread", "retries", "failures", "cyc/call");
+
+    for (int n = 1; ; n = (n * 2 > max_threads) ? max_threads : n * 2) {
+        drng_stats_reset();     // Count only this step
+        bench_stop = 0;
+        memset(bytes, 0, max_threads * sizeof(uint64_t));
+
+        double start = bench_now();
+        for (int i = 0; i < n; i++) {
+            pthread_create(&threads[i], NULL, bench_drng_worker,
+                           &bytes[i]);
+        }
+
+        struct timespec dur = {seconds, 0};
+        nanosleep(&dur, NULL);
+        bench_stop = 1;
+
+        uint64_t total = 0;
+        for (int i = 0; i < n; i++) {
+            pthread_join(threads[i], NULL);
+            total += bytes[i];
+        }
+        double elapsed = bench_now() - start;
+
+        DrngStats st;
+        drng_stats_get(&st);
+        double mbs = (double)total / elapsed / 1e6;
+        printf("%8d %12.1f %12.1f %10llu %10llu %10llu\n", n, mbs,
+               mbs / n, (unsigned long long)st.retries,
+               (unsigned long long)st.failures,
+               (unsigned long long)(st.calls ? st.cycles / st.calls : 0));
+
+        if (n == max_threads) {
+            drng_stats_print(stdout, &st);  // Histogram of the last step
+            break;
+        }
+    }
+
+    free(threads);
+    free(bytes);
+    return 0;
+}
+
+// ========================================================================
+// Reactor scaling benchmark
+// ========================================================================
+#define BENCH_PORT 9777   // Loopback port used by the in-process server
+
+typedef struct {
+    int port;                  // Port of the server pool
+    int persistent;            // Keep the session open (echo benchmark)
+    int reconnect;             // Resume benchmark: BENCH_FULL,
+                               // BENCH_RESUME or BENCH_EARLY (0: fixed
+                               // key pair)
+    TicketCache ticket;        // Last ticket (BENCH_RESUME)
+    int have_ticket;           // 'ticket' is valid
+    uint8_t server_key[KEY_SIZE];  // Server key cached for BENCH_EARLY
+    int have_server_key;       // 'server_key' is valid
+    uint64_t handshakes;       // Completed key exchanges
+    uint64_t echoes;           // Verified echo round trips
+    uint64_t errors;           // Failed connections
+    double *lat;               // Echo round-trip times (or NULL)
+    size_t lat_n, lat_cap;     // Samples taken / room in lat
+} BenchClient;
+
+#define BENCH_FULL 1     // New key pair and X25519 on every connection
+#define BENCH_RESUME 2   // Session resumed with the last ticket
+#define BENCH_EARLY 3    // First message sent with the public key
+
+// Reads the next FRAME_DATA (or FRAME_EARLY_REJECT), skipping
+// FRAME_HELLO and FRAME_TICKET and moving 'key' on at FRAME_REKEY
+static int bench_recv_data(int fd, FrameBuffer *rx, Frame *f,
+                           uint8_t *scratch, size_t len, RatchetKey *key)
+{
+    int n;
+    do {
+        n = frame_recv(fd, rx, f, scratch, len);
+        if (n == 1 && f->type == FRAME_REKEY &&
+            ratchet_accept(key, f) != 0) {
+            return -1;
+        }
+    } while (n == 1 && f->type != FRAME_DATA &&
+             f->type != FRAME_EARLY_REJECT);
+    return n;
+}
+
+// Like session_send() into 'out': the FRAME_DATA of 'msg' under the next
+// nonce of 'tx', behind a FRAME_REKEY when the key is due. Returns the
+// bytes written.
+static size_t bench_seal(RatchetKey *tx, const RatchetLimits *limits,
+                         uint8_t *out, const uint8_t *msg, size_t len)
+{
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint64_t clen = 0;
+    size_t n = 0;
+
+    if (ratchet_due(tx, limits)) {
+        n = frame_encode_header(out, FRAME_REKEY, RATCHET_REKEY_SIZE);
+        ratchet_rekey(tx, out + n);
+        n += RATCHET_REKEY_SIZE;
+    }
+    ratchet_nonce(tx, nonce);
+    ratchet_count(tx, len);
+    n += frame_encode_header(out + n, FRAME_DATA, len + TAG_SIZE);
+    crypto_aead_encrypt(out + n, &clen, msg, len, nonce, tx->key);
+    return n + clen;
+}
+
+// Decrypts a FRAME_DATA under 'rx' into 'out' ('cap' bytes).
+// Returns 0, or -1 if it does not fit or authenticate.
+static int bench_open(RatchetKey *rx, const Frame *f, uint8_t *out,
+                      size_t cap)
+{
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint64_t len = 0;
+
+    if (f->chain != NULL || f->len < TAG_SIZE || f->len - TAG_SIZE > cap) {
+        return -1;
+    }
+    ratchet_nonce(rx, nonce);
+    if (crypto_aead_decrypt(out, &len, NULL, f->payload, f->len, nonce,
+                            rx->key) != 0) {
+        return -1;
+    }
+    ratchet_count(rx, (size_t)len);
+    return 0;
+}
+
+// BENCH_EARLY: with the server key of the last connection, the public key
+// and the first message leave in one write. Returns 1 if they were sent,
+// 0 if no server key is known yet or -1 on error.
+static int bench_client_early(BenchClient *bc, int fd, uint8_t *private_key,
+                              uint8_t *public_key, const uint8_t *msg,
+                              size_t len, uint8_t *key)
+{
+    uint8_t out[KEY_SIZE + FRAME_HEADER_MAX + 1 + BUFFER_SIZE + TAG_SIZE];
+
+    if (bc->reconnect != BENCH_EARLY || !bc->have_server_key) return 0;
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+    crypto_scalarmult(key, private_key, bc->server_key);
+    memcpy(out, public_key, KEY_SIZE);
+    size_t n = KEY_SIZE + early_seal(out + KEY_SIZE, key, msg, len);
+    return write(fd, out, n) == (ssize_t)n ? 1 : -1;
+}
+
+// Key exchange of one connection after the server key was read: with a
+// ticket the session is resumed, otherwise the client public key is sent
+// Returns 0 with the session key or -1
+static int bench_client_handshake(BenchClient *bc, int fd, FrameBuffer *rx,
+                                  uint8_t *private_key, uint8_t *public_key,
+                                  const uint8_t *server_key, uint8_t *key)
+{
+    uint64_t control = 0;  // Control frames of this connection
+
+    if (bc->reconnect == BENCH_RESUME && bc->have_ticket) {
+        int rc = ticket_resume(fd, rx, &bc->ticket, &control, key);
+        if (rc != 0) return rc > 0 ? 0 : -1;
+        bc->have_ticket = 0;  // Rejected: full handshake
+    }
+    if (bc->reconnect != 0) {
+        // Like ./client: a new key pair for every connection
+        rdrand_get_bytes(KEY_SIZE, private_key);
+        crypto_scalarmult_base(public_key, private_key);
+    }
+    if (write(fd, public_key, KEY_SIZE) != KEY_SIZE) return -1;
+    crypto_scalarmult(key, private_key, server_key);
+    if (bc->reconnect == BENCH_RESUME) {
+        if (ticket_receive(fd, rx, &bc->ticket, &control, key) != 0) {
+            return -1;
+        }
+        bc->have_ticket = 1;
+    }
+    return 0;
+}
+
+// One client thread: connect, exchange keys, echo one message, close
+static void *bench_client_worker(void *arg)
+{
+    BenchClient *bc = (BenchClient *)arg;
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+    uint8_t server_key[KEY_SIZE], shared_secret[SHARED_SECRET_SIZE];
+    const uint8_t msg[] = "benchmark";
+    uint8_t ct[2 * (FRAME_HEADER_MAX + 1) + RATCHET_REKEY_SIZE +
+               sizeof(msg) + TAG_SIZE];
+    uint8_t pt[sizeof(msg) + TAG_SIZE];
+    uint8_t echo[REACTOR_FRAME_MAX];
+    FrameBuffer rx;
+    Frame f;
+    Ratchet ratchet;
+    RatchetLimits rekey;
+
+    ratchet_limits_default(&rekey);
+
+    if (frame_buffer_init(&rx, FRAME_BUFFER_SIZE) != 0) {
+        bc->errors++;
+        return NULL;
+    }
+
+    // The client key pair is fixed, so the client side costs only the
+    // shared secret computation per connection
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(bc->port);
+
+    while (!bench_stop) {
+        rx.head = rx.tail = 0;  // Drop what the last session left behind
+        double t_connect = bench_now();
+        int early = 0;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 ||
+            connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            (early = bench_client_early(bc, fd, private_key, public_key,
+                                        msg, sizeof(msg),
+                                        shared_secret)) < 0 ||
+            frame_recv_exact(fd, &rx, server_key, KEY_SIZE) != 1 ||
+            (!early &&
+             bench_client_handshake(bc, fd, &rx, private_key, public_key,
+                                    server_key, shared_secret) != 0)) {
+            bc->errors++;
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        bc->handshakes++;
+        if (bc->reconnect == BENCH_EARLY) {
+            memcpy(bc->server_key, server_key, KEY_SIZE);
+            bc->have_server_key = 1;
+        }
+
+        ratchet_init(&ratchet, shared_secret, SHARED_SECRET_SIZE,
+                     RATCHET_CLIENT);
+        do {
+            // Reconnects are timed from connect() to the first echo
+            double t0 = bc->reconnect ? t_connect : bench_now();
+            size_t len = early ? 0 : bench_seal(&ratchet.tx, &rekey, ct,
+                                                msg, sizeof(msg));
+            if ((early || write(fd, ct, len) == (ssize_t)len) &&
+                bench_recv_data(fd, &rx, &f, echo, sizeof(echo),
+                                &ratchet.rx) == 1 &&
+                f.type == FRAME_DATA &&
+                bench_open(&ratchet.rx, &f, pt, sizeof(pt)) == 0) {
+                bc->echoes++;
+                if (bc->lat != NULL && bc->lat_n < bc->lat_cap) {
+                    bc->lat[bc->lat_n++] = bench_now() - t0;
+                }
+            } else {
+                bc->errors++;
+                break;
+            }
+            early = 0;
+        } while (bc->persistent && !bench_stop);
+        close(fd);
+    }
+    frame_buffer_free(&rx);
+    return NULL;
+}
+
+// Runs 'clients' client threads against a pool of 'n' reactors for
+// 'seconds' seconds; returns the verified echoes per second
+static double bench_pool_run(int n, int seconds, int clients, int flags,
+                             int persistent, const uint8_t *private_key,
+                             const uint8_t *public_key, uint64_t *errors)
+{
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    BenchClient *bc = calloc(clients, sizeof(BenchClient));
+    ReactorPool pool;
+    int port = BENCH_PORT + n + (persistent ? 64 : 0) +
+               ((flags & REACTOR_URING) ? 128 : 0);  // Fresh port
+
+    *errors = 0;
+    if (threads == NULL || bc == NULL ||
+        reactor_pool_start(&pool, -1, port, n, 0, private_key,
+                           public_key, flags | REACTOR_QUIET, NULL) < 0) {
+        perror("reactor_pool_start");
+        free(threads);
+        free(bc);
+        return -1.0;
+    }
+
+    bench_stop = 0;
+    double start = bench_now();
+    for (int i = 0; i < clients; i++) {
+        bc[i].port = port;
+        bc[i].persistent = persistent;
+        pthread_create(&threads[i], NULL, bench_client_worker, &bc[i]);
+    }
+
+    struct timespec dur = {seconds, 0};
+    nanosleep(&dur, NULL);
+    bench_stop = 1;
+
+    uint64_t done = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        done += bc[i].echoes;
+        *errors += bc[i].errors;
+    }
+    double elapsed = bench_now() - start;
+    reactor_pool_stop(&pool);
+
+    free(threads);
+    free(bc);
+    return (double)done / elapsed;
+}
+
+static int bench_reactor(int max_threads, int seconds, int clients,
+                         int flags)
+{
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    printf("%8s %14s %14s %10s\n", "threads", "handshakes/s",
+           "per thread", "errors");
+
+    for (int n = 1; ; n = (n * 2 > max_threads) ? max_threads : n * 2) {
+        uint64_t errors;
+        double rate = bench_pool_run(n, seconds, clients, flags, 0,
+                                     private_key, public_key, &errors);
+        if (rate < 0) return 1;
+        printf("%8d %14.0f %14.0f %10llu\n", n, rate, rate / n,
+               (unsigned long long)errors);
+        if (n == max_threads) break;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Echo benchmark: the same load against both backends
+// ========================================================================
+static int bench_echo(int threads, int seconds, int clients, int flags)
+{
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    printf("%8s %14s %10s\n", "backend", "messages/s", "errors");
+
+    // Without an explicit backend both are measured one after another
+    int backends[2] = {0, REACTOR_URING};
+    for (int b = 0; b < 2; b++) {
+        if (flags >= 0 && backends[b] != flags) continue;
+
+        uint64_t errors;
+        double rate = bench_pool_run(threads, seconds, clients,
+                                     backends[b], 1, private_key,
+                                     public_key, &errors);
+        if (rate < 0) return 1;
+        printf("%8s %14.0f %10llu\n",
+               backends[b] ? "io_uring" : "epoll", rate,
+               (unsigned long long)errors);
+    }
+    return 0;
+}
+
+// ========================================================================
+// Connection storm benchmark: echo latency while handshakes pile up
+// ========================================================================
+#define BENCH_LAT_SAMPLES (1 << 18)  // Latency samples per echo client
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int bench_storm_run(int hs_workers, int seconds, int echo_clients,
+                           int storm_clients, int flags,
+                           const uint8_t *private_key,
+                           const uint8_t *public_key)
+{
+    int clients = echo_clients + storm_clients;
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    BenchClient *bc = calloc(clients, sizeof(BenchClient));
+    double *lat = malloc((size_t)echo_clients * BENCH_LAT_SAMPLES *
+                         sizeof(double));
+    ReactorPool pool;
+    int port = BENCH_PORT + 256 + hs_workers +
+               ((flags & REACTOR_URING) ? 128 : 0);  // Fresh port
+
+    if (threads == NULL || bc == NULL || lat == NULL ||
+        reactor_pool_start(&pool, -1, port, 1, hs_workers, private_key,
+                           public_key, flags | REACTOR_QUIET, NULL) < 0) {
+        perror("reactor_pool_start");
+        free(threads);
+        free(bc);
+        free(lat);
+        return 1;
+    }
+
+    bench_stop = 0;
+    double start = bench_now();
+    for (int i = 0; i < clients; i++) {
+        bc[i].port = port;
+        bc[i].persistent = (i < echo_clients);
+        if (bc[i].persistent) {
+            bc[i].lat = lat + (size_t)i * BENCH_LAT_SAMPLES;
+            bc[i].lat_cap = BENCH_LAT_SAMPLES;
+        }
+        pthread_create(&threads[i], NULL, bench_client_worker, &bc[i]);
+    }
+
+    struct timespec dur = {seconds, 0};
+    nanosleep(&dur, NULL);
+    bench_stop = 1;
+
+    uint64_t handshakes = 0, echoes = 0, errors = 0;
+    size_t samples = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        if (bc[i].persistent) {
+            echoes += bc[i].echoes;
+            // Gather the samples at the front of the array
+            memmove(lat + samples, bc[i].lat,
+                    bc[i].lat_n * sizeof(double));
+            samples += bc[i].lat_n;
+        } else {
+            handshakes += bc[i].handshakes;
+        }
+        errors += bc[i].errors;
+    }
+    double elapsed = bench_now() - start;
+    reactor_pool_stop(&pool);
+
+    qsort(lat, samples, sizeof(double), bench_cmp_double);
+    double p50 = samples ? lat[samples / 2] : 0;
+    double p99 = samples ? lat[samples * 99 / 100] : 0;
+    double max = samples ? lat[samples - 1] : 0;
+    printf("%10d %14.0f %12.0f %10.1f %10.1f %10.1f %8llu\n", hs_workers,
+           (double)handshakes / elapsed, (double)echoes / elapsed,
+           p50 * 1e6, p99 * 1e6, max * 1e6, (unsigned long long)errors);
+
+    free(threads);
+    free(bc);
+    free(lat);
+    return 0;
+}
+
+static int bench_storm(int hs_workers, int seconds, int echo_clients,
+                       int storm_clients, int flags)
+{
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    printf("%10s %14s %12s %10s %10s %10s %8s\n", "hs_workers",
+           "handshakes/s", "echoes/s", "p50 us", "p99 us", "max us",
+           "errors");
+
+    // 0 = key exchanges computed inside the event loop
+    if (bench_storm_run(0, seconds, echo_clients, storm_clients, flags,
+                        private_key, public_key) != 0 ||
+        bench_storm_run(hs_workers, seconds, echo_clients, storm_clients,
+                        flags, private_key, public_key) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Room fan-out benchmark: N encryptions and copies vs. one shared frame
+// ========================================================================
+static void bench_fanout_run(Connection **m, int members, size_t msg_size,
+                             int seconds, int shared)
+{
+    uint8_t msg[BUFFER_SIZE];
+    uint8_t frame[FRAME_HEADER_MAX + 1 + BUFFER_SIZE + TAG_SIZE];
+    uint8_t key[GROUP_KEY_SIZE];
+    uint8_t nonce[NONCE_SIZE];
+    uint64_t messages = 0, clen;
+
+    memset(msg, 'x', sizeof(msg));
+    rdrand_get_bytes(GROUP_KEY_SIZE, key);
+
+    double start = bench_now(), elapsed;
+    do {
+        for (int batch = 0; batch < 64; batch++) {
+            if (shared) {
+                // Encrypt once, every member takes a reference
+                size_t plen = ROOM_HEADER + msg_size + TAG_SIZE;
+                SharedBuf *b = shared_buf_new(FRAME_HEADER_MAX + 1 + plen);
+                size_t hlen = frame_encode_header(b->data, FRAME_GROUP,
+                                                  plen);
+                room_encode_header(b->data + hlen, 1, messages);
+                room_nonce(nonce, b->data + hlen);
+                crypto_aead_encrypt(b->data + hlen + ROOM_HEADER, &clen,
+                                    msg, msg_size, nonce, key);
+                b->len = hlen + ROOM_HEADER + clen;
+                for (int i = 0; i < members; i++) {
+                    reactor_conn_queue_shared(m[i], b);
+                }
+                shared_buf_unref(b);
+            } else {
+                // One encryption and one copy per member
+                for (int i = 0; i < members; i++) {
+                    size_t hlen = frame_encode_header(frame, FRAME_DATA,
+                                                      msg_size + TAG_SIZE);
+                    uint8_t nonce[RATCHET_NONCE_SIZE];
+                    ratchet_nonce(&m[i]->ratchet.tx, nonce);
+                    ratchet_count(&m[i]->ratchet.tx, msg_size);
+                    crypto_aead_encrypt(frame + hlen, &clen, msg, msg_size,
+                                        nonce, m[i]->ratchet.tx.key);
+                    reactor_conn_queue(m[i], frame, hlen + clen);
+                }
+            }
+            // "Write" everything: the last reference frees the frame
+            for (int i = 0; i < members; i++) {
+                struct iovec iov[REACTOR_TX_IOV];
+                size_t total;
+                reactor_conn_iov(m[i], iov, &total);
+                reactor_conn_consume(m[i], total);
+            }
+            messages++;
+        }
+        elapsed = bench_now() - start;
+    } while (elapsed < seconds);
+
+    double deliveries = (double)messages * members;
+    printf("%14s %12.0f %14.0f %12.1f\n",
+           shared ? "encrypt-once" : "per-member",
+           (double)messages / elapsed, deliveries / elapsed,
+           elapsed * 1e9 / deliveries);
+}
+
+static int bench_fanout(int members, size_t msg_size, int seconds)
+{
+    Connection **m = calloc(members, sizeof(*m));
+    BufPool bufs;  // Output buffers of the members
+
+    if (m == NULL) return 1;
+    buf_pool_init(&bufs);
+    for (int i = 0; i < members; i++) {
+        m[i] = calloc(1, sizeof(Connection));
+        if (m[i] == NULL) {
+            perror("calloc");
+            return 1;
+        }
+        m[i]->bufs = &bufs;
+        rdrand_get_bytes(SHARED_SECRET_SIZE, m[i]->shared_secret);
+        ratchet_init(&m[i]->ratchet, m[i]->shared_secret,
+                     SHARED_SECRET_SIZE, RATCHET_SERVER);
+    }
+
+    printf("%d members, %zu-byte messages\n", members, msg_size);
+    printf("%14s %12s %14s %12s\n", "mode", "messages/s", "deliveries/s",
+           "ns/delivery");
+    bench_fanout_run(m, members, msg_size, seconds, 0);
+    bench_fanout_run(m, members, msg_size, seconds, 1);
+
+    for (int i = 0; i < members; i++) free(m[i]);
+    free(m);
+    buf_pool_free(&bufs);
+    return 0;
+}
+
+// ========================================================================
+// Resume benchmark: reconnects with and without session tickets
+// ========================================================================
+
+// CPU time used so far by a thread, in seconds
+static double bench_thread_cpu(pthread_t thread)
+{
+    clockid_t cid;
+    struct timespec ts;
+    if (pthread_getcpuclockid(thread, &cid) != 0 ||
+        clock_gettime(cid, &ts) != 0) {
+        return 0.0;
+    }
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int bench_resume_run(int mode, int seconds, int clients, int flags,
+                            const uint8_t *private_key,
+                            const uint8_t *public_key)
+{
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    BenchClient *bc = calloc(clients, sizeof(BenchClient));
+    double *lat = malloc((size_t)clients * BENCH_LAT_SAMPLES *
+                         sizeof(double));
+    ReactorPool pool;
+    int port = BENCH_PORT + 384 + mode +
+               ((flags & REACTOR_URING) ? 128 : 0);  // Fresh port
+
+    if (threads == NULL || bc == NULL || lat == NULL ||
+        reactor_pool_start(&pool, -1, port, 1, 0, private_key,
+                           public_key, flags | REACTOR_QUIET, NULL) < 0) {
+        perror("reactor_pool_start");
+        free(threads);
+        free(bc);
+        free(lat);
+        return 1;
+    }
+
+    bench_stop = 0;
+    double start = bench_now();
+    double cpu_start = bench_thread_cpu(pool.threads[0]);
+    for (int i = 0; i < clients; i++) {
+        bc[i].port = port;
+        bc[i].reconnect = mode;
+        bc[i].lat = lat + (size_t)i * BENCH_LAT_SAMPLES;
+        bc[i].lat_cap = BENCH_LAT_SAMPLES;
+        pthread_create(&threads[i], NULL, bench_client_worker, &bc[i]);
+    }
+
+    struct timespec dur = {seconds, 0};
+    nanosleep(&dur, NULL);
+    bench_stop = 1;
+
+    uint64_t connections = 0, errors = 0;
+    size_t samples = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        connections += bc[i].echoes;
+        errors += bc[i].errors;
+        memmove(lat + samples, bc[i].lat, bc[i].lat_n * sizeof(double));
+        samples += bc[i].lat_n;
+    }
+    double elapsed = bench_now() - start;
+    double cpu = bench_thread_cpu(pool.threads[0]) - cpu_start;
+    reactor_pool_stop(&pool);
+
+    qsort(lat, samples, sizeof(double), bench_cmp_double);
+    double p50 = samples ? lat[samples / 2] : 0;
+    double p99 = samples ? lat[samples * 99 / 100] : 0;
+    printf("%8s %14.0f %10.1f %10.1f %14.2f %8llu\n",
+           mode == BENCH_RESUME ? "ticket" :
+           mode == BENCH_EARLY ? "0-rtt" : "full",
+           (double)connections / elapsed, p50 * 1e6, p99 * 1e6,
+           connections ? cpu / (double)connections * 1e6 : 0.0,
+           (unsigned long long)errors);
+
+    free(threads);
+    free(bc);
+    free(lat);
+    return 0;
+}
+
+static int bench_resume(int seconds, int clients, int flags)
+{
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    printf("%8s %14s %10s %10s %14s %8s\n", "session", "reconnects/s",
+           "p50 us", "p99 us", "server us/conn", "errors");
+    if (bench_resume_run(BENCH_FULL, seconds, clients, flags,
+                         private_key, public_key) != 0 ||
+        bench_resume_run(BENCH_RESUME, seconds, clients, flags,
+                         private_key, public_key) != 0 ||
+        bench_resume_run(BENCH_EARLY, seconds, clients, flags,
+                         private_key, public_key) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Idle benchmark: memory per idle session and allocations under churn
+// ========================================================================
+
+// Resident set size of the process in KiB (0 if unknown)
+static long bench_rss_kib(void)
+{
+    char line[128];
+    long kib = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &kib) == 1) break;
+    }
+    fclose(f);
+    return kib;
+}
+
+// Opens a session and waits for its ticket, so the server has finished
+// the handshake and written all of its output. '*control' starts at 0
+// and counts the control frames of the session. Returns the socket or -1.
+static int bench_idle_open(int port, const uint8_t *public_key,
+                           uint64_t *control, FrameBuffer *rx,
+                           uint8_t *server_key, uint8_t *key,
+                           const uint8_t *private_key)
+{
+    struct sockaddr_in addr;
+    TicketCache ticket;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    rx->head = rx->tail = 0;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        frame_recv_exact(fd, rx, server_key, KEY_SIZE) != 1 ||
+        write(fd, public_key, KEY_SIZE) != KEY_SIZE) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    // The server key is the same for every session
+    crypto_scalarmult(key, private_key, server_key);
+    if (ticket_receive(fd, rx, &ticket, control, key) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Waits until the event loop has no session (or holds 'n' of them)
+static void bench_idle_settle(const Reactor *r, size_t n)
+{
+    struct timespec tick = {0, 1000000};
+    for (int i = 0; i < 5000 && r->active != n; i++) {
+        nanosleep(&tick, NULL);
+    }
+    nanosleep(&tick, NULL);  // Let the loop put the last buffers back
+}
+
+// Bytes the pools of 'r' have handed out
+static size_t bench_pool_bytes(const Reactor *r)
+{
+    size_t bytes = r->conn_pool.in_use * r->conn_pool.size;
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        bytes += r->bufs.cls[i].in_use * r->bufs.cls[i].size;
+    }
+    return bytes;
+}
+
+// Slabs the pools of 'r' have allocated
+static size_t bench_pool_slabs(const Reactor *r)
+{
+    return r->conn_pool.slab_count + buf_pool_slabs(&r->bufs);
+}
+
+static int bench_idle(int connections, int rounds, int flags)
+{
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+    uint8_t server_key[KEY_SIZE], key[SHARED_SECRET_SIZE];
+    int *fds = calloc(connections, sizeof(int));
+    ReactorPool pool;
+    FrameBuffer rx;
+    int port = BENCH_PORT + 448 + ((flags & REACTOR_URING) ? 128 : 0);
+    int rc = 1;
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    if (fds == NULL || frame_buffer_init(&rx, FRAME_BUFFER_SIZE) != 0) {
+        free(fds);
+        return 1;
+    }
+    if (reactor_pool_start(&pool, -1, port, 1, 0, private_key,
+                           public_key, flags | REACTOR_QUIET, NULL) < 0) {
+        perror("reactor_pool_start");
+        frame_buffer_free(&rx);
+        free(fds);
+        return 1;
+    }
+    // The loop is idle whenever the statistics below are read
+    const Reactor *r = &pool.reactors[0];
+
+    long rss_half = 0;
+    size_t slabs = 0;
+    for (int round = 0; round <= rounds; round++) {
+        for (int i = 0; i < connections; i++) {
+            // Growth is measured over the second half, so that memory
+            // the first sessions touch once (stacks, the connection
+            // table, receive buffers) is not counted per session
+            if (round == 0 && i == connections / 2) {
+                rss_half = bench_rss_kib();
+            }
+            uint64_t control = 0;
+            fds[i] = bench_idle_open(port, public_key, &control, &rx,
+                                     server_key, key, private_key);
+            if (fds[i] < 0) {
+                fprintf(stderr, "Connection %d failed\n", i);
+                for (int k = 0; k < i; k++) close(fds[k]);
+                goto out;
+            }
+        }
+        bench_idle_settle(r, (size_t)connections);
+
+        if (round == 0) {
+            // The pools have grown to the peak: report and remember it
+            long rss = bench_rss_kib() - rss_half;
+            int measured = connections - connections / 2;
+            printf("%d idle sessions\n", connections);
+            printf("  sizeof(Connection)      %8zu bytes\n",
+                   sizeof(Connection));
+            printf("  pool memory per session %8.0f bytes\n",
+                   (double)bench_pool_bytes(r) / connections);
+            printf("  process growth          %8.0f bytes per session\n",
+                   (double)rss * 1024.0 / measured);
+            slabs = bench_pool_slabs(r);
+        }
+
+        for (int i = 0; i < connections; i++) close(fds[i]);
+        bench_idle_settle(r, 0);
+    }
+    printf("  slabs allocated by %d close/reopen rounds: %zu\n", rounds,
+           bench_pool_slabs(r) - slabs);
+    rc = 0;
+
+out:
+    reactor_pool_stop(&pool);
+    frame_buffer_free(&rx);
+    free(fds);
+    return rc;
+}
+
+// ========================================================================
+// Zero-copy benchmark: write() vs. MSG_ZEROCOPY on loopback TCP
+// ========================================================================
+#define BENCH_ZC_SLOTS 8        // Frames the kernel may hold per size
+#define BENCH_ZC_READ (1 << 20) // Bytes per read() of the receiver
+
+static void *bench_zc_reader(void *arg)
+{
+    int fd = *(int *)arg;
+    uint8_t *buf = malloc(BENCH_ZC_READ);
+    if (buf == NULL) return NULL;
+    while (read(fd, buf, BENCH_ZC_READ) > 0) {
+    }
+    free(buf);
+    return NULL;
+}
+
+// CPU time used so far by the whole process, in seconds
+static double bench_process_cpu(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0.0;
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+           (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// Waits for completion notifications until no slot is busy, or only
+// while slot 'k' is. Returns 1 if the kernel reported a copy.
+static int bench_zc_wait(int fd, int *busy, const uint32_t *seq, int k)
+{
+    int copied = 0;
+    for (;;) {
+        int pending = 0;
+        for (int j = 0; j < BENCH_ZC_SLOTS; j++) pending |= busy[j];
+        if (k >= 0 ? !busy[k] : !pending) return copied;
+
+        struct pollfd p = {fd, 0, 0};  // POLLERR is always reported
+        poll(&p, 1, 100);
+        ZcRange r[ZC_MAX_RANGES];
+        int n = zc_reap(fd, r, ZC_MAX_RANGES);
+        if (n < 0) return copied;
+        for (int i = 0; i < n; i++) {
+            copied |= r[i].copied;
+            for (int j = 0; j < BENCH_ZC_SLOTS; j++) {
+                if (busy[j] && zc_covers(&r[i], seq[j])) busy[j] = 0;
+            }
+        }
+    }
+}
+
+// 'next' is the number the kernel gives the next zero-copy send of 'fd'
+static void bench_zc_run(int fd, uint8_t *slots, size_t size, int seconds,
+                         int zerocopy, uint32_t *next)
+{
+    int busy[BENCH_ZC_SLOTS] = {0};
+    uint32_t seq[BENCH_ZC_SLOTS];
+    uint64_t bytes = 0;
+    int copied = 0, k = 0;
+
+    double cpu = bench_thread_cpu(pthread_self());
+    double total = bench_process_cpu();
+    double start = bench_now(), elapsed;
+    do {
+        // A slot is written again only after the kernel released it
+        if (zerocopy) copied |= bench_zc_wait(fd, busy, seq, k);
+
+        uint8_t *buf = slots + (size_t)k * size;
+        long n = zerocopy ? zc_send(fd, buf, size, 0)
+                          : (long)write(fd, buf, size);
+        if (n <= 0) break;
+        if (zerocopy) {
+            seq[k] = (*next)++;
+            busy[k] = 1;
+        }
+        bytes += (uint64_t)n;
+        k = (k + 1) % BENCH_ZC_SLOTS;
+        elapsed = bench_now() - start;
+    } while (elapsed < seconds);
+    if (zerocopy) copied |= bench_zc_wait(fd, busy, seq, -1);
+    elapsed = bench_now() - start;
+
+    double gb = (double)bytes / 1e9;
+    printf("%8zu %9s %10.0f %12.3f %12.3f%s\n", size,
+           zerocopy ? "zerocopy" : "write", (double)bytes / elapsed / 1e6,
+           (bench_thread_cpu(pthread_self()) - cpu) / gb,
+           (bench_process_cpu() - total) / gb,
+           copied ? "  (copied by the kernel)" : "");
+}
+
+static int bench_zerocopy(int seconds)
+{
+    static const size_t sizes[] = {4096, 16384, 65536, 262144, 1048576};
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    pthread_t reader;
+    int lfd, tx, rx;
+
+    // Loopback TCP connection, the reader on its own thread
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &len) < 0 ||
+        (tx = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(tx, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        (rx = accept(lfd, NULL, NULL)) < 0) {
+        perror("loopback connection");
+        return 1;
+    }
+    close(lfd);
+    if (zc_enable(tx) != 0) {
+        perror("SO_ZEROCOPY");
+        return 1;
+    }
+    uint8_t *slots = malloc(BENCH_ZC_SLOTS * sizes[4]);
+    if (slots == NULL ||
+        pthread_create(&reader, NULL, bench_zc_reader, &rx) != 0) {
+        perror("zerocopy benchmark");
+        return 1;
+    }
+    rdrand_get_bytes(BENCH_ZC_SLOTS * sizes[4], slots);  // "Ciphertext"
+
+    printf("loopback TCP, %d frames in flight\n", BENCH_ZC_SLOTS);
+    printf("%8s %9s %10s %12s %12s\n", "frame", "send", "MB/s",
+           "tx CPU s/GB", "all CPU s/GB");
+    uint32_t next = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_zc_run(tx, slots, sizes[i], seconds, 0, &next);
+        bench_zc_run(tx, slots, sizes[i], seconds, 1, &next);
+    }
+
+    close(tx);
+    pthread_join(reader, NULL);
+    close(rx);
+    free(slots);
+    return 0;
+}
+
+// ========================================================================
+// Relay benchmark: the two forwarding paths of --relay
+// ========================================================================
+#define BENCH_RELAY_READ 65536  // Bytes per read() of the receiver
+
+typedef struct {
+    int fd;                      // Socket of the receiving client
+    volatile uint64_t received;  // Bytes read so far
+} BenchRelayRx;
+
+static void *bench_relay_reader(void *arg)
+{
+    BenchRelayRx *rx = (BenchRelayRx *)arg;
+    uint8_t *buf = malloc(BENCH_RELAY_READ);
+    ssize_t n;
+    if (buf == NULL) return NULL;
+    while ((n = read(rx->fd, buf, BENCH_RELAY_READ)) > 0) {
+        rx->received += (uint64_t)n;
+    }
+    free(buf);
+    return NULL;
+}
+
+// Reads until 'ctx' holds its pair key and the notice sent behind it
+static int bench_relay_paired(ClientServerContext *ctx, FrameBuffer *rx)
+{
+    uint8_t scratch[BUFFER_SIZE + TAG_SIZE];
+    Frame f;
+
+    for (;;) {
+        if (frame_recv(ctx->sockfd, rx, &f, scratch, sizeof(scratch)) != 1 ||
+            (f.type == FRAME_RELAY_KEY && relay_open_frame(ctx, &f) != 0)) {
+            return -1;
+        }
+        if (f.type == FRAME_DATA && ctx->relay_valid) return 0;
+    }
+}
+
+// One size and path: client 0 sends to client 1 through the loop for
+// 'seconds', then the bytes are counted once they have all arrived
+static int bench_relay_run(int splice_path, size_t size, int seconds,
+                           int port, const uint8_t *private_key,
+                           const uint8_t *public_key)
+{
+    ClientServerContext *ctx = calloc(2, sizeof(ClientServerContext));
+    uint8_t *msg = malloc(size);
+    uint8_t server_key[KEY_SIZE], head[FRAME_HEADER_MAX + 1];
+    FrameBuffer rx[2];
+    BenchRelayRx reader = {-1, 0};
+    pthread_t thread;
+    ReactorPool pool;
+    int rc = 1;
+
+    if (ctx == NULL || msg == NULL ||
+        frame_buffer_init(&rx[0], FRAME_BUFFER_SIZE) != 0) {
+        free(ctx);
+        free(msg);
+        return 1;
+    }
+    if (frame_buffer_init(&rx[1], FRAME_BUFFER_SIZE) != 0) {
+        frame_buffer_free(&rx[0]);
+        free(ctx);
+        free(msg);
+        return 1;
+    }
+    if (reactor_pool_start(&pool, -1, port, 1, 0, private_key, public_key,
+                           REACTOR_RELAY | REACTOR_QUIET, NULL) < 0) {
+        perror("reactor_pool_start");
+        goto out;
+    }
+
+    // The first two sessions of the loop form a pair
+    for (int i = 0; i < 2; i++) {
+        ctx[i].sockfd = bench_idle_open(port, public_key, &ctx[i].control_rx,
+                                        &rx[i], server_key,
+                                        ctx[i].shared_secret, private_key);
+        ratchet_init(&ctx[i].ratchet, ctx[i].shared_secret,
+                     SHARED_SECRET_SIZE, RATCHET_CLIENT);
+        ratchet_limits_default(&ctx[i].rekey);
+    }
+    if (ctx[0].sockfd < 0 || ctx[1].sockfd < 0 ||
+        bench_relay_paired(&ctx[0], &rx[0]) != 0 ||
+        bench_relay_paired(&ctx[1], &rx[1]) != 0) {
+        fprintf(stderr, "Relay pair not formed\n");
+        goto stop;
+    }
+    if (!splice_path) ctx[0].relay_valid = 0;  // FRAME_DATA instead
+    reader.fd = ctx[1].sockfd;
+    if (pthread_create(&thread, NULL, bench_relay_reader, &reader) != 0) {
+        goto stop;
+    }
+
+    rdrand_get_bytes(size, msg);
+    size_t payload = size + TAG_SIZE + (splice_path ? RELAY_HEADER : 0);
+    uint64_t frame = frame_encode_header(head, FRAME_RELAY, payload) +
+                     payload;
+    uint64_t sent = 0;
+    double cpu = bench_thread_cpu(pool.threads[0]);
+    double start = bench_now();
+    do {
+        if (relay_send(&ctx[0], ctx[0].sockfd, msg, size) != 0) break;
+        sent += frame;
+    } while (bench_now() - start < seconds);
+
+    struct timespec tick = {0, 1000000};
+    for (int i = 0; i < 10000 && reader.received < sent; i++) {
+        nanosleep(&tick, NULL);
+    }
+    double elapsed = bench_now() - start;
+    cpu = bench_thread_cpu(pool.threads[0]) - cpu;
+    double mb = (double)reader.received / 1e6;
+    printf("%8zu %8s %10.0f %14.0f%s\n", size,
+           splice_path ? "splice" : "reseal", mb / elapsed,
+           cpu > 0 ? mb / cpu : 0.0,
+           reader.received < sent ? "  (incomplete)" : "");
+    rc = reader.received < sent;
+
+    shutdown(ctx[1].sockfd, SHUT_RDWR);  // Ends the reader
+    pthread_join(thread, NULL);
+
+stop:
+    for (int i = 0; i < 2; i++) {
+        if (ctx[i].sockfd >= 0) close(ctx[i].sockfd);
+    }
+    reactor_pool_stop(&pool);
+out:
+    frame_buffer_free(&rx[0]);
+    frame_buffer_free(&rx[1]);
+    free(ctx[0].decrypted_msg);
+    free(ctx[1].decrypted_msg);
+    free(ctx);
+    free(msg);
+    return rc;
+}
+
+// One core, no sockets: decryption and encryption in two passes against
+// chain_reseal()
+static void bench_relay_kernel(size_t size, int seconds)
+{
+    uint8_t key_in[SHARED_SECRET_SIZE], key_out[SHARED_SECRET_SIZE];
+    uint8_t npub[NONCE_SIZE];
+    uint8_t *in = malloc(size + TAG_SIZE);
+    uint8_t *plain = malloc(size);
+    uint8_t *out = malloc(size + TAG_SIZE);
+    uint64_t len = 0;
+    double mbs[2];
+
+    if (in == NULL || plain == NULL || out == NULL) {
+        free(in);
+        free(plain);
+        free(out);
+        return;
+    }
+    rdrand_get_bytes(sizeof(key_in), key_in);
+    rdrand_get_bytes(sizeof(key_out), key_out);
+    rdrand_get_bytes(sizeof(npub), npub);
+    rdrand_get_bytes(size, plain);
+    crypto_aead_encrypt(in, &len, plain, size, npub, key_in);
+    Frame f = {FRAME_DATA, in, size + TAG_SIZE, NULL};
+
+    for (int fused = 0; fused < 2; fused++) {
+        uint64_t bytes = 0;
+        double start = bench_now(), elapsed;
+        do {
+            if (fused) {
+                chain_reseal(&f, out, npub, key_in, npub, key_out);
+            } else {
+                crypto_aead_decrypt(plain, &len, NULL, in, size + TAG_SIZE,
+                                    npub, key_in);
+                crypto_aead_encrypt(out, &len, plain, size, npub, key_out);
+            }
+            bytes += size;
+            elapsed = bench_now() - start;
+        } while (elapsed < seconds);
+        mbs[fused] = (double)bytes / elapsed / 1e6;
+    }
+    printf("%8zu %10.0f %10.0f %7.2fx\n", size, mbs[0], mbs[1],
+           mbs[1] / mbs[0]);
+
+    free(in);
+    free(plain);
+    free(out);
+}
+
+static int bench_relay(int seconds)
+{
+    static const size_t sizes[] = {256, 4096, 65536, 524288};
+    uint8_t private_key[KEY_SIZE], public_key[KEY_SIZE];
+    int rc = 0;
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(public_key, private_key);
+
+    printf("one relay loop, client 0 -> client 1 over loopback TCP\n");
+    printf("%8s %8s %10s %14s\n", "message", "path", "MB/s",
+           "MB/s per core");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int splice_path = 1; splice_path >= 0; splice_path--) {
+            int port = BENCH_PORT + 640 + 2 * (int)i + splice_path;
+            rc |= bench_relay_run(splice_path, sizes[i], seconds, port,
+                                  private_key, public_key);
+        }
+    }
+
+    printf("\nre-encryption on one core\n");
+    printf("%8s %10s %10s %8s\n", "message", "2-pass", "1-pass", "gain");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_relay_kernel(sizes[i], seconds);
+    }
+    return rc;
+}
+
+// ========================================================================
+// Timer wheel against a scan of every deadline per tick
+// ========================================================================
+#define BENCH_TIMER_SPAN 60000   // Deadlines within a minute (ms)
+#define BENCH_TIMER_TICKS 1000   // Simulated ticks (10 seconds)
+
+typedef struct {
+    TimerWheel *w;
+    uint64_t now;                // Simulated clock (ms)
+    uint64_t fired;              // Timers expired so far
+} BenchTimers;
+
+// Fast deterministic deadlines (xorshift64)
+static uint64_t bench_timer_rand(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+// Armed again a minute later, as conn_on_timer() does for a keepalive
+static void bench_timer_fire(Timer *t, void *arg)
+{
+    BenchTimers *b = arg;
+    b->fired++;
+    timer_add(b->w, t, b->now + BENCH_TIMER_SPAN);
+}
+
+static int bench_timers_run(size_t n)
+{
+    static TimerWheel wheel;
+    Timer *timers = calloc(n, sizeof(*timers));
+    uint64_t *deadlines = malloc(n * sizeof(*deadlines));
+    BenchTimers b = {&wheel, 0, 0};
+    uint64_t x = 88172645463325252ull;
+
+    if (timers == NULL || deadlines == NULL) {
+        free(timers);
+        free(deadlines);
+        return -1;
+    }
+    timer_wheel_init(&wheel, 0);
+
+    double start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        deadlines[i] = 1 + bench_timer_rand(&x) % BENCH_TIMER_SPAN;
+        timer_add(&wheel, &timers[i], deadlines[i]);
+    }
+    double add_ns = (bench_now() - start) * 1e9 / (double)n;
+
+    // Input on a session: its deadline moves
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        timer_cancel(&wheel, &timers[i]);
+        timer_add(&wheel, &timers[i], deadlines[i]);
+    }
+    double move_ns = (bench_now() - start) * 1e9 / (double)n;
+
+    start = bench_now();
+    for (int tick = 0; tick < BENCH_TIMER_TICKS; tick++) {
+        b.now += TIMER_TICK_MS;
+        timer_wheel_advance(&wheel, b.now, bench_timer_fire, &b);
+    }
+    double wheel_us = (bench_now() - start) * 1e6 / BENCH_TIMER_TICKS;
+    uint64_t wheel_fired = b.fired;
+
+    // The same expiries found by looking at every deadline on every tick
+    uint64_t now = 0, scan_fired = 0;
+    start = bench_now();
+    for (int tick = 0; tick < BENCH_TIMER_TICKS; tick++) {
+        now += TIMER_TICK_MS;
+        for (size_t i = 0; i < n; i++) {
+            if (deadlines[i] <= now) {
+                deadlines[i] = now + BENCH_TIMER_SPAN;
+                scan_fired++;
+            }
+        }
+    }
+    double scan_us = (bench_now() - start) * 1e6 / BENCH_TIMER_TICKS;
+
+    printf("%9zu %7.1f %7.1f %9llu %10.1f %10.1f\n", n, add_ns, move_ns,
+           (unsigned long long)wheel_fired, wheel_us, scan_us);
+    if (wheel_fired != scan_fired) {
+        printf("expiries differ: wheel %llu, scan %llu\n",
+               (unsigned long long)wheel_fired,
+               (unsigned long long)scan_fired);
+    }
+    free(timers);
+    free(deadlines);
+    return 0;
+}
+
+static int bench_timers(size_t max_timers)
+{
+    int rc = 0;
+
+    printf("timers on a simulated clock, %d ticks of %d ms\n",
+           BENCH_TIMER_TICKS, TIMER_TICK_MS);
+    printf("%9s %7s %7s %9s %10s %10s\n", "timers", "add ns", "move ns",
+           "expired", "wheel us", "scan us");
+    for (size_t n = 10000; n <= max_timers; n *= 10) {
+        rc |= bench_timers_run(n);
+    }
+    return rc;
+}
+
+// ========================================================================
+// Rekeying: a ratchet step against a new key exchange
+// ========================================================================
+
+// Runs 'fn' for about 'seconds' and returns nanoseconds per call
+static double bench_rekey_time(void (*fn)(void *), void *arg, int seconds)
+{
+    uint64_t calls = 0;
+    double start = bench_now(), elapsed;
+    do {
+        for (int i = 0; i < 64; i++) fn(arg);
+        calls += 64;
+        elapsed = bench_now() - start;
+    } while (elapsed < seconds);
+    return elapsed * 1e9 / (double)calls;
+}
+
+// Sender and receiver of one direction move to the next key
+static void bench_rekey_step(void *arg)
+{
+    Ratchet *r = arg;
+    uint8_t payload[RATCHET_REKEY_SIZE];
+    Frame f = {FRAME_REKEY, payload, sizeof(payload), NULL};
+
+    ratchet_rekey(&r[0].tx, payload);
+    if (ratchet_accept(&r[1].rx, &f) != 0) abort();
+}
+
+// Both sides of a full key exchange
+static void bench_rekey_x25519(void *arg)
+{
+    uint8_t *k = arg;  // Two private keys, two public keys, a secret
+    crypto_scalarmult_base(k + 64, k);
+    crypto_scalarmult_base(k + 96, k + 32);
+    crypto_scalarmult(k + 128, k, k + 96);
+    crypto_scalarmult(k + 128, k + 32, k + 64);
+}
+
+typedef struct {
+    Ratchet r[2];
+    RatchetLimits limits;
+    uint8_t msg[BUFFER_SIZE];
+    uint8_t out[2 * (FRAME_HEADER_MAX + 1) + RATCHET_REKEY_SIZE +
+                BUFFER_SIZE + TAG_SIZE];
+} BenchRekeyMsg;
+
+// One message of BUFFER_SIZE bytes, with a FRAME_REKEY when it is due
+static void bench_rekey_message(void *arg)
+{
+    BenchRekeyMsg *m = arg;
+    bench_seal(&m->r[0].tx, &m->limits, m->out, m->msg, sizeof(m->msg));
+}
+
+static int bench_rekey(int seconds)
+{
+    static const uint64_t every[] = {0, 1000000, 1000, 100, 10, 1};
+    Ratchet r[2];
+    uint8_t secret[SHARED_SECRET_SIZE], keys[160];
+    BenchRekeyMsg *m = calloc(1, sizeof(*m));
+
+    if (m == NULL) return 1;
+    rdrand_get_bytes(sizeof(secret), secret);
+    rdrand_get_bytes(64, keys);
+    ratchet_init(&r[0], secret, sizeof(secret), RATCHET_CLIENT);
+    ratchet_init(&r[1], secret, sizeof(secret), RATCHET_SERVER);
+    double step = bench_rekey_time(bench_rekey_step, r, seconds);
+    double x25519 = bench_rekey_time(bench_rekey_x25519, keys, seconds);
+    printf("ratchet step (rekey and accept) %10.0f ns\n", step);
+    printf("key exchange (X25519, both sides) %8.0f ns (%.0fx)\n",
+           x25519, x25519 / step);
+
+    printf("\n%d-byte messages\n", BUFFER_SIZE);
+    printf("%16s %12s\n", "rekey every", "ns/message");
+    ratchet_init(m->r, secret, sizeof(secret), RATCHET_CLIENT);
+    for (size_t i = 0; i < sizeof(every) / sizeof(every[0]); i++) {
+        m->limits.messages = every[i];
+        double ns = bench_rekey_time(bench_rekey_message, m, seconds);
+        if (every[i] == 0) {
+            printf("%16s %12.0f\n", "never", ns);
+        } else {
+            printf("%16llu %12.0f\n", (unsigned long long)every[i], ns);
+        }
+    }
+    free(m);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage:\n"
+                "./bench drng [max_threads] [seconds_per_step]\n"
+                "./bench reactor [max_threads] [seconds_per_step] "
+                "[client_threads] [epoll|uring]\n"
+                "./bench echo [server_threads] [seconds] "
+                "[client_threads] [epoll|uring]\n"
+                "./bench storm [hs_workers] [seconds] [echo_clients] "
+                "[storm_clients] [epoll|uring]\n"
+                "./bench fanout [members] [msg_size] [seconds]\n"
+                "./bench resume [seconds] [clients] [epoll|uring]\n"
+                "./bench idle [connections] [rounds] [epoll|uring]\n"
+                "./bench zerocopy [seconds]\n"
+                "./bench relay [seconds]\n"
+                "./bench timers [max_timers]\n"
+                "./bench rekey [seconds]\n");
+        return 1;
+    }
+
+    if (strcmp(argv[1], "drng") == 0) {
+        int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+        int seconds = argc > 3 ? atoi(argv[3]) : 2;
+        if (max_threads < 1) max_threads = 1;
+        if (seconds < 1) seconds = 1;
+        return bench_drng(max_threads, seconds);
+    }
+
+    if (strcmp(argv[1], "reactor") == 0) {
+        int max_threads = argc > 2 ? atoi(argv[2]) : 4;
+        int seconds = argc > 3 ? atoi(argv[3]) : 2;
+        int clients = argc > 4 ? atoi(argv[4]) : 2 * max_threads;
+        int flags = (argc > 5 && strcmp(argv[5], "uring") == 0)
+                    ? REACTOR_URING : 0;
+        if (max_threads < 1) max_threads = 1;
+        if (seconds < 1) seconds = 1;
+        if (clients < 1) clients = 1;
+        return bench_reactor(max_threads, seconds, clients, flags);
+    }
+
+    if (strcmp(argv[1], "echo") == 0) {
+        int threads = argc > 2 ? atoi(argv[2]) : 1;
+        int seconds = argc > 3 ? atoi(argv[3]) : 2;
+        int clients = argc > 4 ? atoi(argv[4]) : 16;
+        int flags = -1;  // Both backends
+        if (argc > 5) {
+            flags = strcmp(argv[5], "uring") == 0 ? REACTOR_URING : 0;
+        }
+        if (threads < 1) threads = 1;
+        if (seconds < 1) seconds = 1;
+        if (clients < 1) clients = 1;
+        return bench_echo(threads, seconds, clients, flags);
+    }
+
+    if (strcmp(argv[1], "storm") == 0) {
+        int hs_workers = argc > 2 ? atoi(argv[2]) : 2;
+        int seconds = argc > 3 ? atoi(argv[3]) : 2;
+        int echo_clients = argc > 4 ? atoi(argv[4]) : 4;
+        int storm_clients = argc > 5 ? atoi(argv[5]) : 16;
+        if (hs_workers < 1) hs_workers = 1;
+        if (seconds < 1) seconds = 1;
+        if (echo_clients < 1) echo_clients = 1;
+        int flags = (argc > 6 && strcmp(argv[6], "uring") == 0)
+                    ? REACTOR_URING : 0;
+        if (storm_clients < 0) storm_clients = 0;
+        return bench_storm(hs_workers, seconds, echo_clients,
+                           storm_clients, flags);
+    }
+
+    if (strcmp(argv[1], "fanout") == 0) {
+        int members = argc > 2 ? atoi(argv[2]) : 1000;
+        int msg_size = argc > 3 ? atoi(argv[3]) : 64;
+        int seconds = argc > 4 ? atoi(argv[4]) : 2;
+        if (members < 1) members = 1;
+        if (msg_size < 1) msg_size = 1;
+        if (msg_size > ROOM_TEXT_MAX) msg_size = ROOM_TEXT_MAX;
+        if (seconds < 1) seconds = 1;
+        return bench_fanout(members, (size_t)msg_size, seconds);
+    }
+
+    if (strcmp(argv[1], "resume") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 2;
+        int clients = argc > 3 ? atoi(argv[3]) : 4;
+        int flags = (argc > 4 && strcmp(argv[4], "uring") == 0)
+                    ? REACTOR_URING : 0;
+        if (seconds < 1) seconds = 1;
+        if (clients < 1) clients = 1;
+        return bench_resume(seconds, clients, flags);
+    }
+
+    if (strcmp(argv[1], "idle") == 0) {
+        int connections = argc > 2 ? atoi(argv[2]) : 500;
+        int rounds = argc > 3 ? atoi(argv[3]) : 3;
+        int flags = (argc > 4 && strcmp(argv[4], "uring") == 0)
+                    ? REACTOR_URING : 0;
+        if (connections < 1) connections = 1;
+        if (rounds < 0) rounds = 0;
+        return bench_idle(connections, rounds, flags);
+    }
+
+    if (strcmp(argv[1], "zerocopy") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 2;
+        if (seconds < 1) seconds = 1;
+        return bench_zerocopy(seconds);
+    }
+
+    if (strcmp(argv[1], "relay") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 2;
+        if (seconds < 1) seconds = 1;
+        return bench_relay(seconds);
+    }
+
+    if (strcmp(argv[1], "timers") == 0) {
+        long max_timers = argc > 2 ? atol(argv[2]) : 1000000;
+        if (max_timers < 10000) max_timers = 10000;
+        return bench_timers((size_t)max_timers);
+    }
+
+    if (strcmp(argv[1], "rekey") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 1;
+        if (seconds < 1) seconds = 1;
+        return bench_rekey(seconds);
+    }
+
+    fprintf(stderr, "Unknown benchmark: %s\n", argv[1]);
+    return 1;
+}
@@ -0,0 +1,497 @@
+#include "session.h"
+#include "chain.h"
+
+#ifndef _WIN32
+#include <errno.h>        // For errno, EINTR
+#include <sys/uio.h>      // For writev()
+#endif
+
+#define CHAIN_IOV 64      // Segments handed to one writev()
+
+// ========================================================================
+// Segment chains
+// ========================================================================
+void chain_init(BufChain *c)
+{
+    c->head = c->tail = NULL;
+    c->len = 0;
+    c->spare = NULL;
+}
+
+void chain_reset(BufChain *c)
+{
+    // Keep one segment, enough for most messages, and free the others
+    // so that one large message does not stay allocated
+    BufSeg *s = c->head;
+    if (s == NULL) return;
+    c->head = s->next;
+    s->next = NULL;
+    s->len = 0;
+    if (c->spare == NULL) c->spare = s;
+    else free(s);
+
+    while (c->head != NULL) {
+        s = c->head;
+        c->head = s->next;
+        free(s);
+    }
+    c->tail = NULL;
+    c->len = 0;
+}
+
+void chain_free(BufChain *c)
+{
+    chain_reset(c);
+    free(c->spare);
+    c->spare = NULL;
+}
+
+uint8_t *chain_reserve(BufChain *c, size_t *avail)
+{
+    if (c->tail == NULL || c->tail->len == CHAIN_SEG_SIZE) {
+        BufSeg *s = c->spare;
+        if (s != NULL) {
+            c->spare = NULL;
+        } else {
+            s = malloc(sizeof(*s));
+            if (s == NULL) return NULL;
+        }
+        s->next = NULL;
+        s->len = 0;
+        if (c->tail != NULL) c->tail->next = s;
+        else c->head = s;
+        c->tail = s;
+    }
+    *avail = CHAIN_SEG_SIZE - c->tail->len;
+    return c->tail->data + c->tail->len;
+}
+
+void chain_commit(BufChain *c, size_t n)
+{
+    c->tail->len += n;
+    c->len += n;
+}
+
+int chain_append(BufChain *c, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        size_t avail;
+        uint8_t *dst = chain_reserve(c, &avail);
+        if (dst == NULL) return -1;
+        if (avail > len) avail = len;
+        memcpy(dst, data, avail);
+        chain_commit(c, avail);
+        data += avail;
+        len -= avail;
+    }
+    return 0;
+}
+
+// Copies 'len' bytes starting 'off' bytes into the chain
+static void chain_copy(const BufChain *c, size_t off, uint8_t *out,
+                       size_t len)
+{
+    const BufSeg *s = c->head;
+    while (off >= s->len) {
+        off -= s->len;
+        s = s->next;
+    }
+    while (len > 0) {
+        size_t n = s->len - off;
+        if (n > len) n = len;
+        memcpy(out, s->data + off, n);
+        out += n;
+        len -= n;
+        off = 0;
+        s = s->next;
+    }
+}
+
+// ========================================================================
+// Encryption over segments
+// ========================================================================
+int chain_seal(BufChain *c, const uint8_t *msg, size_t len,
+               const uint8_t *npub, const uint8_t *key)
+{
+    ascon_aead_state_t a;
+    size_t full = len & ~(size_t)(ASCON_AEAD_RATE - 1);
+    uint8_t last[ASCON_AEAD_RATE + TAG_SIZE];
+
+    ECC_PROBE1(aead_encrypt_entry, len);
+    chain_reset(c);
+    ascon_aead_start(&a, npub, key);
+
+    // Whole blocks go straight into the segments. Every segment is
+    // filled up to CHAIN_SEG_SIZE, so the free space is always a
+    // multiple of the rate.
+    for (size_t off = 0; off < full;) {
+        size_t avail;
+        uint8_t *dst = chain_reserve(c, &avail);
+        if (dst == NULL) return -1;
+        if (avail > full - off) avail = full - off;
+        ascon_aead_encrypt_blocks(&a, dst, msg + off, avail);
+        chain_commit(c, avail);
+        off += avail;
+    }
+
+    // The last partial block and the tag may straddle two segments
+    ascon_aead_encrypt_final(&a, last, msg + full, len - full,
+                             last + (len - full));
+    metrics_add(METRIC_ENCRYPTED_BYTES, len);
+    ECC_PROBE1(aead_encrypt_return, len + TAG_SIZE);
+    return chain_append(c, last, len - full + TAG_SIZE);
+}
+
+// Counts the result of chain_open() for --metrics and returns it
+static int chain_opened(int rc, uint64_t len)
+{
+    if (rc == 0) {
+        metrics_add(METRIC_DECRYPTED_BYTES, len);
+    } else {
+        metrics_add(METRIC_DECRYPT_FAILURES, 1);
+    }
+    return rc;
+}
+
+int chain_open(const Frame *f, uint8_t *out, uint64_t *outlen,
+               const uint8_t *npub, const uint8_t *key)
+{
+    if (f->chain == NULL) {
+        uint64_t t = trace_begin();
+        int rc = crypto_aead_decrypt(out, outlen, NULL, f->payload, f->len,
+                                     npub, key);
+        trace_end(TRACE_DECRYPT, t);
+        return chain_opened(rc, *outlen);
+    }
+
+    const BufChain *c = f->chain;
+    ECC_PROBE1(aead_decrypt_entry, f->len);
+    if (f->len < TAG_SIZE || c->len != f->len) {
+        ECC_PROBE2(aead_decrypt_return, 0, -1);
+        return chain_opened(-1, 0);
+    }
+
+    ascon_aead_state_t a;
+    size_t clen = f->len - TAG_SIZE;
+    size_t full = clen & ~(size_t)(ASCON_AEAD_RATE - 1);
+    uint8_t last[ASCON_AEAD_RATE + TAG_SIZE];
+
+    ascon_aead_start(&a, npub, key);
+
+    // Whole blocks are decrypted segment by segment; all segments but
+    // the last are full, so each piece is a multiple of the rate
+    size_t off = 0;
+    for (const BufSeg *s = c->head; s != NULL && off < full; s = s->next) {
+        size_t n = s->len;
+        if (n > full - off) n = full - off;
+        ascon_aead_decrypt_blocks(&a, out + off, s->data, n);
+        off += n;
+    }
+
+    chain_copy(c, full, last, clen - full + TAG_SIZE);
+    if (ascon_aead_decrypt_final(&a, out + full, last, clen - full,
+                                 last + (clen - full)) != 0) {
+        ECC_PROBE2(aead_decrypt_return, 0, -1);
+        return chain_opened(-1, 0);
+    }
+    *outlen = clen;
+    ECC_PROBE2(aead_decrypt_return, clen, 0);
+    return chain_opened(0, clen);
+}
+
+int chain_reseal(const Frame *f, uint8_t *out, const uint8_t *npub_in,
+                 const uint8_t *key_in, const uint8_t *npub_out,
+                 const uint8_t *key_out)
+{
+    if (f->len < TAG_SIZE) return -1;
+    if (f->chain != NULL && f->chain->len != f->len) return -1;
+
+    ascon_aead_state_t d, e;
+    size_t clen = f->len - TAG_SIZE;
+    size_t full = clen & ~(size_t)(ASCON_AEAD_RATE - 1);
+    uint8_t last[ASCON_AEAD_RATE + TAG_SIZE];
+    const uint8_t *tail = last;
+
+    ascon_aead_start(&d, npub_in, key_in);
+    ascon_aead_start(&e, npub_out, key_out);
+
+    if (f->chain == NULL) {
+        ascon_aead_reencrypt_blocks(&d, &e, out, f->payload, full);
+        tail = f->payload + full;
+    } else {
+        // Segment by segment, as in chain_open()
+        size_t off = 0;
+        for (const BufSeg *s = f->chain->head; s != NULL && off < full;
+             s = s->next) {
+            size_t n = s->len;
+            if (n > full - off) n = full - off;
+            ascon_aead_reencrypt_blocks(&d, &e, out + off, s->data, n);
+            off += n;
+        }
+        chain_copy(f->chain, full, last, clen - full + TAG_SIZE);
+    }
+    int rc = ascon_aead_reencrypt_final(&d, &e, out + full, tail,
+                                        clen - full, tail + (clen - full),
+                                        out + clen);
+    if (rc == 0) {
+        metrics_add(METRIC_DECRYPTED_BYTES, clen);
+        metrics_add(METRIC_ENCRYPTED_BYTES, clen);
+    } else {
+        metrics_add(METRIC_DECRYPT_FAILURES, 1);
+    }
+    return rc;
+}
+
+// ========================================================================
+// Sending
+// ========================================================================
+int chain_send(int fd, uint8_t type, const BufChain *c)
+{
+    uint8_t header[FRAME_HEADER_MAX + 1];
+    size_t hlen = frame_encode_header(header, type, c->len);
+    const BufSeg *s = c->head;
+
+#ifdef _WIN32
+    // Header and segments leave in batches of one WSASend() each
+    WSABUF bufs[CHAIN_IOV];
+    int cnt = 0;
+    bufs[cnt].buf = (char *)header;
+    bufs[cnt++].len = (ULONG)hlen;
+    for (;;) {
+        while (s != NULL && cnt < CHAIN_IOV) {
+            bufs[cnt].buf = (char *)s->data;
+            bufs[cnt++].len = (ULONG)s->len;
+            s = s->next;
+        }
+        DWORD sent = 0, want = 0;
+        for (int i = 0; i < cnt; i++) want += bufs[i].len;
+        if (WSASend((SOCKET)fd, bufs, (DWORD)cnt, &sent, 0, NULL,
+                    NULL) != 0 || sent != want) {
+            return -1;
+        }
+        if (s == NULL) break;
+        cnt = 0;
+    }
+#else
+    // Header and segments leave in one writev() per CHAIN_IOV segments;
+    // a short write continues where it stopped
+    struct iovec iov[CHAIN_IOV];
+    int cnt = 0;
+    iov[cnt].iov_base = header;
+    iov[cnt++].iov_len = hlen;
+    for (;;) {
+        while (s != NULL && cnt < CHAIN_IOV) {
+            iov[cnt].iov_base = (void *)s->data;
+            iov[cnt++].iov_len = s->len;
+            s = s->next;
+        }
+
+        struct iovec *v = iov;
+        while (cnt > 0) {
+            ssize_t n = writev(fd, v, cnt);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+
+            while (cnt > 0 && (size_t)n >= v->iov_len) {
+                n -= (ssize_t)v->iov_len;
+                v++;
+                cnt--;
+            }
+            if (cnt > 0) {
+                v->iov_base = (uint8_t *)v->iov_base + n;
+                v->iov_len -= (size_t)n;
+            }
+        }
+        if (s == NULL) break;
+    }
+#endif
+    return 0;
+}
+
+// ========================================================================
+// Receiving
+// ========================================================================
+void chain_rx_init(ChainRx *rx)
+{
+    chain_init(&rx->chain);
+    rx->type = 0;
+    rx->need = 0;
+    rx->active = 0;
+}
+
+void chain_rx_free(ChainRx *rx)
+{
+    chain_free(&rx->chain);
+    rx->active = 0;
+}
+
+int chain_rx_start(ChainRx *rx, FrameBuffer *fb, size_t small,
+                   size_t max_size)
+{
+    uint8_t type;
+    size_t hlen, plen;
+    int r = frame_buffer_peek(fb, &type, &hlen, &plen);
+    if (r <= 0) return r;
+    if (plen > max_size) return -1;
+    if (plen <= small) return 0;
+
+    chain_reset(&rx->chain);
+    rx->type = type;
+    rx->need = plen;
+    rx->active = 1;
+    frame_buffer_consume(fb, hlen);
+
+    // Move the part of the payload that is already in the ring
+    while (rx->chain.len < rx->need && fb->tail != fb->head) {
+        size_t avail;
+        const uint8_t *src = frame_buffer_read_ptr(fb, &avail);
+        size_t n = chain_rx_feed(rx, src, avail);
+        if (n == 0) return -1;  // Out of memory
+        frame_buffer_consume(fb, n);
+    }
+    return 1;
+}
+
+size_t chain_rx_feed(ChainRx *rx, const uint8_t *data, size_t len)
+{
+    if (len > rx->need - rx->chain.len) len = rx->need - rx->chain.len;
+    return chain_append(&rx->chain, data, len) == 0 ? len : 0;
+}
+
+int chain_rx_read(int fd, ChainRx *rx)
+{
+    size_t avail;
+    uint8_t *dst = chain_reserve(&rx->chain, &avail);
+    if (dst == NULL) return -1;
+
+    // Never read past the frame: what follows goes to the ring
+    if (avail > rx->need - rx->chain.len) {
+        avail = rx->need - rx->chain.len;
+    }
+    for (;;) {
+#ifdef _WIN32
+        int n = recv(fd, (char *)dst, (int)avail, 0);
+#else
+        ssize_t n = read(fd, dst, avail);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return n == 0 ? 0 : -1;
+        chain_commit(&rx->chain, (size_t)n);
+        return (int)n;
+    }
+}
+
+int chain_rx_complete(const ChainRx *rx)
+{
+    return rx->active && rx->chain.len == rx->need;
+}
+
+void chain_rx_frame(ChainRx *rx, Frame *f)
+{
+    f->type = rx->type;
+    f->payload = NULL;
+    f->len = rx->need;
+    f->chain = &rx->chain;
+    rx->active = 0;
+}
+
+int frame_recv_chain(int fd, FrameBuffer *fb, Frame *f, ChainRx *rx,
+                     uint8_t *scratch, size_t scratch_len,
+                     size_t max_size)
+{
+    for (;;) {
+        if (!rx->active) {
+            int r = chain_rx_start(rx, fb, scratch_len, max_size);
+            if (r < 0) return -1;
+            if (r == 0) {
+                // Small frames come out of the ring as usual
+                r = frame_pop(fb, f, scratch, scratch_len, scratch_len);
+                if (r != 0) return r;
+
+                int n = frame_buffer_fill(fd, fb);
+                if (n <= 0) return n;
+                continue;
+            }
+        }
+
+        // The rest of a large frame goes from the socket to the chain
+        while (rx->chain.len < rx->need) {
+            int n = chain_rx_read(fd, rx);
+            if (n <= 0) return n;
+        }
+        chain_rx_frame(rx, f);
+        return 1;
+    }
+}
+
+// ========================================================================
+// Messages of a ClientServerContext
+// ========================================================================
+int session_reserve(ClientServerContext *ctx, size_t len)
+{
+    if (len + 1 <= ctx->decrypted_cap) return 0;
+
+    size_t size = ctx->decrypted_cap > 0 ? ctx->decrypted_cap : BUFFER_SIZE;
+    while (size < len + 1) size *= 2;
+    uint8_t *buf = realloc(ctx->decrypted_msg, size);
+    if (buf == NULL) return -1;
+    ctx->decrypted_msg = buf;
+    ctx->decrypted_cap = size;
+    return 0;
+}
+
+int session_open(ClientServerContext *ctx, const Frame *f)
+{
+    if (f->len < TAG_SIZE || session_reserve(ctx, f->len - TAG_SIZE) != 0) {
+        return -1;
+    }
+
+    // Large frames are decrypted segment by segment, straight into the
+    // output buffer
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    ratchet_nonce(&ctx->ratchet.rx, nonce);
+    if (chain_open(f, ctx->decrypted_msg, &ctx->decrypted_msglen,
+                   nonce, ctx->ratchet.rx.key) != 0) {
+        return -1;
+    }
+    ratchet_count(&ctx->ratchet.rx, ctx->decrypted_msglen);
+    ctx->decrypted_msg[ctx->decrypted_msglen] = '\0';
+    return 0;
+}
+
+int session_send(ClientServerContext *ctx, int fd, const uint8_t *msg,
+                 size_t len)
+{
+    RatchetKey *tx = &ctx->ratchet.tx;
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+
+    // The next key is announced in front of its first message
+    if (ratchet_due(tx, &ctx->rekey)) {
+        uint8_t rekey[RATCHET_REKEY_SIZE];
+        ratchet_rekey(tx, rekey);
+        if (frame_send(fd, FRAME_REKEY, rekey, sizeof(rekey)) < 0) {
+            return -1;
+        }
+    }
+    ratchet_nonce(tx, nonce);
+    ratchet_count(tx, len);
+
+    // Short messages keep the single-buffer path
+    if (len + TAG_SIZE <= sizeof(ctx->encrypted_msg)) {
+        uint64_t t = trace_begin();
+        int rc = crypto_aead_encrypt(ctx->encrypted_msg,
+                                     &ctx->encrypted_msglen, msg, len,
+                                     nonce, tx->key);
+        trace_end(TRACE_ENCRYPT, t);
+        if (rc != 0) return -1;
+        metrics_add(METRIC_ENCRYPTED_BYTES, len);
+        return frame_send(fd, FRAME_DATA, ctx->encrypted_msg,
+                          ctx->encrypted_msglen);
+    }
+
+    if (chain_seal(&ctx->tx_chain, msg, len, nonce, tx->key) != 0) {
+        return -1;
+    }
+    ctx->encrypted_msglen = ctx->tx_chain.len;
+    return chain_send(fd, FRAME_DATA, &ctx->tx_chain);
+}
@@ -0,0 +1,132 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint8_t
+#include "frame.h"        // For Frame and FrameBuffer
+
+// ========================================================================
+// Large messages on chained buffers
+// ========================================================================
+// A text message used to be limited to BUFFER_SIZE (256) bytes: lines
+// were cut by fgets() and every buffer on the way had that size. Larger
+// messages are kept in a BufChain instead: a list of CHAIN_SEG_SIZE
+// segments that grows as bytes arrive, so nothing is moved once written.
+//
+// - Receiving: a frame whose payload is larger than the caller's scratch
+//   buffer is diverted from the ring into a ChainRx. Its remaining bytes
+//   are read from the socket straight into the segments.
+// - Decrypting: chain_open() runs ASCON over the segments one after the
+//   other and writes the plaintext into memory given by the caller.
+// - Sending: chain_seal() encrypts into the segments and chain_send()
+//   hands them to a single writev() together with the frame header.
+//
+// The largest frame accepted is chosen by the caller (--max-frame in the
+// client and server, REACTOR_MSG_MAX in the event loop).
+// ========================================================================
+
+#define CHAIN_SEG_SIZE 65536          // Bytes per segment (a multiple of
+                                      // the ASCON rate)
+#define MSG_MAX_DEFAULT (1 << 20)     // Default largest frame (1 MiB)
+#define MSG_MAX_LIMIT (16 << 20)      // Largest --max-frame (16 MiB)
+
+typedef struct BufSeg {
+    struct BufSeg *next;              // Next segment of the chain
+    size_t len;                       // Bytes used in 'data'
+    uint8_t data[CHAIN_SEG_SIZE];
+} BufSeg;
+
+typedef struct BufChain {
+    BufSeg *head, *tail;              // Segments holding data
+    size_t len;                       // Bytes in all of them
+    BufSeg *spare;                    // Emptied segments kept for reuse
+} BufChain;
+
+// A large frame being received
+typedef struct {
+    BufChain chain;                   // Payload received so far
+    uint8_t type;                     // FRAME_* type of the frame
+    size_t need;                      // Payload length
+    int active;                       // A frame is being received
+} ChainRx;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Prepares an empty chain / releases every segment
+void chain_init(BufChain *c);
+void chain_free(BufChain *c);
+
+// Empties the chain; its segments are kept for the next message
+void chain_reset(BufChain *c);
+
+// Returns free space at the end of the chain (adding a segment if the
+// last one is full) and its size, or NULL if out of memory.
+// chain_commit() marks 'n' bytes written there as data.
+uint8_t *chain_reserve(BufChain *c, size_t *avail);
+void chain_commit(BufChain *c, size_t n);
+
+// Copies 'len' bytes to the end of the chain. Returns 0 or -1.
+int chain_append(BufChain *c, const uint8_t *data, size_t len);
+
+// Encrypts 'len' bytes of 'msg' into the (emptied) chain: ciphertext
+// followed by the tag. Returns 0 or -1 if out of memory.
+int chain_seal(BufChain *c, const uint8_t *msg, size_t len,
+               const uint8_t *npub, const uint8_t *key);
+
+// Sends the chain as one frame on a blocking socket. Returns 0 or -1.
+int chain_send(int fd, uint8_t type, const BufChain *c);
+
+// Decrypts the payload of a frame, held in place or in a chain, into
+// 'out' (room for f->len - TAG_SIZE bytes). Returns 0 or -1 like
+// crypto_aead_decrypt().
+int chain_open(const Frame *f, uint8_t *out, uint64_t *outlen,
+               const uint8_t *npub, const uint8_t *key);
+
+// Re-encrypts the payload of a frame (held in place or in a chain) from
+// 'key_in' to 'key_out' in one pass, without writing the plaintext
+// anywhere: 'out' receives f->len bytes, ciphertext and tag. Returns 0,
+// or -1 if the input does not authenticate ('out' must be discarded).
+int chain_reseal(const Frame *f, uint8_t *out, const uint8_t *npub_in,
+                 const uint8_t *key_in, const uint8_t *npub_out,
+                 const uint8_t *key_out);
+
+// Receive side
+void chain_rx_init(ChainRx *rx);
+void chain_rx_free(ChainRx *rx);
+
+// Looks at the frame at the front of the ring. If its payload is larger
+// than 'small', starts receiving it into the chain: the header is
+// dropped and the payload bytes already buffered are moved over.
+// Returns 1 if a frame was diverted, 0 if not, -1 if it exceeds
+// 'max_size'.
+int chain_rx_start(ChainRx *rx, FrameBuffer *fb, size_t small,
+                   size_t max_size);
+
+// Adds received bytes to the frame. Returns how many were taken (the
+// rest belongs to the next frames).
+size_t chain_rx_feed(ChainRx *rx, const uint8_t *data, size_t len);
+
+// Reads once from 'fd' into the frame. Returns the number of bytes
+// read, 0 on close, -1 on error.
+int chain_rx_read(int fd, ChainRx *rx);
+
+// Returns 1 once the whole payload is there
+int chain_rx_complete(const ChainRx *rx);
+
+// Fills 'f' with the completed frame. It stays valid until the next
+// chain_rx_start().
+void chain_rx_frame(ChainRx *rx, Frame *f);
+
+// frame_recv() for large frames: blocks until one frame is available.
+// Frames up to 'scratch_len' bytes are returned as by frame_recv(),
+// larger ones (up to 'max_size') are received into 'rx'.
+int frame_recv_chain(int fd, FrameBuffer *fb, Frame *f, ChainRx *rx,
+                     uint8_t *scratch, size_t scratch_len,
+                     size_t max_size);
+
+#endif // CHAIN_H
@@ -1,5 +1,54 @@
 #include "session.h"
 #include "error.h"
+#include "drng.h"         // For --drng-stats
+#include "dispatch.h"       // For --print-dispatch
+#include "duplex.h"
+#include "room.h"
+#include "ticket.h"
+#include "early.h"
+#include "relay.h"
+#include "loadgen.h"
+
+// Printed when an argument is missing or unknown
+#define CLIENT_USAGE                                                      \
+    "Client usage format:\n"                                              \
+    "./client <hostname> <port> [--duplex] [--ticket FILE] "              \
+    "[--early FILE] [--max-frame BYTES] [--recv-dir DIR] [--zerocopy] "   \
+    "[--rekey-messages N] [--rekey-bytes N] [--rekey-interval SEC] "      \
+    "[--log-level LEVEL] [--log-keys] [--trace] [--trace-json FILE] "     \
+    "[--drng-stats SEC]\n"                                                \
+    "./client <hostname> <port> --bench [--connections N] [--threads N] " \
+    "[--size BYTES] [--rate N] [--duration SEC] [--open-loop] "           \
+    "[--reconnect N]\n"                                                   \
+    "./client --print-dispatch\n"
+
+// ========================================================================
+// Read one line from the user into ctx->buffer (without the newline)
+// ========================================================================
+static void read_message(ClientServerContext *ctx)
+{
+    log_flush();  // The lines logged so far come before the prompt
+    printf("Me: ");
+
+    // The whole line, whatever its length (up to --max-frame)
+    if (session_read_line(ctx) != 0) {
+        error("Error reading input");  // Read input from stdin, check
+                                       // for errors
+    }
+}
+
+// ========================================================================
+// Encrypt ctx->buffer and send it as one frame
+// ========================================================================
+static void send_message(ClientServerContext *ctx)
+{
+    // Encrypt the message and send it as one frame (in segments when
+    // it is larger than encrypted_msg), under the pair key on a relay
+    if (relay_send(ctx, ctx->sockfd, ctx->buffer, ctx->bufferlen) < 0) {
+        error("Error writing to server");  // Check for errors while
+                                           // sending
+    }
+}
 int main(int argc, char *argv[]) {
 
     // ====================================================================
@@ -22,6 +71,14 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    // ====================================================================
+    // --print-dispatch: the crypto kernels picked for this CPU
+    // ====================================================================
+    if (argc == 2 && strcmp(argv[1], "--print-dispatch") == 0) {
+        dispatch_print(stdout);
+        return 0;
+    }
+
     // ====================================================================
     // Validate input arguments (hostname and port)
     // ====================================================================
@@ -29,32 +86,175 @@ int main(int argc, char *argv[]) {
         error("Checking...\n"
               "User has not read the client usage documentation.\n"
               "Missing IP address or port.\n"
-              "Client usage format:\n"
-              "./client <hostname> <port>\n"
+              CLIENT_USAGE
               "Departing into oblivion");
     }
-    if (argc >= 4){
+    int duplex = 0;
+    int bench = 0;            // --bench: load generator, no chat
+    int bench_options = 0;    // Options that need --bench
+    LoadgenConfig load;
+    loadgen_defaults(&load);
+    const char *ticket_path = NULL;  // --ticket FILE: resume sessions
+    const char *early_path = NULL;   // --early FILE: server key cache for
+                                     // 0-RTT first messages
+    int trace = 0;                   // --trace: phase latencies
+    const char *trace_json = NULL;   // --trace-json FILE: Chrome trace
+    int drng_stats = 0;  // --drng-stats SEC: RDRAND counters every SEC s
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--drng-stats") == 0 && i + 1 < argc &&
+            atoi(argv[i + 1]) > 0) {
+            drng_stats = atoi(argv[++i]);  // Printed to stderr
+        } else if (strcmp(argv[i], "--duplex") == 0) {
+            duplex = 1;
+        } else if (strcmp(argv[i], "--ticket") == 0 && i + 1 < argc) {
+            ticket_path = argv[++i];
+        } else if (strcmp(argv[i], "--early") == 0 && i + 1 < argc) {
+            early_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-frame") == 0 && i + 1 < argc) {
+            long max = atol(argv[++i]);
+            if (max < BUFFER_SIZE || max > MSG_MAX_LIMIT) {
+                error("Checking...\n"
+                      "--max-frame must be between 256 and 16777216");
+            }
+            ctx.max_frame = (size_t)max;
+        } else if (strcmp(argv[i], "--recv-dir") == 0 && i + 1 < argc) {
+            ctx.files.dir = argv[++i];  // Files sent by a --duplex server
+        } else if (strcmp(argv[i], "--zerocopy") == 0) {
+            ctx.zc.on = 1;  // "/send" without copying into the kernel
+        } else if (strcmp(argv[i], "--rekey-messages") == 0 &&
+                   i + 1 < argc && atoll(argv[i + 1]) >= 0) {
+            ctx.rekey.messages = (uint64_t)atoll(argv[++i]);  // 0: off
+        } else if (strcmp(argv[i], "--rekey-bytes") == 0 && i + 1 < argc &&
+                   atoll(argv[i + 1]) >= 0) {
+            ctx.rekey.bytes = (uint64_t)atoll(argv[++i]);     // 0: off
+        } else if (strcmp(argv[i], "--rekey-interval") == 0 &&
+                   i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            ctx.rekey.seconds = (unsigned)atoi(argv[++i]);    // 0: off
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc &&
+                   log_parse_level(argv[i + 1]) >= 0) {
+            log_level = log_parse_level(argv[++i]);
+        } else if (strcmp(argv[i], "--log-keys") == 0) {
+            log_keys = 1;         // Keys in hex: debugging only
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = 1;
+        } else if (strcmp(argv[i], "--trace-json") == 0 && i + 1 < argc) {
+            trace_json = argv[++i];           // Implies --trace
+            trace = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--connections") == 0 &&
+                   i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            load.connections = atoi(argv[++i]);
+            bench_options = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) > 0) {
+            load.threads = atoi(argv[++i]);
+            bench_options = 1;
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc &&
+                   atol(argv[i + 1]) > 0) {
+            load.size = (size_t)atol(argv[++i]);
+            bench_options = 1;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc &&
+                   atof(argv[i + 1]) > 0) {
+            load.rate = atof(argv[++i]);        // Messages/s in total
+            bench_options = 1;
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) > 0) {
+            load.duration = atoi(argv[++i]);
+            bench_options = 1;
+        } else if (strcmp(argv[i], "--open-loop") == 0) {
+            load.open_loop = 1;
+            bench_options = 1;
+        } else if (strcmp(argv[i], "--reconnect") == 0 && i + 1 < argc &&
+                   atoll(argv[i + 1]) > 0) {
+            load.reconnect = (uint64_t)atoll(argv[++i]);
+            bench_options = 1;
+        } else {
+            error("Checking...\n"
+                  "User has not read the client documentation.\n"
+                  "Unknown argument\n"
+                  CLIENT_USAGE
+                  "Departing into oblivion");
+        }
+    }
+    if (early_path != NULL && (duplex || ticket_path != NULL)) {
         error("Checking...\n"
-                "User has not read the client documentation.\n"
-                "Adding too many arguments\n"
-                "Client usage format:\n"
-                "./client <hostname> <port>\n"
-                "Departing into oblivion");
+              "--early cannot be combined with --duplex or --ticket");
     }
-    // ====================================================================
-    // Generate a private key using Curve25519
-    // ====================================================================
-    generate_private_key(ctx.private_key);  // Generate the private key
-                                            // using Curve25519
-    printf("Generated private key for client:\n");
-    hexdump(ctx.private_key, 32);  // Print the generated private key in
-                                     // hexadecimal format
+    if (bench_options && !bench) {
+        error("Checking...\n"
+              "--connections, --threads, --size, --rate, --duration, "
+              "--open-loop and --reconnect need --bench");
+    }
+    if (bench && (duplex || ticket_path != NULL || early_path != NULL)) {
+        error("Checking...\n"
+              "--bench cannot be combined with --duplex, --ticket or "
+              "--early");
+    }
+    if (bench && load.size > ctx.max_frame) {
+        error("Checking...\n"
+              "--size is larger than --max-frame");
+    }
+    if (load.open_loop && load.rate <= 0) {
+        error("Checking...\n"
+              "--open-loop needs --rate");
+    }
+#ifdef _WIN32
+    if (duplex || bench) {
+        error("Checking...\n"
+              "--duplex and --bench are not available on Windows");
+    }
+#endif
 
     // ====================================================================
     // Convert the port number from string to integer
     // ====================================================================
     ctx.portno = atoi(argv[2]);  // Convert the port argument (string)
                                  // into an integer
+    if (drng_stats > 0) {
+        if (drng_stats_start_dump((unsigned)drng_stats) < 0) {
+            error("Cannot start the --drng-stats thread");
+        }
+        atexit(drng_stats_stop_dump);  // Every exit() of the client
+    }
+    if (trace && trace_start(trace_json) < 0) {
+        error("Out of memory for the trace");
+    }
+
+#ifndef _WIN32
+    // ====================================================================
+    // Load generator: many sessions, no chat (see loadgen.h)
+    // ====================================================================
+    if (bench) {
+        load.rekey = ctx.rekey;
+        if (loadgen_run(&load, argv[1], ctx.portno) != 0) {
+            error("Load run failed: unknown host or no session opened");
+        }
+        exit(0);
+    }
+#endif
+
+    // ====================================================================
+    // 0-RTT: with the server key of the last connection, the first
+    // message is typed before connecting and leaves with the public key
+    // ====================================================================
+    uint8_t cached_key[KEY_SIZE];
+    int early = (early_path != NULL &&
+                 early_key_load(early_path, cached_key) == 0);
+    int typed = 0;  // ctx.buffer already holds the first message
+    if (early) {
+        read_message(&ctx);
+        typed = 1;
+        if (strcasecmp((char *)ctx.buffer, "bye") == 0) {
+            printf("You ended the conversation.\n");
+            exit(0);
+        }
+        if (ctx.bufferlen > EARLY_TEXT_MAX ||
+            file_command((char *)ctx.buffer) != NULL) {
+            early = 0;  // Too long, or a file: sent after the key
+                        // exchange
+        }
+    }
 
     // ====================================================================
     // Create a TCP socket
@@ -65,7 +265,7 @@ int main(int argc, char *argv[]) {
         error("ERROR opening socket");  // If socket creation fails, print
                                         // an error message
     }
-    printf("Socket successfully opened\n");
+    log_info("Socket successfully opened");
 
     // ====================================================================
     // Resolve hostname to IP address
@@ -79,7 +279,7 @@ int main(int argc, char *argv[]) {
                                                    // if the host cannot
                                                    // be resolved
     }
-    printf("Host found\n");
+    log_info("Host found");
 
     // ====================================================================
     // Prepare server address structure
@@ -101,6 +301,7 @@ int main(int argc, char *argv[]) {
     // ====================================================================
     // Establish connection to the server
     // ====================================================================
+    uint64_t hs_start = trace_begin();  // Until the chat can start
     if (connect(ctx.sockfd,(struct sockaddr *)&ctx.serv_addr,
                 sizeof(ctx.serv_addr)) < 0) {
 
@@ -111,53 +312,146 @@ int main(int argc, char *argv[]) {
         "Conclusion");  // Try to connect to the server; print
                                     // error if it fails
     }
-    printf("Connection successful\n");
-
-    // ====================================================================
-    // Perform Diffie-Hellman key exchange (X25519)
-    // ====================================================================
-
-    crypto_scalarmult_base(ctx.public_key, ctx.private_key);// Generate the
-                                                          // client's
-                                                          // public key
-                                                          // using X25519
-
-    // Send public key to the server
-    #ifdef _WIN32
-    int n = send(ctx.sockfd,(char *)ctx.public_key, sizeof(ctx.public_key),
-               0);  // Convert to const char *
+    log_info("Connection successful");
+
+    int n;
+    if (early) {
+        // ================================================================
+        // Key exchange against the cached server key: the public key and
+        // the encrypted first message leave in one write
+        // ================================================================
+        uint8_t out[KEY_SIZE + FRAME_HEADER_MAX + 1 + BUFFER_SIZE +
+                    TAG_SIZE];
+
+        uint64_t t = trace_begin();
+        generate_private_key(ctx.private_key);
+        crypto_scalarmult_base(ctx.public_key, ctx.private_key);
+        trace_end(TRACE_KEYGEN, t);
+        t = trace_begin();
+        crypto_scalarmult(ctx.shared_secret, ctx.private_key, cached_key);
+        trace_end(TRACE_SCALARMULT, t);
+
+        memcpy(out, ctx.public_key, KEY_SIZE);
+        size_t len = KEY_SIZE + early_seal(out + KEY_SIZE,
+                                           ctx.shared_secret, ctx.buffer,
+                                           ctx.bufferlen);
+        t = trace_begin();
+#ifdef _WIN32
+        n = send(ctx.sockfd, (char *)out, (int)len, 0);
 #else
-   int n = write(ctx.sockfd, (char *)ctx.public_key,
-                sizeof(ctx.public_key));
+        n = write(ctx.sockfd, out, len);
 #endif
-    // Send the generated public key to the server
-    if (n < 0) {
-        error("Error sending public key");
+        trace_end(TRACE_SEND_KEY, t);
+        if (n < 0 || (size_t)n != len) {
+            error("Error sending public key");
+        }
+        log_info("First message sent with the public key (0-RTT)");
     }
 
-    // Receive server's public key
-
-    n = recv(ctx.sockfd, (char *)ctx.server_public_key,
-             sizeof(ctx.server_public_key), 0);  // Receive the server's
+    // ====================================================================
+    // Receive the server's public key
+    // ====================================================================
+    uint64_t t = trace_begin();
+    n = frame_recv_exact(ctx.sockfd, &ctx.rx, ctx.server_public_key,
+                         sizeof(ctx.server_public_key));  // Receive all
+                                             // 32 bytes of the server's
                                              // public key
-    if (n < 0) {
+    trace_end(TRACE_RECV_KEY, t);
+    if (n <= 0) {
         error("Error receiving public key from server");
         // Check if receiving the public key was successful
     }
 
-    // Print received server's public key (for debugging)
-    printf("Received server's public key:\n");
-    hexdump(ctx.server_public_key, 32);  // Print the received server's
-                                       // public key
+    // Keys are hidden unless --log-keys
+    log_key("Received server's public key", ctx.server_public_key, 32);
+
+    // ====================================================================
+    // Resume the last session with its ticket (no key exchange)
+    // ====================================================================
+    TicketCache ticket;
+    int resumed = 0;
+    if (ticket_path != NULL && ticket_cache_load(ticket_path, &ticket) == 0)
+    {
+        resumed = ticket_resume(ctx.sockfd, &ctx.rx, &ticket,
+                                &ctx.control_rx, ctx.shared_secret);
+        if (resumed < 0) {
+            error("Error resuming the session");
+        }
+        log_info("%s", resumed ? "Session resumed with a ticket"
+                               : "Ticket rejected, exchanging keys");
+    }
+
+    if (early) {
+        // A server that was restarted has a new key pair: it refuses the
+        // early message, which is sent again under the real session key
+        if (memcmp(cached_key, ctx.server_public_key, KEY_SIZE) != 0) {
+            crypto_scalarmult(ctx.shared_secret, ctx.private_key,
+                              ctx.server_public_key);
+        }
+    } else if (!resumed) {
+        // ================================================================
+        // Generate a private key using Curve25519
+        // ================================================================
+        t = trace_begin();
+        generate_private_key(ctx.private_key);  // Generate the private
+                                                // key using Curve25519
+        log_key("Generated private key for client", ctx.private_key, 32);
+
+        // ================================================================
+        // Perform Diffie-Hellman key exchange (X25519)
+        // ================================================================
+        crypto_scalarmult_base(ctx.public_key, ctx.private_key);
+                                          // Generate the client's public
+                                          // key using X25519
+        trace_end(TRACE_KEYGEN, t);
+
+        // Send public key to the server
+        t = trace_begin();
+#ifdef _WIN32
+        n = send(ctx.sockfd, (char *)ctx.public_key,
+                 sizeof(ctx.public_key), 0);  // Convert to const char *
+#else
+        n = write(ctx.sockfd, (char *)ctx.public_key,
+                  sizeof(ctx.public_key));
+#endif
+        trace_end(TRACE_SEND_KEY, t);
+        // Send the generated public key to the server
+        if (n < 0) {
+            error("Error sending public key");
+        }
 
-    // Compute shared secret key using Diffie-Hellman key exchange
-    crypto_scalarmult(ctx.shared_secret, ctx.private_key,
-                      ctx.server_public_key);  //
-// Compute the shared secret based on the client's private key
-// and the server's public key
+        // Compute shared secret key using Diffie-Hellman key exchange
+        t = trace_begin();
+        crypto_scalarmult(ctx.shared_secret, ctx.private_key,
+                          ctx.server_public_key);  // Compute the shared
+                                                   // secret based on the
+                                                   // client's private key
+                                                   // and the server's
+                                                   // public key
+        trace_end(TRACE_SCALARMULT, t);
+
+        // The server follows up with a ticket for the next connection
+        t = trace_begin();
+        if (ticket_path != NULL &&
+            ticket_receive(ctx.sockfd, &ctx.rx, &ticket, &ctx.control_rx,
+                           ctx.shared_secret) != 0) {
+            error("Error receiving the session ticket");
+        }
+        if (ticket_path != NULL) trace_end(TRACE_TICKET, t);
+    }
+    trace_end(TRACE_HANDSHAKE, hs_start);
+    if (ticket_path != NULL && ticket_cache_save(ticket_path, &ticket) != 0)
+    {
+        perror("Could not save the session ticket");
+    }
+    if (early_path != NULL &&
+        early_key_save(early_path, ctx.server_public_key) != 0) {
+        perror("Could not save the server public key");
+    }
 
-    printf("Shared secret key:\n");
-    hexdump(ctx.shared_secret, 32);  // Print the shared secret key
+    log_key("Shared secret key", ctx.shared_secret, 32);
+    ratchet_init(&ctx.ratchet, ctx.shared_secret, SHARED_SECRET_SIZE,
+                 RATCHET_CLIENT);  // Message keys of both directions
     // ====================================================================
     // Ctrl+Z and Ctrl+C checking
     // ====================================================================
@@ -181,49 +475,43 @@ sigemptyset(&sa.sa_mask);
 sigaction(SIGTSTP, &sa, NULL);
 #endif
 
+#ifndef _WIN32
     // ====================================================================
-    // Begin encrypted message exchange loop
+    // Full-duplex mode: send and receive independently
     // ====================================================================
-    while (1) {
-        // Get input from the user
-        printf("Me: ");
-        memset(ctx.buffer, 0, sizeof(ctx.buffer));  // Clear the buffer
-                                                    // to store
-                                                    // the user's message
-        if (fgets((char *)ctx.buffer, sizeof(ctx.buffer), stdin) == NULL)
-        {
-            error("Error reading input");  // Read input from stdin,
-                                           // check for errors
+    if (duplex) {
+        log_flush();  // The chat prints to stdout itself
+        if (chat_duplex(&ctx, ctx.sockfd, "Server") < 0) {
+            error("Error in full-duplex chat");
         }
+        file_rx_free(&ctx.files);
+        close(ctx.sockfd);
+        exit(0);
+    }
+#endif
 
-        // Remove newline character if present
-        size_t len = strlen((char *)ctx.buffer);
-        if (len > 0 && ctx.buffer[len - 1] == '\n') {
-            ctx.buffer[len - 1] = '\0';  // Remove newline character from
-                                         // the input string
-        }
-        ctx.bufferlen = strlen((char *)ctx.buffer);  // Store the length
-                                                     // of the message
-
-        // Encrypt the message
-        if (crypto_aead_encrypt(ctx.encrypted_msg, &ctx.encrypted_msglen,
-                                ctx.buffer, ctx.bufferlen,
-                                ctx.npub,
-                                ctx.shared_secret) != 0) {
-          error("Encryption error");
+    // ====================================================================
+    // Begin encrypted message exchange loop
+    // ====================================================================
+    int sent = early;  // The first message already left as early data
+    while (1) {
+        // Get input from the user, encrypt it and send it
+        if (!typed) read_message(&ctx);
+        typed = 0;
+
+        // "/send <path>" streams a file; the server does not answer it,
+        // so the client types again
+        const char *path = file_command((char *)ctx.buffer);
+        if (path != NULL) {
+            int rc = file_send(ctx.sockfd, ctx.shared_secret, FILE_C2S,
+                               &ctx.file_tx, path, &ctx.zc);
+            if (rc == -1) printf("Cannot send %s\n", path);
+            if (rc == -2) error("Error sending file to server");
+            continue;
         }
 
-        // Send the encrypted message
-#ifdef _WIN32
-n = send(ctx.sockfd, (const char *)ctx.encrypted_msg,
-                 ctx.encrypted_msglen, 0);  // Send the encrypted message
-                                            // on Windows
-#else
-        n = write(ctx.sockfd, ctx.encrypted_msg, ctx.encrypted_msglen);
-// Send the encrypted message on Linux/Unix
-#endif
-        if (n < 0) error("Error writing to server");  // Check for errors
-                                                      // while sending
+        if (!sent) send_message(&ctx);
+        sent = 0;
 
         // If the client typed "bye", end the communication
         if (strcasecmp((char *)ctx.buffer, "bye") == 0) {
@@ -231,35 +519,36 @@ n = send(ctx.sockfd, (const char *)ctx.encrypted_msg,
             break;  // Break the loop if the client types "bye"
         }
 
-        // Receive the encrypted response from the server
-        memset(ctx.encrypted_msg, 0, sizeof(ctx.encrypted_msg));
-// Clear the encrypted message buffer
-#ifdef _WIN32
-n = recv(ctx.sockfd, (char *)ctx.encrypted_msg,
-             sizeof(ctx.encrypted_msg), 0);  //Receive the encrypted
-// response on Windows
-#else
-        n = read(ctx.sockfd, ctx.encrypted_msg,
-             sizeof(ctx.encrypted_msg));  // Receive the
-   // encrypted response on Linux/Unix
-#endif
+        // Receive the encrypted response from the server: read until a
+        // complete frame with a message has arrived, however TCP split
+        // or merged it (room keys are stored on the way)
+        Frame frame;
+        int opened = 0;
+        do {
+            n = frame_recv_chain(ctx.sockfd, &ctx.rx, &frame,
+                                 &ctx.rx_large, ctx.encrypted_msg,
+                                 sizeof(ctx.encrypted_msg), ctx.max_frame);
+            if (n == 1 && frame.type == FRAME_EARLY_REJECT) {
+                // The server did not take the early message: send it
+                // again, the reply follows (room_open_frame skips this
+                // frame type)
+                printf("Early message refused, sending it again\n");
+                send_message(&ctx);
+            }
+        } while (n == 1 && (opened = room_open_frame(&ctx, &frame)) == 0);
         if (n < 0) error("Error reading from server");
 // Check for  errors while receiving
-        ctx.encrypted_msglen = n;  // Store the actual length of the
-                                   // received data
-
-        // Decrypt the response
-        if (crypto_aead_decrypt(ctx.decrypted_msg, &ctx.decrypted_msglen,
-                                ctx.nsec,
-                                ctx.encrypted_msg, ctx.encrypted_msglen,
-                                ctx.npub, ctx.shared_secret) != 0) {
+        if (n == 0) {
+            printf("Server closed the connection.\n");
+            break;
+        }
 
+        // The response was decrypted (and null-terminated) while it was
+        // taken out of the frame
+        if (opened < 0) {
             error("Decryption error");
         }
 
-        ctx.decrypted_msg[ctx.decrypted_msglen] = '\0';  // Null-terminate
-                                                         // the decrypted
-                                                       // message
         printf("Server: %s\n", ctx.decrypted_msg);  // Print the decrypted
                                                     // response from
                                                   // the server
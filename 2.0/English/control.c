@@ -0,0 +1,80 @@
+#include "control.h"
+#include "ASCON/ascon.h"  // For crypto_xof() and the AEAD
+#include <string.h>       // For memcpy(), memset(), strlen()
+
+// ========================================================================
+// Helpers
+// ========================================================================
+
+// Nonce of control frame 'seq': seq (8) | "CTRL s2c"
+static void control_nonce(uint64_t seq, uint8_t nonce[16])
+{
+    for (int i = 0; i < 8; i++) nonce[i] = (uint8_t)(seq >> (8 * i));
+    memcpy(nonce + 8, "CTRL s2c", 8);
+}
+
+// Key of the frames of 'kind'
+static void control_key(const uint8_t *secret, size_t len, int kind,
+                        uint8_t key[CONTROL_KEY_SIZE])
+{
+    control_derive(kind == CONTROL_TICKET ? "ECC-code ticket frame"
+                                          : "ECC-code control",
+                   secret, len, key);
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+void control_derive(const char *label, const uint8_t *secret, size_t len,
+                    uint8_t key[CONTROL_KEY_SIZE])
+{
+    uint8_t buf[64];
+    size_t n = strlen(label);
+
+    if (len > sizeof(buf) - n) len = sizeof(buf) - n;
+    memcpy(buf, label, n);
+    memcpy(buf + n, secret, len);
+    crypto_xof(key, CONTROL_KEY_SIZE, buf, n + len);
+    memset(buf, 0, sizeof(buf));
+}
+
+size_t control_seal(const uint8_t *secret, size_t secret_len, int kind,
+                    uint64_t *seq, const uint8_t *plain, size_t len,
+                    uint8_t *out)
+{
+    uint8_t key[CONTROL_KEY_SIZE];
+    uint8_t nonce[16];
+    uint64_t clen = 0;
+
+    control_key(secret, secret_len, kind, key);
+    control_nonce(*seq, nonce);
+    memcpy(out, nonce, CONTROL_HEADER);
+    crypto_aead_encrypt(out + CONTROL_HEADER, &clen, plain, len, nonce,
+                        key);
+    memset(key, 0, sizeof(key));
+    (*seq)++;
+    return CONTROL_HEADER + (size_t)clen;
+}
+
+int control_open(const uint8_t *secret, size_t secret_len, int kind,
+                 uint64_t *next, const uint8_t *payload, size_t len,
+                 uint8_t *plain, uint64_t *plen)
+{
+    uint8_t key[CONTROL_KEY_SIZE];
+    uint8_t nonce[16];
+    uint64_t seq = 0;
+
+    if (len < CONTROL_HEADER + CONTROL_TAG_SIZE) return -1;
+    for (int i = 0; i < 8; i++) seq |= (uint64_t)payload[i] << (8 * i);
+    if (seq < *next || seq == UINT64_MAX) return -1;  // Seen already
+
+    control_key(secret, secret_len, kind, key);
+    control_nonce(seq, nonce);
+    int rc = crypto_aead_decrypt(plain, plen, NULL,
+                                 payload + CONTROL_HEADER,
+                                 len - CONTROL_HEADER, nonce, key);
+    memset(key, 0, sizeof(key));
+    if (rc != 0) return -1;
+    *next = seq + 1;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stdint.h>       // For uint8_t and other fixed-width types
+#include <stddef.h>       // For size_t
+
+// ========================================================================
+// Control frames
+// ========================================================================
+// Room keys, relay pair keys and tickets go from the server to the
+// client as control frames, under a key derived from the X25519 shared
+// secret for each kind of frame:
+//
+//   control key = Ascon-XOF128("ECC-code control" | secret)
+//   ticket key  = Ascon-XOF128("ECC-code ticket frame" | secret)
+//
+//   payload     = seq (8) | AEAD(key, seq (8) | "CTRL s2c", plain)
+//
+// 'seq' (little-endian) counts the control frames the server sent on the
+// connection, so no nonce repeats under a key, and the client refuses a
+// number lower than the next one it expects (replays). The session key
+// itself never seals a control frame. The ticket is sent in the clear
+// later (FRAME_RESUME); it is the only plaintext ever sealed under the
+// ticket key of its session, so knowing it opens nothing else.
+// ========================================================================
+
+#define CONTROL_KEY_SIZE 16           // ASCON-128a key
+#define CONTROL_HEADER 8              // seq in front of the ciphertext
+#define CONTROL_TAG_SIZE 16           // ASCON-128a tag after it
+
+#define CONTROL_KEYS 0                // Kinds: room and pair keys,
+#define CONTROL_TICKET 1              // FRAME_TICKET
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Ascon-XOF128(label | secret), truncated to a key. Also derives the
+// keys of other frames kept off the session key (file.h).
+void control_derive(const char *label, const uint8_t *secret, size_t len,
+                    uint8_t key[CONTROL_KEY_SIZE]);
+
+// Seals 'len' bytes of 'plain' of 'kind' into 'out' (CONTROL_HEADER +
+// len + CONTROL_TAG_SIZE bytes) under frame number '*seq', which moves
+// on. Returns the payload length.
+size_t control_seal(const uint8_t *secret, size_t secret_len, int kind,
+                    uint64_t *seq, const uint8_t *plain, size_t len,
+                    uint8_t *out);
+
+// Opens a control payload into 'plain' (len - CONTROL_HEADER -
+// CONTROL_TAG_SIZE bytes). '*next' is the lowest frame number still
+// accepted and moves past the frame. Returns 0, or -1 if the payload is
+// short, replayed or does not authenticate.
+int control_open(const uint8_t *secret, size_t secret_len, int kind,
+                 uint64_t *next, const uint8_t *payload, size_t len,
+                 uint8_t *plain, uint64_t *plen);
+
+#endif // CONTROL_H
@@ -0,0 +1,49 @@
+#include "dispatch.h"
+#include "drng.h"         // For drng_source()
+
+// ========================================================================
+// Kernel names
+// ========================================================================
+
+// Same tests, in the same order, as the resolvers GCC generates for
+// DISPATCH_CLONES
+const char *dispatch_kernel(void)
+{
+#ifdef HAVE_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v4")) return "x86-64-v4 (AVX-512)";
+    if (__builtin_cpu_supports("x86-64-v3")) return "x86-64-v3 (AVX2)";
+    return "default (scalar)";
+#else
+    return "default (scalar, no dispatch in this build)";
+#endif
+}
+
+// ========================================================================
+// --print-dispatch
+// ========================================================================
+void dispatch_print(FILE *out)
+{
+#ifdef HAVE_DISPATCH
+    // __builtin_cpu_supports() only takes a string literal
+#define DISPATCH_FEATURE(name) \
+    if (__builtin_cpu_supports(name)) fprintf(out, " %s", name)
+
+    __builtin_cpu_init();
+    fprintf(out, "CPU features:");
+    DISPATCH_FEATURE("avx2");
+    DISPATCH_FEATURE("bmi2");
+    DISPATCH_FEATURE("fma");
+    DISPATCH_FEATURE("avx512f");
+    DISPATCH_FEATURE("avx512dq");
+    DISPATCH_FEATURE("avx512vl");
+    DISPATCH_FEATURE("adx");
+    DISPATCH_FEATURE("rdrnd");
+    DISPATCH_FEATURE("rdseed");
+    fprintf(out, "\n");
+#endif
+    const char *kernel = dispatch_kernel();
+    fprintf(out, "X25519 field arithmetic (ECC.c)   %s\n", kernel);
+    fprintf(out, "Ascon AEAD (ASCON/aead.c)         %s\n", kernel);
+    fprintf(out, "Random bytes (drng.c)             %s\n", drng_source());
+}
@@ -0,0 +1,54 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stdio.h>        // For FILE
+
+// ========================================================================
+// Runtime CPU dispatch of the crypto kernels
+// ========================================================================
+// One binary runs on every x86-64 server, from the oldest without AVX2
+// to those with AVX-512. A function marked DISPATCH_CLONES is compiled
+// three times, for x86-64-v4 (AVX-512), x86-64-v3 (AVX2, BMI2, FMA) and
+// the baseline, with every function it calls inlined into each copy
+// (flatten). An IFUNC resolver picks the copy for the CPU once, when
+// the dynamic linker loads the program (-z now); calls then go straight
+// to it.
+//
+//     DISPATCH_CLONES
+//     int crypto_scalarmult(uint8_t *q, const uint8_t *n,
+//                           const uint8_t *p)
+//
+// Marked: crypto_scalarmult() (the field arithmetic of ECC.c, inlined)
+// and the Ascon AEAD functions (the permutation of word.h, inlined).
+// The DRNG path (drng.c) has a resolver of its own: RDRAND, or the
+// getrandom() system call on CPUs without a working RDRAND.
+//
+// ./server --print-dispatch (or ./client) lists the choices. Needs GCC
+// 12 on x86-64 Linux; elsewhere, and with make DISPATCH=0 (NO_DISPATCH),
+// only the baseline is built.
+// ========================================================================
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(__clang__) && \
+    defined(__GNUC__) && __GNUC__ >= 12 && !defined(NO_DISPATCH)
+#define HAVE_DISPATCH 1
+#define DISPATCH_CLONES                                                 \
+    __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3",  \
+                                 "default"), flatten))
+#else
+#define DISPATCH_CLONES
+#endif
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Name of the copy the resolvers of DISPATCH_CLONES pick on this CPU
+const char *dispatch_kernel(void);
+
+// Prints the CPU features and the kernel of every family to 'out'
+void dispatch_print(FILE *out);
+
+#endif // DISPATCH_H
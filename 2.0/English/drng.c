@@ -1,4 +1,53 @@
 #include "drng.h"
+#include "probes.h"   // For the rdrand_* USDT probes
+#include "dispatch.h" // For HAVE_DISPATCH
+#include <pthread.h>  // For the periodic statistics dump thread
+#include <time.h>     // For nanosleep in the dump thread
+
+// ========================================================================
+// Statistics storage: one cache-line aligned slot per group of threads
+// ========================================================================
+#ifndef DRNG_NO_STATS
+typedef struct {
+    DrngStats s;
+} __attribute__((aligned(64))) DrngStatSlot;
+
+static DrngStatSlot drng_slots[DRNG_STAT_SLOTS];  // Counter slots
+static unsigned int drng_next_slot = 0;           // Round-robin slot
+                                                  // assignment
+static __thread int drng_slot = -1;               // Slot of this thread
+
+// Returns the counter slot of the calling thread, assigning one on the
+// first call
+static inline DrngStats *drng_my_stats(void)
+{
+    if (drng_slot < 0) {
+        drng_slot = (int)(__atomic_fetch_add(&drng_next_slot, 1,
+                                             __ATOMIC_RELAXED)
+                          % DRNG_STAT_SLOTS);
+    }
+    return &drng_slots[drng_slot].s;
+}
+
+// Relaxed atomic add: the slot is normally private to one thread, the
+// atomic only matters when more than DRNG_STAT_SLOTS threads share it
+#define DRNG_ADD(field, v) \
+    __atomic_fetch_add(&(field), (uint64_t)(v), __ATOMIC_RELAXED)
+
+// Reads the time-stamp counter (cycles since reset)
+static inline uint64_t drng_rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Index of the highest set bit, used as histogram bucket
+static inline unsigned int drng_log2(uint64_t v)
+{
+    return v ? 63u - (unsigned int)__builtin_clzll(v) : 0u;
+}
+#endif
 
 // ========================================================================
 // RDRAND primitives: functions for generating random numbers
@@ -40,20 +89,43 @@ int rdrand64_step(uint64_t *rand)
 int rdrand64_retry(unsigned int retries, uint64_t *rand)
 {
     unsigned int count = 0;
+    int ok = 0;
+#ifndef DRNG_NO_STATS
+    uint64_t start = drng_rdtsc();  // Cycle count before the draw
+#endif
 
     // Retry until the limit is reached
     while (count <= retries) {
         if (rdrand64_step(rand)) {
-            return 1;  // Success
+            ok = 1;  // Success
+            break;
         }
         ++count;
     }
 
-    return 0;  // Failed after all attempts
+#ifndef DRNG_NO_STATS
+    // Account the draw: every failed attempt before the last one is a
+    // retry, a draw without success is a failure
+    uint64_t cycles = drng_rdtsc() - start;
+    DrngStats *st = drng_my_stats();
+    DRNG_ADD(st->calls, 1);
+    DRNG_ADD(st->cycles, cycles);
+    unsigned int bucket = drng_log2(cycles);
+    if (bucket >= DRNG_HIST_BUCKETS) bucket = DRNG_HIST_BUCKETS - 1;
+    DRNG_ADD(st->hist[bucket], 1);
+    if (ok) {
+        if (count) DRNG_ADD(st->retries, count);
+    } else {
+        DRNG_ADD(st->retries, retries);
+        DRNG_ADD(st->failures, 1);
+    }
+#endif
+
+    return ok;  // 1 on success, 0 if all attempts failed
 }
 
 // ========================================================================
-// Function: rdrand_get_bytes
+// Function: rdrand_fill
 // Purpose: Retrieves `n` random bytes using 64-bit values from RDRAND.
 // Parameters:
 //   - n: number of bytes to generate
@@ -61,7 +133,7 @@ int rdrand64_retry(unsigned int retries, uint64_t *rand)
 // Returns:
 //   - the number of bytes actually retrieved (may be < n on error)
 // ========================================================================
-unsigned int rdrand_get_bytes(uint32_t n, uint8_t *dest)
+static unsigned int rdrand_fill(uint32_t n, uint8_t *dest)
 {
     uint8_t *headstart;       // start of the buffer (possibly
                                     // unaligned)
@@ -127,6 +199,228 @@ unsigned int rdrand_get_bytes(uint32_t n, uint8_t *dest)
         memcpy(tailstart, &temprand, ltail);
     }
 
+#ifndef DRNG_NO_STATS
+    DRNG_ADD(drng_my_stats()->bytes, n);
+#endif
+
     // Successfully generated all 'n' bytes
     return n;
 }
+
+#ifdef HAVE_DISPATCH
+#include <sys/random.h>  // For getrandom()
+#include <errno.h>       // For EINTR
+
+// Set by drng_resolve(), which runs while the program is still being
+// relocated: a plain int, no pointer to relocate, no TLS
+static int drng_getrandom = 0;
+
+// ========================================================================
+// Function: getrandom_fill
+// Purpose: Same contract as rdrand_fill(), from the kernel's random
+//          number generator, for CPUs without a working RDRAND.
+// ========================================================================
+static unsigned int getrandom_fill(uint32_t n, uint8_t *dest)
+{
+    uint32_t got = 0;
+
+    while (got < n) {
+        ssize_t r = getrandom(dest + got, n - got, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) break;  // No entropy source: a short count
+        got += (uint32_t)r;
+    }
+#ifndef DRNG_NO_STATS
+    DRNG_ADD(drng_my_stats()->bytes, got);
+#endif
+    return got;
+}
+
+// One RDRAND draw with retries, without the statistics of
+// rdrand64_retry() (no thread slot exists yet in the resolver)
+static int drng_draw(uint64_t *v)
+{
+    for (int i = 0; i <= RDRAND_RETRIES; i++) {
+        if (rdrand64_step(v)) return 1;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Function: drng_resolve
+// Purpose: IFUNC resolver of drng_fill(), run once by the dynamic
+//          linker. RDRAND is kept only if CPUID lists it and two draws
+//          succeed without both returning all ones (some AMD parts
+//          report success with 0xFFFFFFFFFFFFFFFF after a resume).
+// ========================================================================
+static unsigned int (*drng_resolve(void))(uint32_t, uint8_t *)
+{
+    uint64_t a = 0, b = 0;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("rdrnd") && drng_draw(&a) &&
+        drng_draw(&b) && (a != ~0ull || b != ~0ull)) {
+        return rdrand_fill;
+    }
+    drng_getrandom = 1;
+    return getrandom_fill;
+}
+
+static unsigned int drng_fill(uint32_t n, uint8_t *dest)
+    __attribute__((ifunc("drng_resolve")));
+#else
+static const int drng_getrandom = 0;
+#define drng_fill rdrand_fill
+#endif
+
+// ========================================================================
+// Function: drng_source
+// Purpose: Names the source of rdrand_get_bytes() ("rdrand" or
+//          "getrandom").
+// ========================================================================
+const char *drng_source(void)
+{
+    return drng_getrandom ? "getrandom" : "rdrand";
+}
+
+// ========================================================================
+// Function: rdrand_get_bytes
+// Purpose: drng_fill() between the rdrand_entry and rdrand_return
+//          USDT probes.
+// ========================================================================
+unsigned int rdrand_get_bytes(uint32_t n, uint8_t *dest)
+{
+    ECC_PROBE1(rdrand_entry, n);
+    unsigned int got = drng_fill(n, dest);
+    ECC_PROBE2(rdrand_return, n, got);
+    return got;
+}
+
+// ========================================================================
+// Function: drng_stats_get
+// Purpose: Sums the per-thread counter slots into one snapshot.
+// ========================================================================
+void drng_stats_get(DrngStats *out)
+{
+    memset(out, 0, sizeof(*out));
+#ifndef DRNG_NO_STATS
+    for (int i = 0; i < DRNG_STAT_SLOTS; i++) {
+        const DrngStats *s = &drng_slots[i].s;
+        out->calls    += __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+        out->bytes    += __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+        out->retries  += __atomic_load_n(&s->retries, __ATOMIC_RELAXED);
+        out->failures += __atomic_load_n(&s->failures, __ATOMIC_RELAXED);
+        out->cycles   += __atomic_load_n(&s->cycles, __ATOMIC_RELAXED);
+        for (int b = 0; b < DRNG_HIST_BUCKETS; b++) {
+            out->hist[b] += __atomic_load_n(&s->hist[b],
+                                            __ATOMIC_RELAXED);
+        }
+    }
+#endif
+}
+
+// ========================================================================
+// Function: drng_stats_reset
+// Purpose: Clears all counters (e.g. between benchmark runs).
+// ========================================================================
+void drng_stats_reset(void)
+{
+#ifndef DRNG_NO_STATS
+    for (int i = 0; i < DRNG_STAT_SLOTS; i++) {
+        DrngStats *s = &drng_slots[i].s;
+        __atomic_store_n(&s->calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->retries, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->failures, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->cycles, 0, __ATOMIC_RELAXED);
+        for (int b = 0; b < DRNG_HIST_BUCKETS; b++) {
+            __atomic_store_n(&s->hist[b], 0, __ATOMIC_RELAXED);
+        }
+    }
+#endif
+}
+
+// ========================================================================
+// Function: drng_stats_print
+// Purpose: Prints counters, average cost and the non-empty histogram
+// buckets together with the approximate p50/p99 bucket.
+// ========================================================================
+void drng_stats_print(FILE *out, const DrngStats *st)
+{
+    DrngStats now;
+    if (st == NULL) {
+        drng_stats_get(&now);  // No snapshot given: take a fresh one
+        st = &now;
+    }
+
+    fprintf(out, "DRNG: calls=%llu bytes=%llu retries=%llu "
+            "failures=%llu avg_cycles=%llu\n",
+            (unsigned long long)st->calls,
+            (unsigned long long)st->bytes,
+            (unsigned long long)st->retries,
+            (unsigned long long)st->failures,
+            (unsigned long long)(st->calls ? st->cycles / st->calls : 0));
+    if (st->calls == 0) return;
+
+    // Walk the buckets once to find the percentiles and print the
+    // non-empty ones
+    uint64_t seen = 0;
+    int p50 = -1, p99 = -1;
+    for (int b = 0; b < DRNG_HIST_BUCKETS; b++) {
+        if (st->hist[b] == 0) continue;
+        seen += st->hist[b];
+        if (p50 < 0 && seen * 2 >= st->calls) p50 = b;
+        if (p99 < 0 && seen * 100 >= st->calls * 99) p99 = b;
+        fprintf(out, "  [%10llu, %10llu) cycles: %llu\n",
+                1ULL << b, 1ULL << (b + 1),
+                (unsigned long long)st->hist[b]);
+    }
+    fprintf(out, "  p50 < %llu cycles, p99 < %llu cycles\n",
+            1ULL << (p50 + 1), 1ULL << (p99 + 1));
+}
+
+// ========================================================================
+// Periodic dump thread
+// ========================================================================
+static pthread_t drng_dump_thread;          // Dump thread handle
+static volatile int drng_dump_running = 0;  // Set while the thread runs
+static unsigned int drng_dump_interval = 0; // Seconds between dumps
+
+// Thread body: sleeps in 100 ms steps so that stop is quick, prints the
+// counters every 'drng_dump_interval' seconds
+static void *drng_dump_main(void *arg)
+{
+    (void)arg;
+    struct timespec step = {0, 100 * 1000 * 1000};
+    unsigned int ticks = 0;
+
+    while (drng_dump_running) {
+        nanosleep(&step, NULL);
+        if (++ticks >= drng_dump_interval * 10) {
+            ticks = 0;
+            drng_stats_print(stderr, NULL);
+        }
+    }
+    return NULL;
+}
+
+int drng_stats_start_dump(unsigned int interval_sec)
+{
+    if (drng_dump_running || interval_sec == 0) return -1;
+
+    drng_dump_interval = interval_sec;
+    drng_dump_running = 1;
+    if (pthread_create(&drng_dump_thread, NULL, drng_dump_main, NULL)
+        != 0) {
+        drng_dump_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void drng_stats_stop_dump(void)
+{
+    if (!drng_dump_running) return;
+    drng_dump_running = 0;
+    pthread_join(drng_dump_thread, NULL);
+}
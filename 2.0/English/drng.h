@@ -19,6 +19,7 @@
 #include <stdint.h>  /* Provides standard integer types (e.g., uint64_t,
                         uint32_t, etc.) */
 #include <string.h>  /* For memory-related functions like memcpy */
+#include <stdio.h>   /* For FILE used by the statistics dump */
 
 // ========================================================================
 //   RDRAND Retries
@@ -65,4 +66,53 @@ int rdrand64_retry(uint32_t retries, uint64_t *rand);
 // Function for generating multiple random bytes
 unsigned int rdrand_get_bytes(uint32_t n, uint8_t *dest);
 
+/* With runtime dispatch (dispatch.h), CPUs without a working RDRAND get
+   their bytes from getrandom() instead. Returns "rdrand" or
+   "getrandom". */
+const char *drng_source(void);
+
+// ========================================================================
+//   Health-Test and Throughput Statistics
+// ========================================================================
+
+/* Every call of rdrand64_retry is counted: how many 64-bit draws were
+   requested, how many extra RDRAND attempts (retries) were needed, how
+   many draws failed after RDRAND_RETRIES attempts and how many CPU
+   cycles (rdtsc) a draw took. Counters live in per-thread slots padded
+   to a cache line, so concurrent callers do not fight over one line.
+   Define DRNG_NO_STATS at compile time to remove the instrumentation. */
+
+// Number of power-of-two buckets in the cycles-per-call histogram:
+// bucket i counts draws that took [2^i, 2^(i+1)) cycles
+#define DRNG_HIST_BUCKETS 32
+
+// Number of independent counter slots (threads are spread over them)
+#define DRNG_STAT_SLOTS 64
+
+typedef struct {
+    uint64_t calls;      // rdrand64_retry invocations (64-bit draws)
+    uint64_t bytes;      // bytes delivered by rdrand_get_bytes
+    uint64_t retries;    // extra RDRAND attempts after an underflow
+    uint64_t failures;   // draws that failed after all retries
+    uint64_t cycles;     // total cycles spent in rdrand64_retry
+    uint64_t hist[DRNG_HIST_BUCKETS];  // cycles-per-call histogram
+} DrngStats;
+
+// Sum all counter slots into 'out'
+void drng_stats_get(DrngStats *out);
+
+// Reset all counters to zero
+void drng_stats_reset(void);
+
+// Print a human-readable report of 'st' (or of the current counters if
+// 'st' is NULL) to 'out'
+void drng_stats_print(FILE *out, const DrngStats *st);
+
+// Start a background thread that prints the counters every
+// 'interval_sec' seconds to stderr. Returns 0 on success, -1 on error.
+int drng_stats_start_dump(unsigned int interval_sec);
+
+// Stop the periodic dump started by drng_stats_start_dump
+void drng_stats_stop_dump(void);
+
 #endif  /* __DRNG__H */
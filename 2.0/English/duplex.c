@@ -0,0 +1,387 @@
+#include "duplex.h"
+#include "room.h"         // For room messages and keys
+#include "relay.h"        // For relay pair keys
+
+#ifndef _WIN32
+
+#include <errno.h>        // For errno, EINTR, EPROTO
+#include <poll.h>         // For poll()
+#include <pthread.h>      // For the file sender thread
+
+// ========================================================================
+// State of the outgoing side
+// ========================================================================
+typedef struct {
+    uint8_t *line;                 // Line typed so far
+    size_t line_cap;               // Bytes allocated for it
+    size_t line_max;               // Longest line sent as one message
+    size_t line_len;               // Valid bytes in line
+    uint8_t tx[DUPLEX_TX_SIZE];    // Encrypted frames not yet written
+    size_t tx_len;                 // Valid bytes in tx
+    int done;                      // "bye" was sent
+
+    // "/send": a thread owns the socket for writing while the loop keeps
+    // reading, so two peers sending at once cannot block each other
+    pthread_t file_thread;
+    int file_active;               // A file is being sent
+    int file_wake[2];              // Pipe written when it has left
+    int file_fd;                   // Arguments and result of file_send()
+    const uint8_t *file_secret;
+    int file_dir;
+    uint32_t *file_id;
+    ZcSocket *file_zc;
+    char file_path[FILENAME_MAX];
+    int file_rc;
+} DuplexOutput;
+
+// ========================================================================
+// Helper: write a whole buffer to the (blocking) socket
+// ========================================================================
+static int duplex_write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int duplex_flush(int fd, DuplexOutput *out)
+{
+    if (out->file_active) return 0;  // Kept until the file has left
+
+    int rc = duplex_write_all(fd, out->tx, out->tx_len);
+    out->tx_len = 0;
+    return rc;
+}
+
+// ========================================================================
+// File sender thread
+// ========================================================================
+static void *duplex_file_main(void *arg)
+{
+    DuplexOutput *out = arg;
+    uint8_t one = 1;
+
+    out->file_rc = file_send(out->file_fd, out->file_secret, out->file_dir,
+                             out->file_id, out->file_path, out->file_zc);
+    while (write(out->file_wake[1], &one, 1) < 0 && errno == EINTR) {
+    }
+    return NULL;
+}
+
+// Waits for the file being sent, then writes the messages typed meanwhile
+static int duplex_file_wait(int fd, DuplexOutput *out)
+{
+    uint8_t byte;
+
+    if (!out->file_active) return 0;
+    pthread_join(out->file_thread, NULL);
+    while (read(out->file_wake[0], &byte, 1) < 0 && errno == EINTR) {
+    }
+    out->file_active = 0;
+    if (out->file_rc == -1) printf("Cannot send %s\n", out->file_path);
+    if (out->file_rc == -2) return -1;
+    return duplex_flush(fd, out);
+}
+
+// ========================================================================
+// Encrypt one message and append it to the batch as a frame
+// ========================================================================
+static int duplex_queue(ClientServerContext *ctx, int fd,
+                        DuplexOutput *out, const uint8_t *msg, size_t len)
+{
+    uint64_t clen = 0;
+    size_t flen = FRAME_HEADER_MAX + 1 + len + TAG_SIZE;
+    if (ctx->relay_valid) flen += RELAY_HEADER;  // pair | seq
+
+    // A FRAME_REKEY goes in front when the session key is replaced
+    int rekey = !ctx->relay_valid &&
+                ratchet_due(&ctx->ratchet.tx, &ctx->rekey);
+    if (rekey) flen += FRAME_HEADER_MAX + 1 + RATCHET_REKEY_SIZE;
+
+    // "/send <path>": the messages typed before it leave first, then the
+    // file, from its own thread (one file at a time)
+    if (len > 6 && len - 6 < sizeof(out->file_path) &&
+        memcmp(msg, "/send ", 6) == 0) {
+        if (duplex_file_wait(fd, out) < 0 || duplex_flush(fd, out) < 0) {
+            return -1;
+        }
+        memcpy(out->file_path, msg + 6, len - 6);
+        out->file_path[len - 6] = '\0';
+        out->file_fd = fd;
+        out->file_secret = ctx->shared_secret;
+        out->file_dir = ctx->file_dir;
+        out->file_id = &ctx->file_tx;
+        out->file_zc = &ctx->zc;
+        if (pthread_create(&out->file_thread, NULL, duplex_file_main,
+                           out) != 0) {
+            return -1;
+        }
+        out->file_active = 1;
+        return 0;
+    }
+
+    // Messages typed during a transfer wait in the batch; a full batch
+    // waits for the file
+    if (out->file_active && out->tx_len + flen > sizeof(out->tx) &&
+        duplex_file_wait(fd, out) < 0) {
+        return -1;
+    }
+
+    // Write the batch first if the frame would not fit behind it
+    if (out->tx_len + flen > sizeof(out->tx) &&
+        duplex_flush(fd, out) < 0) {
+        return -1;
+    }
+
+    if (flen > sizeof(out->tx)) {
+        // Larger than a batch: encrypted into segments and sent alone
+        if (relay_send(ctx, fd, msg, len) < 0) return -1;
+    } else if (ctx->relay_valid) {
+        // To a relay peer, under the pair key
+        out->tx_len += relay_seal(ctx, out->tx + out->tx_len, msg, len);
+    } else {
+        RatchetKey *tx = &ctx->ratchet.tx;
+        uint8_t nonce[RATCHET_NONCE_SIZE];
+        if (rekey) {
+            size_t hlen = frame_encode_header(out->tx + out->tx_len,
+                                              FRAME_REKEY,
+                                              RATCHET_REKEY_SIZE);
+            ratchet_rekey(tx, out->tx + out->tx_len + hlen);
+            out->tx_len += hlen + RATCHET_REKEY_SIZE;
+        }
+        ratchet_nonce(tx, nonce);
+        ratchet_count(tx, len);
+
+        size_t hlen = frame_encode_header(out->tx + out->tx_len,
+                                          FRAME_DATA, len + TAG_SIZE);
+        uint64_t t = trace_begin();
+        int rc = crypto_aead_encrypt(out->tx + out->tx_len + hlen, &clen,
+                                     msg, len, nonce, tx->key);
+        trace_end(TRACE_ENCRYPT, t);
+        if (rc != 0) return -1;
+        metrics_add(METRIC_ENCRYPTED_BYTES, len);
+        out->tx_len += hlen + clen;
+    }
+
+    // Check if we want to end the conversation
+    if (len == 3 && strncasecmp((const char *)msg, "bye", 3) == 0) {
+        printf("You ended the conversation.\n");
+        out->done = 1;
+    }
+    return 0;
+}
+
+// ========================================================================
+// stdin is readable: split the input into lines and send each of them
+// ========================================================================
+static int duplex_on_stdin(ClientServerContext *ctx, int fd,
+                           DuplexOutput *out)
+{
+    uint8_t input[BUFFER_SIZE];
+    ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    if (n == 0) {
+        // End of input: send what is left of the line, then say goodbye
+        if (out->line_len > 0 &&
+            duplex_queue(ctx, fd, out, out->line, out->line_len) < 0) {
+            return -1;
+        }
+        printf("End of input.\n");
+        if (!out->done &&
+            duplex_queue(ctx, fd, out, (const uint8_t *)"bye", 3) < 0) {
+            return -1;
+        }
+        return duplex_flush(fd, out);
+    }
+
+    for (ssize_t i = 0; i < n && !out->done; i++) {
+        if (input[i] == '\n') {
+            // Remove a carriage return left by a Windows terminal
+            if (out->line_len > 0 && out->line[out->line_len - 1] == '\r')
+                out->line_len--;
+            if (duplex_queue(ctx, fd, out, out->line, out->line_len) < 0)
+                return -1;
+            out->line_len = 0;
+            continue;
+        }
+        if (out->line_len == out->line_cap) {
+            // Grow the line up to the longest message
+            size_t cap = out->line_cap * 2;
+            if (cap > out->line_max) cap = out->line_max;
+            uint8_t *line = realloc(out->line, cap);
+            if (line == NULL) return -1;
+            out->line = line;
+            out->line_cap = cap;
+        }
+        out->line[out->line_len++] = input[i];
+        if (out->line_len == out->line_max) {
+            // Line longer than one message: send the part typed so far
+            if (duplex_queue(ctx, fd, out, out->line, out->line_len) < 0)
+                return -1;
+            out->line_len = 0;
+        }
+    }
+
+    // Every line of this read leaves in one write
+    return duplex_flush(fd, out);
+}
+
+// ========================================================================
+// Socket is readable: print every complete frame that has arrived
+// Returns 1 to keep going, 0 when the peer ended, -1 on error
+// ========================================================================
+static int duplex_on_socket(ClientServerContext *ctx, int fd,
+                            const DuplexOutput *out, const char *peer)
+{
+    Frame frame;
+    int rc;
+    int n;
+
+    // The rest of a large frame goes straight into its segments, all
+    // other bytes into the ring
+    if (ctx->rx_large.active) n = chain_rx_read(fd, &ctx->rx_large);
+    else n = frame_buffer_fill(fd, &ctx->rx);
+    if (n < 0) return errno == EINTR ? 1 : -1;
+    if (n == 0) {
+        printf("%s closed the connection.\n", peer);
+        return 0;
+    }
+
+    for (;;) {
+        if (!ctx->rx_large.active) {
+            rc = chain_rx_start(&ctx->rx_large, &ctx->rx,
+                                sizeof(ctx->encrypted_msg), ctx->max_frame);
+            if (rc < 0) break;
+        }
+        if (ctx->rx_large.active) {
+            if (!chain_rx_complete(&ctx->rx_large)) return 1;
+            chain_rx_frame(&ctx->rx_large, &frame);
+        } else {
+            rc = frame_pop(&ctx->rx, &frame, ctx->encrypted_msg,
+                           sizeof(ctx->encrypted_msg),
+                           sizeof(ctx->encrypted_msg));
+            if (rc != 1) break;
+        }
+
+        // The event loop checks that we are still there. While a file is
+        // sent its thread owns the socket, and its frames answer for us.
+        if (frame.type == FRAME_KEEPALIVE) {
+            if (!out->file_active &&
+                frame_send(fd, FRAME_KEEPALIVE, NULL, 0) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        // Files sent with "/send" are stored on the way; they come the
+        // other way round from ours
+        if (file_is_frame(frame.type)) {
+            int dir = ctx->file_dir == FILE_C2S ? FILE_S2C : FILE_C2S;
+            if (file_rx_frame(&ctx->files, ctx->shared_secret, dir,
+                              &frame) != 0) {
+                errno = EPROTO;
+                return -1;
+            }
+            continue;
+        }
+
+        // Messages of the peer or of a room; room keys are only stored
+        int opened = room_open_frame(ctx, &frame);
+        if (opened == 0) continue;
+        if (opened < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        printf("%s: %s\n", peer, ctx->decrypted_msg);
+
+        // Check if the peer wants to end the conversation
+        if (strcasecmp((char *)ctx->decrypted_msg, "bye") == 0) {
+            printf("%s ended the conversation.\n", peer);
+            return 0;
+        }
+    }
+    if (rc < 0) {
+        errno = EPROTO;  // Malformed or oversized frame
+        return -1;
+    }
+    return 1;
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int chat_duplex(ClientServerContext *ctx, int fd, const char *peer)
+{
+    DuplexOutput out;
+    struct pollfd fds[3];
+    int rc = 0;
+
+    out.line_cap = BUFFER_SIZE;
+    out.line_max = ctx->max_frame - TAG_SIZE;
+    out.line = malloc(out.line_cap);
+    out.line_len = 0;
+    out.tx_len = 0;
+    out.done = 0;
+    out.file_active = 0;
+    if (out.line == NULL) return -1;
+    if (pipe(out.file_wake) != 0) {
+        free(out.line);
+        return -1;
+    }
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = out.file_wake[0];     // The file being sent has left
+    fds[2].events = POLLIN;
+
+    printf("Full-duplex mode: type messages at any time, "
+           "\"bye\" to quit.\n");
+
+    while (!out.done) {
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            rc = -1;
+            break;
+        }
+
+        // Incoming messages first, so they are shown before our
+        // "bye" closes the conversation
+        // While a file is sent, POLLERR may only announce completions of
+        // its zero-copy sends (read by the sender thread); a socket error
+        // also ends the transfer
+        short errs = out.file_active ? 0 : POLLERR;
+        if (fds[1].revents & (POLLIN | POLLHUP | errs)) {
+            rc = duplex_on_socket(ctx, fd, &out, peer);
+            if (rc <= 0) break;
+            rc = 0;
+        }
+        if ((fds[2].revents & POLLIN) && duplex_file_wait(fd, &out) < 0) {
+            rc = -1;
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (duplex_on_stdin(ctx, fd, &out) < 0) {
+                rc = -1;
+                break;
+            }
+        }
+    }
+
+    // A file still being sent leaves before the conversation ends (with
+    // the messages typed meanwhile, and our "bye")
+    if (duplex_file_wait(fd, &out) < 0) rc = -1;
+    close(out.file_wake[0]);
+    close(out.file_wake[1]);
+    free(out.line);
+    return rc;
+}
+
+#endif // _WIN32
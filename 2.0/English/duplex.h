@@ -0,0 +1,35 @@
+#ifndef DUPLEX_H
+#define DUPLEX_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For ClientServerContext and the frame layer
+
+// ========================================================================
+// Full-duplex chat
+// ========================================================================
+// In the classic mode each side waits for the reply of its peer before it
+// may type again. In full-duplex mode stdin and the socket are watched
+// with poll(): every line typed is encrypted and sent at once (all lines
+// of one read leave in a single write), and every frame received is
+// decrypted and printed as soon as it arrives.
+//
+// Not available on Windows, where poll() cannot watch the console.
+
+#ifndef _WIN32
+#define DUPLEX_TX_SIZE 8192                      // Frames batched from
+                                                 // one read of stdin;
+                                                 // larger messages are
+                                                 // sent on their own
+
+// Runs the chat on the connected socket 'fd' with the shared secret and
+// nonce of 'ctx'. Lines longer than ctx->max_frame allows are split.
+// 'peer' names the other side in the output ("Client" or
+// "Server"). Returns 0 when either side ended the conversation (typing
+// "bye", closing the connection or the end of stdin) and -1 on a socket,
+// encryption or decryption error.
+int chat_duplex(ClientServerContext *ctx, int fd, const char *peer);
+#endif
+
+#endif // DUPLEX_H
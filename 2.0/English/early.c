@@ -0,0 +1,175 @@
+#include "early.h"
+#include "room.h"         // For room_store32 and room_load32
+
+static const uint8_t early_label[NONCE_SIZE - EARLY_HEADER] = "0-RTT";
+
+// ========================================================================
+// Nonce of an early message: its send time (little-endian) | "0-RTT"
+// ========================================================================
+static void early_nonce(uint8_t nonce[NONCE_SIZE],
+                        const uint8_t header[EARLY_HEADER])
+{
+    memcpy(nonce, header, EARLY_HEADER);
+    memcpy(nonce + EARLY_HEADER, early_label, sizeof(early_label));
+}
+
+// ========================================================================
+// Anti-replay window
+// ========================================================================
+int early_window_init(ReplayWindow *w)
+{
+    memset(w, 0, sizeof(*w));
+#ifndef _WIN32
+    if (pthread_mutex_init(&w->lock, NULL) != 0) return -1;
+#endif
+    w->slots[0] = calloc(EARLY_REPLAY_SLOTS, EARLY_REPLAY_ID);
+    w->slots[1] = calloc(EARLY_REPLAY_SLOTS, EARLY_REPLAY_ID);
+    if (w->slots[0] == NULL || w->slots[1] == NULL) {
+        early_window_free(w);
+        return -1;
+    }
+    w->start = time(NULL);
+    return 0;
+}
+
+void early_window_free(ReplayWindow *w)
+{
+    free(w->slots[0]);
+    free(w->slots[1]);
+    w->slots[0] = w->slots[1] = NULL;
+#ifndef _WIN32
+    pthread_mutex_destroy(&w->lock);
+#endif
+}
+
+// Starts a new generation when the current one is EARLY_WINDOW old
+// (called with the lock held)
+static void early_window_advance(ReplayWindow *w, time_t now)
+{
+    if (now - w->start < EARLY_WINDOW) return;
+
+    // The previous generation is forgotten, the current one becomes the
+    // previous one (unless it is too old to matter as well)
+    uint8_t *t = w->slots[1];
+    w->slots[1] = w->slots[0];
+    w->used[1] = w->used[0];
+    w->slots[0] = t;
+    memset(w->slots[0], 0, EARLY_REPLAY_SLOTS * EARLY_REPLAY_ID);
+    w->used[0] = 0;
+    if (now - w->start >= 2 * EARLY_WINDOW) {
+        memset(w->slots[1], 0, EARLY_REPLAY_SLOTS * EARLY_REPLAY_ID);
+        w->used[1] = 0;
+    }
+    w->start = now;
+}
+
+// Returns the slot of 'id' in generation 'g', or of the free slot where
+// it would go
+static uint8_t *early_window_find(ReplayWindow *w, int g, const uint8_t *id)
+{
+    static const uint8_t empty[EARLY_REPLAY_ID];
+    size_t i = room_load32(id) & (EARLY_REPLAY_SLOTS - 1);
+
+    for (;;) {
+        uint8_t *slot = w->slots[g] + i * EARLY_REPLAY_ID;
+        if (memcmp(slot, id, EARLY_REPLAY_ID) == 0 ||
+            memcmp(slot, empty, EARLY_REPLAY_ID) == 0) {
+            return slot;
+        }
+        i = (i + 1) & (EARLY_REPLAY_SLOTS - 1);  // Never full: see below
+    }
+}
+
+// Records 'id'. Returns 0 if it is new, -1 if it was seen before or the
+// current generation is full.
+static int early_window_insert(ReplayWindow *w, const uint8_t *id,
+                               time_t now)
+{
+    int rc = -1;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&w->lock);
+#endif
+    early_window_advance(w, now);
+    // At most 3/4 full, so probing always finds a free slot
+    if (w->used[0] < EARLY_REPLAY_SLOTS / 4 * 3 &&
+        memcmp(early_window_find(w, 1, id), id, EARLY_REPLAY_ID) != 0) {
+        uint8_t *slot = early_window_find(w, 0, id);
+        if (memcmp(slot, id, EARLY_REPLAY_ID) != 0) {
+            memcpy(slot, id, EARLY_REPLAY_ID);
+            w->used[0]++;
+            rc = 0;
+        }
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&w->lock);
+#endif
+    return rc;
+}
+
+int early_open(ReplayWindow *w, const uint8_t peer_key[KEY_SIZE],
+               const uint8_t key[SHARED_SECRET_SIZE],
+               const uint8_t *payload, size_t len, uint8_t *msg)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint64_t mlen = 0;
+
+    if (len < EARLY_HEADER + TAG_SIZE ||
+        len - EARLY_HEADER - TAG_SIZE > EARLY_TEXT_MAX) {
+        return -1;
+    }
+    early_nonce(nonce, payload);
+    if (crypto_aead_decrypt(msg, &mlen, NULL, payload + EARLY_HEADER,
+                            len - EARLY_HEADER, nonce, key) != 0) {
+        return -1;  // Encrypted for another server key
+    }
+
+    // Only fresh frames from client keys not seen before
+    time_t now = time(NULL);
+    int64_t sent = (int64_t)((uint64_t)room_load32(payload) |
+                             (uint64_t)room_load32(payload + 4) << 32);
+    if (sent < (int64_t)now - EARLY_SKEW ||
+        sent > (int64_t)now + EARLY_SKEW ||
+        early_window_insert(w, peer_key, now) != 0) {
+        return -1;
+    }
+    return (int)mlen;
+}
+
+// ========================================================================
+// Client side
+// ========================================================================
+size_t early_seal(uint8_t *out, const uint8_t key[SHARED_SECRET_SIZE],
+                  const uint8_t *msg, size_t len)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint64_t clen = 0;
+    uint64_t now = (uint64_t)time(NULL);
+
+    size_t hlen = frame_encode_header(out, FRAME_EARLY,
+                                      EARLY_HEADER + len + TAG_SIZE);
+    room_store32(out + hlen, (uint32_t)now);
+    room_store32(out + hlen + 4, (uint32_t)(now >> 32));
+    early_nonce(nonce, out + hlen);
+    crypto_aead_encrypt(out + hlen + EARLY_HEADER, &clen, msg, len, nonce,
+                        key);
+    return hlen + EARLY_HEADER + (size_t)clen;
+}
+
+int early_key_load(const char *path, uint8_t key[KEY_SIZE])
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return -1;
+    size_t n = fread(key, 1, KEY_SIZE, f);
+    fclose(f);
+    return n == KEY_SIZE ? 0 : -1;
+}
+
+int early_key_save(const char *path, const uint8_t key[KEY_SIZE])
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return -1;
+    size_t n = fwrite(key, 1, KEY_SIZE, f);
+    if (fclose(f) != 0) return -1;
+    return n == KEY_SIZE ? 0 : -1;
+}
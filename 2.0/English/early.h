@@ -0,0 +1,99 @@
+#ifndef EARLY_H
+#define EARLY_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For the frame layer and the crypto headers
+#include <time.h>         // For time_t
+
+#ifndef _WIN32
+#include <pthread.h>      // The replay window is shared by all loops
+#endif
+
+// ========================================================================
+// 0-RTT early data
+// ========================================================================
+// The server key pair lives as long as the server process, so a client
+// that remembers the server public key from its last connection can
+// compute the session key before it connects. It then sends its public
+// key and its first message in the same write:
+//
+//   client -> server   public key (32) | FRAME_EARLY(time | AEAD(msg))
+//   server -> client   public key (32) | ... | the reply
+//                   or FRAME_EARLY_REJECT    (the client sends the
+//                                             message again as
+//                                             FRAME_DATA)
+//
+// The message is encrypted under the session key with its own nonce
+// (time | "0-RTT\0\0\0"), so the send time is authenticated and the
+// nonce differs from the one of FRAME_DATA.
+//
+// Unlike a normal message, early data can be replayed: an attacker who
+// recorded the first write of a session can send it again and the
+// server derives the same key. The server therefore accepts it only
+// when its send time is within EARLY_SKEW seconds of its own clock and
+// the client public key was not seen before. Client keys are remembered
+// in two generations of EARLY_WINDOW seconds each, so a key is known
+// for as long as its frame could be accepted. A generation holds at
+// most EARLY_REPLAY_SLOTS keys; when it is full, early data is refused
+// until the next generation starts. Refused early data costs a round
+// trip, never a message.
+// ========================================================================
+
+#define EARLY_HEADER 8                    // Send time before the
+                                          // ciphertext
+#define EARLY_TEXT_MAX (BUFFER_SIZE - EARLY_HEADER)
+                                          // Longest early message (the
+                                          // frame fits REACTOR_FRAME_MAX)
+#define EARLY_SKEW 5                      // Accepted clock difference
+#define EARLY_WINDOW (2 * EARLY_SKEW)     // Seconds per generation
+#define EARLY_REPLAY_SLOTS 4096           // Keys per generation (power
+                                          // of two)
+#define EARLY_REPLAY_ID 16                // Bytes of the client key kept
+
+// ========================================================================
+// Server side: the anti-replay window
+// ========================================================================
+typedef struct {
+    uint8_t *slots[2];                    // Client key prefixes seen in
+                                          // the current and previous
+                                          // generation (zero: free)
+    size_t used[2];                       // Keys in each generation
+    time_t start;                         // When the current one began
+#ifndef _WIN32
+    pthread_mutex_t lock;                 // Shared by all event loops
+#endif
+} ReplayWindow;
+
+// Allocates an empty window. Returns 0 or -1 if out of memory.
+int early_window_init(ReplayWindow *w);
+
+// Frees the window
+void early_window_free(ReplayWindow *w);
+
+// Opens a FRAME_EARLY payload of the client 'peer_key' with the session
+// 'key'. Returns the message length (the message is written to 'msg',
+// which holds EARLY_TEXT_MAX bytes) or -1 if the frame must be refused:
+// it could not be decrypted (the client used an old server key), its
+// time is off or it is a replay.
+int early_open(ReplayWindow *w, const uint8_t peer_key[KEY_SIZE],
+               const uint8_t key[SHARED_SECRET_SIZE],
+               const uint8_t *payload, size_t len, uint8_t *msg);
+
+// ========================================================================
+// Client side
+// ========================================================================
+
+// Encodes 'msg' (at most EARLY_TEXT_MAX bytes) as a complete FRAME_EARLY
+// at 'out', which holds FRAME_HEADER_MAX + 1 + BUFFER_SIZE + TAG_SIZE
+// bytes. Returns the frame length.
+size_t early_seal(uint8_t *out, const uint8_t key[SHARED_SECRET_SIZE],
+                  const uint8_t *msg, size_t len);
+
+// Reads or writes the server public key cached by the client
+// Return 0 or -1.
+int early_key_load(const char *path, uint8_t key[KEY_SIZE]);
+int early_key_save(const char *path, const uint8_t key[KEY_SIZE]);
+
+#endif // EARLY_H
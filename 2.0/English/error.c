@@ -115,22 +115,15 @@ BOOL WINAPI ConsoleHandler(DWORD signal) {
             // Message to be sent to the server before closing
             const char *msg = "bye";
 
-            // Encrypt the message using the shared secret and nonce
-            if (crypto_aead_encrypt
-                (g_ctx->encrypted_msg, &g_ctx->encrypted_msglen,
-                 (const unsigned char *)msg, strlen(msg),
-                  g_ctx->npub, g_ctx->shared_secret) != 0) {
-                error("Encryption error\n");  // Log encryption error
-            }
-
 // ========================================================================
-            // Send the encrypted message to the server
-            int bytes_sent = send(g_ctx->sockfd,
-  (const char *)g_ctx->encrypted_msg, (int)g_ctx->encrypted_msglen, 0);
-            if (bytes_sent == SOCKET_ERROR) {
+            // Encrypt the message under the sending key of the session
+            // and send it to the server as one frame
+            if (session_send(g_ctx, g_ctx->sockfd,
+                             (const uint8_t *)msg, strlen(msg)) < 0) {
                 error("Send failed: %d\n");  // Log send error
             } else {
-                printf("Sent %d bytes\n", bytes_sent);  // Debug info
+                printf("Sent %d bytes\n",
+                       (int)g_ctx->encrypted_msglen);  // Debug info
             }
 
             // Inform the user and close the socket
@@ -176,21 +169,15 @@ void handle_signal_client(int sig, siginfo_t *si, void *ucontext) {
     // Message to be sent to the server before shutdown
     const char *msg = "bye";
 
-    // Encrypt the message using AEAD encryption
-    if (crypto_aead_encrypt(ctx->encrypted_msg, &ctx->encrypted_msglen,
-                            (unsigned char *)msg, strlen(msg),
-                            ctx->npub, ctx->shared_secret) != 0) {
-        error("Encryption error");  // Log encryption failure
-    }
-
 // ========================================================================
-    // Send the encrypted message to the server
-    ssize_t bytes_sent = send(ctx->sockfd, ctx->encrypted_msg,
-                              ctx->encrypted_msglen, 0);
-    if (bytes_sent == -1) {
+    // Encrypt the message under the sending key of the session and send
+    // it to the server as one frame
+    if (session_send(ctx, ctx->sockfd, (const uint8_t *)msg,
+                     strlen(msg)) < 0) {
         error("Send failed");  // Log send error
     } else {
-        printf("Sent %ld bytes\n", bytes_sent);  // Debug output
+        printf("Sent %ld bytes\n",
+               (long)ctx->encrypted_msglen);  // Debug output
     }
 
     // Notify the user about signal handling and shutdown
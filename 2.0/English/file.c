@@ -0,0 +1,616 @@
+#include "session.h"
+#include "file.h"
+#include "zerocopy.h"     // For MSG_ZEROCOPY sends (--zerocopy)
+
+#ifdef _WIN32
+#include <sys/stat.h>     // For _stat64()
+#else
+#include <errno.h>        // For errno, EINTR
+#include <fcntl.h>        // For open()
+#include <poll.h>         // For poll() on the error queue
+#include <pthread.h>      // For the sender thread
+#include <sys/mman.h>     // For mmap(), madvise()
+#include <sys/stat.h>     // For fstat()
+#include <time.h>         // For clock_gettime()
+#endif
+
+#define FILE_SLOT_SIZE (FILE_BATCH * (FRAME_HEADER_MAX + 1 + \
+                                      FILE_CHUNK_SIZE + TAG_SIZE))
+                                          // Frames of one output buffer
+
+static const uint8_t file_label[4] = {'F', 'I', 'L', 'E'};
+
+// ========================================================================
+// Helpers
+// ========================================================================
+
+// Nonce of frame 'index' of transfer 'id': index | id | "FILE"
+static void file_nonce(uint8_t nonce[NONCE_SIZE], uint32_t id,
+                       uint64_t index)
+{
+    for (int i = 0; i < 8; i++) nonce[i] = (uint8_t)(index >> (8 * i));
+    for (int i = 0; i < 4; i++) nonce[8 + i] = (uint8_t)(id >> (8 * i));
+    memcpy(nonce + 12, file_label, sizeof(file_label));
+}
+
+// File key of direction 'dir'
+static void file_key(const uint8_t *secret, int dir,
+                     uint8_t key[CONTROL_KEY_SIZE])
+{
+    control_derive(dir == FILE_C2S ? "ECC-code file c2s"
+                                   : "ECC-code file s2c",
+                   secret, SHARED_SECRET_SIZE, key);
+}
+
+static double file_now(void)
+{
+#ifdef _WIN32
+    return (double)GetTickCount64() / 1e3;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static void file_report(const char *what, const char *name, uint64_t size,
+                        double start)
+{
+    double secs = file_now() - start;
+    if (secs <= 0) secs = 1e-9;
+    printf("%s %s (%llu bytes) in %.2f s, %.1f MB/s\n", what, name,
+           (unsigned long long)size, secs, (double)size / secs / 1e6);
+}
+
+// Last component of a path
+static const char *file_basename(const char *path)
+{
+    const char *name = path;
+    for (const char *p = path; *p != '\0'; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    return name;
+}
+
+static int file_write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+#ifdef _WIN32
+        int n = send(fd, (const char *)data, (int)len, 0);
+#else
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Sender: the file, mapped or read in chunks
+// ========================================================================
+typedef struct {
+    uint64_t size;                        // File size
+    const uint8_t *map;                   // Mapping (NULL: read chunks)
+    uint8_t *stage;                       // Chunk read with pread/fread
+#ifdef _WIN32
+    FILE *fp;
+#else
+    int fd;
+#endif
+} FileSrc;
+
+static int file_src_open(FileSrc *s, const char *path)
+{
+    memset(s, 0, sizeof(*s));
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0 || (s->fp = fopen(path, "rb")) == NULL) {
+        return -1;
+    }
+    s->size = (uint64_t)st.st_size;
+#else
+    struct stat st;
+    s->fd = open(path, O_RDONLY);
+    if (s->fd < 0) return -1;
+    if (fstat(s->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(s->fd);
+        return -1;
+    }
+    s->size = (uint64_t)st.st_size;
+
+    // Encrypt straight from the page cache; the kernel reads ahead
+    if (s->size > 0 && s->size <= (uint64_t)SIZE_MAX) {
+        void *map = mmap(NULL, (size_t)s->size, PROT_READ, MAP_PRIVATE,
+                         s->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)s->size, MADV_SEQUENTIAL);
+            s->map = map;
+        }
+    }
+#endif
+    if (s->map == NULL && (s->stage = malloc(FILE_CHUNK_SIZE)) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 'len' bytes of the file at 'off', or NULL on a read error
+static const uint8_t *file_src_chunk(FileSrc *s, uint64_t off, size_t len)
+{
+    if (s->map != NULL) return s->map + off;
+
+#ifdef _WIN32
+    if (fread(s->stage, 1, len, s->fp) != len) return NULL;
+#else
+    for (size_t got = 0; got < len;) {
+        ssize_t n = pread(s->fd, s->stage + got, len - got,
+                          (off_t)(off + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return NULL;  // Error, or the file shrank
+        got += (size_t)n;
+    }
+#endif
+    return s->stage;
+}
+
+// Asks the kernel to read the next 'len' bytes of the mapping ahead
+static void file_src_prefetch(FileSrc *s, uint64_t off, size_t len)
+{
+#ifndef _WIN32
+    if (s->map == NULL || off >= s->size) return;
+    if (len > s->size - off) len = (size_t)(s->size - off);
+    madvise((void *)(s->map + off), len, MADV_WILLNEED);
+#else
+    (void)s;
+    (void)off;
+    (void)len;
+#endif
+}
+
+static void file_src_close(FileSrc *s)
+{
+#ifdef _WIN32
+    fclose(s->fp);
+#else
+    if (s->map != NULL) munmap((void *)s->map, (size_t)s->size);
+    close(s->fd);
+#endif
+    free(s->stage);
+}
+
+// ========================================================================
+// Sender: two output buffers, one filled while the other is written
+// ========================================================================
+// With --zerocopy the writer sends a buffer with MSG_ZEROCOPY and keeps
+// it "full" until the kernel has released it: that happens once the
+// other buffer has been written behind it, so one buffer is always
+// being sent while the other one is encrypted.
+typedef struct {
+    int fd;                               // Socket
+    uint8_t *data[2];                     // Encrypted frames
+    size_t len[2];                        // Bytes in each
+    int full[2];                          // Not free for the encryption
+    int done;                             // No more buffers follow
+    int error;                            // A write failed
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+#endif
+
+    // Zero-copy state, used by the writer only
+    ZcSocket *zc;                         // The socket (NULL: copy)
+    int zc_pending[2];                    // The kernel still reads it
+    int zc_held[2];                       // Kept full for that reason
+    uint32_t zc_seq[2];                   // Its last send number
+} FilePipe;
+
+#ifndef _WIN32
+// Sends buffer 'i' without copying it (the rest with a copy if the
+// kernel runs out of memory for pinned pages)
+static int file_write_zc(FilePipe *p, int i)
+{
+    const uint8_t *data = p->data[i];
+    size_t len = p->len[i];
+
+    while (len > 0) {
+        long n = zc_send(p->fd, data, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ENOBUFS) return file_write_all(p->fd, data,
+                                                             len);
+        if (n <= 0) return -1;
+        p->zc_pending[i] = 1;
+        p->zc_seq[i] = p->zc->next++;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Waits until the kernel has released buffer 'i'
+static void file_zc_wait(FilePipe *p, int i)
+{
+    while (p->zc_pending[i]) {
+        ZcRange done[ZC_MAX_RANGES];
+        struct pollfd pfd = {p->fd, 0, 0};  // POLLERR is always reported
+        poll(&pfd, 1, 1000);
+
+        int n = zc_reap(p->fd, done, ZC_MAX_RANGES);
+        if (n < 0) {
+            p->zc_pending[0] = p->zc_pending[1] = 0;  // Socket gone
+            return;
+        }
+        for (int k = 0; k < n; k++) {
+            // The kernel copied anyway: plain writes are cheaper
+            if (done[k].copied) p->zc->on = 0;
+            for (int j = 0; j < 2; j++) {
+                if (zc_covers(&done[k], p->zc_seq[j])) {
+                    p->zc_pending[j] = 0;
+                }
+            }
+        }
+    }
+}
+
+static void *file_writer_main(void *arg)
+{
+    FilePipe *p = arg;
+    int i;
+
+    for (i = 0;; i ^= 1) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->full[i] && !p->done) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        int full = p->full[i];
+        pthread_mutex_unlock(&p->lock);
+        if (!full) break;  // Everything has been written
+
+        int rc = p->zc != NULL && p->zc->on
+                 ? file_write_zc(p, i)
+                       : file_write_all(p->fd, p->data[i], p->len[i]);
+
+        // Sent without a copy: kept full until the kernel releases it.
+        // The other buffer left before this one; once it is released,
+        // it may be filled again.
+        int held = p->zc_pending[i];
+        file_zc_wait(p, i ^ 1);
+
+        pthread_mutex_lock(&p->lock);
+        if (rc < 0) p->error = 1;
+        if (!held) p->full[i] = 0;
+        if (p->zc_held[i ^ 1]) p->full[i ^ 1] = 0;
+        p->zc_held[i ^ 1] = 0;
+        p->zc_held[i] = held;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    // The last buffer sent, before file_pipe_finish() frees it
+    file_zc_wait(p, i ^ 1);
+    return NULL;
+}
+#endif
+
+static int file_pipe_start(FilePipe *p, int fd, ZcSocket *zc)
+{
+    memset(p, 0, sizeof(*p));
+    p->fd = fd;
+    if (zc != NULL && zc->on && zc_enable(fd) != 0) zc->on = 0;
+    p->zc = zc;
+    p->data[0] = malloc(FILE_SLOT_SIZE);
+    p->data[1] = malloc(FILE_SLOT_SIZE);
+    if (p->data[0] == NULL || p->data[1] == NULL) {
+        free(p->data[0]);
+        free(p->data[1]);
+        return -1;
+    }
+#ifndef _WIN32
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    if (pthread_create(&p->thread, NULL, file_writer_main, p) != 0) {
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->cond);
+        free(p->data[0]);
+        free(p->data[1]);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+// Waits until buffer 'i' has been written. Returns it, or NULL if a
+// write failed.
+static uint8_t *file_pipe_acquire(FilePipe *p, int i)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&p->lock);
+    while (p->full[i]) pthread_cond_wait(&p->cond, &p->lock);
+    int error = p->error;
+    pthread_mutex_unlock(&p->lock);
+    return error ? NULL : p->data[i];
+#else
+    return p->error ? NULL : p->data[i];
+#endif
+}
+
+// Hands 'len' bytes of buffer 'i' to the writer
+static void file_pipe_submit(FilePipe *p, int i, size_t len)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&p->lock);
+    p->len[i] = len;
+    p->full[i] = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+#else
+    // No sender thread: written right away
+    if (file_write_all(p->fd, p->data[i], len) < 0) p->error = 1;
+#endif
+}
+
+// Waits for the last write. Returns 0, or -1 if a write failed.
+static int file_pipe_finish(FilePipe *p)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&p->lock);
+    p->done = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+#endif
+    free(p->data[0]);
+    free(p->data[1]);
+    return p->error ? -1 : 0;
+}
+
+// ========================================================================
+// Sender
+// ========================================================================
+const char *file_command(const char *line)
+{
+    if (strncmp(line, "/send ", 6) != 0 || line[6] == '\0') return NULL;
+    return line + 6;
+}
+
+int file_send(int fd, const uint8_t *secret, int dir, uint32_t *id,
+              const char *path, ZcSocket *zc)
+{
+    FileSrc src;
+    FilePipe pipe;
+    uint8_t key[CONTROL_KEY_SIZE];
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t header[FRAME_HEADER_MAX + 1 + FILE_ID_SIZE + 8 +
+                   FILE_NAME_MAX + TAG_SIZE];
+    uint8_t meta[8 + FILE_NAME_MAX];
+    uint64_t clen = 0;
+
+    const char *name = file_basename(path);
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > FILE_NAME_MAX) return -1;
+    if (*id == UINT32_MAX) return -1;  // Ids used up on this connection
+    if (file_src_open(&src, path) != 0) return -1;
+    if (file_pipe_start(&pipe, fd, zc) != 0) {
+        file_src_close(&src);
+        return -1;
+    }
+    double start = file_now();
+
+    // FRAME_FILE_BEGIN: id | AEAD(size | name), nonce index 0
+    uint32_t tid = (*id)++;
+    file_key(secret, dir, key);
+    for (int i = 0; i < 8; i++) meta[i] = (uint8_t)(src.size >> (8 * i));
+    memcpy(meta + 8, name, name_len);
+    size_t plen = FILE_ID_SIZE + 8 + name_len + TAG_SIZE;
+    size_t hlen = frame_encode_header(header, FRAME_FILE_BEGIN, plen);
+    for (int i = 0; i < 4; i++) {
+        header[hlen + i] = (uint8_t)(tid >> (8 * i));
+    }
+    file_nonce(nonce, tid, 0);
+    crypto_aead_encrypt(header + hlen + FILE_ID_SIZE, &clen, meta,
+                        8 + name_len, nonce, key);
+
+    // The header leaves first, ahead of every chunk
+    uint8_t *out = file_pipe_acquire(&pipe, 0);
+    memcpy(out, header, hlen + plen);
+    size_t len = hlen + plen;
+
+    // Chunks: encrypted from the mapping into one buffer while the
+    // writer sends the other one
+    uint64_t off = 0, index = 1;
+    int slot = 0, rc = 0;
+    for (;;) {
+        for (int b = 0; b < FILE_BATCH && off < src.size; b++) {
+            size_t n = src.size - off < FILE_CHUNK_SIZE
+                       ? (size_t)(src.size - off) : FILE_CHUNK_SIZE;
+            const uint8_t *chunk = file_src_chunk(&src, off, n);
+            if (chunk == NULL) {
+                rc = -1;
+                break;
+            }
+            hlen = frame_encode_header(out + len, FRAME_FILE_CHUNK,
+                                       n + TAG_SIZE);
+            file_nonce(nonce, tid, index++);
+            crypto_aead_encrypt(out + len + hlen, &clen, chunk, n, nonce,
+                                key);
+            len += hlen + (size_t)clen;
+            off += n;
+        }
+        file_pipe_submit(&pipe, slot, len);
+        if (rc != 0 || off >= src.size) break;
+
+        // Let the disk work on the batch after the next one meanwhile
+        file_src_prefetch(&src, off,
+                          (size_t)FILE_BATCH * FILE_CHUNK_SIZE);
+        slot ^= 1;
+        len = 0;
+        if ((out = file_pipe_acquire(&pipe, slot)) == NULL) break;
+    }
+    if (file_pipe_finish(&pipe) != 0) rc = -1;
+    file_src_close(&src);
+    memset(key, 0, sizeof(key));
+
+    // A file cut short by a read error leaves the receiver waiting for
+    // the rest; the connection must be closed
+    if (rc == 0 && off == src.size) {
+        file_report("Sent", name, src.size, start);
+        return 0;
+    }
+    return -2;
+}
+
+// ========================================================================
+// Receiver
+// ========================================================================
+void file_rx_init(FileRx *rx, const char *dir)
+{
+    memset(rx, 0, sizeof(*rx));
+    rx->dir = dir;
+}
+
+// Drops the transfer in progress and its .part file
+static void file_rx_abort(FileRx *rx)
+{
+    char path[FILENAME_MAX];
+
+    if (rx->fp != NULL) {
+        fclose(rx->fp);
+        rx->fp = NULL;
+        snprintf(path, sizeof(path), "%s/%s.part", rx->dir, rx->name);
+        remove(path);
+    }
+    rx->active = 0;
+}
+
+void file_rx_free(FileRx *rx)
+{
+    if (rx->active) {
+        printf("Transfer of %s incomplete, dropped\n", rx->name);
+        file_rx_abort(rx);
+    }
+    free(rx->plain);
+    rx->plain = NULL;
+}
+
+int file_is_frame(uint8_t type)
+{
+    return type == FRAME_FILE_BEGIN || type == FRAME_FILE_CHUNK;
+}
+
+// All bytes have arrived: move the .part file to its name
+static void file_rx_finish(FileRx *rx)
+{
+    char part[FILENAME_MAX], path[FILENAME_MAX];
+
+    rx->active = 0;
+    if (rx->fp == NULL) return;  // Skipped
+
+    snprintf(part, sizeof(part), "%s/%s.part", rx->dir, rx->name);
+    snprintf(path, sizeof(path), "%s/%s", rx->dir, rx->name);
+    int failed = fclose(rx->fp) != 0;
+    rx->fp = NULL;
+    if (failed || rename(part, path) != 0) {
+        printf("Cannot store %s\n", path);
+        remove(part);
+        return;
+    }
+    file_report("Received", path, rx->size, rx->start);
+}
+
+static int file_rx_begin(FileRx *rx, const uint8_t *secret, int dir,
+                         const Frame *f)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t meta[8 + FILE_NAME_MAX];
+    uint64_t mlen = 0;
+    char path[FILENAME_MAX];
+
+    if (f->chain != NULL || f->len < FILE_ID_SIZE + 8 + 1 + TAG_SIZE ||
+        f->len > FILE_ID_SIZE + sizeof(meta) + TAG_SIZE) {
+        return -1;
+    }
+    if (rx->active) {
+        printf("Transfer of %s interrupted, dropped\n", rx->name);
+        file_rx_abort(rx);
+    }
+
+    // Ids only go up, so a transfer of the connection is never replayed
+    uint32_t id = 0;
+    for (int i = 0; i < 4; i++) id |= (uint32_t)f->payload[i] << (8 * i);
+    if (id < rx->next_id || id == UINT32_MAX) return -1;
+    file_key(secret, dir, rx->key);
+    file_nonce(nonce, id, 0);
+    if (crypto_aead_decrypt(meta, &mlen, NULL, f->payload + FILE_ID_SIZE,
+                            f->len - FILE_ID_SIZE, nonce, rx->key) != 0) {
+        return -1;
+    }
+
+    rx->size = 0;
+    for (int i = 0; i < 8; i++) rx->size |= (uint64_t)meta[i] << (8 * i);
+    memcpy(rx->name, meta + 8, (size_t)mlen - 8);
+    rx->name[mlen - 8] = '\0';
+    rx->id = id;
+    rx->next_id = id + 1;
+    rx->index = 1;
+    rx->received = 0;
+    rx->active = 1;
+    rx->start = file_now();
+
+    if (rx->plain == NULL && (rx->plain = malloc(FILE_CHUNK_SIZE)) == NULL) {
+        return -1;
+    }
+
+    // Only a plain name is accepted, and an existing file is kept
+    const char *name = rx->name;
+    snprintf(path, sizeof(path), "%s/%s", rx->dir, name);
+    FILE *exists = NULL;
+    if (strlen(name) != (size_t)mlen - 8 || file_basename(name) != name ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        printf("Refusing file with an invalid name\n");
+    } else if ((exists = fopen(path, "rb")) != NULL) {
+        fclose(exists);
+        printf("Refusing %s: the file exists\n", path);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s.part", rx->dir, name);
+        rx->fp = fopen(path, "wbx");  // Never replaces a file
+        if (rx->fp == NULL) printf("Cannot create %s\n", path);
+        else printf("Receiving %s (%llu bytes)\n", name,
+                    (unsigned long long)rx->size);
+    }
+    if (rx->size == 0) file_rx_finish(rx);
+    return 0;
+}
+
+int file_rx_frame(FileRx *rx, const uint8_t *secret, int dir,
+                  const Frame *f)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint64_t len = 0;
+
+    if (f->type == FRAME_FILE_BEGIN) {
+        return file_rx_begin(rx, secret, dir, f);
+    }
+    if (!rx->active) return -1;  // Chunk without a header
+
+    // Chunks come in order and never exceed the announced size
+    if (f->len < TAG_SIZE || f->len - TAG_SIZE > FILE_CHUNK_SIZE ||
+        f->len - TAG_SIZE > rx->size - rx->received) {
+        return -1;
+    }
+    file_nonce(nonce, rx->id, rx->index++);
+    if (chain_open(f, rx->plain, &len, nonce, rx->key) != 0) return -1;
+
+    if (rx->fp != NULL && fwrite(rx->plain, 1, (size_t)len, rx->fp) != len) {
+        printf("Cannot write %s, skipping the rest\n", rx->name);
+        file_rx_abort(rx);
+        rx->active = 1;  // Still count the remaining chunks
+    }
+    rx->received += len;
+    if (rx->received == rx->size) file_rx_finish(rx);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef FILE_H
+#define FILE_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint8_t, uint64_t
+#include <stdio.h>        // For FILE
+#include "frame.h"        // For Frame
+#include "control.h"      // For control_derive(), CONTROL_KEY_SIZE
+#include "zerocopy.h"     // For ZcSocket
+
+// ========================================================================
+// Encrypted file transfer
+// ========================================================================
+// "/send <path>" streams a file to the peer:
+//
+//   FRAME_FILE_BEGIN   id (4) | AEAD(size (8) | name)
+//   FRAME_FILE_CHUNK   AEAD(FILE_CHUNK_SIZE bytes of the file)
+//   FRAME_FILE_CHUNK   ...
+//
+// Every frame is encrypted under the file key of its direction, never
+// under the session key:
+//
+//   file key = Ascon-XOF128("ECC-code file c2s" | secret)   (or "s2c")
+//
+// so a frame sent back to its sender does not open. The nonce is
+// index (8) | id (4) | "FILE", where the header has index 0 and chunk i
+// has index i + 1. The id counts the files sent on the connection in
+// that direction, so no two transfers share a nonce, and the receiver
+// refuses an id lower than the next one it expects (replays). The index
+// authenticates the order of the chunks. The receiver knows the size
+// from the header, so a transfer cut short is never taken for a
+// complete file.
+//
+// The sender maps the file (mmap(), or pread() where mapping fails) and
+// encrypts the chunks straight from the mapping into one of two output
+// buffers of FILE_BATCH frames each. A sender thread writes one buffer
+// to the socket while the next one is encrypted, and the kernel reads
+// the file ahead meanwhile (MADV_SEQUENTIAL), so disk, AEAD and socket
+// work at the same time. With --zerocopy the buffers are sent with
+// MSG_ZEROCOPY, and a buffer is filled again only after the kernel has
+// released it. On Windows the buffers are written in turn.
+//
+// The receiver writes to "<name>.part" in its directory and renames it
+// once the last byte has arrived. Only the last component of the name
+// is used, and existing files are never overwritten.
+// ========================================================================
+
+#define FILE_CHUNK_SIZE 65536             // Plaintext bytes per chunk
+#define FILE_BATCH 16                     // Chunks per output buffer
+#define FILE_NAME_MAX 200                 // Longest file name sent
+#define FILE_ID_SIZE 4                    // Transfer id in the header
+#define FILE_FRAME_MAX (FILE_CHUNK_SIZE + 16)
+                                          // Largest frame payload (a
+                                          // chunk and its tag)
+
+#define FILE_C2S 0                        // Directions: client to server,
+#define FILE_S2C 1                        // server to client
+
+// A transfer being received
+typedef struct {
+    const char *dir;                      // Directory for received files
+    int active;                           // A file is being received
+    FILE *fp;                             // The .part file (NULL: the
+                                          // transfer is skipped)
+    uint32_t id;                          // Transfer id
+    uint32_t next_id;                     // Lowest id still accepted
+    uint8_t key[CONTROL_KEY_SIZE];        // File key of the direction
+    uint64_t size;                        // Bytes announced
+    uint64_t received;                    // Bytes received so far
+    uint64_t index;                       // Nonce index of the next chunk
+    char name[FILE_NAME_MAX + 1];         // Name without directories
+    uint8_t *plain;                       // One decrypted chunk
+    double start;                         // Time of FRAME_FILE_BEGIN
+} FileRx;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Sends the file at 'path' on the blocking socket 'fd' in direction
+// 'dir' (FILE_C2S or FILE_S2C), under the file key derived from the
+// shared 'secret'. '*id' is the transfer id of the connection and moves
+// on once the header is sealed. With 'zc' (the zero-copy state of 'fd',
+// see zerocopy.h) switched on, the buffers leave with MSG_ZEROCOPY; NULL
+// copies them. Prints the throughput when done. Returns 0, -1 if the
+// file cannot be opened or the ids are used up (nothing is sent), or -2
+// if the transfer broke off (the connection must be closed).
+int file_send(int fd, const uint8_t *secret, int dir, uint32_t *id,
+              const char *path, ZcSocket *zc);
+
+// Returns the path of a "/send <path>" line, or NULL for other lines
+const char *file_command(const char *line);
+
+// Prepares a receiver that stores files in 'dir'
+void file_rx_init(FileRx *rx, const char *dir);
+void file_rx_free(FileRx *rx);
+
+// Returns 1 if 'type' is a file transfer frame
+int file_is_frame(uint8_t type);
+
+// Handles one file transfer frame sent in direction 'dir' under the
+// shared 'secret'. Returns 0, or -1 if it does not authenticate or
+// replays a transfer (the connection must be closed). A file that
+// cannot be written is skipped with a message.
+int file_rx_frame(FileRx *rx, const uint8_t *secret, int dir,
+                  const Frame *f);
+
+#endif // FILE_H
@@ -0,0 +1,329 @@
+#include "session.h"
+#include "frame.h"
+
+#ifndef _WIN32
+#include <errno.h>        // For errno, EINTR
+#include <sys/uio.h>      // For writev()
+#endif
+
+// ========================================================================
+// Ring buffer management
+// ========================================================================
+int frame_buffer_init(FrameBuffer *fb, size_t cap)
+{
+    size_t size = 64;
+    while (size < cap) size *= 2;  // Index masking needs a power of two
+
+    fb->data = malloc(size);
+    if (fb->data == NULL) return -1;
+    fb->cap = size;
+    fb->head = fb->tail = 0;
+    return 0;
+}
+
+void frame_buffer_free(FrameBuffer *fb)
+{
+    free(fb->data);
+    fb->data = NULL;
+    fb->cap = fb->head = fb->tail = 0;
+}
+
+void frame_buffer_attach(FrameBuffer *fb, uint8_t *mem, size_t cap)
+{
+    fb->data = mem;
+    fb->cap = cap;
+    fb->head = fb->tail = 0;
+}
+
+uint8_t *frame_buffer_detach(FrameBuffer *fb)
+{
+    uint8_t *mem = fb->data;
+    fb->data = NULL;
+    fb->cap = fb->head = fb->tail = 0;
+    return mem;
+}
+
+size_t frame_buffer_used(const FrameBuffer *fb)
+{
+    return fb->tail - fb->head;
+}
+
+uint8_t *frame_buffer_write_ptr(FrameBuffer *fb, size_t *avail)
+{
+    size_t used = fb->tail - fb->head;
+    size_t tidx = fb->tail & (fb->cap - 1);
+    size_t hidx = fb->head & (fb->cap - 1);
+
+    if (used == fb->cap) {
+        *avail = 0;                  // Full
+    } else if (tidx >= hidx) {
+        *avail = fb->cap - tidx;     // Free space up to the end
+    } else {
+        *avail = hidx - tidx;        // Free space up to the read position
+    }
+    return fb->data + tidx;
+}
+
+void frame_buffer_commit(FrameBuffer *fb, size_t n)
+{
+    fb->tail += n;
+}
+
+const uint8_t *frame_buffer_read_ptr(const FrameBuffer *fb, size_t *avail)
+{
+    size_t used = fb->tail - fb->head;
+    size_t hidx = fb->head & (fb->cap - 1);
+
+    // Buffered bytes up to the end of the storage or to the tail
+    *avail = used < fb->cap - hidx ? used : fb->cap - hidx;
+    return fb->data + hidx;
+}
+
+void frame_buffer_consume(FrameBuffer *fb, size_t n)
+{
+    fb->head += n;
+    if (fb->head == fb->tail) fb->head = fb->tail = 0;
+}
+
+int frame_buffer_write(FrameBuffer *fb, const uint8_t *data, size_t len)
+{
+    if (len > fb->cap - (fb->tail - fb->head)) return -1;
+
+    while (len > 0) {
+        size_t avail;
+        uint8_t *dst = frame_buffer_write_ptr(fb, &avail);
+        size_t take = len < avail ? len : avail;
+        memcpy(dst, data, take);
+        fb->tail += take;
+        data += take;
+        len -= take;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Header encoding and decoding
+// ========================================================================
+size_t frame_encode_header(uint8_t *out, uint8_t type, size_t payload_len)
+{
+    size_t value = payload_len + 1;  // The length covers the type byte
+    size_t n = 0;
+
+    // LEB128: low 7 bits first, high bit set while more bytes follow
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    out[n++] = type;
+    return n;
+}
+
+// Decodes the varint at position 'start' of 'data' ('mask' wraps the
+// index for the ring, SIZE_MAX for a linear buffer). Returns the varint
+// size, 0 if it is incomplete and -1 if it does not fit into 32 bits.
+static int frame_decode_length(const uint8_t *data, size_t mask,
+                               size_t start, size_t avail,
+                               uint32_t *value)
+{
+    uint32_t v = 0;
+
+    for (size_t i = 0; i < FRAME_HEADER_MAX; i++) {
+        if (i == avail) return 0;  // Need more bytes
+
+        uint8_t b = data[(start + i) & mask];
+        if (i == FRAME_HEADER_MAX - 1 && b > 0x0f) return -1;
+        v |= (uint32_t)(b & 0x7f) << (7 * i);
+        if ((b & 0x80) == 0) {
+            *value = v;
+            return (int)i + 1;
+        }
+    }
+    return -1;
+}
+
+int frame_buffer_peek(const FrameBuffer *fb, uint8_t *type,
+                      size_t *header_len, size_t *payload_len)
+{
+    size_t used = fb->tail - fb->head;
+    uint32_t length;
+    int hlen = frame_decode_length(fb->data, fb->cap - 1, fb->head, used,
+                                   &length);
+
+    if (hlen <= 0) return hlen;
+    if (length == 0) return -1;
+    if (used == (size_t)hlen) return 0;  // Type byte not there yet
+
+    *type = fb->data[(fb->head + (size_t)hlen) & (fb->cap - 1)];
+    *header_len = (size_t)hlen + 1;
+    *payload_len = length - 1;
+    return 1;
+}
+
+int frame_peek_header(const uint8_t *data, size_t len, uint8_t *type,
+                      size_t *header_len, size_t *payload_len)
+{
+    uint32_t length;
+    int hlen = frame_decode_length(data, SIZE_MAX, 0, len, &length);
+
+    if (hlen <= 0) return hlen;
+    if (length == 0) return -1;
+    if (len == (size_t)hlen) return 0;  // Type byte not there yet
+
+    *type = data[hlen];
+    *header_len = (size_t)hlen + 1;
+    *payload_len = length - 1;
+    return 1;
+}
+
+int frame_parse(const uint8_t *data, size_t len, Frame *f,
+                size_t *consumed, size_t max_size)
+{
+    uint32_t length;
+    int hlen = frame_decode_length(data, SIZE_MAX, 0, len, &length);
+
+    if (hlen <= 0) return hlen;
+    if (length == 0 || length - 1 > max_size) return -1;
+    if (len - (size_t)hlen < length) return 0;  // Partial frame
+
+    f->type = data[hlen];
+    f->payload = data + hlen + 1;
+    f->len = length - 1;
+    f->chain = NULL;
+    *consumed = (size_t)hlen + length;
+    return 1;
+}
+
+int frame_pop(FrameBuffer *fb, Frame *f, uint8_t *scratch,
+              size_t scratch_len, size_t max_size)
+{
+    size_t mask = fb->cap - 1;
+    size_t used = fb->tail - fb->head;
+    uint32_t length;
+    int hlen = frame_decode_length(fb->data, mask, fb->head, used,
+                                   &length);
+
+    if (hlen <= 0) return hlen;
+    if (length == 0 || length - 1 > max_size) return -1;
+    if (used - (size_t)hlen < length) return 0;  // Partial frame
+
+    size_t plen = length - 1;
+    size_t start = (fb->head + (size_t)hlen + 1) & mask;
+
+    f->type = fb->data[(fb->head + (size_t)hlen) & mask];
+    f->len = plen;
+    f->chain = NULL;
+    if (start + plen <= fb->cap) {
+        f->payload = fb->data + start;    // Contiguous: no copy
+    } else {
+        // The payload wraps around the end of the ring
+        size_t first = fb->cap - start;
+        if (plen > scratch_len) return -1;
+        memcpy(scratch, fb->data + start, first);
+        memcpy(scratch + first, fb->data, plen - first);
+        f->payload = scratch;
+    }
+
+    fb->head += (size_t)hlen + length;
+    if (fb->head == fb->tail) {
+        fb->head = fb->tail = 0;  // Empty: restart at the beginning so
+                                  // the next frame is contiguous
+    }
+    return 1;
+}
+
+// ========================================================================
+// Blocking socket helpers
+// ========================================================================
+int frame_send(int fd, uint8_t type, const uint8_t *payload, size_t len)
+{
+    uint8_t header[FRAME_HEADER_MAX + 1];
+    size_t hlen = frame_encode_header(header, type, len);
+
+#ifdef _WIN32
+    // Header and payload leave in a single send
+    WSABUF bufs[2];
+    DWORD sent = 0;
+    bufs[0].buf = (char *)header;
+    bufs[0].len = (ULONG)hlen;
+    bufs[1].buf = (char *)payload;
+    bufs[1].len = (ULONG)len;
+    if (WSASend((SOCKET)fd, bufs, 2, &sent, 0, NULL, NULL) != 0 ||
+        sent != hlen + len) {
+        return -1;
+    }
+#else
+    // Header and payload leave in a single writev(); a short write
+    // continues where it stopped
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+
+    struct iovec *v = iov;
+    int cnt = 2;
+    while (cnt > 0) {
+        ssize_t n = writev(fd, v, cnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        while (cnt > 0 && (size_t)n >= v->iov_len) {
+            n -= (ssize_t)v->iov_len;
+            v++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            v->iov_base = (uint8_t *)v->iov_base + n;
+            v->iov_len -= (size_t)n;
+        }
+    }
+#endif
+    return 0;
+}
+
+int frame_buffer_fill(int fd, FrameBuffer *fb)
+{
+    size_t avail;
+    uint8_t *dst = frame_buffer_write_ptr(fb, &avail);
+    if (avail == 0) return -1;  // Frame larger than the ring
+
+    for (;;) {
+#ifdef _WIN32
+        int n = recv(fd, (char *)dst, (int)avail, 0);
+#else
+        ssize_t n = read(fd, dst, avail);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return n == 0 ? 0 : -1;
+        fb->tail += (size_t)n;
+        return (int)n;
+    }
+}
+
+int frame_recv_exact(int fd, FrameBuffer *fb, uint8_t *out, size_t len)
+{
+    while (fb->tail - fb->head < len) {
+        int n = frame_buffer_fill(fd, fb);
+        if (n <= 0) return n;
+    }
+    for (size_t i = 0; i < len; i++) {
+        out[i] = fb->data[(fb->head + i) & (fb->cap - 1)];
+    }
+    fb->head += len;
+    if (fb->head == fb->tail) fb->head = fb->tail = 0;
+    return 1;
+}
+
+int frame_recv(int fd, FrameBuffer *fb, Frame *f, uint8_t *scratch,
+               size_t scratch_len)
+{
+    for (;;) {
+        // Frames already buffered by an earlier read come first
+        int r = frame_pop(fb, f, scratch, scratch_len, scratch_len);
+        if (r != 0) return r;
+
+        int n = frame_buffer_fill(fd, fb);
+        if (n <= 0) return n;
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stdint.h>       // For uint8_t and other fixed-width types
+#include <stddef.h>       // For size_t
+
+// ========================================================================
+// Frame format
+// ========================================================================
+// TCP is a byte stream: one read() may return half a message or several
+// messages at once. Every message is therefore sent as a frame:
+//
+//   +----------------+--------+---------------------------+
+//   | length (varint)|  type  | payload (length - 1 bytes)|
+//   +----------------+--------+---------------------------+
+//
+// 'length' counts the type byte and the payload and is encoded as an
+// unsigned LEB128 varint (7 bits per byte, high bit = more bytes follow),
+// so short messages need a single header byte.
+// ========================================================================
+
+#define FRAME_HEADER_MAX 5          // Varint bytes for a 32-bit length
+#define FRAME_MAX_SIZE 4096         // Largest accepted payload
+#define FRAME_BUFFER_SIZE 8192      // Default reassembly ring capacity
+
+// Frame types
+#define FRAME_DATA 0x01             // Encrypted chat message
+#define FRAME_GROUP_KEY 0x02        // Room key, a control frame
+#define FRAME_GROUP 0x03            // Room message, under the room key
+#define FRAME_TICKET 0x04           // Resumption ticket, under the session
+                                    // key
+#define FRAME_HELLO 0x05            // Server random, sent with the key
+#define FRAME_RESUME 0x06           // Client random and ticket
+#define FRAME_RESUME_REJECT 0x07    // Ticket refused: full handshake
+#define FRAME_EARLY 0x08            // First message, sent with the key
+#define FRAME_EARLY_REJECT 0x09     // Early message refused: send again
+#define FRAME_FILE_BEGIN 0x0A       // File name and size (see file.h)
+#define FRAME_FILE_CHUNK 0x0B       // Next piece of the file
+#define FRAME_RELAY_KEY 0x0C        // Pair key of a relay, under the
+                                    // session key (see relay.h)
+#define FRAME_RELAY 0x0D            // Message under the pair key
+#define FRAME_KEEPALIVE 0x0E        // Empty; the duplex client answers
+                                    // with one (see timer.h)
+#define FRAME_REKEY 0x0F            // Next message key (see ratchet.h)
+
+// ========================================================================
+// Reassembly ring buffer
+// ========================================================================
+// Bytes read from a socket are appended at 'tail' and frames are taken
+// from 'head'. Both positions only grow; the storage index is
+// 'position & (cap - 1)', so 'cap' must be a power of two.
+typedef struct {
+    uint8_t *data;                  // Ring storage
+    size_t cap;                     // Capacity (power of two)
+    size_t head;                    // First unread byte
+    size_t tail;                    // One past the last written byte
+} FrameBuffer;
+
+struct BufChain;
+
+// One parsed frame. 'payload' points into the ring when the frame is
+// contiguous there, otherwise into the scratch buffer given to
+// frame_pop(). It stays valid until the ring is written again.
+// A frame too large for the ring is received into a chain of segments
+// instead (see chain.h): 'payload' is then NULL and 'chain' holds it.
+typedef struct {
+    uint8_t type;                   // FRAME_* type
+    const uint8_t *payload;         // Payload bytes
+    size_t len;                     // Payload length
+    const struct BufChain *chain;   // Payload of a large frame (or NULL)
+} Frame;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Allocates a ring of 'cap' bytes (rounded up to a power of two).
+// Returns 0 on success, -1 if out of memory.
+int frame_buffer_init(FrameBuffer *fb, size_t cap);
+
+// Releases the ring storage
+void frame_buffer_free(FrameBuffer *fb);
+
+// Uses 'mem' ('cap' bytes, a power of two) as the storage of an empty
+// ring, or takes the storage back out of it (the ring is then empty and
+// unallocated). For storage that comes from a pool.
+void frame_buffer_attach(FrameBuffer *fb, uint8_t *mem, size_t cap);
+uint8_t *frame_buffer_detach(FrameBuffer *fb);
+
+// Returns the largest contiguous free region of the ring and its size,
+// so that read()/recv() can write into the ring directly
+uint8_t *frame_buffer_write_ptr(FrameBuffer *fb, size_t *avail);
+
+// Marks 'n' bytes written through frame_buffer_write_ptr() as valid
+void frame_buffer_commit(FrameBuffer *fb, size_t n);
+
+// Returns the largest contiguous region of buffered bytes and its size,
+// and removes 'n' bytes from the front of the ring
+const uint8_t *frame_buffer_read_ptr(const FrameBuffer *fb, size_t *avail);
+void frame_buffer_consume(FrameBuffer *fb, size_t n);
+
+// Reads once from 'fd' into the free space of the ring.
+// Returns the number of bytes read, 0 on close, -1 on error.
+int frame_buffer_fill(int fd, FrameBuffer *fb);
+
+// Copies 'len' bytes into the ring. Returns 0, or -1 if they do not fit.
+int frame_buffer_write(FrameBuffer *fb, const uint8_t *data, size_t len);
+
+// Returns the number of buffered bytes not yet taken out as frames
+size_t frame_buffer_used(const FrameBuffer *fb);
+
+// Writes the header of a frame with 'payload_len' payload bytes into
+// 'out' (at least FRAME_HEADER_MAX + 1 bytes). Returns the header size.
+size_t frame_encode_header(uint8_t *out, uint8_t type, size_t payload_len);
+
+// Decodes the header of the frame at the front of the ring without
+// taking it out. Returns 1 with its type, header size (length and type
+// byte) and payload size, 0 if the header is incomplete and -1 if it is
+// malformed.
+int frame_buffer_peek(const FrameBuffer *fb, uint8_t *type,
+                      size_t *header_len, size_t *payload_len);
+
+// The same for the frame at the start of a linear buffer (bytes peeked
+// from a socket, for example)
+int frame_peek_header(const uint8_t *data, size_t len, uint8_t *type,
+                      size_t *header_len, size_t *payload_len);
+
+// Parses the frame at the start of a linear buffer without copying.
+// Returns 1 and sets '*consumed' to the frame size, 0 if 'data' holds only
+// part of a frame and -1 if the frame is malformed or its payload is
+// larger than 'max_size'.
+int frame_parse(const uint8_t *data, size_t len, Frame *f,
+                size_t *consumed, size_t max_size);
+
+// Takes the next complete frame out of the ring.
+// Returns 1 if a frame was produced, 0 if more bytes are needed and -1 if
+// the stream is malformed, the payload is larger than 'max_size' or it
+// wraps around the ring and does not fit into 'scratch'.
+int frame_pop(FrameBuffer *fb, Frame *f, uint8_t *scratch,
+              size_t scratch_len, size_t max_size);
+
+// ========================================================================
+// Blocking socket helpers (classic client/server)
+// ========================================================================
+
+// Sends header and payload of one frame, retrying on short writes.
+// Returns 0 on success, -1 on error.
+int frame_send(int fd, uint8_t type, const uint8_t *payload, size_t len);
+
+// Reads exactly 'len' unframed bytes (such as a public key) through the
+// ring, so bytes that follow them stay buffered for frame_recv().
+// Returns 1 on success, 0 if the peer closed the connection, -1 on error.
+int frame_recv_exact(int fd, FrameBuffer *fb, uint8_t *out, size_t len);
+
+// Reads from 'fd' until one complete frame is available in 'fb'.
+// Payloads larger than 'scratch_len' are rejected. Returns 1 with the
+// frame in 'f', 0 if the peer closed the connection and -1 on a socket
+// error or malformed stream.
+int frame_recv(int fd, FrameBuffer *fb, Frame *f, uint8_t *scratch,
+               size_t scratch_len);
+
+#endif // FRAME_H
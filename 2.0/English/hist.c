@@ -0,0 +1,92 @@
+#include "hist.h"
+#include <string.h>       // For memset()
+
+// ========================================================================
+// Helpers
+// ========================================================================
+
+// Bucket of 'value'
+static unsigned hist_index(uint64_t value)
+{
+    if (value < 2 * HIST_SUB) return (unsigned)value;
+
+    unsigned shift = 63 - (unsigned)__builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned)(value >> shift) - HIST_SUB;
+}
+
+// Largest value counted in bucket 'index'
+static uint64_t hist_upper(unsigned index)
+{
+    if (index < 2 * HIST_SUB) return index;
+
+    unsigned shift = index / HIST_SUB - 1;
+    uint64_t sub = index % HIST_SUB + HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+void hist_init(Histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_record(Histogram *h, uint64_t value)
+{
+    h->counts[hist_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+void hist_record_atomic(Histogram *h, uint64_t value)
+{
+    __atomic_fetch_add(&h->counts[hist_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+
+    uint64_t m = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (value < m &&
+           !__atomic_compare_exchange_n(&h->min, &m, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > m &&
+           !__atomic_compare_exchange_n(&h->max, &m, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void hist_merge(Histogram *to, const Histogram *from)
+{
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+    to->total += from->total;
+    to->sum += from->sum;
+    if (from->min < to->min) to->min = from->min;
+    if (from->max > to->max) to->max = from->max;
+}
+
+uint64_t hist_percentile(const Histogram *h, double percentile)
+{
+    if (h->total == 0) return 0;
+
+    // Rank of the value: at least the first, at most the last
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)h->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->total) rank = h->total;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = hist_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
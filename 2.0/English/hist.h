@@ -0,0 +1,59 @@
+#ifndef HIST_H
+#define HIST_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stdint.h>       // For uint64_t
+
+// ========================================================================
+// Latency histogram
+// ========================================================================
+// Keeping every sample to sort them costs memory per message. A
+// histogram with log-linear buckets (as in HdrHistogram) keeps a count
+// per bucket instead:
+//
+// - Values below 2 * HIST_SUB have a bucket each.
+// - Above, every power of two [2^k, 2^(k+1)) is split into HIST_SUB
+//   buckets of equal width, so a bucket is never wider than 1/HIST_SUB
+//   of its values (0.8 %), from nanoseconds to hours.
+//
+// Recording is an index computation and an increment; histograms of
+// several threads are merged by adding their counts, or share one
+// histogram with hist_record_atomic().
+// ========================================================================
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)          // Buckets per power of two
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;                            // Values recorded
+    uint64_t sum;                              // Their sum (for the mean)
+    uint64_t min, max;                         // Exact extremes
+} Histogram;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Empties 'h'
+void hist_init(Histogram *h);
+
+// Counts one value
+void hist_record(Histogram *h, uint64_t value);
+
+// Counts one value in a histogram shared by several threads (relaxed
+// atomic increments)
+void hist_record_atomic(Histogram *h, uint64_t value);
+
+// Adds the counts of 'from' to 'to'
+void hist_merge(Histogram *to, const Histogram *from);
+
+// Returns the value below which 'percentile' % of the recorded values
+// lie (the upper end of its bucket, at most the maximum), or 0 if
+// nothing was recorded
+uint64_t hist_percentile(const Histogram *h, double percentile);
+
+#endif // HIST_H
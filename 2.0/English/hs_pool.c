@@ -0,0 +1,224 @@
+#include "hs_pool.h"
+
+#ifdef __linux__
+
+#include <errno.h>        // For errno, EINTR
+#include <sched.h>        // For sched_yield()
+#include <stdint.h>       // For intptr_t
+#include <sys/eventfd.h>  // For eventfd()
+
+// ========================================================================
+// Bounded lock-free queue
+// ========================================================================
+// Every cell carries a sequence number. A cell at position 'pos' is free
+// for the producer of 'pos' when seq == pos and holds data for the
+// consumer of 'pos' when seq == pos + 1. Producers and consumers claim
+// positions with a compare-and-swap and never wait for each other except
+// when the queue is full or empty.
+static int hs_queue_init(HsQueue *q, size_t capacity)
+{
+    q->cells = calloc(capacity, sizeof(HsCell));
+    if (q->cells == NULL) return -1;
+    for (size_t i = 0; i < capacity; i++) {
+        q->cells[i].seq = i;
+    }
+    q->mask = capacity - 1;   // 'capacity' is a power of two
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    return 0;
+}
+
+static void hs_queue_free(HsQueue *q)
+{
+    if (q->cells == NULL) return;
+    // Jobs left behind may still hold a shared secret
+    memset(q->cells, 0, (q->mask + 1) * sizeof(HsCell));
+    free(q->cells);
+    q->cells = NULL;
+}
+
+// Returns 0, or -1 if the queue is full
+static int hs_queue_push(HsQueue *q, const HsJob *job)
+{
+    size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        HsCell *cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                cell->job = *job;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            // Lost the race: 'pos' now holds the current position
+        } else if (dif < 0) {
+            return -1;  // Full: the consumer is a whole lap behind
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Returns 1 with the oldest job, or 0 if the queue is empty
+static int hs_queue_pop(HsQueue *q, HsJob *job)
+{
+    size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        HsCell *cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                *job = cell->job;
+                memset(cell->job.shared_secret, 0,
+                       sizeof(cell->job.shared_secret));
+                // Hand the cell to the producer of the next lap
+                __atomic_store_n(&cell->seq, pos + q->mask + 1,
+                                 __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;  // Empty
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// ========================================================================
+// Worker thread: compute shared secrets until the pool is stopped
+// ========================================================================
+static void *hs_worker_main(void *arg)
+{
+    HsPool *p = (HsPool *)arg;
+    HsJob job;
+
+    for (;;) {
+        while (sem_wait(&p->ready) < 0 && errno == EINTR) {
+            // Interrupted by a signal: wait again
+        }
+        if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) break;
+
+        // The semaphore counts published jobs, but a producer may still
+        // be finishing the cell it claimed
+        while (!hs_queue_pop(&p->jobs, &job)) sched_yield();
+
+        uint64_t t = trace_begin();
+        crypto_scalarmult(job.shared_secret, job.private_key,
+                          job.peer_public_key);
+        trace_end(TRACE_SCALARMULT, t);
+
+        // The reactor never has more jobs in flight than its inbox holds,
+        // so this only waits if it is still draining an older batch
+        HsInbox *in = job.inbox;
+        while (hs_queue_push(&in->done, &job) < 0) sched_yield();
+        memset(job.shared_secret, 0, sizeof(job.shared_secret));
+
+        // Signal the reactor unless a signal is already pending
+        if (__atomic_exchange_n(&in->notified, 1, __ATOMIC_SEQ_CST) == 0) {
+            uint64_t one = 1;
+            if (write(in->event_fd, &one, sizeof(one)) < 0) {
+                // Counter overflow is impossible: the reactor reads it
+            }
+        }
+    }
+    return NULL;
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int hs_pool_start(HsPool *p, int workers)
+{
+    memset(p, 0, sizeof(*p));
+    if (workers < 1 || hs_queue_init(&p->jobs, HS_POOL_JOBS) < 0) {
+        return -1;
+    }
+    p->threads = calloc((size_t)workers, sizeof(pthread_t));
+    if (p->threads == NULL || sem_init(&p->ready, 0, 0) < 0) {
+        free(p->threads);
+        hs_queue_free(&p->jobs);
+        return -1;
+    }
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&p->threads[i], NULL, hs_worker_main, p) != 0) {
+            break;
+        }
+        p->count++;
+    }
+    if (p->count == 0) {
+        hs_pool_stop(p);
+        return -1;
+    }
+    return 0;
+}
+
+void hs_pool_stop(HsPool *p)
+{
+    if (p->threads == NULL) return;
+
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < p->count; i++) {
+        sem_post(&p->ready);  // Wake every sleeping worker
+    }
+    for (int i = 0; i < p->count; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+    sem_destroy(&p->ready);
+    free(p->threads);
+    p->threads = NULL;
+    p->count = 0;
+    hs_queue_free(&p->jobs);
+}
+
+int hs_pool_submit(HsPool *p, const HsJob *job)
+{
+    if (hs_queue_push(&p->jobs, job) < 0) return -1;
+    sem_post(&p->ready);
+    return 0;
+}
+
+int hs_inbox_init(HsInbox *in)
+{
+    if (hs_queue_init(&in->done, HS_INBOX_SIZE) < 0) return -1;
+    in->notified = 0;
+    in->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (in->event_fd < 0) {
+        hs_queue_free(&in->done);
+        return -1;
+    }
+    return 0;
+}
+
+void hs_inbox_free(HsInbox *in)
+{
+    if (in->event_fd >= 0) close(in->event_fd);
+    in->event_fd = -1;
+    hs_queue_free(&in->done);
+}
+
+void hs_inbox_rearm(HsInbox *in)
+{
+    uint64_t value;
+    if (read(in->event_fd, &value, sizeof(value)) < 0) {
+        // EAGAIN: nothing was signalled
+    }
+    // A worker that pushes after this store writes the eventfd again
+    __atomic_store_n(&in->notified, 0, __ATOMIC_SEQ_CST);
+}
+
+int hs_inbox_pop(HsInbox *in, HsJob *job)
+{
+    return hs_queue_pop(&in->done, job);
+}
+
+#endif // __linux__
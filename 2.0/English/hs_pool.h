@@ -0,0 +1,104 @@
+#ifndef HS_POOL_H
+#define HS_POOL_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For KEY_SIZE, SHARED_SECRET_SIZE
+
+#ifdef __linux__
+
+#include <pthread.h>      // For the worker threads
+#include <semaphore.h>    // For sem_t (idle workers sleep on it)
+
+// ========================================================================
+// Handshake worker pool
+// ========================================================================
+// crypto_scalarmult() takes tens of microseconds. Computed inside an
+// event loop, a burst of new connections would stall every established
+// session of that loop. With a pool, the loop only copies the peer key
+// into a job:
+//
+//   reactor --submit--> [ job queue ] --> worker threads
+//   reactor <--eventfd-- [ inbox of the reactor ] <--+
+//
+// Both queues are bounded lock-free rings (one sequence number per cell)
+// that any number of threads may push to and pop from. Workers sleep on a
+// semaphore while there is nothing to do; the reactor waits for its inbox
+// with the eventfd in its epoll set or io_uring.
+
+#define HS_POOL_JOBS 1024           // Capacity of the job queue
+#define HS_INBOX_SIZE 256           // Jobs one reactor may have in flight
+
+struct HsInbox;
+
+// One key exchange. The worker fills in 'shared_secret'.
+typedef struct {
+    int fd;                                  // Connection descriptor
+    uint64_t id;                             // Connection id (detects a
+                                             // descriptor reused after
+                                             // the connection closed)
+    const uint8_t *private_key;              // Server private key
+    uint8_t peer_public_key[KEY_SIZE];       // Client public key
+    uint8_t shared_secret[SHARED_SECRET_SIZE];  // Result
+    struct HsInbox *inbox;                   // Where the result goes
+} HsJob;
+
+typedef struct {
+    size_t seq;                              // Cell sequence number
+    HsJob job;                               // Cell payload
+} HsCell;
+
+// Bounded multi-producer multi-consumer ring
+typedef struct {
+    HsCell *cells;                           // Power-of-two cell array
+    size_t mask;                             // Capacity - 1
+    size_t enqueue_pos __attribute__((aligned(64)));  // Next push
+    size_t dequeue_pos __attribute__((aligned(64)));  // Next pop
+} HsQueue;
+
+// Completed jobs of one reactor
+typedef struct HsInbox {
+    HsQueue done;                            // Finished jobs
+    int event_fd;                            // Signalled after a push
+    int notified;                            // eventfd already written
+} HsInbox;
+
+typedef struct {
+    HsQueue jobs;                            // Jobs not yet picked up
+    sem_t ready;                             // Counts queued jobs
+    pthread_t *threads;                      // Worker threads
+    int count;                               // Number of workers
+    volatile int stop;                       // Set by hs_pool_stop()
+} HsPool;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Starts 'workers' threads. Returns 0 on success, -1 on error.
+int hs_pool_start(HsPool *p, int workers);
+
+// Stops and joins the workers. Jobs still queued are discarded, so stop
+// the pool before freeing the inboxes it delivers to.
+void hs_pool_stop(HsPool *p);
+
+// Queues a job ('job->inbox' must be set). Returns 0, or -1 if the queue
+// is full; the caller then computes the shared secret itself.
+int hs_pool_submit(HsPool *p, const HsJob *job);
+
+// Creates the inbox of one reactor. Returns 0 or -1 (errno is set).
+int hs_inbox_init(HsInbox *in);
+
+// Releases the inbox and closes its eventfd
+void hs_inbox_free(HsInbox *in);
+
+// Acknowledges the eventfd before the inbox is drained, so that a job
+// pushed while draining signals the eventfd again
+void hs_inbox_rearm(HsInbox *in);
+
+// Takes one finished job out of the inbox. Returns 1 or 0 when empty.
+int hs_inbox_pop(HsInbox *in, HsJob *job);
+
+#endif // __linux__
+#endif // HS_POOL_H
@@ -0,0 +1,630 @@
+#define _GNU_SOURCE       // For ppoll()
+#include "loadgen.h"
+#include "hist.h"         // For the latency histograms
+#include "drng.h"         // For rdrand_get_bytes()
+
+#ifndef _WIN32
+
+#include <errno.h>        // For errno, EAGAIN, EINPROGRESS
+#include <fcntl.h>        // For fcntl(), O_NONBLOCK
+#include <netinet/tcp.h>  // For TCP_NODELAY
+#include <poll.h>         // For ppoll()
+#include <pthread.h>      // For the worker threads
+#include <time.h>         // For clock_gettime()
+
+#define LOADGEN_TX_SIZE 4096            // Output buffer per connection
+                                        // (larger for large messages)
+#define LOADGEN_RX_SIZE 4096            // Reassembly ring per connection
+#define LOADGEN_RETRY_MS 100            // Pause after a failed session
+#define LOADGEN_NS 1000000000ull        // Nanoseconds per second
+
+// States of a connection
+#define LOADGEN_CLOSED 0                // Between two sessions
+#define LOADGEN_CONNECTING 1            // connect() in progress
+#define LOADGEN_KEY 2                   // Waiting for the server key
+#define LOADGEN_PROBE 3                 // Waiting for the first echo
+#define LOADGEN_READY 4                 // Messages on the schedule
+
+// Bytes one message may take in the output: FRAME_REKEY and FRAME_DATA
+#define LOADGEN_FRAME_ROOM(size) \
+    (2 * (FRAME_HEADER_MAX + 1) + RATCHET_REKEY_SIZE + (size) + TAG_SIZE)
+
+// ========================================================================
+// State of one connection and of one thread
+// ========================================================================
+typedef struct {
+    int fd;                             // Socket (-1: none)
+    int state;                          // LOADGEN_*
+    FrameBuffer rx;                     // Bytes received, not yet parsed
+    uint8_t *tx;                        // Bytes not yet written
+    size_t tx_len, tx_cap;
+    Ratchet ratchet;                    // Message keys of the session
+    uint64_t *intended;                 // Intended send times of the
+    size_t inflight_cap;                // echoes awaited (a ring of
+    uint64_t head, tail;                // 'inflight_cap' entries)
+    uint64_t next_ns;                   // Intended time of the next
+                                        // message (0: not scheduled)
+    uint64_t offset_ns;                 // Its first message after the
+                                        // first session is confirmed
+    uint64_t retry_ns;                  // Earliest reconnect
+    uint64_t connect_ns;                // When the session was started
+    uint64_t session_sent;              // Messages of this session
+} LoadgenConn;
+
+typedef struct {
+    const LoadgenConfig *cfg;
+    struct sockaddr_in addr;            // Server address
+    const uint8_t *msg;                 // Contents of every message
+    LoadgenConn *conns;                 // Connections of this thread
+    struct pollfd *pfd;                 // One per connection
+    int n;
+    uint64_t interval_ns;               // Between two messages of one
+                                        // connection (0: no schedule)
+    uint64_t start_ns;                  // Start of the run
+    uint64_t end_ns;                    // No message is due after it
+    uint8_t *scratch;                   // frame_pop() copy of a frame
+    size_t scratch_len;
+    uint8_t *plain;                     // Decrypted echo
+    Histogram lat;                      // Echo latencies (ns)
+    Histogram hs;                       // Handshake latencies (ns)
+    uint64_t handshakes, sent, echoes, errors, lost;
+    uint64_t unsent;                    // Due, but never sent
+    pthread_t thread;
+} LoadgenThread;
+
+static uint64_t loadgen_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * LOADGEN_NS + (uint64_t)ts.tv_nsec;
+}
+
+// ========================================================================
+// Sessions
+// ========================================================================
+
+// Ends the session of 'c'. After a failure its awaited echoes are lost
+// and the next session waits LOADGEN_RETRY_MS.
+static void loadgen_close(LoadgenThread *t, LoadgenConn *c, int failed,
+                          uint64_t now)
+{
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->state = LOADGEN_CLOSED;
+    if (failed) {
+        t->errors++;
+        t->lost += c->tail - c->head;
+        c->retry_ns = now + LOADGEN_RETRY_MS * 1000000ull;
+    }
+    c->head = c->tail = 0;
+    c->tx_len = 0;
+    c->rx.head = c->rx.tail = 0;
+    ratchet_wipe(&c->ratchet);
+}
+
+// Starts a non-blocking connect()
+static void loadgen_open(LoadgenThread *t, LoadgenConn *c, uint64_t now)
+{
+    int one = 1;
+
+    c->connect_ns = now;
+    c->session_sent = 0;
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0 || fcntl(c->fd, F_SETFL,
+                           fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        loadgen_close(t, c, 1, now);
+        return;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&t->addr, sizeof(t->addr)) == 0) {
+        c->state = LOADGEN_KEY;
+    } else if (errno == EINPROGRESS) {
+        c->state = LOADGEN_CONNECTING;
+    } else {
+        loadgen_close(t, c, 1, now);
+    }
+}
+
+// ========================================================================
+// Messages
+// ========================================================================
+
+// Appends the next message to the output of 'c', behind a FRAME_REKEY
+// when its key is due, and remembers when it should have left
+static void loadgen_seal(LoadgenThread *t, LoadgenConn *c,
+                         uint64_t intended)
+{
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint8_t *out = c->tx + c->tx_len;
+    uint64_t clen = 0;
+    size_t n = 0;
+
+    if (ratchet_due(&c->ratchet.tx, &t->cfg->rekey)) {
+        n = frame_encode_header(out, FRAME_REKEY, RATCHET_REKEY_SIZE);
+        ratchet_rekey(&c->ratchet.tx, out + n);
+        n += RATCHET_REKEY_SIZE;
+    }
+    ratchet_nonce(&c->ratchet.tx, nonce);
+    ratchet_count(&c->ratchet.tx, t->cfg->size);
+    n += frame_encode_header(out + n, FRAME_DATA, t->cfg->size + TAG_SIZE);
+    crypto_aead_encrypt(out + n, &clen, t->msg, t->cfg->size, nonce,
+                        c->ratchet.tx.key);
+    c->tx_len += n + (size_t)clen;
+
+    c->intended[c->tail++ % c->inflight_cap] = intended;
+    c->session_sent++;
+    t->sent++;
+}
+
+// ========================================================================
+// Key exchange
+// ========================================================================
+
+// The server key has arrived: a new key pair and the session key, as
+// ./client does. The public key and a first message (the probe) are the
+// first output of the session. Returns 1, or 0 if the key is not
+// complete yet.
+static int loadgen_handshake(LoadgenThread *t, LoadgenConn *c)
+{
+    uint8_t server_key[KEY_SIZE], private_key[KEY_SIZE];
+    uint8_t secret[SHARED_SECRET_SIZE];
+
+    if (frame_buffer_used(&c->rx) < KEY_SIZE) return 0;
+    for (size_t got = 0; got < KEY_SIZE;) {
+        size_t avail;
+        const uint8_t *p = frame_buffer_read_ptr(&c->rx, &avail);
+        if (avail > KEY_SIZE - got) avail = KEY_SIZE - got;
+        memcpy(server_key + got, p, avail);
+        frame_buffer_consume(&c->rx, avail);
+        got += avail;
+    }
+
+    rdrand_get_bytes(KEY_SIZE, private_key);
+    crypto_scalarmult_base(c->tx, private_key);
+    c->tx_len = KEY_SIZE;
+    crypto_scalarmult(secret, private_key, server_key);
+    ratchet_init(&c->ratchet, secret, SHARED_SECRET_SIZE, RATCHET_CLIENT);
+    memset(private_key, 0, sizeof(private_key));
+    memset(secret, 0, sizeof(secret));
+
+    // The client cannot see when the server has derived the key too:
+    // the echo of the probe tells, and ends the handshake
+    loadgen_seal(t, c, c->connect_ns);
+    c->state = LOADGEN_PROBE;
+    return 1;
+}
+
+// The echo of the probe came back at 'now': the handshake is complete
+static void loadgen_confirmed(LoadgenThread *t, LoadgenConn *c,
+                              uint64_t now)
+{
+    c->state = LOADGEN_READY;
+    t->handshakes++;
+    hist_record(&t->hs, now - c->connect_ns);
+
+    // The schedule starts with the first session and goes on across
+    // reconnects: messages due meanwhile leave late and count as late
+    if (t->interval_ns != 0 && c->next_ns == 0) {
+        c->next_ns = now + c->offset_ns;
+    }
+}
+
+// ========================================================================
+// Schedule and I/O
+// ========================================================================
+
+// Queues every message of 'c' that is due at 'now'. Returns when the
+// next one is due, or 0 if it waits for an echo or for output room.
+static uint64_t loadgen_stage(LoadgenThread *t, LoadgenConn *c,
+                              uint64_t now)
+{
+    const LoadgenConfig *cfg = t->cfg;
+
+    for (;;) {
+        if (cfg->reconnect != 0 && c->session_sent >= cfg->reconnect) {
+            return 0;
+        }
+        if (c->tail - c->head >= c->inflight_cap ||
+            c->tx_cap - c->tx_len < LOADGEN_FRAME_ROOM(cfg->size)) {
+            return 0;
+        }
+        if (t->interval_ns == 0) {
+            loadgen_seal(t, c, now);    // Closed loop, no schedule
+            continue;
+        }
+        if (c->next_ns >= t->end_ns) return 0;
+        if (c->next_ns > now) return c->next_ns;
+        loadgen_seal(t, c, c->next_ns);
+        c->next_ns += t->interval_ns;
+    }
+}
+
+// Writes what the socket takes. Returns 0, or -1 on an error.
+static int loadgen_flush(LoadgenConn *c)
+{
+    size_t off = 0;
+
+    while (off < c->tx_len) {
+        ssize_t n = write(c->fd, c->tx + off, c->tx_len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            break;
+        }
+        off += (size_t)n;
+    }
+    memmove(c->tx, c->tx + off, c->tx_len - off);
+    c->tx_len -= off;
+    return 0;
+}
+
+// Handles the frames received for an established session: every echo
+// is checked against the message and its latency recorded.
+// Returns 0, or -1 if the session failed.
+static int loadgen_frames(LoadgenThread *t, LoadgenConn *c, uint64_t now)
+{
+    const LoadgenConfig *cfg = t->cfg;
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint64_t len = 0;
+    Frame f;
+    int rc;
+
+    while ((rc = frame_pop(&c->rx, &f, t->scratch, t->scratch_len,
+                           t->scratch_len)) == 1) {
+        if (f.type == FRAME_REKEY) {
+            if (ratchet_accept(&c->ratchet.rx, &f) != 0) return -1;
+            continue;
+        }
+        if (f.type != FRAME_DATA) continue;  // Tickets, keepalives
+
+        ratchet_nonce(&c->ratchet.rx, nonce);
+        if (c->head == c->tail || f.len != cfg->size + TAG_SIZE ||
+            crypto_aead_decrypt(t->plain, &len, NULL, f.payload, f.len,
+                                nonce, c->ratchet.rx.key) != 0 ||
+            len != cfg->size || memcmp(t->plain, t->msg, cfg->size) != 0) {
+            return -1;
+        }
+        ratchet_count(&c->ratchet.rx, cfg->size);
+        uint64_t at = c->intended[c->head++ % c->inflight_cap];
+        t->echoes++;
+        if (c->state == LOADGEN_PROBE) {
+            loadgen_confirmed(t, c, now);
+        } else {
+            hist_record(&t->lat, now - at);
+        }
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+// Reads everything that arrived for 'c'. Every read is timed on its
+// own, not with the wakeup. Returns 0, or -1 if the session failed or
+// the server closed it.
+static int loadgen_read(LoadgenThread *t, LoadgenConn *c)
+{
+    for (;;) {
+        int n = frame_buffer_fill(c->fd, &c->rx);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+        if (c->state == LOADGEN_KEY) loadgen_handshake(t, c);
+        if (c->state >= LOADGEN_PROBE &&
+            loadgen_frames(t, c, loadgen_now_ns()) < 0) {
+            return -1;
+        }
+    }
+}
+
+// ========================================================================
+// Worker thread: its connections in one poll() loop
+// ========================================================================
+
+// Handles the events of one connection
+static void loadgen_event(LoadgenThread *t, LoadgenConn *c, short revents,
+                          uint64_t now)
+{
+    if (c->state == LOADGEN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (revents == 0) return;
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+            err != 0) {
+            loadgen_close(t, c, 1, now);
+            return;
+        }
+        c->state = LOADGEN_KEY;
+    }
+    if ((revents & (POLLIN | POLLERR | POLLHUP)) &&
+        loadgen_read(t, c) < 0) {
+        loadgen_close(t, c, 1, now);
+        return;
+    }
+    if ((revents & POLLOUT) && c->tx_len > 0 && loadgen_flush(c) < 0) {
+        loadgen_close(t, c, 1, now);
+    }
+}
+
+static void *loadgen_worker(void *arg)
+{
+    LoadgenThread *t = (LoadgenThread *)arg;
+    const LoadgenConfig *cfg = t->cfg;
+    uint64_t drain_ns = 0;
+
+    for (;;) {
+        uint64_t now = loadgen_now_ns();
+        int draining = now >= t->end_ns;
+        if (draining && drain_ns == 0) {
+            drain_ns = now + LOADGEN_DRAIN_MS * 1000000ull;
+        }
+        uint64_t wake = draining ? drain_ns : t->end_ns;
+        int busy = 0;  // Echoes still awaited
+
+        for (int i = 0; i < t->n; i++) {
+            LoadgenConn *c = &t->conns[i];
+
+            if (draining && c->state < LOADGEN_PROBE) {
+                loadgen_close(t, c, 0, now);  // Not a session yet
+            } else if (c->state == LOADGEN_CLOSED) {
+                if (now >= c->retry_ns) {
+                    loadgen_open(t, c, now);
+                } else if (c->retry_ns < wake) {
+                    wake = c->retry_ns;
+                }
+            }
+            if (c->state >= LOADGEN_PROBE) {
+                // A schedule that fell behind catches up while the
+                // echoes are drained
+                if (c->state == LOADGEN_READY &&
+                    (!draining || t->interval_ns != 0)) {
+                    uint64_t due = loadgen_stage(t, c, now);
+                    if (due != 0 && due < wake) wake = due;
+                }
+                if (c->tx_len > 0 && loadgen_flush(c) < 0) {
+                    loadgen_close(t, c, 1, now);
+                } else if (c->state == LOADGEN_READY &&
+                           cfg->reconnect != 0 &&
+                           c->session_sent >= cfg->reconnect &&
+                           c->head == c->tail && c->tx_len == 0) {
+                    loadgen_close(t, c, 0, now);  // Next session
+                    if (!draining) loadgen_open(t, c, now);
+                }
+            }
+            busy |= c->head != c->tail ||
+                    (c->state == LOADGEN_READY && t->interval_ns != 0 &&
+                     c->next_ns < t->end_ns);
+
+            t->pfd[i].fd = c->fd;  // -1: ignored by poll()
+            t->pfd[i].events = POLLIN;
+            if (c->state == LOADGEN_CONNECTING || c->tx_len > 0) {
+                t->pfd[i].events |= POLLOUT;
+            }
+            t->pfd[i].revents = 0;
+        }
+        if (draining && (!busy || now >= drain_ns)) break;
+
+        // Sleep until the next message is due
+        uint64_t wait = wake > now ? wake - now : 0;
+        struct timespec ts = { (time_t)(wait / LOADGEN_NS),
+                               (long)(wait % LOADGEN_NS) };
+        if (ppoll(t->pfd, (nfds_t)t->n, &ts, NULL) < 0 && errno != EINTR) {
+            break;
+        }
+
+        now = loadgen_now_ns();
+        for (int i = 0; i < t->n; i++) {
+            if (t->conns[i].fd >= 0 && t->pfd[i].fd == t->conns[i].fd) {
+                loadgen_event(t, &t->conns[i], t->pfd[i].revents, now);
+            }
+        }
+    }
+
+    // Echoes that did not come back within LOADGEN_DRAIN_MS, and
+    // messages of the schedule that never left
+    for (int i = 0; i < t->n; i++) {
+        LoadgenConn *c = &t->conns[i];
+        uint64_t next = c->next_ns != 0 ? c->next_ns
+                                        : t->start_ns + c->offset_ns;
+        if (t->interval_ns != 0 && next < t->end_ns) {
+            t->unsent += (t->end_ns - next + t->interval_ns - 1) /
+                         t->interval_ns;
+        }
+        t->lost += c->tail - c->head;
+        loadgen_close(t, c, 0, 0);
+    }
+    return NULL;
+}
+
+// ========================================================================
+// Setup and report
+// ========================================================================
+
+// Allocates the connections of 't'. Returns 0, or -1 if out of memory.
+static int loadgen_thread_init(LoadgenThread *t, int first, int n)
+{
+    const LoadgenConfig *cfg = t->cfg;
+    size_t frame = LOADGEN_FRAME_ROOM(cfg->size);
+
+    hist_init(&t->lat);
+    hist_init(&t->hs);
+    t->n = n;
+    t->conns = calloc((size_t)n, sizeof(*t->conns));
+    t->pfd = calloc((size_t)n, sizeof(*t->pfd));
+    t->scratch_len = cfg->size + TAG_SIZE + BUFFER_SIZE;  // Or a ticket
+    t->scratch = malloc(t->scratch_len);
+    t->plain = malloc(cfg->size + TAG_SIZE);
+    if (t->conns == NULL || t->pfd == NULL || t->scratch == NULL ||
+        t->plain == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        LoadgenConn *c = &t->conns[i];
+        c->fd = -1;
+        c->inflight_cap = cfg->open_loop ? LOADGEN_INFLIGHT : 1;
+        c->intended = malloc(c->inflight_cap * sizeof(*c->intended));
+        c->tx_cap = LOADGEN_TX_SIZE > 2 * frame ? LOADGEN_TX_SIZE
+                                                : 2 * frame;
+        c->tx = malloc(c->tx_cap);
+        // Spread the first messages over one interval
+        c->offset_ns = t->interval_ns * (uint64_t)(first + i) /
+                       (uint64_t)cfg->connections;
+        if (c->intended == NULL || c->tx == NULL ||
+            frame_buffer_init(&c->rx, LOADGEN_RX_SIZE > 2 * frame
+                                      ? LOADGEN_RX_SIZE
+                                      : 2 * frame) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void loadgen_thread_free(LoadgenThread *t)
+{
+    for (int i = 0; t->conns != NULL && i < t->n; i++) {
+        free(t->conns[i].intended);
+        free(t->conns[i].tx);
+        frame_buffer_free(&t->conns[i].rx);
+    }
+    free(t->conns);
+    free(t->pfd);
+    free(t->scratch);
+    free(t->plain);
+}
+
+// Prints one line of percentiles (milliseconds)
+static void loadgen_print_latency(const char *name, const Histogram *h)
+{
+    printf("  %-10s", name);
+    if (h->total == 0) {
+        printf(" (none)\n");
+        return;
+    }
+    printf(" %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+           hist_percentile(h, 50.0) / 1e6, hist_percentile(h, 90.0) / 1e6,
+           hist_percentile(h, 99.0) / 1e6, hist_percentile(h, 99.9) / 1e6,
+           h->max / 1e6, (double)h->sum / (double)h->total / 1e6);
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int loadgen_run(const LoadgenConfig *cfg, const char *host, int port)
+{
+    struct hostent *server = gethostbyname(host);
+    if (server == NULL) return -1;
+
+    int threads = cfg->threads;
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    if (threads > cfg->connections) threads = cfg->connections;
+
+    LoadgenThread *t = calloc((size_t)threads, sizeof(*t));
+    uint8_t *msg = malloc(cfg->size);
+    if (t == NULL || msg == NULL) {
+        free(t);
+        free(msg);
+        return -1;
+    }
+    for (size_t i = 0; i < cfg->size; i++) {
+        msg[i] = (uint8_t)('a' + i % 26);  // Printable, not a command
+    }
+
+    // A write to a session the server closed fails instead of
+    // killing the process
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t start = loadgen_now_ns();
+    uint64_t end = start + (uint64_t)cfg->duration * LOADGEN_NS;
+    int first = 0, started = 0;
+    for (int i = 0; i < threads; i++) {
+        int n = cfg->connections / threads +
+                (i < cfg->connections % threads);
+        t[i].cfg = cfg;
+        t[i].msg = msg;
+        t[i].start_ns = start;
+        t[i].end_ns = end;
+        t[i].interval_ns = cfg->rate > 0
+            ? (uint64_t)((double)cfg->connections * 1e9 / cfg->rate)
+            : 0;
+        t[i].addr.sin_family = AF_INET;
+        memcpy(&t[i].addr.sin_addr.s_addr, server->h_addr,
+               server->h_length);
+        t[i].addr.sin_port = htons(port);
+        if (loadgen_thread_init(&t[i], first, n) != 0 ||
+            pthread_create(&t[i].thread, NULL, loadgen_worker, &t[i]) != 0) {
+            perror("Cannot start the load threads");
+            break;
+        }
+        started++;
+        first += n;
+    }
+
+    // Everything the threads counted
+    Histogram *lat = malloc(sizeof(*lat)), *hs = malloc(sizeof(*hs));
+    uint64_t handshakes = 0, sent = 0, echoes = 0, errors = 0, lost = 0;
+    uint64_t unsent = 0;
+    if (lat != NULL) hist_init(lat);
+    if (hs != NULL) hist_init(hs);
+    for (int i = 0; i < started; i++) {
+        pthread_join(t[i].thread, NULL);
+        if (lat != NULL) hist_merge(lat, &t[i].lat);
+        if (hs != NULL) hist_merge(hs, &t[i].hs);
+        handshakes += t[i].handshakes;
+        sent += t[i].sent;
+        echoes += t[i].echoes;
+        errors += t[i].errors;
+        lost += t[i].lost;
+        unsent += t[i].unsent;
+    }
+    for (int i = 0; i < threads; i++) loadgen_thread_free(&t[i]);
+    free(t);
+    free(msg);
+
+    int rc = started == threads && lat != NULL && hs != NULL &&
+             handshakes > 0 ? 0 : -1;
+    if (rc == 0) {
+        double secs = (double)cfg->duration;
+        printf("Load: %d connections on %d threads, %zu-byte messages, ",
+               cfg->connections, threads, cfg->size);
+        if (cfg->rate > 0) {
+            printf("%s loop at %.0f msg/s, ",
+                   cfg->open_loop ? "open" : "closed", cfg->rate);
+        } else {
+            printf("closed loop, ");
+        }
+        printf("%d s\n", cfg->duration);
+        printf("  handshakes %10llu %12.1f/s\n",
+               (unsigned long long)handshakes, handshakes / secs);
+        printf("  messages   %10llu %12.1f/s %9.2f MB/s each way\n",
+               (unsigned long long)echoes, echoes / secs,
+               echoes * (double)cfg->size / secs / 1e6);
+        printf("  errors     %10llu   (%llu of %llu messages without "
+               "echo", (unsigned long long)errors,
+               (unsigned long long)lost, (unsigned long long)sent);
+        if (unsent != 0) {
+            printf(", %llu due but not sent", (unsigned long long)unsent);
+        }
+        printf(")\n");
+        printf("  latency ms       p50       p90       p99     p99.9"
+               "       max      mean\n");
+        loadgen_print_latency("handshake", hs);
+        loadgen_print_latency("echo", lat);
+        printf(cfg->rate > 0
+               ? "  (echo latency from the intended send time)\n"
+               : "  (echo latency from the send time: no --rate, no "
+                 "schedule)\n");
+    }
+    free(lat);
+    free(hs);
+    return rc;
+}
+
+#endif // _WIN32
+
+// The options are parsed on every platform (and refused on Windows)
+void loadgen_defaults(LoadgenConfig *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->connections = 1;
+    cfg->size = 64;
+    cfg->duration = 10;
+    ratchet_limits_default(&cfg->rekey);
+}
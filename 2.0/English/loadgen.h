@@ -0,0 +1,65 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For the session keys and the frame layer
+
+// ========================================================================
+// Load generator (./client <host> <port> --bench)
+// ========================================================================
+// Opens 'connections' sessions to an echoing event loop server (--epoll,
+// --uring or --threads, without --room and --relay), one thread each,
+// and sends messages of 'size' bytes for 'duration' seconds:
+//
+// - closed loop (default): the next message leaves once the echo of the
+//   last one has arrived, at 'rate' messages/s over all connections if
+//   it is set, otherwise at once.
+// - open loop (--open-loop, needs --rate): messages leave on their
+//   schedule whether or not the echoes keep up.
+//
+// With a rate, every message has an intended send time on a fixed
+// schedule, and its latency is counted from that time, not from when it
+// actually left. A server that stalls for a second therefore shows a
+// second of latency on every message that should have left during the
+// stall, instead of one slow message and a pause in the samples
+// (coordinated omission).
+//
+// Prints handshakes/s, messages/s, MB/s and the latency percentiles of
+// the handshakes and of the echoes. Linux and other POSIX systems only.
+// ========================================================================
+
+#define LOADGEN_INFLIGHT 4096           // Echoes awaited per connection
+                                        // (open loop)
+#define LOADGEN_DRAIN_MS 2000           // Wait for late echoes after the
+                                        // run
+
+typedef struct {
+    int connections;                    // --connections N (1)
+    int threads;                        // --threads N (0: one per CPU,
+                                        // at most 'connections')
+    size_t size;                        // --size BYTES (64)
+    double rate;                        // --rate N: messages/s over all
+                                        // connections (0: no schedule)
+    int duration;                       // --duration SEC (10)
+    int open_loop;                      // --open-loop
+    uint64_t reconnect;                 // --reconnect N: new session
+                                        // after N messages (0: never)
+    RatchetLimits rekey;                // --rekey-* of the client
+} LoadgenConfig;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// One connection, 64-byte messages as fast as possible for 10 seconds
+void loadgen_defaults(LoadgenConfig *cfg);
+
+#ifndef _WIN32
+// Runs the load against 'host':'port' and prints the results.
+// Returns 0, or -1 if the host is unknown or no session was opened.
+int loadgen_run(const LoadgenConfig *cfg, const char *host, int port);
+#endif
+
+#endif // LOADGEN_H
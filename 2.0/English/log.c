@@ -0,0 +1,290 @@
+#include "log.h"
+#include <stdarg.h>       // For va_list
+#include <stdio.h>        // For vsnprintf(), fwrite()
+#include <stdlib.h>       // For calloc(), atexit()
+#include <string.h>       // For strcmp(), memcpy()
+
+int log_level = LOG_INFO;
+int log_keys = 0;
+
+static const char *const log_names[] = { "error", "warn", "info", "debug" };
+static const char *const log_prefix[] = { "Error: ", "Warning: ", "",
+                                          "Debug: " };
+
+// ========================================================================
+// Helpers
+// ========================================================================
+
+// Formats one line with the prefix of its level into 'out'. Returns its
+// length (cut to 'size' - 1).
+static size_t log_format(char *out, size_t size, int level,
+                         const char *fmt, va_list ap)
+{
+    size_t n = strlen(log_prefix[level]);
+    memcpy(out, log_prefix[level], n);
+    int m = vsnprintf(out + n, size - n, fmt, ap);
+    if (m > 0) n += (size_t)m;
+    return n < size ? n : size - 1;
+}
+
+int log_parse_level(const char *name)
+{
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++) {
+        if (strcmp(name, log_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+void log_key(const char *label, const uint8_t *key, size_t len)
+{
+    char hex[LOG_LINE / 2];
+    size_t n = 0;
+
+    if (!log_keys) {
+        log_info("%s: (hidden, --log-keys shows it)", label);
+        return;
+    }
+    // 16 bytes per line, as hexdump() printed them
+    for (size_t i = 0; i < len && n + 4 < sizeof(hex); i++) {
+        n += (size_t)snprintf(hex + n, sizeof(hex) - n, "%02x", key[i]);
+        if ((i + 1) % 16 == 0 || i + 1 == len) hex[n++] = '\n';
+    }
+    hex[n] = '\0';
+    log_info("%s:\n%s", label, hex);
+}
+
+#ifdef _WIN32
+// ========================================================================
+// Windows: printed by the calling thread
+// ========================================================================
+void log_write(int level, const char *fmt, ...)
+{
+    char line[LOG_LINE];
+    va_list ap;
+
+    va_start(ap, fmt);
+    size_t n = log_format(line, sizeof(line), level, fmt, ap);
+    va_end(ap);
+    printf("%.*s\n", (int)n, line);
+}
+
+void log_flush(void)
+{
+    fflush(stdout);
+}
+
+size_t log_queued(void)
+{
+    return 0;
+}
+
+#else
+
+#include <pthread.h>      // For the flusher thread
+#include <time.h>         // For nanosleep()
+
+typedef struct {
+    uint16_t len;                       // Bytes of 'text' (no newline)
+    char text[LOG_LINE - sizeof(uint16_t)];
+} LogRecord;
+
+// Ring of one thread: the thread writes 'head', the flusher 'tail'
+typedef struct LogRing {
+    uint32_t head __attribute__((aligned(64)));  // Records published
+    uint32_t tail __attribute__((aligned(64)));  // Records written out
+    uint64_t dropped;                   // Lines lost to a full ring
+    int orphan;                         // The thread exited: free to
+                                        // take over
+    struct LogRing *next;               // All rings (never unlinked)
+    LogRecord rec[LOG_RING];
+} LogRing;
+
+// ========================================================================
+// State
+// ========================================================================
+static LogRing *log_rings;              // Rings of all threads
+static __thread LogRing *log_mine;      // Ring of this thread
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_owner;         // Marks the ring orphan at exit
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static char log_out[64 * 1024];         // Lines of one write (under
+                                        // log_drain_lock)
+
+// ========================================================================
+// Flusher
+// ========================================================================
+
+static void log_emit(size_t len)
+{
+    fwrite(log_out, 1, len, stdout);
+    fflush(stdout);
+}
+
+// Writes out the records of all rings. Returns the number of lines.
+// Caller holds log_drain_lock.
+static size_t log_drain(void)
+{
+    size_t used = 0, lines = 0;
+
+    for (LogRing *r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+        uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+        for (; tail != head; tail++, lines++) {
+            const LogRecord *rec = &r->rec[tail % LOG_RING];
+            if (used + rec->len + 1 > sizeof(log_out)) {
+                log_emit(used);
+                used = 0;
+            }
+            memcpy(log_out + used, rec->text, rec->len);
+            used += rec->len;
+            log_out[used++] = '\n';
+        }
+        __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+
+        uint64_t lost = __atomic_exchange_n(&r->dropped, 0,
+                                            __ATOMIC_RELAXED);
+        if (lost > 0) {
+            if (used + 80 > sizeof(log_out)) {
+                log_emit(used);
+                used = 0;
+            }
+            used += (size_t)snprintf(log_out + used, 80,
+                                     "%s%llu log lines dropped "
+                                     "(ring full)\n", log_prefix[LOG_WARN],
+                                     (unsigned long long)lost);
+        }
+    }
+    if (used > 0) log_emit(used);
+    return lines;
+}
+
+// Background thread: drains the rings, sleeps LOG_FLUSH_MS when they
+// were empty
+static void *log_flusher(void *arg)
+{
+    const struct timespec idle = { 0, LOG_FLUSH_MS * 1000000L };
+
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&log_drain_lock);
+        size_t lines = log_drain();
+        pthread_mutex_unlock(&log_drain_lock);
+        if (lines == 0) nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+// At exit: the last lines. A thread that exits from a signal handler
+// may hold the lock already, so this gives up after 100 ms.
+static void log_exit(void)
+{
+    const struct timespec wait = { 0, 10 * 1000000L };
+
+    for (int i = 0; i < 10; i++) {
+        if (pthread_mutex_trylock(&log_drain_lock) == 0) {
+            log_drain();
+            pthread_mutex_unlock(&log_drain_lock);
+            return;
+        }
+        nanosleep(&wait, NULL);
+    }
+}
+
+// Called when a thread that logged exits
+static void log_release(void *ring)
+{
+    __atomic_store_n(&((LogRing *)ring)->orphan, 1, __ATOMIC_RELEASE);
+}
+
+static void log_init(void)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_key_create(&log_owner, log_release);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, log_flusher, NULL) != 0) {
+        perror("Log flusher");  // Lines still leave at log_flush()
+    }
+    pthread_attr_destroy(&attr);
+    atexit(log_exit);
+}
+
+// Returns the ring of the calling thread: the ring of a thread that
+// exited, or a new one. NULL if out of memory.
+static LogRing *log_ring(void)
+{
+    if (log_mine != NULL) return log_mine;
+    pthread_once(&log_once, log_init);
+
+    LogRing *r;
+    for (r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); r != NULL;
+         r = r->next) {
+        int orphan = 1;
+        if (__atomic_compare_exchange_n(&r->orphan, &orphan, 0, 0,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        r = calloc(1, sizeof(*r));
+        if (r == NULL) return NULL;
+        r->next = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&log_rings, &r->next, r, 0,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(log_owner, r);
+    log_mine = r;
+    return r;
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+void log_write(int level, const char *fmt, ...)
+{
+    LogRing *r = log_ring();
+    if (r == NULL) return;
+
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING) {
+        __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    LogRecord *rec = &r->rec[head % LOG_RING];
+    va_list ap;
+    va_start(ap, fmt);
+    rec->len = (uint16_t)log_format(rec->text, sizeof(rec->text), level,
+                                    fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void log_flush(void)
+{
+    if (__atomic_load_n(&log_rings, __ATOMIC_ACQUIRE) == NULL) return;
+    pthread_mutex_lock(&log_drain_lock);
+    log_drain();
+    pthread_mutex_unlock(&log_drain_lock);
+}
+
+size_t log_queued(void)
+{
+    size_t queued = 0;
+
+    for (LogRing *r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+        queued += __atomic_load_n(&r->head, __ATOMIC_RELAXED)
+                  - __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    }
+    return queued;
+}
+
+#endif // _WIN32
@@ -0,0 +1,91 @@
+#ifndef LOG_H
+#define LOG_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint8_t, uint32_t, uint64_t
+
+// ========================================================================
+// Leveled, asynchronous logger
+// ========================================================================
+// The event loops printed every message with printf() on the thread
+// that serves the sessions: when stdout is a slow terminal or a full
+// pipe, the whole loop waits for it. Log lines now leave through a
+// background thread:
+//
+// - Every thread that logs gets its own ring of LOG_RING records. The
+//   line is formatted into the next free record and published with one
+//   release store: no lock and no system call on the calling thread.
+// - A flusher thread copies the records of all rings into one buffer and
+//   writes it to stdout every LOG_FLUSH_MS (at once while there is more).
+//   Lines of one thread keep their order; lines of different threads may
+//   interleave by up to one flush.
+// - A full ring drops the line instead of waiting; the flusher reports
+//   how many lines were lost.
+// - Levels above LOG_MAX are removed at compile time (make
+//   LOG_MAX=LOG_DEBUG to keep the debug lines); the others are filtered
+//   at run time by log_level (--log-level).
+//
+// Keys (private keys, shared secrets, public keys) go through log_key(),
+// which prints "(hidden)" unless --log-keys was given.
+//
+// On Windows, log lines are printed at once by the calling thread.
+// Messages typed in the chat are not log lines: the chat prints them
+// itself, after log_flush().
+// ========================================================================
+
+#define LOG_ERROR 0                     // Session or server failures
+#define LOG_WARN  1                     // Refused frames, lost lines
+#define LOG_INFO  2                     // Connections, messages
+#define LOG_DEBUG 3                     // Frame-level events
+
+#ifndef LOG_MAX
+#define LOG_MAX LOG_INFO                // Highest level compiled in
+#endif
+
+#define LOG_LINE 512                    // Bytes per record (longer lines
+                                        // are cut)
+#define LOG_RING 512                    // Records per thread (256 KiB)
+#define LOG_FLUSH_MS 10                 // Flusher period when idle
+
+extern int log_level;                   // --log-level (LOG_INFO)
+extern int log_keys;                    // --log-keys: print key material
+
+// Logs a printf-style line (without the newline) at 'level'. Costs
+// nothing when 'level' is above LOG_MAX.
+#define log_at(level, ...)                                            \
+    do {                                                              \
+        if ((level) <= LOG_MAX && (level) <= log_level)               \
+            log_write((level), __VA_ARGS__);                          \
+    } while (0)
+
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Parses "error", "warn", "info" or "debug". Returns the level, or -1.
+int log_parse_level(const char *name);
+
+// Queues one line; use the log_* macros instead
+void log_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Logs "<label>:" and 'key' in hex at LOG_INFO, or "<label>: (hidden)"
+// without --log-keys
+void log_key(const char *label, const uint8_t *key, size_t len);
+
+// Writes every line queued so far before returning (before the chat
+// prints to stdout itself, and at exit)
+void log_flush(void);
+
+// Lines queued and not yet written out (0 on Windows)
+size_t log_queued(void);
+
+#endif // LOG_H
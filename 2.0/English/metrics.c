@@ -0,0 +1,232 @@
+#include "metrics.h"
+#include "drng.h"         // For drng_stats_get()
+#include "log.h"          // For log_queued()
+#include <stdio.h>        // For snprintf()
+#include <string.h>       // For strchr(), strncmp()
+
+#ifndef _WIN32
+#include <arpa/inet.h>    // For htonl(), htons()
+#include <netinet/in.h>   // For struct sockaddr_in
+#include <pthread.h>      // For the listener thread
+#include <stdlib.h>       // For atoi()
+#include <sys/socket.h>   // For socket(), accept(), send()
+#include <sys/time.h>     // For struct timeval
+#include <sys/un.h>       // For struct sockaddr_un
+#include <unistd.h>       // For close(), unlink()
+#endif
+
+// ========================================================================
+// Counter storage: one cache-line aligned slot per thread
+// ========================================================================
+int metrics_on = 0;
+__thread MetricsSlot *metrics_mine;     // NULL until the first add
+
+static MetricsSlot metrics_slots[METRICS_SLOTS];  // Counter slots
+static unsigned int metrics_next_slot = 0;        // Round-robin slot
+                                                  // assignment
+
+MetricsSlot *metrics_slot(void)
+{
+    if (metrics_mine == NULL) {
+        metrics_mine = &metrics_slots[__atomic_fetch_add(
+            &metrics_next_slot, 1, __ATOMIC_RELAXED) % METRICS_SLOTS];
+    }
+    return metrics_mine;
+}
+
+void metrics_get(uint64_t out[METRICS_COUNTERS])
+{
+    memset(out, 0, METRICS_COUNTERS * sizeof(uint64_t));
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        for (int c = 0; c < METRICS_COUNTERS; c++) {
+            out[c] += __atomic_load_n(&metrics_slots[i].v[c],
+                                      __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// ========================================================================
+// Exposition format
+// ========================================================================
+
+// Appends one metric with its HELP and TYPE lines
+static int metrics_put(char *out, size_t size, int used, const char *name,
+                       const char *type, const char *help, uint64_t value)
+{
+    if (used < 0 || (size_t)used >= size) return used;
+    return used + snprintf(out + used, size - (size_t)used,
+                           "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+                           name, help, name, type, name,
+                           (unsigned long long)value);
+}
+
+int metrics_format(char *out, size_t size)
+{
+    uint64_t c[METRICS_COUNTERS];
+    int n = 0;
+
+    metrics_get(c);
+    // Both counters of a gauge are read without a lock: the closing
+    // side may be ahead by a connection still being counted as opened
+    uint64_t active = c[METRIC_CONN_OPENED] > c[METRIC_CONN_CLOSED]
+                      ? c[METRIC_CONN_OPENED] - c[METRIC_CONN_CLOSED] : 0;
+    uint64_t queued = c[METRIC_HS_QUEUED] > c[METRIC_HS_DONE]
+                      ? c[METRIC_HS_QUEUED] - c[METRIC_HS_DONE] : 0;
+
+    n = metrics_put(out, size, n, "ecc_connections_active", "gauge",
+                    "Client connections open.", active);
+    n = metrics_put(out, size, n, "ecc_connections_total", "counter",
+                    "Client connections accepted.", c[METRIC_CONN_OPENED]);
+    n = metrics_put(out, size, n, "ecc_handshakes_total", "counter",
+                    "Sessions keyed (X25519 or ticket); rate() gives "
+                    "handshakes/s.", c[METRIC_HANDSHAKES]);
+    n = metrics_put(out, size, n, "ecc_handshake_queue_depth", "gauge",
+                    "Key exchanges waiting for a handshake worker or "
+                    "for their reactor.", queued);
+    n = metrics_put(out, size, n, "ecc_aead_encrypted_bytes_total",
+                    "counter", "Plaintext bytes sealed by the AEAD.",
+                    c[METRIC_ENCRYPTED_BYTES]);
+    n = metrics_put(out, size, n, "ecc_aead_decrypted_bytes_total",
+                    "counter", "Plaintext bytes opened by the AEAD.",
+                    c[METRIC_DECRYPTED_BYTES]);
+    n = metrics_put(out, size, n, "ecc_aead_decrypt_failures_total",
+                    "counter", "Frames that failed authentication.",
+                    c[METRIC_DECRYPT_FAILURES]);
+#ifndef DRNG_NO_STATS
+    DrngStats st;
+    drng_stats_get(&st);
+    n = metrics_put(out, size, n, "ecc_rdrand_retries_total", "counter",
+                    "Extra RDRAND attempts after an underflow.",
+                    st.retries);
+    n = metrics_put(out, size, n, "ecc_rdrand_failures_total", "counter",
+                    "RDRAND draws that failed after all retries.",
+                    st.failures);
+#endif
+    n = metrics_put(out, size, n, "ecc_log_queue_depth", "gauge",
+                    "Log lines queued for the flusher thread.",
+                    log_queued());
+    return n < 0 || (size_t)n < size ? n : (int)size - 1;
+}
+
+#ifdef _WIN32
+
+int metrics_start(const char *addr)
+{
+    (void)addr;
+    return -1;
+}
+
+#else
+
+// ========================================================================
+// Admin listener
+// ========================================================================
+
+// Answers one HTTP request on 'fd': GET /metrics (or /) is served, any
+// other path gets a 404
+static void metrics_serve(int fd)
+{
+    char req[1024];
+    char body[METRICS_BODY_SIZE];
+    char head[160];
+    size_t used = 0;
+
+    // A scraper that never sends its request does not block the others
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while (used < sizeof(req) - 1) {
+        ssize_t r = recv(fd, req + used, sizeof(req) - 1 - used, 0);
+        if (r <= 0) break;
+        used += (size_t)r;
+        req[used] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL) {
+            break;
+        }
+    }
+    req[used] = '\0';
+
+    int found = strncmp(req, "GET /metrics ", 13) == 0 ||
+                strncmp(req, "GET / ", 6) == 0;
+    int len = found ? metrics_format(body, sizeof(body))
+                    : snprintf(body, sizeof(body), "Not found\n");
+    int hlen = snprintf(head, sizeof(head),
+                        "HTTP/1.0 %s\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %d\r\n"
+                        "Connection: close\r\n\r\n",
+                        found ? "200 OK" : "404 Not Found", len);
+    send(fd, head, (size_t)hlen, MSG_NOSIGNAL);
+    send(fd, body, (size_t)len, MSG_NOSIGNAL);
+}
+
+// Thread body: one scrape at a time
+static void *metrics_main(void *arg)
+{
+    int lfd = (int)(intptr_t)arg;
+
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        metrics_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(const char *addr)
+{
+    int fd;
+
+    if (strchr(addr, '/') != NULL) {
+        struct sockaddr_un un;
+
+        if (strlen(addr) >= sizeof(un.sun_path)) return -1;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, addr);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        unlink(addr);  // Left over by an earlier run
+        if (bind(fd, (struct sockaddr *)&un, sizeof(un)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in in;
+        int port = atoi(addr);
+        int one = 1;
+
+        if (port <= 0 || port > 65535) return -1;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Local only
+        in.sin_port = htons((uint16_t)port);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr *)&in, sizeof(in)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, metrics_main,
+                            (void *)(intptr_t)fd);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        close(fd);
+        return -1;
+    }
+    metrics_on = 1;
+    return 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,83 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint64_t
+
+// ========================================================================
+// Server metrics (./server <port> --metrics ADDR)
+// ========================================================================
+// Counters for a monitoring system, served in the Prometheus text
+// exposition format by an admin listener on the loopback interface
+// (--metrics PORT) or a Unix socket (--metrics /path/to/socket):
+//
+//     curl -s http://127.0.0.1:9100/metrics
+//
+// The data path only adds to counters. Each thread adds to its own slot
+// of METRICS_COUNTERS counters, one cache line, with a relaxed atomic
+// add (threads share a slot only beyond METRICS_SLOTS threads, as in
+// drng.c). The slots are summed when the listener is scraped; gauges
+// (active connections, handshakes queued) are differences of two
+// counters. The RDRAND counters come from the statistics of drng.c,
+// the log queue from log.c.
+//
+// Without --metrics, metrics_add() returns at once. The listener is not
+// available on Windows.
+// ========================================================================
+
+#define METRICS_SLOTS 64                // Counter slots (threads)
+#define METRICS_BODY_SIZE 4096          // Largest scrape reply
+
+typedef enum {
+    METRIC_CONN_OPENED,                 // Connections accepted
+    METRIC_CONN_CLOSED,                 // Connections released
+    METRIC_HANDSHAKES,                  // Sessions keyed (X25519, ticket)
+    METRIC_HS_QUEUED,                   // Key exchanges handed to the
+                                        // handshake workers
+    METRIC_HS_DONE,                     // Their results taken back
+    METRIC_ENCRYPTED_BYTES,             // Plaintext bytes sealed
+    METRIC_DECRYPTED_BYTES,             // Plaintext bytes opened
+    METRIC_DECRYPT_FAILURES,            // Frames that did not
+                                        // authenticate
+    METRICS_COUNTERS
+} MetricId;
+
+// Counters of one thread, alone on their cache line
+typedef struct {
+    uint64_t v[METRICS_COUNTERS];
+} __attribute__((aligned(64))) MetricsSlot;
+
+extern int metrics_on;                  // Set by metrics_start()
+extern __thread MetricsSlot *metrics_mine;  // Slot of this thread
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Returns the slot of the calling thread, assigning one on the first
+// call
+MetricsSlot *metrics_slot(void);
+
+// Sums the slots of all threads into 'out'
+void metrics_get(uint64_t out[METRICS_COUNTERS]);
+
+// Writes the exposition text into 'out'. Returns its length.
+int metrics_format(char *out, size_t size);
+
+// Opens the admin listener on 127.0.0.1:'addr' (a port) or on the Unix
+// socket 'addr' (a path with a '/') and serves it from a thread.
+// Returns 0, or -1 if the socket cannot be opened.
+int metrics_start(const char *addr);
+
+// Adds 'n' to counter 'id' of the calling thread
+static inline void metrics_add(MetricId id, uint64_t n)
+{
+    if (!metrics_on) return;
+    MetricsSlot *s = metrics_mine != NULL ? metrics_mine : metrics_slot();
+    __atomic_fetch_add(&s->v[id], n, __ATOMIC_RELAXED);
+}
+
+#endif // METRICS_H
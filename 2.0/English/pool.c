@@ -0,0 +1,115 @@
+#include "pool.h"
+#include <stdlib.h>       // For malloc() and free()
+
+// Every slab starts with a link to the previous one; objects follow at
+// the next aligned offset
+#define POOL_SLAB_HEADER POOL_ALIGN
+
+// ========================================================================
+// Fixed-size pools
+// ========================================================================
+void pool_init(Pool *p, size_t size)
+{
+    if (size < sizeof(void *)) size = sizeof(void *);  // Holds the link
+    p->size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    p->free = NULL;
+    p->slabs = NULL;
+    p->in_use = 0;
+    p->slab_count = 0;
+}
+
+// Allocates one slab and puts all of its objects on the free list
+static int pool_grow(Pool *p)
+{
+    size_t count = (POOL_SLAB_SIZE - POOL_SLAB_HEADER) / p->size;
+    if (count == 0) count = 1;  // Objects larger than a slab
+
+    uint8_t *slab = malloc(POOL_SLAB_HEADER + count * p->size);
+    if (slab == NULL) return -1;
+    *(void **)slab = p->slabs;
+    p->slabs = slab;
+    p->slab_count++;
+
+    // Thread them in reverse, so objects are handed out in address order
+    for (size_t i = count; i-- > 0;) {
+        void *obj = slab + POOL_SLAB_HEADER + i * p->size;
+        *(void **)obj = p->free;
+        p->free = obj;
+    }
+    return 0;
+}
+
+void *pool_get(Pool *p)
+{
+    if (p->free == NULL && pool_grow(p) != 0) return NULL;
+
+    void *obj = p->free;
+    p->free = *(void **)obj;
+    p->in_use++;
+    return obj;
+}
+
+void pool_put(Pool *p, void *obj)
+{
+    *(void **)obj = p->free;
+    p->free = obj;
+    p->in_use--;
+}
+
+void pool_free(Pool *p)
+{
+    while (p->slabs != NULL) {
+        void *next = *(void **)p->slabs;
+        free(p->slabs);
+        p->slabs = next;
+    }
+    p->free = NULL;
+    p->in_use = 0;
+    p->slab_count = 0;
+}
+
+// ========================================================================
+// Buffer size classes
+// ========================================================================
+
+// Index of the smallest class holding 'len' bytes (POOL_CLASSES if none)
+static int buf_pool_class(size_t len)
+{
+    int i = 0;
+    size_t size = POOL_CLASS_MIN;
+    while (i < POOL_CLASSES && size < len) {
+        size <<= 2;
+        i++;
+    }
+    return i;
+}
+
+void buf_pool_init(BufPool *b)
+{
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        pool_init(&b->cls[i], (size_t)POOL_CLASS_MIN << 2 * i);
+    }
+}
+
+void *buf_pool_get(BufPool *b, size_t len)
+{
+    int i = buf_pool_class(len);
+    return i < POOL_CLASSES ? pool_get(&b->cls[i]) : NULL;
+}
+
+void buf_pool_put(BufPool *b, void *buf, size_t len)
+{
+    pool_put(&b->cls[buf_pool_class(len)], buf);
+}
+
+void buf_pool_free(BufPool *b)
+{
+    for (int i = 0; i < POOL_CLASSES; i++) pool_free(&b->cls[i]);
+}
+
+size_t buf_pool_slabs(const BufPool *b)
+{
+    size_t n = 0;
+    for (int i = 0; i < POOL_CLASSES; i++) n += b->cls[i].slab_count;
+    return n;
+}
@@ -0,0 +1,80 @@
+#ifndef POOL_H
+#define POOL_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint8_t
+
+// ========================================================================
+// Slab pools
+// ========================================================================
+// An event loop accepts and closes connections all the time. Taking
+// every session and every buffer from malloc() makes that churn a
+// stream of allocator calls and spreads the sessions over the heap.
+//
+// A Pool hands out objects of one size. It carves them from slabs of
+// POOL_SLAB_SIZE bytes and keeps released objects on a free list, so
+// once the pool has grown to the peak number of objects, getting and
+// putting one is a pointer swap. Slabs are only returned to the system
+// by pool_free().
+//
+// A BufPool is a set of pools for I/O buffers, one per size class
+// (256, 1024 and 4096 bytes). A buffer is taken from the smallest class
+// that holds the requested length and must be put back with the same
+// length.
+//
+// Pools are not locked: each event loop owns its own, which makes them
+// per-thread caches. Objects must be put back on the thread that got
+// them.
+// ========================================================================
+
+#define POOL_SLAB_SIZE 65536              // Bytes per slab
+#define POOL_ALIGN 16                     // Alignment of every object
+#define POOL_CLASSES 3                    // Buffer size classes
+#define POOL_CLASS_MIN 256                // Smallest class; each next one
+                                          // is four times larger
+#define POOL_CLASS_MAX (POOL_CLASS_MIN << 2 * (POOL_CLASSES - 1))
+                                          // Largest buffer (4096)
+
+typedef struct {
+    size_t size;                          // Object size (aligned)
+    void *free;                           // Released objects
+    void *slabs;                          // Slabs allocated so far
+    size_t in_use;                        // Objects handed out
+    size_t slab_count;                    // Slabs allocated so far
+} Pool;
+
+typedef struct {
+    Pool cls[POOL_CLASSES];               // 256, 1024 and 4096 bytes
+} BufPool;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Prepares an empty pool of 'size'-byte objects (no memory is allocated
+// until the first pool_get())
+void pool_init(Pool *p, size_t size);
+
+// Returns an object (not zeroed), or NULL if out of memory
+void *pool_get(Pool *p);
+
+// Puts an object back on the free list of its pool
+void pool_put(Pool *p, void *obj);
+
+// Frees every slab. All objects must have been put back.
+void pool_free(Pool *p);
+
+// Same for the buffer size classes. buf_pool_get() returns NULL if
+// 'len' is larger than POOL_CLASS_MAX or memory is exhausted.
+void buf_pool_init(BufPool *b);
+void *buf_pool_get(BufPool *b, size_t len);
+void buf_pool_put(BufPool *b, void *buf, size_t len);
+void buf_pool_free(BufPool *b);
+
+// Slabs allocated by all classes (for statistics)
+size_t buf_pool_slabs(const BufPool *b);
+
+#endif // POOL_H
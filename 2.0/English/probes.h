@@ -0,0 +1,47 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// ========================================================================
+// USDT probes (make USDT=1)
+// ========================================================================
+// Static probe points for SystemTap, bpftrace and perf, in provider
+// "ecc":
+//
+//     scalarmult_entry, scalarmult_return    crypto_scalarmult()
+//     aead_encrypt_entry(mlen)               crypto_aead_encrypt(),
+//     aead_encrypt_return(clen)              chain_seal()
+//     aead_decrypt_entry(clen)               crypto_aead_decrypt(),
+//     aead_decrypt_return(mlen, rc)          chain_open()
+//     rdrand_entry(n)                        rdrand_get_bytes()
+//     rdrand_return(n, got)
+//     conn_accept(fd)                        server.c, reactor.c
+//     conn_close(fd)
+//
+// Built with USDT=1 (needs <sys/sdt.h>, package systemtap-sdt-dev),
+// each probe is a single nop and a note in the ELF file; a tracer that
+// attaches replaces the nop with a breakpoint. Unattached, the cost is
+// the nop and keeping the arguments in registers:
+//
+//     bpftrace -e 'usdt:./server:ecc:aead_encrypt_entry
+//                  { @len = hist(arg0); }'
+//
+// Without USDT, and on Windows, the probes compile to nothing.
+// ========================================================================
+
+#if defined(ECC_USDT) && !defined(_WIN32)
+
+#include <sys/sdt.h>      // For DTRACE_PROBEn()
+
+#define ECC_PROBE(name) DTRACE_PROBE(ecc, name)
+#define ECC_PROBE1(name, a) DTRACE_PROBE1(ecc, name, a)
+#define ECC_PROBE2(name, a, b) DTRACE_PROBE2(ecc, name, a, b)
+
+#else
+
+#define ECC_PROBE(name) do { } while (0)
+#define ECC_PROBE1(name, a) do { } while (0)
+#define ECC_PROBE2(name, a, b) do { } while (0)
+
+#endif
+
+#endif // PROBES_H
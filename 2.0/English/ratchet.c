@@ -0,0 +1,136 @@
+#include "ratchet.h"
+#include "timer.h"        // For timer_now_ms()
+#include <string.h>       // For memcpy(), memset()
+
+// ========================================================================
+// Helpers
+// ========================================================================
+
+// Ascon-XOF128(label | in), truncated to a key
+static void ratchet_derive(const char *label, const uint8_t *in,
+                           size_t len, uint8_t out[RATCHET_KEY_SIZE])
+{
+    uint8_t buf[64];
+    size_t n = strlen(label);
+
+    if (len > sizeof(buf) - n) len = sizeof(buf) - n;
+    memcpy(buf, label, n);
+    memcpy(buf + n, in, len);
+    crypto_xof(out, RATCHET_KEY_SIZE, buf, n + len);
+    memset(buf, 0, sizeof(buf));
+}
+
+static void ratchet_start(RatchetKey *k, const char *label,
+                          const uint8_t *secret, size_t len)
+{
+    memset(k, 0, sizeof(*k));
+    ratchet_derive(label, secret, len, k->key);
+    k->since_ms = timer_now_ms();
+}
+
+static void ratchet_store32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// Nonce of message 'seq' of epoch 'epoch'
+static void ratchet_nonce_at(uint64_t seq, uint32_t epoch,
+                             uint8_t nonce[RATCHET_NONCE_SIZE])
+{
+    for (int i = 0; i < 8; i++) nonce[i] = (uint8_t)(seq >> (8 * i));
+    ratchet_store32(nonce + 8, epoch);
+    memset(nonce + 12, 0, 4);
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+void ratchet_limits_default(RatchetLimits *l)
+{
+    l->messages = RATCHET_MESSAGES;
+    l->bytes = RATCHET_BYTES;
+    l->seconds = 0;
+}
+
+void ratchet_init(Ratchet *r, const uint8_t *secret, size_t len, int side)
+{
+    RatchetKey *c2s = side == RATCHET_CLIENT ? &r->tx : &r->rx;
+    RatchetKey *s2c = side == RATCHET_CLIENT ? &r->rx : &r->tx;
+
+    ratchet_start(c2s, "ECC-code c2s", secret, len);
+    ratchet_start(s2c, "ECC-code s2c", secret, len);
+}
+
+void ratchet_nonce(const RatchetKey *k, uint8_t nonce[RATCHET_NONCE_SIZE])
+{
+    ratchet_nonce_at(k->seq, k->epoch, nonce);
+}
+
+void ratchet_count(RatchetKey *k, size_t len)
+{
+    k->seq++;
+    k->bytes += len;
+}
+
+int ratchet_due(const RatchetKey *tx, const RatchetLimits *l)
+{
+    if (l->messages && tx->seq >= l->messages) return 1;
+    if (l->bytes && tx->bytes >= l->bytes) return 1;
+    // The clock is read only when there is a time limit
+    return l->seconds &&
+           timer_now_ms() - tx->since_ms >= (uint64_t)l->seconds * 1000;
+}
+
+void ratchet_rekey(RatchetKey *tx, uint8_t payload[RATCHET_REKEY_SIZE])
+{
+    uint8_t next[RATCHET_KEY_SIZE];
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint8_t epoch[4];
+    uint64_t clen;
+
+    ratchet_derive("ECC-code ratchet", tx->key, sizeof(tx->key), next);
+    memcpy(tx->key, next, sizeof(next));
+    memset(next, 0, sizeof(next));
+    tx->epoch++;
+    tx->seq = 0;
+    tx->bytes = 0;
+    tx->since_ms = timer_now_ms();
+
+    // Proof of the new key: never a message nonce (seq ~0)
+    ratchet_store32(epoch, tx->epoch);
+    ratchet_nonce_at(UINT64_MAX, tx->epoch, nonce);
+    crypto_aead_encrypt(payload, &clen, epoch, sizeof(epoch), nonce,
+                        tx->key);
+}
+
+int ratchet_accept(RatchetKey *rx, const Frame *f)
+{
+    uint8_t next[RATCHET_KEY_SIZE];
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint8_t epoch[4], expect[4];
+    uint64_t mlen;
+
+    if (f->len != RATCHET_REKEY_SIZE) return -1;
+    ratchet_derive("ECC-code ratchet", rx->key, sizeof(rx->key), next);
+    ratchet_store32(expect, rx->epoch + 1);
+    ratchet_nonce_at(UINT64_MAX, rx->epoch + 1, nonce);
+    if (crypto_aead_decrypt(epoch, &mlen, NULL, f->payload, f->len, nonce,
+                            next) != 0 ||
+        mlen != sizeof(epoch) || memcmp(epoch, expect, 4) != 0) {
+        memset(next, 0, sizeof(next));
+        return -1;
+    }
+
+    memcpy(rx->key, next, sizeof(next));
+    memset(next, 0, sizeof(next));
+    rx->epoch++;
+    rx->seq = 0;
+    rx->bytes = 0;
+    rx->since_ms = timer_now_ms();
+    return 0;
+}
+
+void ratchet_wipe(Ratchet *r)
+{
+    memset(r, 0, sizeof(*r));
+}
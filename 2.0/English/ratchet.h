@@ -0,0 +1,105 @@
+#ifndef RATCHET_H
+#define RATCHET_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint8_t and other fixed-width types
+#include "frame.h"        // For Frame and FRAME_REKEY
+#include "ASCON/ascon.h"  // For the AEAD and Ascon-XOF128
+
+// ========================================================================
+// Symmetric ratchet of the message keys
+// ========================================================================
+// Messages are not encrypted under the X25519 shared secret itself. Each
+// direction derives a key of its own from it, and replaces that key
+// with a hash of it from time to time:
+//
+//   client -> server   key 0   = Ascon-XOF128("ECC-code c2s" | secret)
+//   server -> client   key 0   = Ascon-XOF128("ECC-code s2c" | secret)
+//   both               key n+1 = Ascon-XOF128("ECC-code ratchet" | key n)
+//
+// Every FRAME_DATA is sealed under the current key of its direction,
+// with the nonce  seq (8) | epoch (4) | 0 (4)  where 'seq' counts the
+// messages under that key, so no nonce is used twice with one key.
+//
+// The sender moves to the next key once one of its limits (messages,
+// bytes or seconds under the key) is reached, and sends a FRAME_REKEY
+// in front of the first message under the new key:
+//
+//   FRAME_REKEY   payload = AEAD(key n+1, nonce(seq = ~0), epoch n+1)
+//
+// The receiver derives the same key and checks the payload. Nothing
+// waits for an answer and no scalar multiplication is needed. The old
+// key is overwritten, so a key taken from memory later does not open
+// the messages sent before it.
+//
+// Control frames (room and pair keys, tickets) and files have keys of
+// their own, derived from the shared secret (control.h, file.h).
+// ========================================================================
+
+#define RATCHET_KEY_SIZE 16             // ASCON-128a key
+#define RATCHET_NONCE_SIZE 16           // ASCON-128a nonce
+#define RATCHET_REKEY_SIZE (4 + 16)     // FRAME_REKEY payload: epoch and
+                                        // tag
+#define RATCHET_MESSAGES ((uint64_t)1 << 20)  // Default limits of a key:
+#define RATCHET_BYTES ((uint64_t)1 << 30)     // 1M messages or 1 GiB
+
+// Sides of a session (the directions are swapped between them)
+#define RATCHET_CLIENT 0
+#define RATCHET_SERVER 1
+
+// When the sender replaces its key (0: no limit of that kind)
+typedef struct {
+    uint64_t messages;                  // Messages under one key
+    uint64_t bytes;                     // Plaintext bytes under one key
+    unsigned seconds;                   // Lifetime of one key
+} RatchetLimits;
+
+// One direction
+typedef struct {
+    uint8_t key[RATCHET_KEY_SIZE];      // Current key
+    uint64_t seq;                       // Messages under it
+    uint64_t bytes;                     // Their plaintext bytes
+    uint64_t since_ms;                  // When it was derived
+    uint32_t epoch;                     // Keys replaced so far
+} RatchetKey;
+
+typedef struct {
+    RatchetKey tx;                      // Messages we send
+    RatchetKey rx;                      // Messages we receive
+} Ratchet;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// RATCHET_MESSAGES, RATCHET_BYTES and no time limit
+void ratchet_limits_default(RatchetLimits *l);
+
+// Derives both directions from the shared secret of a new session.
+// 'side' is RATCHET_CLIENT or RATCHET_SERVER.
+void ratchet_init(Ratchet *r, const uint8_t *secret, size_t len, int side);
+
+// Nonce of the next message under 'k'. Once the message is sealed or
+// opened, ratchet_count() moves past it.
+void ratchet_nonce(const RatchetKey *k, uint8_t nonce[RATCHET_NONCE_SIZE]);
+void ratchet_count(RatchetKey *k, size_t len);
+
+// Returns 1 if 'tx' has reached one of the limits, so the next message
+// must go under a new key (ratchet_rekey() first)
+int ratchet_due(const RatchetKey *tx, const RatchetLimits *l);
+
+// Moves 'tx' to the next key and writes the FRAME_REKEY payload that
+// announces it
+void ratchet_rekey(RatchetKey *tx, uint8_t payload[RATCHET_REKEY_SIZE]);
+
+// A FRAME_REKEY was received: moves 'rx' to the next key.
+// Returns 0, or -1 if the frame does not authenticate under it.
+int ratchet_accept(RatchetKey *rx, const Frame *f);
+
+// Overwrites both keys
+void ratchet_wipe(Ratchet *r);
+
+#endif // RATCHET_H
@@ -0,0 +1,1548 @@
+#define _GNU_SOURCE       // For accept4()
+
+#include "reactor.h"
+#include "room.h"         // For rooms and their broadcasts
+#include "drng.h"         // For the server random of FRAME_HELLO
+#include "relay.h"        // For relay pairs
+#include <stddef.h>       // For offsetof()
+
+#ifdef __linux__
+
+#include <errno.h>        // For errno, EAGAIN, EINTR
+#include <fcntl.h>        // For fcntl(), O_NONBLOCK
+#include <sys/epoll.h>    // For epoll_create1(), epoll_ctl(),
+                          // epoll_wait()
+#include <sys/eventfd.h>  // For eventfd() used to wake the loop
+#include <sys/uio.h>      // For writev()
+
+// Markers stored in epoll data for the wake-up eventfd and the handshake
+// inbox (the listener uses NULL, connections their Connection pointer)
+static char reactor_wake_marker;
+static char reactor_hs_marker;
+
+// ========================================================================
+// Helper: switch a descriptor to non-blocking mode
+// ========================================================================
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// ========================================================================
+// Connection table: connections are indexed by their descriptor
+// ========================================================================
+static int conn_table_reserve(Reactor *r, int fd)
+{
+    if ((size_t)fd < r->conns_cap) return 0;
+
+    size_t cap = r->conns_cap ? r->conns_cap : 1024;
+    while (cap <= (size_t)fd) cap *= 2;  // Grow geometrically
+
+    Connection **t = realloc(r->conns, cap * sizeof(*t));
+    if (t == NULL) return -1;
+    memset(t + r->conns_cap, 0, (cap - r->conns_cap) * sizeof(*t));
+    r->conns = t;
+    r->conns_cap = cap;
+    return 0;
+}
+
+// ========================================================================
+// Deadlines: one timer per session, armed for the earliest one
+// ========================================================================
+// Input does not move the timer (that would relink it on every read), it
+// only records the time in rx_ms. When the timer fires, the deadlines
+// are computed again from rx_ms and the timer is armed for the next one.
+static void conn_arm_timer(Reactor *r, Connection *c)
+{
+    const ReactorTimeouts *t = &r->timeouts;
+    uint64_t at = UINT64_MAX;
+
+    if (c->state == CONN_HANDSHAKE) {
+        // Counted from the accept, whatever the client sends meanwhile
+        if (t->handshake > 0) at = r->now_ms + t->handshake * 1000ull;
+    } else if (c->state == CONN_ESTABLISHED) {
+        if (t->idle > 0) at = c->rx_ms + t->idle * 1000ull;
+        if (t->keepalive > 0) {
+            uint64_t ka = c->rx_ms + t->keepalive * 1000ull;
+            if (ka <= r->now_ms) {
+                ka = r->now_ms + t->keepalive * 1000ull;  // One was just
+                                                          // sent
+            }
+            if (ka < at) at = ka;
+        }
+    }
+    if (at == UINT64_MAX) timer_cancel(&r->timers, &c->timer);
+    else timer_add(&r->timers, &c->timer, at);
+}
+
+// The session is over: close it as soon as the loop gets to it
+static void conn_timeout(Reactor *r, Connection *c, const char *what)
+{
+    if (!r->quiet) {
+        log_info("Client %llu: %s timeout", (unsigned long long)c->id,
+                 what);
+    }
+    c->state = CONN_CLOSING;
+    reactor_conn_drop_output(c);
+    reactor_conn_wake(r, c);
+}
+
+static void conn_on_timer(Timer *t, void *arg)
+{
+    Reactor *r = arg;
+    Connection *c = (Connection *)((char *)t -
+                                   offsetof(Connection, timer));
+    const ReactorTimeouts *to = &r->timeouts;
+    uint64_t silent = r->now_ms - c->rx_ms;
+
+    if (c->state == CONN_CLOSING) return;
+    if (c->state == CONN_HANDSHAKE) {
+        conn_timeout(r, c, "handshake");
+        return;
+    }
+    if (to->idle > 0 && silent >= to->idle * 1000ull) {
+        conn_timeout(r, c, "idle");
+        return;
+    }
+    if (to->keepalive > 0 && silent >= to->keepalive * 1000ull) {
+        // Lets the client notice a dead server (and keeps NAT state);
+        // a full output needs no keepalive
+        uint8_t frame[FRAME_HEADER_MAX + 1];
+        size_t hlen = frame_encode_header(frame, FRAME_KEEPALIVE, 0);
+        if (reactor_conn_queue(c, frame, hlen) == 0) {
+            reactor_conn_wake(r, c);
+        }
+        log_debug("Client %llu: keepalive", (unsigned long long)c->id);
+    }
+    conn_arm_timer(r, c);
+}
+
+int reactor_timers_timeout(Reactor *r)
+{
+    return timer_wheel_timeout(&r->timers, timer_now_ms());
+}
+
+void reactor_timers_run(Reactor *r)
+{
+    r->now_ms = timer_now_ms();
+    timer_wheel_advance(&r->timers, r->now_ms, conn_on_timer, r);
+}
+
+// ========================================================================
+// Allocate a session for an accepted socket and start the key exchange:
+// the server public key is queued as the first output
+// ========================================================================
+Connection *reactor_conn_new(Reactor *r, int fd)
+{
+    Connection *c = pool_get(&r->conn_pool);
+    if (c == NULL) return NULL;
+    if (conn_table_reserve(r, fd) != 0) {
+        pool_put(&r->conn_pool, c);
+        return NULL;
+    }
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->bufs = &r->bufs;
+    c->state = CONN_HANDSHAKE;
+    c->id = r->next_id;
+    r->next_id += r->id_step;
+    c->rx_ms = r->now_ms;
+    conn_arm_timer(r, c);  // Handshake deadline
+
+    r->conns[fd] = c;
+    r->active++;
+    metrics_add(METRIC_CONN_OPENED, 1);
+    ECC_PROBE1(conn_accept, fd);
+
+    // Large frames leave without a copy where the socket allows it (the
+    // io_uring backend always copies)
+    if (r->zerocopy && r->uring == NULL && zc_enable(fd) == 0) {
+        c->zc_on = 1;
+    }
+    if (r->relay && relay_attach(r, c) != 0) c->state = CONN_CLOSING;
+
+    reactor_conn_queue(c, r->public_key, KEY_SIZE);
+    if (r->tickets != NULL) {
+        // A fresh random for a client that resumes with a ticket
+        uint8_t hello[FRAME_HEADER_MAX + 1 + TICKET_RANDOM_SIZE];
+        size_t hlen = frame_encode_header(hello, FRAME_HELLO,
+                                          TICKET_RANDOM_SIZE);
+        if (rdrand_get_bytes(TICKET_RANDOM_SIZE, c->server_random) <
+            TICKET_RANDOM_SIZE) {
+            c->state = CONN_CLOSING;
+        }
+        memcpy(hello + hlen, c->server_random, TICKET_RANDOM_SIZE);
+        reactor_conn_queue(c, hello, hlen + TICKET_RANDOM_SIZE);
+    }
+    return c;
+}
+
+// ========================================================================
+// Frames larger than REACTOR_FRAME_MAX are received into a chain of
+// segments, allocated when such a frame starts and freed once handled
+// ========================================================================
+static void conn_big_free(Connection *c)
+{
+    if (c->big != NULL) {
+        chain_rx_free(c->big);
+        free(c->big);
+        c->big = NULL;
+    }
+}
+
+// Diverts the frame at the front of the ring into a chain if it is too
+// large for the ring. Returns 1 if it was, 0 if not, -1 on error.
+static int conn_big_start(Connection *c)
+{
+    uint8_t type;
+    size_t hlen, plen;
+
+    if (frame_buffer_peek(&c->rx, &type, &hlen, &plen) != 1 ||
+        plen <= REACTOR_FRAME_MAX) {
+        return 0;
+    }
+    if (plen > REACTOR_MSG_MAX) return -1;
+    if (c->big == NULL) {
+        c->big = malloc(sizeof(*c->big));
+        if (c->big == NULL) return -1;
+        chain_rx_init(c->big);
+    }
+    return chain_rx_start(c->big, &c->rx, REACTOR_FRAME_MAX,
+                          REACTOR_MSG_MAX);
+}
+
+// ========================================================================
+// Zero-copy sends: a large shared frame at the front of the output is
+// passed to the kernel by reference, and the connection keeps a
+// reference to it until the completion arrives on the error queue
+// ========================================================================
+static int conn_zc_eligible(const Connection *c)
+{
+    if (!c->zc_on || c->seg_count == 0) return 0;
+    if (c->segs->mark[c->seg_head] > 0) return 0;  // Private output first
+    if (c->zc != NULL && c->zc->count == REACTOR_ZC_PENDING) return 0;
+    return c->segs->buf[c->seg_head]->len - c->seg_off >= ZC_MIN_SIZE;
+}
+
+// Returns like send(); errno ENOBUFS: write the frame with a copy
+static ssize_t conn_zc_send(Connection *c)
+{
+    if (c->zc == NULL) {
+        // The pending list comes from the pool and goes back to it once
+        // every send has completed
+        c->zc = buf_pool_get(c->bufs, sizeof(ConnZc));
+        if (c->zc == NULL) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        c->zc->head = 0;
+        c->zc->count = 0;
+    }
+
+    SharedBuf *b = c->segs->buf[c->seg_head];
+    long n = zc_send(c->fd, b->data + c->seg_off, b->len - c->seg_off,
+                     MSG_DONTWAIT);
+    if (n > 0) {
+        unsigned i = (c->zc->head + c->zc->count) % REACTOR_ZC_PENDING;
+        c->zc->buf[i] = b;
+        c->zc->seq[i] = c->zc_next++;
+        c->zc->count++;
+        b->refs++;  // Dropped by the completion
+    }
+    return n;
+}
+
+// Puts the pending list back once it is empty
+static void conn_zc_release(Connection *c)
+{
+    if (c->zc != NULL && c->zc->count == 0) {
+        buf_pool_put(c->bufs, c->zc, sizeof(ConnZc));
+        c->zc = NULL;
+    }
+}
+
+// Drops the frames whose sends have completed. Returns 0, or -1 if the
+// error queue cannot be read.
+static int conn_zc_reap(Connection *c)
+{
+    ZcRange done[ZC_MAX_RANGES];
+    int n;
+
+    do {
+        n = zc_reap(c->fd, done, ZC_MAX_RANGES);
+        for (int i = 0; i < n && c->zc != NULL; i++) {
+            // The kernel copied anyway (loopback, no scatter-gather):
+            // plain writes are cheaper from now on
+            if (done[i].copied) c->zc_on = 0;
+
+            for (unsigned k = 0; k < c->zc->count; k++) {
+                unsigned j = (c->zc->head + k) % REACTOR_ZC_PENDING;
+                if (c->zc->buf[j] != NULL &&
+                    zc_covers(&done[i], c->zc->seq[j])) {
+                    shared_buf_unref(c->zc->buf[j]);
+                    c->zc->buf[j] = NULL;
+                }
+            }
+            while (c->zc->count > 0 && c->zc->buf[c->zc->head] == NULL) {
+                c->zc->head = (c->zc->head + 1) % REACTOR_ZC_PENDING;
+                c->zc->count--;
+            }
+        }
+    } while (n == ZC_MAX_RANGES);
+    conn_zc_release(c);
+    return n < 0 ? -1 : 0;
+}
+
+// The socket is closed: the frames are no longer needed for it (the
+// kernel keeps the pages it still sends from)
+static void conn_zc_drop(Connection *c)
+{
+    while (c->zc != NULL && c->zc->count > 0) {
+        if (c->zc->buf[c->zc->head] != NULL) {
+            shared_buf_unref(c->zc->buf[c->zc->head]);
+        }
+        c->zc->head = (c->zc->head + 1) % REACTOR_ZC_PENDING;
+        c->zc->count--;
+    }
+    conn_zc_release(c);
+}
+
+// Returns 1 if EPOLLERR on 'c' only announced zero-copy completions
+static int conn_zc_only(Connection *c)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (c->zc == NULL || conn_zc_reap(c) != 0) return 0;
+    return getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+           err == 0;
+}
+
+// ========================================================================
+// Release the slot and memory of a session (the socket is closed by the
+// caller)
+// ========================================================================
+void reactor_conn_free(Reactor *r, Connection *c)
+{
+    room_leave(r, c);
+    relay_detach(r, c);
+    timer_cancel(&r->timers, &c->timer);
+    r->conns[c->fd] = NULL;
+    r->active--;
+    metrics_add(METRIC_CONN_CLOSED, 1);
+    ECC_PROBE1(conn_close, c->fd);
+
+    // Wipe the session keys before the memory is reused
+    memset(c->shared_secret, 0, sizeof(c->shared_secret));
+    ratchet_wipe(&c->ratchet);
+    if (c->rx.data != NULL) {
+        buf_pool_put(c->bufs, frame_buffer_detach(&c->rx),
+                     REACTOR_RX_SIZE);
+    }
+    conn_big_free(c);
+    conn_zc_drop(c);
+    c->tx_inflight = 0;  // The kernel no longer uses the output
+    reactor_conn_drop_output(c);  // Puts the output buffers back
+    pool_put(&r->conn_pool, c);
+}
+
+// ========================================================================
+// Close a connection and release its slot
+// ========================================================================
+static void conn_close(Reactor *r, Connection *c)
+{
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    reactor_conn_free(r, c);
+}
+
+// ========================================================================
+// Append data to the pending output of a connection
+// Returns 0 on success, -1 if the output buffer is full
+// ========================================================================
+int reactor_conn_queue(Connection *c, const uint8_t *data, size_t len)
+{
+    uint8_t *out = reactor_conn_reserve(c, len);
+    if (out == NULL) return -1;
+
+    memcpy(out, data, len);
+    c->tx_len += len;
+    return 0;
+}
+
+uint8_t *reactor_conn_reserve(Connection *c, size_t len)
+{
+    if (len > REACTOR_TX_SIZE - c->tx_len) return NULL;
+    if (c->tx == NULL &&
+        (c->tx = buf_pool_get(c->bufs, REACTOR_TX_SIZE)) == NULL) {
+        return NULL;
+    }
+    return c->tx + c->tx_len;
+}
+
+// ========================================================================
+// Shared output buffers
+// ========================================================================
+SharedBuf *shared_buf_new(size_t len)
+{
+    SharedBuf *b = malloc(sizeof(*b) + len);
+    if (b == NULL) return NULL;
+    b->refs = 1;
+    b->len = len;
+    return b;
+}
+
+void shared_buf_unref(SharedBuf *b)
+{
+    if (--b->refs == 0) free(b);
+}
+
+int reactor_conn_queue_shared(Connection *c, SharedBuf *b)
+{
+    if (c->seg_count == REACTOR_TX_SEGS) return -1;
+    if (c->segs == NULL &&
+        (c->segs = buf_pool_get(c->bufs, sizeof(ConnSegs))) == NULL) {
+        return -1;
+    }
+
+    unsigned i = (c->seg_head + c->seg_count) % REACTOR_TX_SEGS;
+    c->segs->buf[i] = b;
+    c->segs->mark[i] = c->tx_len;  // Goes out after what tx holds now
+    c->seg_count++;
+    b->refs++;
+    return 0;
+}
+
+// ========================================================================
+// Output in sending order: tx up to the mark of the first shared frame,
+// that frame, tx up to the next mark, ... and the rest of tx
+// ========================================================================
+int reactor_conn_iov(const Connection *c, struct iovec *iov,
+                     size_t *total)
+{
+    size_t off = 0;
+    int n = 0;
+
+    *total = 0;
+    for (unsigned i = 0; i < c->seg_count; i++) {
+        unsigned k = (c->seg_head + i) % REACTOR_TX_SEGS;
+        size_t skip = (i == 0) ? c->seg_off : 0;
+
+        if (c->segs->mark[k] > off) {
+            iov[n].iov_base = (void *)(c->tx + off);
+            iov[n].iov_len = c->segs->mark[k] - off;
+            *total += iov[n++].iov_len;
+            off = c->segs->mark[k];
+        }
+        iov[n].iov_base = c->segs->buf[k]->data + skip;
+        iov[n].iov_len = c->segs->buf[k]->len - skip;
+        *total += iov[n++].iov_len;
+    }
+    if (c->tx_len > off) {
+        iov[n].iov_base = (void *)(c->tx + off);
+        iov[n].iov_len = c->tx_len - off;
+        *total += iov[n++].iov_len;
+    }
+    return n;
+}
+
+// Put output buffers that became empty back into the pool (not while
+// io_uring may still be sending from them)
+static void conn_output_release(Connection *c)
+{
+    if (c->tx_inflight > 0) return;
+
+    if (c->tx != NULL && c->tx_len == 0) {
+        buf_pool_put(c->bufs, c->tx, REACTOR_TX_SIZE);
+        c->tx = NULL;
+    }
+    if (c->seg_count > 0) return;
+    if (c->segs != NULL) {
+        buf_pool_put(c->bufs, c->segs, sizeof(ConnSegs));
+        c->segs = NULL;
+    }
+    if (c->tx_msg != NULL) {
+        buf_pool_put(c->bufs, c->tx_msg, REACTOR_TX_MSG_SIZE);
+        c->tx_msg = NULL;
+    }
+}
+
+void reactor_conn_consume(Connection *c, size_t n)
+{
+    size_t sent = 0;  // Bytes of tx written
+
+    while (n > 0 && c->seg_count > 0) {
+        unsigned k = c->seg_head;
+        size_t before = c->segs->mark[k] - sent;  // tx before the frame
+
+        if (before > 0) {
+            size_t take = n < before ? n : before;
+            sent += take;
+            n -= take;
+            continue;
+        }
+
+        SharedBuf *b = c->segs->buf[k];
+        size_t take = b->len - c->seg_off;
+        if (take > n) take = n;
+        c->seg_off += take;
+        n -= take;
+        if (c->seg_off == b->len) {
+            // Written completely: drop our reference
+            shared_buf_unref(b);
+            c->segs->buf[k] = NULL;
+            c->seg_head = (k + 1) % REACTOR_TX_SEGS;
+            c->seg_count--;
+            c->seg_off = 0;
+        }
+    }
+    sent += n;  // The rest came from tx behind the last shared frame
+
+    if (sent > 0) {
+        // Move the unsent part to the front; the marks move with it
+        memmove(c->tx, c->tx + sent, c->tx_len - sent);
+        c->tx_len -= sent;
+        for (unsigned i = 0; i < c->seg_count; i++) {
+            c->segs->mark[(c->seg_head + i) % REACTOR_TX_SEGS] -= sent;
+        }
+    }
+    conn_output_release(c);
+}
+
+void reactor_conn_drop_output(Connection *c)
+{
+    if (c->tx_inflight > 0) return;  // io_uring still sends from it
+
+    relay_drop_output(c);
+    while (c->seg_count > 0) {
+        shared_buf_unref(c->segs->buf[c->seg_head]);
+        c->segs->buf[c->seg_head] = NULL;
+        c->seg_head = (c->seg_head + 1) % REACTOR_TX_SEGS;
+        c->seg_count--;
+    }
+    c->seg_off = 0;
+    c->tx_len = 0;
+    conn_output_release(c);
+}
+
+// ========================================================================
+// Write as much pending output as the socket accepts
+// Returns 0 when everything was written, 1 when the socket is full,
+// -1 on a socket error
+// ========================================================================
+static int conn_flush(Connection *c)
+{
+    // Bytes spliced in from a relay peer are older than the rest
+    int rc = relay_flush(c);
+    if (rc != 0) return rc;
+
+    while (c->tx_len > 0 || c->seg_count > 0) {
+        int zc = conn_zc_eligible(c);
+        ssize_t n = zc ? conn_zc_send(c) : -1;
+
+        if (!zc || (n < 0 && errno == ENOBUFS)) {
+            struct iovec iov[REACTOR_TX_IOV];
+            size_t total;
+            int cnt = reactor_conn_iov(c, iov, &total);
+
+            // Private and shared output leave in one system call
+            n = writev(c->fd, iov, cnt);
+        }
+        if (n > 0) {
+            reactor_conn_consume(c, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        return -1;
+    }
+    return 0;
+}
+
+// ========================================================================
+// Remember a connection whose output was queued while another one was
+// handled; the loop writes it at the end of the batch, so a burst of
+// room messages leaves in one writev() per member
+// ========================================================================
+void reactor_conn_wake(Reactor *r, Connection *c)
+{
+    if (c->dirty) return;
+    if (r->uring) {
+        reactor_uring_mark_dirty(r, c);
+        return;
+    }
+
+    if (r->wake_len == r->wake_cap) {
+        size_t cap = r->wake_cap ? r->wake_cap * 2 : 64;
+        ReactorWake *w = realloc(r->wake, cap * sizeof(*w));
+        if (w == NULL) {
+            conn_flush(c);  // Write now; errors show up on its next event
+            return;
+        }
+        r->wake = w;
+        r->wake_cap = cap;
+    }
+    r->wake[r->wake_len].fd = c->fd;
+    r->wake[r->wake_len].id = c->id;
+    r->wake_len++;
+    c->dirty = 1;
+}
+
+// ========================================================================
+// Announce the next message key of a connection once the current one has
+// reached its limits
+// ========================================================================
+int reactor_conn_rekey(Reactor *r, Connection *c)
+{
+    uint8_t frame[FRAME_HEADER_MAX + 1 + RATCHET_REKEY_SIZE];
+
+    if (!ratchet_due(&c->ratchet.tx, &r->timeouts.rekey)) return 0;
+
+    size_t hlen = frame_encode_header(frame, FRAME_REKEY,
+                                      RATCHET_REKEY_SIZE);
+    ratchet_rekey(&c->ratchet.tx, frame + hlen);
+    if (reactor_conn_queue(c, frame, hlen + RATCHET_REKEY_SIZE) != 0) {
+        c->state = CONN_CLOSING;
+        return -1;
+    }
+    log_debug("Client %llu: sending key %u", (unsigned long long)c->id,
+              (unsigned)c->ratchet.tx.epoch);
+    return 0;
+}
+
+// ========================================================================
+// Encrypt a message under the sending key of the session and queue it as
+// a frame; the ciphertext is written right behind the frame header
+// ========================================================================
+static void conn_send_message(Reactor *r, Connection *c,
+                              const uint8_t *msg, size_t len)
+{
+    uint8_t frame[FRAME_HEADER_MAX + 1 + BUFFER_SIZE + TAG_SIZE];
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    uint64_t encrypted_msglen = 0;
+
+    if (reactor_conn_rekey(r, c) != 0) return;
+    ratchet_nonce(&c->ratchet.tx, nonce);
+    ratchet_count(&c->ratchet.tx, len);
+
+    if (len > BUFFER_SIZE) {
+        // Too large for tx: built in a buffer of its own and queued by
+        // reference, like a room broadcast
+        SharedBuf *b = shared_buf_new(FRAME_HEADER_MAX + 1 + len +
+                                      TAG_SIZE);
+        if (b == NULL) {
+            c->state = CONN_CLOSING;
+            return;
+        }
+        size_t hlen = frame_encode_header(b->data, FRAME_DATA,
+                                          len + TAG_SIZE);
+        if (crypto_aead_encrypt(b->data + hlen, &encrypted_msglen, msg,
+                                len, nonce, c->ratchet.tx.key) != 0) {
+            c->state = CONN_CLOSING;
+        } else {
+            metrics_add(METRIC_ENCRYPTED_BYTES, len);
+            b->len = hlen + encrypted_msglen;
+            if (reactor_conn_queue_shared(c, b) != 0) {
+                c->state = CONN_CLOSING;
+            }
+        }
+        shared_buf_unref(b);
+        return;
+    }
+
+    size_t hlen = frame_encode_header(frame, FRAME_DATA, len + TAG_SIZE);
+    uint64_t t = trace_begin();
+    int rc = crypto_aead_encrypt(frame + hlen, &encrypted_msglen, msg, len,
+                                 nonce, c->ratchet.tx.key);
+    trace_end(TRACE_ENCRYPT, t);
+    metrics_add(METRIC_ENCRYPTED_BYTES, len);
+    if (rc != 0 ||
+        reactor_conn_queue(c, frame, hlen + encrypted_msglen) != 0) {
+        c->state = CONN_CLOSING;
+    }
+}
+
+// ========================================================================
+// Room commands: "/join <name>" and "/leave"
+// Returns 1 if the message was a command, 0 otherwise
+// ========================================================================
+static int conn_room_command(Reactor *r, Connection *c, const char *msg)
+{
+    char reply[BUFFER_SIZE - TAG_SIZE];
+
+    if (strncmp(msg, "/join ", 6) == 0) {
+        const char *name = msg + 6;
+        if (room_join(r, c, name) != 0) {
+            snprintf(reply, sizeof(reply), "Cannot join room %.*s",
+                     ROOM_NAME_MAX, name);
+        } else {
+            snprintf(reply, sizeof(reply),
+                     "Joined room %.*s (%zu members)", ROOM_NAME_MAX, name,
+                     c->room->count);
+            if (!r->quiet) {
+                log_info("Client %llu joined room %s",
+                         (unsigned long long)c->id, name);
+            }
+        }
+    } else if (strcmp(msg, "/leave") == 0) {
+        if (c->room == NULL) {
+            snprintf(reply, sizeof(reply), "Not in a room");
+        } else {
+            snprintf(reply, sizeof(reply), "Left room %s", c->room->name);
+            if (!r->quiet) {
+                log_info("Client %llu left room %s",
+                         (unsigned long long)c->id, c->room->name);
+            }
+            room_leave(r, c);
+        }
+    } else {
+        return 0;
+    }
+
+    conn_send_message(r, c, (const uint8_t *)reply, strlen(reply));
+    return 1;
+}
+
+// ========================================================================
+// ESTABLISHED: print a decrypted message and echo it back (or send it to
+// the room of the client). 'decrypted_msg' has room for a terminator.
+// ========================================================================
+static void conn_handle_plain(Reactor *r, Connection *c,
+                              uint8_t *decrypted_msg,
+                              size_t decrypted_msglen)
+{
+    decrypted_msg[decrypted_msglen] = '\0';
+    if (!r->quiet) {
+        log_info("Client %llu: %s", (unsigned long long)c->id,
+                 (char *)decrypted_msg);
+    }
+
+    // Check if the client wants to end the conversation
+    if (strcasecmp((char *)decrypted_msg, "bye") == 0) {
+        if (!r->quiet) {
+            log_info("Client %llu ended the conversation.",
+                     (unsigned long long)c->id);
+        }
+        c->state = CONN_CLOSING;
+        return;
+    }
+
+    // Relay clients have no rooms: their peer is fixed
+    if (c->relay == NULL &&
+        conn_room_command(r, c, (char *)decrypted_msg)) {
+        return;
+    }
+
+    if (c->room != NULL) {
+        // One encryption for the whole room
+        if (room_broadcast(r, c, decrypted_msg, decrypted_msglen) != 0) {
+            c->state = CONN_CLOSING;
+        }
+        return;
+    }
+
+    // Echo the message back under the session key
+    conn_send_message(r, c, decrypted_msg, decrypted_msglen);
+}
+
+// ========================================================================
+// ESTABLISHED: handle one received frame. FRAME_EARLY is only accepted
+// as the first frame of a session set up with a full key exchange.
+// ========================================================================
+static void conn_handle_frame(Reactor *r, Connection *c, const Frame *f)
+{
+    uint8_t decrypted_msg[BUFFER_SIZE + 1];  // +1 for the terminator
+    uint64_t decrypted_msglen = 0;
+    int early_ok = c->early_ok;
+
+    c->early_ok = 0;
+    if (f->type == FRAME_EARLY) {
+        int n = -1;
+        if (early_ok && r->replay != NULL && f->chain == NULL) {
+            n = early_open(r->replay, c->peer_public_key, c->shared_secret,
+                           f->payload, f->len, decrypted_msg);
+        }
+        if (n >= 0) {
+            conn_handle_plain(r, c, decrypted_msg, (size_t)n);
+            return;
+        }
+        // Stale server key, replay or too old: the client sends the
+        // message again after the handshake
+        uint8_t reject[FRAME_HEADER_MAX + 1];
+        size_t hlen = frame_encode_header(reject, FRAME_EARLY_REJECT, 0);
+        if (reactor_conn_queue(c, reject, hlen) != 0) {
+            c->state = CONN_CLOSING;
+        }
+        return;
+    }
+    if (f->type == FRAME_REKEY) {
+        // The client moved to its next message key
+        if (ratchet_accept(&c->ratchet.rx, f) != 0) {
+            if (!r->quiet) {
+                log_warn("Client %llu: rekey does not authenticate, "
+                         "closing", (unsigned long long)c->id);
+            }
+            c->state = CONN_CLOSING;
+        } else {
+            log_debug("Client %llu: receiving key %u",
+                      (unsigned long long)c->id,
+                      (unsigned)c->ratchet.rx.epoch);
+        }
+        return;
+    }
+    // Relay mode: messages go to the peer, if there is one
+    if (c->relay != NULL && relay_forward(r, c, f)) return;
+    if (f->type != FRAME_DATA) return;  // Unknown type: skipped
+
+    // Large messages are decrypted from their segments into memory of
+    // their size
+    uint8_t *msg = decrypted_msg;
+    if (f->len > BUFFER_SIZE) {
+        msg = malloc(f->len - TAG_SIZE + 1);
+        if (msg == NULL) {
+            c->state = CONN_CLOSING;
+            return;
+        }
+    }
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    ratchet_nonce(&c->ratchet.rx, nonce);
+    if (chain_open(f, msg, &decrypted_msglen, nonce,
+                   c->ratchet.rx.key) != 0) {
+        if (!r->quiet) {
+            log_warn("Client %llu: decryption error, closing",
+                     (unsigned long long)c->id);
+        }
+        c->state = CONN_CLOSING;
+    } else {
+        ratchet_count(&c->ratchet.rx, (size_t)decrypted_msglen);
+        conn_handle_plain(r, c, msg, (size_t)decrypted_msglen);
+    }
+    if (msg != decrypted_msg) free(msg);
+}
+
+// ========================================================================
+// Buffer received bytes in the reassembly ring (taken from the pool on
+// first use). Returns 0 on success, -1 if they do not fit
+// ========================================================================
+static int conn_rx_append(Connection *c, const uint8_t *data, size_t len)
+{
+    if (c->rx.data == NULL) {
+        uint8_t *mem = buf_pool_get(c->bufs, REACTOR_RX_SIZE);
+        if (mem == NULL) return -1;
+        frame_buffer_attach(&c->rx, mem, REACTOR_RX_SIZE);
+    }
+    return frame_buffer_write(&c->rx, data, len);
+}
+
+// Put the ring back into the pool once every frame has been taken out
+static void conn_rx_release(Connection *c)
+{
+    if (c->rx.data != NULL && frame_buffer_used(&c->rx) == 0) {
+        buf_pool_put(c->bufs, frame_buffer_detach(&c->rx),
+                     REACTOR_RX_SIZE);
+    }
+}
+
+// ========================================================================
+// ESTABLISHED: split received bytes into frames. Complete frames are
+// handled straight from 'data'; only a trailing partial frame is copied
+// into the per-connection ring, and the ring is drained first whenever it
+// holds anything. A frame too large for the ring continues in a chain.
+// ========================================================================
+static void conn_input_frames(Reactor *r, Connection *c,
+                              const uint8_t *data, size_t len)
+{
+    uint8_t scratch[REACTOR_FRAME_MAX];  // For payloads that wrap around
+    Frame f;
+    int rc;
+
+    while (c->state == CONN_ESTABLISHED) {
+        if (c->big != NULL) {
+            // The rest of a large frame
+            size_t n = chain_rx_feed(c->big, data, len);
+            data += n;
+            len -= n;
+            if (!chain_rx_complete(c->big)) {
+                if (len > 0) c->state = CONN_CLOSING;  // Out of memory
+                return;
+            }
+            chain_rx_frame(c->big, &f);
+            conn_handle_frame(r, c, &f);
+            conn_big_free(c);
+            continue;
+        }
+
+        if (frame_buffer_used(&c->rx) == 0) {
+            size_t used;
+            while (len > 0 && c->state == CONN_ESTABLISHED &&
+                   (rc = frame_parse(data, len, &f, &used,
+                                     REACTOR_MSG_MAX)) != 0) {
+                if (rc < 0) {
+                    c->state = CONN_CLOSING;  // Malformed or oversized
+                    return;                   // frame
+                }
+                conn_handle_frame(r, c, &f);
+                data += used;
+                len -= used;
+            }
+            if (len == 0 || c->state != CONN_ESTABLISHED) return;
+        }
+
+        // Keep the rest until the frame is complete
+        if (len > 0 && conn_rx_append(c, data, len) != 0) {
+            c->state = CONN_CLOSING;
+            return;
+        }
+        len = 0;
+        while (c->state == CONN_ESTABLISHED) {
+            rc = conn_big_start(c);
+            if (rc == 0) {
+                rc = frame_pop(&c->rx, &f, scratch, sizeof(scratch),
+                               REACTOR_FRAME_MAX);
+                if (rc == 0) return;  // Wait for the rest
+            }
+            if (rc < 0) {
+                c->state = CONN_CLOSING;
+                return;
+            }
+            if (c->big != NULL) break;  // Continues in the chain
+            conn_handle_frame(r, c, &f);
+        }
+    }
+}
+
+// ========================================================================
+// HANDSHAKE -> ESTABLISHED once the shared secret is known
+// ========================================================================
+static void conn_established(Reactor *r, Connection *c)
+{
+    c->state = CONN_ESTABLISHED;
+    c->early_ok = !ticket_is_resume(c->peer_public_key);
+    metrics_add(METRIC_HANDSHAKES, 1);
+    ratchet_init(&c->ratchet, c->shared_secret, SHARED_SECRET_SIZE,
+                 RATCHET_SERVER);  // Message keys of both directions
+    conn_arm_timer(r, c);  // Idle timeout and keepalive instead
+    if (r->tickets != NULL) {
+        // A ticket for the next connection of this client
+        uint8_t frame[FRAME_HEADER_MAX + 1 + TICKET_FRAME_SIZE];
+        size_t hlen = frame_encode_header(frame, FRAME_TICKET,
+                                          TICKET_FRAME_SIZE);
+        if (ticket_issue(r->tickets, c->shared_secret, &c->control_tx,
+                         frame + hlen) < 0 ||
+            reactor_conn_queue(c, frame, hlen + TICKET_FRAME_SIZE) != 0) {
+            c->state = CONN_CLOSING;
+        }
+    }
+    if (!r->quiet) {
+        log_info("Client %llu: session %s", (unsigned long long)c->id,
+                 ticket_is_resume(c->peer_public_key) ? "resumed"
+                                                      : "established");
+    }
+    if (c->relay != NULL) relay_established(r, c);
+}
+
+// ========================================================================
+// HANDSHAKE with the resumption marker: check the ticket of FRAME_RESUME
+// (buffered in rx) and derive the session key from it. A refused ticket
+// gets FRAME_RESUME_REJECT and the handshake starts over.
+// ========================================================================
+static void conn_resume(Reactor *r, Connection *c)
+{
+    uint8_t scratch[TICKET_RESUME_SIZE];
+    uint8_t secret[TICKET_SECRET_SIZE];
+    Frame f;
+
+    int rc = frame_pop(&c->rx, &f, scratch, sizeof(scratch),
+                       TICKET_RESUME_SIZE);
+    if (rc == 0) return;  // Wait for the rest of the frame
+    if (rc < 0 || f.type != FRAME_RESUME ||
+        f.len != TICKET_RESUME_SIZE) {
+        c->state = CONN_CLOSING;
+        return;
+    }
+    c->resuming = 0;
+
+    if (ticket_open(r->tickets, f.payload + TICKET_RANDOM_SIZE,
+                    TICKET_SIZE, secret) != 0) {
+        // The client waits for the verdict, so nothing may follow
+        uint8_t reject[FRAME_HEADER_MAX + 1];
+        size_t hlen = frame_encode_header(reject, FRAME_RESUME_REJECT, 0);
+        c->peer_key_len = 0;
+        if (frame_buffer_used(&c->rx) != 0 ||
+            reactor_conn_queue(c, reject, hlen) != 0) {
+            c->state = CONN_CLOSING;
+        }
+        return;
+    }
+    ticket_resume_key(secret, c->server_random, f.payload,
+                      c->shared_secret);
+    memset(secret, 0, sizeof(secret));
+    conn_established(r, c);
+}
+
+// ========================================================================
+// Hand the key exchange to the handshake pool
+// Returns 0 if it was queued, -1 if it must be computed here
+// ========================================================================
+static int conn_hs_submit(Reactor *r, Connection *c)
+{
+    HsJob job;
+
+    // Never more jobs in flight than the inbox can return
+    if (r->hs_pool == NULL || r->hs_inflight >= HS_INBOX_SIZE) return -1;
+
+    job.fd = c->fd;
+    job.id = c->id;
+    job.private_key = r->private_key;
+    memcpy(job.peer_public_key, c->peer_public_key, KEY_SIZE);
+    job.inbox = &r->hs_inbox;
+    if (hs_pool_submit(r->hs_pool, &job) != 0) return -1;  // Pool busy
+
+    r->hs_inflight++;
+    metrics_add(METRIC_HS_QUEUED, 1);
+    c->hs_pending = 1;
+    return 0;
+}
+
+// ========================================================================
+// Feed bytes received from the socket into the state machine
+// ========================================================================
+static void conn_input(Reactor *r, Connection *c, const uint8_t *data,
+                       size_t len)
+{
+    if (c->state == CONN_HANDSHAKE && !c->hs_pending) {
+        // Collect the 32-byte client public key (it may arrive in parts)
+        size_t need = KEY_SIZE - c->peer_key_len;
+        size_t take = len < need ? len : need;
+        memcpy(c->peer_public_key + c->peer_key_len, data, take);
+        c->peer_key_len += take;
+        data += take;
+        len -= take;
+
+        if (c->peer_key_len < KEY_SIZE) return;  // Wait for the rest
+
+        if (r->tickets != NULL && ticket_is_resume(c->peer_public_key)) {
+            c->resuming = 1;  // No scalar multiplication: FRAME_RESUME
+        } else if (conn_hs_submit(r, c) != 0) {
+            // Compute the shared secret with the server private key
+            uint64_t t = trace_begin();
+            crypto_scalarmult(c->shared_secret, r->private_key,
+                              c->peer_public_key);
+            trace_end(TRACE_SCALARMULT, t);
+            conn_established(r, c);
+        }
+    }
+
+    if (c->state == CONN_HANDSHAKE) {
+        // Frames sent right behind the key wait for the shared secret
+        if (len > 0 && conn_rx_append(c, data, len) != 0) {
+            c->state = CONN_CLOSING;
+            return;
+        }
+        if (!c->resuming) return;
+        conn_resume(r, c);
+        if (c->state != CONN_ESTABLISHED) return;
+        len = 0;  // The rest is in rx
+    }
+
+    // Anything after the public key is a stream of encrypted frames
+    if (c->state == CONN_ESTABLISHED &&
+        (len > 0 || frame_buffer_used(&c->rx) > 0 || c->big != NULL)) {
+        conn_input_frames(r, c, data, len);
+    }
+}
+
+void reactor_conn_input(Reactor *r, Connection *c, const uint8_t *data,
+                        size_t len)
+{
+    c->rx_ms = r->now_ms;  // Read by conn_on_timer()
+    conn_input(r, c, data, len);
+    conn_rx_release(c);
+}
+
+// ========================================================================
+// EPOLLIN: read until the socket is drained (edge-triggered)
+// ========================================================================
+static void conn_on_readable(Reactor *r, Connection *c)
+{
+    uint8_t buffer[BUFFER_SIZE];
+
+    while (c->state != CONN_CLOSING) {
+        // Leave further input in the socket until a handshake worker
+        // has returned the shared secret
+        if (c->hs_pending) {
+            c->rx_blocked = 1;
+            return;
+        }
+
+        // Stop reading while the replies might not fit into the output
+        // buffer: one read completes at most the buffered partial frame
+        // plus the frames inside the read itself (and as many room
+        // messages, far fewer than REACTOR_TX_SEGS), each reply possibly
+        // behind a FRAME_REKEY. Reading resumes once the output has been
+        // flushed.
+        if (REACTOR_TX_SIZE - c->tx_len <
+            sizeof(buffer) + FRAME_HEADER_MAX + 1 + REACTOR_FRAME_MAX +
+            REACTOR_REKEY_ROOM ||
+            c->seg_count > 0) {
+            c->rx_blocked = 1;
+            return;
+        }
+
+        ssize_t n;
+        if (c->relay != NULL) {
+            // Frame by frame, so that relayed frames can be spliced
+            n = relay_read(r, c, buffer, sizeof(buffer));
+            if (n > 0) continue;
+        } else if (c->big != NULL) {
+            // The rest of a large frame goes straight into its segments
+            n = chain_rx_read(c->fd, c->big);
+            if (n > 0) {
+                reactor_conn_input(r, c, NULL, 0);
+                continue;
+            }
+        } else {
+            n = read(c->fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                reactor_conn_input(r, c, buffer, (size_t)n);
+                continue;
+            }
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+        // n == 0 (peer closed) or a socket error
+        c->state = CONN_CLOSING;
+        reactor_conn_drop_output(c);  // Nobody is left to read it
+    }
+}
+
+// ========================================================================
+// Take the next result of the handshake pool. Returns the connection that
+// is now ESTABLISHED (frames buffered meanwhile have been handled), or
+// NULL when the inbox is empty. Results for connections that were closed
+// in the meantime are dropped.
+// ========================================================================
+Connection *reactor_hs_next(Reactor *r)
+{
+    HsJob job;
+
+    while (hs_inbox_pop(&r->hs_inbox, &job)) {
+        Connection *c = (size_t)job.fd < r->conns_cap ? r->conns[job.fd]
+                                                      : NULL;
+        r->hs_inflight--;
+        metrics_add(METRIC_HS_DONE, 1);
+
+        if (c == NULL || c->id != job.id || !c->hs_pending) {
+            memset(job.shared_secret, 0, sizeof(job.shared_secret));
+            continue;  // Stale: the descriptor now belongs to another
+        }
+        c->hs_pending = 0;
+        memcpy(c->shared_secret, job.shared_secret, SHARED_SECRET_SIZE);
+        memset(job.shared_secret, 0, sizeof(job.shared_secret));
+
+        if (c->state == CONN_HANDSHAKE) {
+            conn_established(r, c);
+            conn_input_frames(r, c, NULL, 0);  // Buffered frames
+            conn_rx_release(c);
+        }
+        return c;
+    }
+    return NULL;
+}
+
+// ========================================================================
+// After input was handled: write the output, resume reading that was
+// paused and close finished sessions
+// ========================================================================
+static void conn_after_io(Reactor *r, Connection *c)
+{
+    int rc = conn_flush(c);
+    if (rc < 0) {
+        conn_close(r, c);
+        return;
+    }
+    while (rc == 0 && c->rx_blocked && !c->hs_pending &&
+           c->state != CONN_CLOSING) {
+        // Output drained: continue with the input left unread (the
+        // socket does not signal it again), until it runs dry or the
+        // kernel stops taking output
+        c->rx_blocked = 0;
+        conn_on_readable(r, c);
+        int own = c->tx_len > 0 || c->seg_count > 0;
+        rc = conn_flush(c);
+        if (!own) break;  // Paused for the relay peer, not for us
+    }
+    if (rc == 0 && c->relay != NULL) relay_resume(r, c);
+    // A graceful close waits until the kernel has released the frames
+    // it sends without a copy (their completions wake the loop)
+    if (c->state == CONN_CLOSING && rc != 1 && c->zc == NULL) {
+        conn_close(r, c);
+    }
+}
+
+// ========================================================================
+// Accept every pending connection (the listener is edge-triggered too)
+// ========================================================================
+static void reactor_accept(Reactor *r)
+{
+    for (;;) {
+        struct sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+        int fd = accept4(r->listen_fd, (struct sockaddr *)&cli_addr,
+                         &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN: backlog drained; anything else (EMFILE, ...):
+            // try again on the next wakeup
+            return;
+        }
+
+        Connection *c = reactor_conn_new(r, fd);
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            reactor_conn_free(r, c);
+            close(fd);
+            continue;
+        }
+
+        // Send the server public key queued by reactor_conn_new()
+        if (conn_flush(c) < 0) conn_close(r, c);
+    }
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int reactor_init(Reactor *r, int listen_fd, const uint8_t *private_key,
+                 const uint8_t *public_key)
+{
+    memset(r, 0, sizeof(*r));
+    pool_init(&r->conn_pool, sizeof(Connection));
+    buf_pool_init(&r->bufs);
+    r->listen_fd = listen_fd;
+    r->private_key = private_key;
+    r->public_key = public_key;
+    r->id_step = 1;
+    r->wake_fd = -1;
+    r->timeouts.handshake = HANDSHAKE_TIMEOUT;
+    ratchet_limits_default(&r->timeouts.rekey);
+    r->now_ms = timer_now_ms();
+    timer_wheel_init(&r->timers, r->now_ms);
+
+    if (set_nonblocking(listen_fd) < 0) return -1;
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0) return -1;
+
+    // data.ptr == NULL marks the listening socket
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        close(r->epoll_fd);
+        return -1;
+    }
+
+    // eventfd that lets reactor_stop() interrupt epoll_wait()
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &reactor_wake_marker;
+    if (r->wake_fd < 0 ||
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &ev) < 0) {
+        if (r->wake_fd >= 0) close(r->wake_fd);
+        close(r->epoll_fd);
+        return -1;
+    }
+
+    r->running = 1;
+    return 0;
+}
+
+void reactor_run(Reactor *r)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    if (r->uring) {
+        reactor_uring_run(r);  // io_uring backend
+        return;
+    }
+
+    while (r->running) {
+        // Sleep until the next deadline at most
+        int n = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS,
+                           reactor_timers_timeout(r));
+        if (n < 0) {
+            if (errno == EINTR) continue;  // Signal: re-check running
+            perror("epoll_wait");
+            return;
+        }
+        r->now_ms = timer_now_ms();
+
+        int hs_ready = 0;
+        for (int i = 0; i < n; i++) {
+            Connection *c = events[i].data.ptr;
+            uint32_t ev = events[i].events;
+
+            if (c == NULL) {
+                reactor_accept(r);
+                continue;
+            }
+            if ((void *)c == (void *)&reactor_wake_marker) {
+                uint64_t v;
+                if (read(r->wake_fd, &v, sizeof(v)) < 0) {
+                    // Nothing to drain: the counter was already read
+                }
+                continue;
+            }
+
+            if ((void *)c == (void *)&reactor_hs_marker) {
+                hs_ready = 1;  // Handled after the batch, because it may
+                               // close connections with events below
+                continue;
+            }
+
+            if ((ev & EPOLLERR) && conn_zc_only(c)) {
+                ev &= ~(uint32_t)EPOLLERR;  // Zero-copy sends completed
+            }
+            if (ev & (EPOLLERR | EPOLLHUP)) {
+                conn_close(r, c);
+                continue;
+            }
+            if (ev & (EPOLLIN | EPOLLRDHUP)) {
+                conn_on_readable(r, c);
+            }
+
+            // Write what was produced (or what was pending on EPOLLOUT)
+            conn_after_io(r, c);
+        }
+
+        // Deadlines that passed; sessions they close or hand a keepalive
+        // are put on the wake list
+        reactor_timers_run(r);
+
+        if (hs_ready) {
+            // Shared secrets computed by the handshake pool
+            Connection *c;
+            hs_inbox_rearm(&r->hs_inbox);
+            while ((c = reactor_hs_next(r)) != NULL) {
+                conn_after_io(r, c);
+            }
+        }
+
+        // Connections handed output by others (room messages). The list
+        // may grow while it is walked; closed connections are skipped.
+        for (size_t i = 0; i < r->wake_len; i++) {
+            ReactorWake w = r->wake[i];
+            Connection *c = (size_t)w.fd < r->conns_cap ? r->conns[w.fd]
+                                                        : NULL;
+            if (c == NULL || c->id != w.id) continue;
+            c->dirty = 0;
+            conn_after_io(r, c);
+        }
+        r->wake_len = 0;
+    }
+}
+
+void reactor_stop(Reactor *r)
+{
+    uint64_t one = 1;
+
+    r->running = 0;
+    // write() is async-signal-safe, so this may be called from a handler
+    if (r->wake_fd >= 0 && write(r->wake_fd, &one, sizeof(one)) < 0) {
+        // Counter overflow is impossible here; the loop still sees
+        // running == 0 on its next wakeup
+    }
+}
+
+int reactor_hs_attach(Reactor *r, HsPool *pool)
+{
+    struct epoll_event ev;
+
+    if (hs_inbox_init(&r->hs_inbox) < 0) return -1;
+
+    // The inbox eventfd is waited on like any other descriptor (the
+    // io_uring backend polls it itself)
+    ev.events = EPOLLIN;
+    ev.data.ptr = &reactor_hs_marker;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->hs_inbox.event_fd,
+                  &ev) < 0) {
+        hs_inbox_free(&r->hs_inbox);
+        return -1;
+    }
+    r->hs_pool = pool;
+    return 0;
+}
+
+void reactor_free(Reactor *r)
+{
+    if (r->uring) {
+        reactor_uring_free(r);  // Closes its sessions and the ring
+    }
+    for (size_t fd = 0; fd < r->conns_cap; fd++) {
+        if (r->conns[fd]) conn_close(r, r->conns[fd]);
+    }
+    free(r->conns);
+    r->conns = NULL;
+    r->conns_cap = 0;
+    pool_free(&r->conn_pool);  // Every session was put back
+    buf_pool_free(&r->bufs);
+    free(r->wake);  // Rooms were freed with their last member
+    r->wake = NULL;
+    r->wake_len = r->wake_cap = 0;
+    if (r->hs_pool) hs_inbox_free(&r->hs_inbox);
+    r->hs_pool = NULL;
+    if (r->wake_fd >= 0) close(r->wake_fd);
+    r->wake_fd = -1;
+    if (r->epoll_fd >= 0) close(r->epoll_fd);
+    r->epoll_fd = -1;
+}
+
+// ========================================================================
+// Multi-reactor mode: one SO_REUSEPORT listener and event loop per thread
+// ========================================================================
+int reactor_listen(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int optval = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval,
+                   sizeof(optval)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                   sizeof(optval)) < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, REACTOR_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Thread body: run one reactor until it is stopped
+static void *reactor_pool_main(void *arg)
+{
+    Reactor *r = (Reactor *)arg;
+    reactor_run(r);
+    return NULL;
+}
+
+int reactor_pool_start(ReactorPool *p, int listen_fd, int port,
+                       int threads, int hs_workers,
+                       const uint8_t *private_key,
+                       const uint8_t *public_key, int flags,
+                       const ReactorTimeouts *timeouts)
+{
+    memset(p, 0, sizeof(*p));
+    p->reactors = calloc(threads, sizeof(Reactor));
+    p->threads = calloc(threads, sizeof(pthread_t));
+    if (p->reactors == NULL || p->threads == NULL ||
+        ticket_keys_init(&p->tickets) < 0) {
+        free(p->reactors);
+        free(p->threads);
+        return -1;
+    }
+    if (early_window_init(&p->replay) < 0) {
+        ticket_keys_free(&p->tickets);
+        free(p->reactors);
+        free(p->threads);
+        return -1;
+    }
+
+    // One handshake pool serves every loop
+    if (hs_workers > 0 && hs_pool_start(&p->hs_pool, hs_workers) < 0) {
+        early_window_free(&p->replay);
+        ticket_keys_free(&p->tickets);
+        free(p->reactors);
+        free(p->threads);
+        return -1;
+    }
+
+    // Create every listener and loop first, so that a failure leaves no
+    // half-started pool behind
+    for (int i = 0; i < threads; i++) {
+        int fd = (i == 0 && listen_fd >= 0) ? listen_fd
+                                            : reactor_listen(port);
+        if (fd < 0 ||
+            reactor_init(&p->reactors[i], fd, private_key,
+                         public_key) < 0) {
+            if (fd >= 0 && fd != listen_fd) close(fd);
+            p->count = i;
+            reactor_pool_stop(p);
+            return -1;
+        }
+        p->count = i + 1;
+        p->reactors[i].quiet = (flags & REACTOR_QUIET) != 0;
+        p->reactors[i].zerocopy = (flags & REACTOR_ZEROCOPY) != 0;
+        p->reactors[i].relay = (flags & REACTOR_RELAY) != 0;
+        if (timeouts != NULL) p->reactors[i].timeouts = *timeouts;
+        p->reactors[i].tickets = &p->tickets;
+        p->reactors[i].replay = &p->replay;
+        if (hs_workers > 0 &&
+            reactor_hs_attach(&p->reactors[i], &p->hs_pool) < 0) {
+            reactor_pool_stop(p);
+            return -1;
+        }
+        if ((flags & REACTOR_URING) && !(flags & REACTOR_RELAY) &&
+            reactor_uring_init(&p->reactors[i]) < 0) {
+            // Kernel without io_uring (or it is disabled): keep epoll
+            if (i == 0) perror("io_uring unavailable, using epoll");
+        }
+        p->reactors[i].next_id = (uint64_t)i;      // Ids stay unique
+        p->reactors[i].id_step = (uint64_t)threads; // across the pool
+    }
+    p->count = threads;
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, reactor_pool_main,
+                           &p->reactors[i]) != 0) {
+            // Workers that did not start are marked by running == 0
+            p->reactors[i].running = 0;
+        }
+    }
+    return 0;
+}
+
+void reactor_pool_wait(ReactorPool *p)
+{
+    for (int i = 0; i < p->count; i++) {
+        if (p->threads[i]) pthread_join(p->threads[i], NULL);
+        p->threads[i] = 0;
+    }
+}
+
+void reactor_pool_stop(ReactorPool *p)
+{
+    for (int i = 0; i < p->count; i++) {
+        reactor_stop(&p->reactors[i]);
+    }
+    reactor_pool_wait(p);
+    hs_pool_stop(&p->hs_pool);  // Workers deliver into the loops' inboxes
+    for (int i = 0; i < p->count; i++) {
+        close(p->reactors[i].listen_fd);
+        reactor_free(&p->reactors[i]);
+    }
+    ticket_keys_free(&p->tickets);
+    early_window_free(&p->replay);
+    free(p->reactors);
+    free(p->threads);
+    memset(p, 0, sizeof(*p));
+}
+
+#endif // __linux__
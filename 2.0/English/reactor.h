@@ -0,0 +1,392 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For KEY_SIZE, BUFFER_SIZE, NONCE_SIZE and
+                          // the crypto headers
+
+#ifdef __linux__
+
+#include <signal.h>       // For sig_atomic_t
+#include <pthread.h>      // For the worker threads of a ReactorPool
+#include <sys/uio.h>      // For struct iovec
+#include "hs_pool.h"      // For handshakes offloaded to worker threads
+#include "ticket.h"       // For session resumption tickets
+#include "early.h"        // For 0-RTT early data
+#include "pool.h"         // For the session and buffer pools
+#include "zerocopy.h"     // For MSG_ZEROCOPY sends of large frames
+#include "timer.h"        // For the deadlines of the sessions
+
+// ========================================================================
+// Constants
+// ========================================================================
+#define REACTOR_MAX_EVENTS 256      // epoll events handled per wakeup
+#define REACTOR_TX_SIZE 4096        // Pending output per connection
+                                    // (a POOL_CLASS_MAX buffer)
+#define REACTOR_BACKLOG 4096        // listen() backlog in reactor mode
+#define REACTOR_RX_SIZE 1024        // Reassembly ring per connection
+                                    // (a power of two)
+#define REACTOR_FRAME_MAX (BUFFER_SIZE + TAG_SIZE)  // Largest frame
+                                                    // payload handled in
+                                                    // the ring
+#define REACTOR_MSG_MAX MSG_MAX_DEFAULT  // Largest accepted frame payload
+                                         // (larger ones are received
+                                         // into a chain)
+#define REACTOR_REKEY_ROOM ((BUFFER_SIZE / (2 + TAG_SIZE) + 1) * \
+                            (FRAME_HEADER_MAX + 1 + RATCHET_REKEY_SIZE))
+                                    // FRAME_REKEY in front of each reply
+                                    // to the frames of one read
+#define REACTOR_TX_SEGS 64          // Shared frames queued per connection
+#define REACTOR_TX_IOV (2 * REACTOR_TX_SEGS + 1)  // iovecs needed to
+                                                  // send all output
+#define REACTOR_TX_MSG_SIZE POOL_CLASS_MAX  // Buffer holding the
+                                           // SENDMSG arguments of the
+                                           // io_uring backend
+#define REACTOR_ZC_PENDING 64       // Zero-copy sends awaiting their
+                                    // completion per connection
+
+// Flags of reactor_pool_start()
+#define REACTOR_QUIET 1             // Do not print messages
+#define REACTOR_URING 2             // Use the io_uring backend if the
+                                    // kernel supports it
+#define REACTOR_ZEROCOPY 4          // Send large shared frames with
+                                    // MSG_ZEROCOPY (epoll backend)
+#define REACTOR_RELAY 8             // Pair the clients and forward
+                                    // between them (epoll backend,
+                                    // see relay.h)
+
+// The io_uring backend needs the kernel UAPI header
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define REACTOR_HAVE_URING 1
+#endif
+#endif
+
+// ========================================================================
+// Per-connection state machine
+// ========================================================================
+// HANDSHAKE   - server public key queued, waiting for the 32-byte client
+//               public key (and, with a handshake pool, for the shared
+//               secret computed by a worker; frames that arrive in the
+//               meantime are buffered). An all-zero key is followed by
+//               a FRAME_RESUME with a ticket instead (see ticket.h)
+// ESTABLISHED - shared secret computed, encrypted frames are decrypted
+//               and echoed back to the client (the first one may be
+//               FRAME_EARLY, sent together with the client key)
+// CLOSING     - the session is over; the socket is closed as soon as the
+//               pending output has been written
+//
+// Every session has one timer, armed for the earliest of its deadlines:
+// the handshake deadline while in HANDSHAKE, then the idle timeout and
+// the next keepalive (see conn_on_timer())
+typedef enum {
+    CONN_HANDSHAKE,
+    CONN_ESTABLISHED,
+    CONN_CLOSING
+} ConnState;
+
+// ========================================================================
+// Reference-counted output buffer
+// ========================================================================
+// A frame sent to many connections (a room broadcast) is built once and
+// queued by reference: every connection that queues it takes a reference
+// and drops it when the frame has been written. Buffers never leave the
+// event loop that created them, so the count is not atomic.
+typedef struct {
+    int refs;                                // Owners of the buffer
+    size_t len;                              // Valid bytes in data
+    uint8_t data[];                          // The frame
+} SharedBuf;
+
+struct Room;
+struct RelayLink;
+
+// Shared frames queued on a connection: mark[i] is the offset in tx at
+// which frame buf[i] is sent
+typedef struct {
+    SharedBuf *buf[REACTOR_TX_SEGS];         // The frames
+    size_t mark[REACTOR_TX_SEGS];            // Where each one goes in tx
+} ConnSegs;
+
+// Shared frames sent with MSG_ZEROCOPY, oldest first. The kernel reads
+// buf[i] until the completion of send number seq[i] arrives on the
+// error queue, so each entry holds a reference until then.
+typedef struct {
+    SharedBuf *buf[REACTOR_ZC_PENDING];      // The frames (NULL: done)
+    uint32_t seq[REACTOR_ZC_PENDING];        // Their send numbers
+    unsigned head;                           // Oldest entry
+    unsigned count;                          // Entries in use
+} ConnZc;
+
+// ========================================================================
+// Structure holding one client session inside the reactor
+// ========================================================================
+// The output of a connection is its private tx buffer with shared frames
+// slotted in between. tx always starts with the next byte to be written.
+//
+// An idle session holds no buffers: tx, the shared frame list and the
+// rx ring are taken from the buffer pool of the reactor when they are
+// needed and put back as soon as they are empty again.
+typedef struct Connection {
+    int fd;                                  // Non-blocking client socket
+    ConnState state;                         // Current protocol state
+    uint64_t id;                             // Sequence number for logs
+
+    uint8_t peer_public_key[KEY_SIZE];       // Client public key
+    size_t peer_key_len;                     // Bytes of it received so far
+    int hs_pending;                          // Key exchange queued in the
+                                             // handshake pool
+    int resuming;                            // Waiting for FRAME_RESUME
+    uint8_t server_random[TICKET_RANDOM_SIZE];  // Sent in FRAME_HELLO
+    int early_ok;                            // Next frame may be early
+    uint8_t shared_secret[SHARED_SECRET_SIZE];  // X25519 shared key
+    Ratchet ratchet;                         // Message keys (FRAME_DATA)
+    uint64_t control_tx;                     // Control frames sent
+                                             // (control.h)
+
+    BufPool *bufs;                           // Buffers of the reactor
+    FrameBuffer rx;                          // Partial frame carried over
+                                             // to the next read
+    ChainRx *big;                            // Frame larger than
+                                             // REACTOR_FRAME_MAX being
+                                             // received (or NULL)
+
+    uint8_t *tx;                             // Output not yet written
+                                             // (REACTOR_TX_SIZE bytes)
+    size_t tx_len;                           // Valid bytes in tx
+    ConnSegs *segs;                          // Shared frames queued
+    unsigned seg_head;                       // Oldest shared frame
+    unsigned seg_count;                      // Shared frames queued
+    size_t seg_off;                          // Bytes of the oldest one
+                                             // already sent
+    int rx_blocked;                          // Input left unread because
+                                             // the output was full
+    ConnZc *zc;                              // Zero-copy sends not yet
+                                             // completed (or NULL)
+    uint32_t zc_next;                        // Number of the next one
+    int zc_on;                               // Large frames leave with
+                                             // MSG_ZEROCOPY
+
+    struct Room *room;                       // Room joined (or NULL)
+    size_t room_index;                       // Slot in its member list
+    struct RelayLink *relay;                 // Relay pair (NULL: not in
+                                             // relay mode)
+
+    int dirty;                               // Queued for a flush at the
+                                             // end of the batch
+    Timer timer;                             // Next deadline
+    uint64_t rx_ms;                          // Time of the last input
+
+    // io_uring backend only
+    size_t tx_inflight;                      // Bytes of output being sent
+    void *tx_msg;                            // msghdr of a SENDMSG with
+                                             // shared frames
+    int recv_armed;                          // Multishot recv active
+    int shutdown_sent;                       // Linked shutdown queued
+    int shutdown_inflight;                   // Shutdown not completed
+    struct Connection *next_dirty;           // Next dirty connection
+} Connection;
+
+// Connection that was handed output by another one (epoll backend)
+typedef struct {
+    int fd;                                  // Its descriptor
+    uint64_t id;                             // Its id (the descriptor
+                                             // may have been reused)
+} ReactorWake;
+
+// Deadlines of the sessions in seconds (0: none), and when the server
+// replaces its message key of a session
+typedef struct {
+    unsigned handshake;                      // Accept -> session key
+    unsigned idle;                           // Without any input
+    unsigned keepalive;                      // Silence before the server
+                                             // sends FRAME_KEEPALIVE
+    RatchetLimits rekey;                     // Messages, bytes or seconds
+                                             // per key (see ratchet.h)
+} ReactorTimeouts;
+
+// ========================================================================
+// Structure holding one event loop and its connection table
+// ========================================================================
+typedef struct {
+    int listen_fd;                           // Non-blocking listen socket
+    int epoll_fd;                            // epoll instance
+    int wake_fd;                             // eventfd used to wake the
+                                             // loop from other threads
+    volatile sig_atomic_t running;           // Cleared by reactor_stop()
+    int quiet;                               // Do not print messages
+    int zerocopy;                            // Enable MSG_ZEROCOPY on
+                                             // new connections
+    int relay;                               // Relay mode (see relay.h)
+
+    const uint8_t *private_key;              // Server key pair shared by
+    const uint8_t *public_key;               // all sessions of the loop
+
+    Connection **conns;                      // Connection table (by fd)
+    size_t conns_cap;                        // Size of the table
+    size_t active;                           // Open connections
+    uint64_t next_id;                        // Next connection id
+    uint64_t id_step;                        // Id increment (number of
+                                             // reactors in the pool)
+    void *uring;                             // io_uring state (NULL when
+                                             // epoll is used)
+
+    HsPool *hs_pool;                         // Handshake workers (NULL:
+                                             // computed in the loop)
+    TicketKeys *tickets;                     // Ticket keys (NULL: no
+                                             // resumption)
+    ReplayWindow *replay;                    // Client keys of accepted
+                                             // early data (NULL: none)
+    HsInbox hs_inbox;                        // Their results
+    size_t hs_inflight;                      // Jobs not yet returned
+
+    struct Room *rooms;                      // Rooms of this loop
+    Connection *relay_waiting;               // Relay client without a
+                                             // peer (or NULL)
+    uint32_t relay_pairs;                    // Pairs formed so far
+    Pool conn_pool;                          // Connection structures
+    BufPool bufs;                            // Their tx, rx and shared
+                                             // frame buffers
+    ReactorWake *wake;                       // Connections to flush at
+    size_t wake_len, wake_cap;               // the end of the batch
+
+    ReactorTimeouts timeouts;                // Deadlines of new sessions
+    TimerWheel timers;                       // Their timers
+    uint64_t now_ms;                         // Clock at the last wakeup
+} Reactor;
+
+// ========================================================================
+// Structure holding one reactor per worker thread
+// ========================================================================
+// Every worker binds its own SO_REUSEPORT listener on the same port, so
+// the kernel spreads new connections over the workers and no state is
+// shared between them.
+typedef struct {
+    Reactor *reactors;                       // One event loop per thread
+    pthread_t *threads;                      // Worker threads
+    int count;                               // Number of workers
+    HsPool hs_pool;                          // Handshake workers shared
+                                             // by all loops (if started)
+    TicketKeys tickets;                      // Ticket keys of all loops
+    ReplayWindow replay;                     // Their anti-replay window
+} ReactorPool;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Prepares a reactor for 'listen_fd' (which must already be listening):
+// makes it non-blocking and registers it with a new epoll instance.
+// Sessions get the default deadlines (HANDSHAKE_TIMEOUT for the
+// handshake, no idle timeout, no keepalive); change r->timeouts before
+// the loop runs.
+// Point 'tickets' at initialized TicketKeys to offer resumption and
+// 'replay' at a ReplayWindow to accept early data.
+// Returns 0 on success, -1 on error (errno is set).
+int reactor_init(Reactor *r, int listen_fd, const uint8_t *private_key,
+                 const uint8_t *public_key);
+
+// Runs the event loop until reactor_stop() is called
+void reactor_run(Reactor *r);
+
+// Asks the loop to return after the current wakeup (signal safe)
+void reactor_stop(Reactor *r);
+
+// Closes every connection and the epoll instance (not the listener)
+void reactor_free(Reactor *r);
+
+// Switches an initialized reactor to the io_uring backend (multishot
+// accept, multishot recv into a provided buffer ring, linked sends).
+// Returns 0 on success, -1 if io_uring is not available; the reactor
+// then keeps using epoll.
+int reactor_uring_init(Reactor *r);
+
+// Moves the key exchanges of the reactor to the workers of 'pool'. The
+// pool must be stopped before the reactor is freed.
+// Returns 0 on success, -1 on error (errno is set).
+int reactor_hs_attach(Reactor *r, HsPool *pool);
+
+// Functions used by the backends (reactor.c and reactor_uring.c)
+void reactor_uring_run(Reactor *r);
+void reactor_uring_free(Reactor *r);
+Connection *reactor_conn_new(Reactor *r, int fd);
+void reactor_conn_free(Reactor *r, Connection *c);
+void reactor_conn_input(Reactor *r, Connection *c, const uint8_t *data,
+                        size_t len);
+int reactor_conn_queue(Connection *c, const uint8_t *data, size_t len);
+Connection *reactor_hs_next(Reactor *r);
+void reactor_uring_mark_dirty(Reactor *r, Connection *c);
+
+// Milliseconds until the next deadline of a session (-1: none), and
+// handles the deadlines that have passed (call once per wakeup, after
+// the completions of the wakeup have been handled)
+int reactor_timers_timeout(Reactor *r);
+void reactor_timers_run(Reactor *r);
+
+// Queues a FRAME_REKEY and moves c->ratchet.tx to its next key when it
+// has reached r->timeouts.rekey; call it before a FRAME_DATA is sealed
+// under c->ratchet.tx. Returns 0, or -1 if the output is full (the
+// connection is then closing).
+int reactor_conn_rekey(Reactor *r, Connection *c);
+
+// Returns room for 'len' more bytes at the end of the private output of
+// 'c' (the caller adds them to tx_len once written), or NULL if they do
+// not fit
+uint8_t *reactor_conn_reserve(Connection *c, size_t len);
+
+// Shared buffers: new returns a buffer of 'len' bytes holding one
+// reference (NULL if out of memory), unref frees it with the last one
+SharedBuf *shared_buf_new(size_t len);
+void shared_buf_unref(SharedBuf *b);
+
+// Queues a reference to 'b' behind the output already queued on 'c'.
+// Returns 0, or -1 if the connection already holds REACTOR_TX_SEGS
+// shared frames (it is not reading fast enough).
+int reactor_conn_queue_shared(Connection *c, SharedBuf *b);
+
+// Fills 'iov' with the output of 'c' in sending order. Returns the
+// number of entries (at most REACTOR_TX_IOV) and the bytes in 'total'.
+int reactor_conn_iov(const Connection *c, struct iovec *iov,
+                     size_t *total);
+
+// Removes 'n' written bytes from the front of the output
+void reactor_conn_consume(Connection *c, size_t n);
+
+// Drops all output (the peer will not read it any more)
+void reactor_conn_drop_output(Connection *c);
+
+// Makes sure the loop writes the output of 'c' at the end of the
+// current batch, when it was queued while handling another connection
+void reactor_conn_wake(Reactor *r, Connection *c);
+
+// Creates a TCP listener on 'port' with SO_REUSEADDR and SO_REUSEPORT
+// set, bound to all interfaces. Returns the descriptor or -1 on error.
+int reactor_listen(int port);
+
+// Starts 'threads' workers, each running its own reactor. The first
+// worker uses 'listen_fd' if it is >= 0 (it must have been created with
+// SO_REUSEPORT), every other worker creates its own listener with
+// reactor_listen(). With 'hs_workers' > 0 the key exchanges of every
+// loop run on that many handshake threads. All loops issue and accept
+// the same resumption tickets and share one anti-replay window for
+// early data. 'flags' is a combination of REACTOR_QUIET,
+// REACTOR_URING, REACTOR_ZEROCOPY and REACTOR_RELAY (which keeps every
+// loop on epoll). 'timeouts' sets the deadlines of the sessions (NULL:
+// the defaults of reactor_init()). Returns 0 on success, -1 on error.
+int reactor_pool_start(ReactorPool *p, int listen_fd, int port,
+                       int threads, int hs_workers,
+                       const uint8_t *private_key,
+                       const uint8_t *public_key, int flags,
+                       const ReactorTimeouts *timeouts);
+
+// Waits until every worker has returned
+void reactor_pool_wait(ReactorPool *p);
+
+// Stops every worker, waits for them, closes the listeners and frees
+// the pool
+void reactor_pool_stop(ReactorPool *p);
+
+#endif // __linux__
+#endif // REACTOR_H
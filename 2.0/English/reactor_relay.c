@@ -0,0 +1,463 @@
+#define _GNU_SOURCE       // For splice(), pipe2() and F_SETPIPE_SZ
+
+#include "relay.h"
+
+#ifdef __linux__
+
+#include <errno.h>        // For errno, EAGAIN, EINTR, EPROTO
+#include <fcntl.h>        // For splice(), pipe2(), fcntl()
+#include <unistd.h>       // For read(), close()
+#include <sys/socket.h>   // For recv(), MSG_PEEK
+#include "room.h"         // For room_store32() and room_load32()
+#include "drng.h"         // For rdrand_get_bytes (pair keys)
+
+// ========================================================================
+// Relay pairs of the event loop
+// ========================================================================
+// Pairing, pair keys and the two forwarding paths. Everything here runs
+// on the thread of the loop that owns both connections, so nothing is
+// locked.
+// ========================================================================
+
+#define RELAY_PIPE_SIZE REACTOR_MSG_MAX   // Pipe size asked for (the
+                                          // kernel may grant less)
+#define RELAY_PEEK (FRAME_HEADER_MAX + 1 + 4)  // Frame header and the
+                                               // pair number
+
+// Label mixed into every pair key
+static const char relay_kdf_label[] = "ECC-code relay key";
+
+// ========================================================================
+// Helper: queue a short notice for the client under its session key
+// ========================================================================
+static void relay_notice(Reactor *r, Connection *c, const char *text)
+{
+    uint8_t frame[FRAME_HEADER_MAX + 1 + BUFFER_SIZE + TAG_SIZE];
+    uint8_t nonce[RATCHET_NONCE_SIZE];
+    size_t len = strlen(text);
+    uint64_t clen = 0;
+
+    if (reactor_conn_rekey(r, c) != 0) return;
+    ratchet_nonce(&c->ratchet.tx, nonce);
+    ratchet_count(&c->ratchet.tx, len);
+
+    size_t hlen = frame_encode_header(frame, FRAME_DATA, len + TAG_SIZE);
+    if (crypto_aead_encrypt(frame + hlen, &clen, (const uint8_t *)text,
+                            len, nonce, c->ratchet.tx.key) != 0 ||
+        reactor_conn_queue(c, frame, hlen + clen) != 0) {
+        c->state = CONN_CLOSING;
+    }
+}
+
+// ========================================================================
+// Helper: send the pair key to a member as a control frame of its
+// session (control.h), or the end of the pair when 'key' is NULL
+// ========================================================================
+static void relay_send_key(Connection *c, const uint8_t *key)
+{
+    uint8_t plain[RELAY_KEY_PLAIN];
+    uint8_t frame[FRAME_HEADER_MAX + 1 + CONTROL_HEADER + RELAY_KEY_PLAIN +
+                  CONTROL_TAG_SIZE];
+    size_t plen = 0;
+
+    if (key != NULL) {
+        room_store32(plain, c->relay->pair);
+        plain[4] = c->relay->side;
+        memcpy(plain + 5, key, GROUP_KEY_SIZE);
+        plen = RELAY_KEY_PLAIN;
+    }
+    size_t hlen = frame_encode_header(frame, FRAME_RELAY_KEY,
+                                      CONTROL_HEADER + plen +
+                                      CONTROL_TAG_SIZE);
+    size_t clen = control_seal(c->shared_secret, SHARED_SECRET_SIZE,
+                               CONTROL_KEYS, &c->control_tx, plain, plen,
+                               frame + hlen);
+    if (reactor_conn_queue(c, frame, hlen + clen) != 0) {
+        c->state = CONN_CLOSING;
+    }
+    memset(plain, 0, sizeof(plain));
+}
+
+// ========================================================================
+// Helper: make 'a' and 'b' a pair and give them a key
+//   key = Ascon-XOF128(label | pair | seed)
+// Without random bytes the pair gets no key: its messages then take the
+// re-encryption path
+// ========================================================================
+static void relay_pair(Reactor *r, Connection *a, Connection *b)
+{
+    uint8_t in[sizeof(relay_kdf_label) + 4 + 32];
+    uint8_t key[GROUP_KEY_SIZE];
+    char text[64];
+    size_t n = 0;
+
+    if (++r->relay_pairs == 0) r->relay_pairs = 1;  // 0 means no pair
+    a->relay->peer = b;
+    a->relay->pair = r->relay_pairs;
+    a->relay->side = 0;
+    b->relay->peer = a;
+    b->relay->pair = r->relay_pairs;
+    b->relay->side = 1;
+
+    memcpy(in, relay_kdf_label, sizeof(relay_kdf_label));  // With '\0'
+    n += sizeof(relay_kdf_label);
+    room_store32(in + n, r->relay_pairs);
+    n += 4;
+    if (rdrand_get_bytes(32, in + n) == 32) {
+        crypto_xof(key, GROUP_KEY_SIZE, in, n + 32);
+        relay_send_key(a, key);
+        relay_send_key(b, key);
+    }
+    memset(in, 0, sizeof(in));
+    memset(key, 0, sizeof(key));
+
+    snprintf(text, sizeof(text), "Connected to client %llu",
+             (unsigned long long)b->id);
+    relay_notice(r, a, text);
+    snprintf(text, sizeof(text), "Connected to client %llu",
+             (unsigned long long)a->id);
+    relay_notice(r, b, text);
+    if (!r->quiet) {
+        log_info("Clients %llu and %llu: relay pair %u",
+                 (unsigned long long)a->id, (unsigned long long)b->id,
+                 r->relay_pairs);
+    }
+}
+
+// ========================================================================
+// Helper: create the pipe that feeds the socket of 'c'
+// Returns 0, or -1 if no pipe is available (frames are then copied)
+// ========================================================================
+static int relay_pipe_open(Connection *c)
+{
+    RelayLink *l = c->relay;
+    if (l->pipe[0] >= 0) return 0;
+    if (pipe2(l->pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        l->pipe[0] = l->pipe[1] = -1;
+        return -1;
+    }
+
+    // A larger pipe moves a whole frame at once; the default (64 KiB)
+    // still works, in more steps
+    fcntl(l->pipe[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+    int cap = fcntl(l->pipe[1], F_GETPIPE_SZ);
+    l->pipe_cap = cap > 0 ? (size_t)cap : 65536;
+    l->pipe_len = 0;
+    return 0;
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int relay_attach(Reactor *r, Connection *c)
+{
+    (void)r;
+    RelayLink *l = buf_pool_get(c->bufs, sizeof(RelayLink));
+    if (l == NULL) return -1;
+    memset(l, 0, sizeof(*l));
+    l->pipe[0] = l->pipe[1] = -1;
+    c->relay = l;
+    return 0;
+}
+
+void relay_detach(Reactor *r, Connection *c)
+{
+    RelayLink *l = c->relay;
+    if (l == NULL) return;
+    if (r->relay_waiting == c) r->relay_waiting = NULL;
+
+    Connection *p = l->peer;
+    if (p != NULL) {
+        RelayLink *pl = p->relay;
+        pl->peer = NULL;
+        pl->pair = 0;
+        if (pl->mode == RELAY_SPLICE) pl->mode = RELAY_SKIP;  // Its frame
+                                                  // has nowhere to go
+        if (l->mode == RELAY_SPLICE && l->left > 0) {
+            // The peer got the start of a frame that will never end
+            p->state = CONN_CLOSING;
+            reactor_conn_drop_output(p);
+        } else if (p->state != CONN_CLOSING && r->running) {
+            char text[64];
+            snprintf(text, sizeof(text), "Client %llu left",
+                     (unsigned long long)c->id);
+            relay_send_key(p, NULL);
+            relay_notice(r, p, text);
+            relay_established(r, p);  // Waits for the next client
+        }
+        reactor_conn_wake(r, p);
+    }
+
+    relay_drop_output(c);
+    c->relay = NULL;
+    buf_pool_put(c->bufs, l, sizeof(*l));
+}
+
+void relay_established(Reactor *r, Connection *c)
+{
+    Connection *w = r->relay_waiting;
+
+    if (c->relay == NULL) return;
+    if (w != NULL && w != c && w->state == CONN_ESTABLISHED) {
+        r->relay_waiting = NULL;
+        relay_pair(r, w, c);
+        reactor_conn_wake(r, w);
+        return;
+    }
+    r->relay_waiting = c;
+    relay_notice(r, c, "Waiting for a peer");
+}
+
+// ========================================================================
+// Helper: look at the next frame of 'c' (still in the socket) and decide
+// where its bytes go. Returns 1, 0 if the client closed, or -1 with
+// errno set.
+// ========================================================================
+static int relay_next_frame(Connection *c)
+{
+    RelayLink *l = c->relay;
+    Connection *p = l->peer;
+    uint8_t head[RELAY_PEEK];
+    uint8_t type;
+    size_t hlen = 0, plen = 0;  // Not set while the header is short
+
+    ssize_t n = recv(c->fd, head, sizeof(head), MSG_PEEK | MSG_DONTWAIT);
+    if (n <= 0) return (int)n;
+    int rc = frame_peek_header(head, (size_t)n, &type, &hlen, &plen);
+    if (rc < 0 || plen > REACTOR_MSG_MAX) {
+        errno = EPROTO;  // Malformed or oversized frame
+        return -1;
+    }
+    if (rc == 0 ||
+        (type == FRAME_RELAY && plen >= 4 && (size_t)n < hlen + 4)) {
+        errno = EAGAIN;  // The rest of the header is on its way
+        return -1;
+    }
+
+    int forward = p != NULL && c->state == CONN_ESTABLISHED &&
+                  (type == FRAME_DATA || type == FRAME_RELAY);
+    if (type == FRAME_RELAY &&
+        (!forward || plen < RELAY_HEADER + TAG_SIZE ||
+         room_load32(head + hlen) != l->pair)) {
+        // Sent to an earlier pair (or to nobody): dropped unread
+        l->mode = RELAY_SKIP;
+        l->left = hlen + plen;
+        return 1;
+    }
+
+    if (forward) {
+        // Wait until the output of the peer can take the frame. A frame
+        // that is spliced must also wait for everything queued before it.
+        int full;
+        if (type == FRAME_RELAY) {
+            full = p->tx_len > 0 || p->seg_count > 0;
+        } else if (plen <= REACTOR_FRAME_MAX) {
+            full = hlen + plen > REACTOR_TX_SIZE - p->tx_len;
+        } else {
+            full = p->seg_count >= REACTOR_TX_SEGS;
+        }
+        if (full) {
+            c->rx_blocked = 1;
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    l->mode = RELAY_READ;
+    if (type == FRAME_RELAY && relay_pipe_open(p) == 0) {
+        l->mode = RELAY_SPLICE;  // Otherwise relay_forward() copies it
+    }
+    l->left = hlen + plen;
+    return 1;
+}
+
+ssize_t relay_read(Reactor *r, Connection *c, uint8_t *buf, size_t len)
+{
+    RelayLink *l = c->relay;
+    ssize_t n;
+
+    // Nothing behind the client public key is read before the session
+    // is set up: it may be a frame that is spliced later
+    if (c->state == CONN_HANDSHAKE && !c->resuming) {
+        size_t need = KEY_SIZE - c->peer_key_len;
+        n = read(c->fd, buf, need < len ? need : len);
+        if (n > 0) reactor_conn_input(r, c, buf, (size_t)n);
+        return n;
+    }
+
+    if (l->left == 0) {
+        int rc = relay_next_frame(c);
+        if (rc <= 0) return rc;
+    }
+
+    if (l->mode == RELAY_SPLICE) {
+        // Socket -> pipe of the peer; the bytes stay in the kernel
+        RelayLink *pl = l->peer->relay;
+        size_t room = pl->pipe_cap - pl->pipe_len;
+        if (room == 0) {
+            c->rx_blocked = 1;  // Until the peer has drained the pipe
+            errno = EAGAIN;
+            return -1;
+        }
+        n = splice(c->fd, NULL, pl->pipe[1], NULL,
+                   l->left < room ? l->left : room,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            l->left -= (size_t)n;
+            pl->pipe_len += (size_t)n;
+            c->rx_ms = r->now_ms;  // Input for the idle timeout
+            reactor_conn_wake(r, l->peer);
+        } else if (n < 0 && errno == EAGAIN && pl->pipe_len > 0) {
+            // Pipe buffers are pages: it may be full before pipe_cap
+            c->rx_blocked = 1;
+        }
+        return n;
+    }
+
+    if (l->mode == RELAY_READ && c->big != NULL) {
+        // The rest of a large frame goes straight into its segments
+        n = chain_rx_read(c->fd, c->big);
+        if (n > 0) {
+            l->left -= (size_t)n;
+            reactor_conn_input(r, c, NULL, 0);
+        }
+        return n;
+    }
+
+    n = read(c->fd, buf, l->left < len ? l->left : len);
+    if (n > 0) {
+        l->left -= (size_t)n;
+        if (l->mode == RELAY_READ) {
+            reactor_conn_input(r, c, buf, (size_t)n);
+        } else {
+            c->rx_ms = r->now_ms;  // Skipped, but input all the same
+        }
+    }
+    return n;
+}
+
+int relay_forward(Reactor *r, Connection *c, const Frame *f)
+{
+    Connection *p = c->relay->peer;
+    uint8_t head[FRAME_HEADER_MAX + 1];
+    SharedBuf *b = NULL;
+    uint8_t *out;
+
+    if (p == NULL || (f->type != FRAME_DATA && f->type != FRAME_RELAY)) {
+        return 0;
+    }
+    if (p->state == CONN_CLOSING) return 1;  // Nobody to read it
+
+    // A message under the session keys goes to the peer under its next
+    // key, announced first when the current one is used up
+    uint8_t nonce_in[RATCHET_NONCE_SIZE], nonce_out[RATCHET_NONCE_SIZE];
+    if (f->type == FRAME_DATA) {
+        if (reactor_conn_rekey(r, p) != 0) {
+            reactor_conn_drop_output(p);
+            return 1;
+        }
+        ratchet_nonce(&c->ratchet.rx, nonce_in);
+        ratchet_nonce(&p->ratchet.tx, nonce_out);
+    }
+
+    // Into the private output of the peer, or a buffer of its own for a
+    // frame larger than that
+    size_t hlen = frame_encode_header(head, f->type, f->len);
+    size_t total = hlen + f->len;
+    out = reactor_conn_reserve(p, total);
+    if (out == NULL) {
+        b = shared_buf_new(total);
+        if (b == NULL) {
+            c->state = CONN_CLOSING;
+            return 1;
+        }
+        b->len = total;
+        out = b->data;
+    }
+    memcpy(out, head, hlen);
+
+    if (f->type == FRAME_RELAY) {
+        // No pipe for splice(): copied as it is
+        if (f->chain == NULL) {
+            memcpy(out + hlen, f->payload, f->len);
+        } else {
+            size_t off = hlen;
+            for (const BufSeg *s = f->chain->head; s != NULL;
+                 s = s->next) {
+                memcpy(out + off, s->data, s->len);
+                off += s->len;
+            }
+        }
+    } else if (chain_reseal(f, out + hlen, nonce_in, c->ratchet.rx.key,
+                            nonce_out, p->ratchet.tx.key) != 0) {
+        // Nothing was queued: the output of the peer stays as it was
+        if (b != NULL) shared_buf_unref(b);
+        if (!r->quiet) {
+            log_warn("Client %llu: decryption error, closing",
+                     (unsigned long long)c->id);
+        }
+        c->state = CONN_CLOSING;
+        return 1;
+    }
+    if (f->type == FRAME_DATA) {
+        // Counted once the tag has been checked
+        ratchet_count(&c->ratchet.rx, f->len - TAG_SIZE);
+        ratchet_count(&p->ratchet.tx, f->len - TAG_SIZE);
+    }
+
+    if (b == NULL) {
+        p->tx_len += total;
+    } else {
+        if (reactor_conn_queue_shared(p, b) != 0) {
+            // Too far behind: drop it rather than buffer without limit
+            p->state = CONN_CLOSING;
+            reactor_conn_drop_output(p);
+        }
+        shared_buf_unref(b);
+    }
+    reactor_conn_wake(r, p);
+    return 1;
+}
+
+int relay_flush(Connection *c)
+{
+    RelayLink *l = c->relay;
+
+    while (l != NULL && l->pipe_len > 0) {
+        ssize_t n = splice(l->pipe[0], NULL, c->fd, NULL, l->pipe_len,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            l->pipe_len -= (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        return -1;
+    }
+    return 0;
+}
+
+void relay_drop_output(Connection *c)
+{
+    RelayLink *l = c->relay;
+    if (l == NULL || l->pipe[0] < 0) return;
+
+    // A frame still being spliced in from the peer goes nowhere now
+    if (l->peer != NULL && l->peer->relay->mode == RELAY_SPLICE) {
+        l->peer->relay->mode = RELAY_SKIP;
+    }
+    close(l->pipe[0]);
+    close(l->pipe[1]);
+    l->pipe[0] = l->pipe[1] = -1;
+    l->pipe_len = 0;
+}
+
+void relay_resume(Reactor *r, Connection *c)
+{
+    Connection *p = c->relay != NULL ? c->relay->peer : NULL;
+    if (p != NULL && p->rx_blocked && p->state != CONN_CLOSING) {
+        reactor_conn_wake(r, p);
+    }
+}
+
+#endif // __linux__
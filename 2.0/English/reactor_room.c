@@ -0,0 +1,229 @@
+#include "room.h"
+
+#ifdef __linux__
+
+#include "drng.h"         // For rdrand_get_bytes (room seeds)
+
+// ========================================================================
+// Rooms of the event loop
+// ========================================================================
+// Membership, key rotation and broadcast. Everything here runs on the
+// thread of the loop that owns the room, so nothing is locked.
+// ========================================================================
+
+// Label mixed into every room key
+static const char room_kdf_label[] = "ECC-code room key";
+
+// ========================================================================
+// Helper: draw a new seed and derive the key of the next epoch
+//   key = Ascon-XOF128(label | name | epoch | seed)
+// Returns 0, or -1 if no random bytes were available
+// ========================================================================
+static int room_rekey(Room *room)
+{
+    uint8_t in[sizeof(room_kdf_label) + ROOM_NAME_MAX + 4 + 32];
+    size_t name_len = strlen(room->name);
+    size_t n = 0;
+
+    memcpy(in, room_kdf_label, sizeof(room_kdf_label));  // With the '\0'
+    n += sizeof(room_kdf_label);
+    memcpy(in + n, room->name, name_len);
+    n += name_len;
+    room_store32(in + n, room->epoch + 1);
+    n += 4;
+    if (rdrand_get_bytes(32, in + n) < 32) {
+        memset(in, 0, sizeof(in));
+        return -1;
+    }
+    n += 32;
+
+    crypto_xof(room->key, GROUP_KEY_SIZE, in, n);
+    memset(in, 0, sizeof(in));
+    room->epoch++;
+    room->seq = 0;  // Nonces restart with the new key
+    return 0;
+}
+
+// ========================================================================
+// Helper: send the room key to one member as a control frame of its
+// session (control.h)
+// ========================================================================
+static void room_send_key(Reactor *r, Room *room, Connection *c)
+{
+    uint8_t plain[4 + GROUP_KEY_SIZE + ROOM_NAME_MAX];
+    uint8_t frame[FRAME_HEADER_MAX + 1 + CONTROL_HEADER + sizeof(plain) +
+                  TAG_SIZE];
+    size_t name_len = strlen(room->name);
+    size_t plen = 4 + GROUP_KEY_SIZE + name_len;
+
+    room_store32(plain, room->epoch);
+    memcpy(plain + 4, room->key, GROUP_KEY_SIZE);
+    memcpy(plain + 4 + GROUP_KEY_SIZE, room->name, name_len);
+
+    size_t hlen = frame_encode_header(frame, FRAME_GROUP_KEY,
+                                      CONTROL_HEADER + plen + TAG_SIZE);
+    size_t clen = control_seal(c->shared_secret, SHARED_SECRET_SIZE,
+                               CONTROL_KEYS, &c->control_tx, plain, plen,
+                               frame + hlen);
+    if (reactor_conn_queue(c, frame, hlen + clen) != 0) {
+        c->state = CONN_CLOSING;
+    }
+    memset(plain, 0, sizeof(plain));
+    reactor_conn_wake(r, c);
+}
+
+// ========================================================================
+// Helper: find a room of this loop by name
+// ========================================================================
+static Room *room_find(Reactor *r, const char *name)
+{
+    for (Room *room = r->rooms; room != NULL; room = room->next) {
+        if (strcmp(room->name, name) == 0) return room;
+    }
+    return NULL;
+}
+
+// ========================================================================
+// Helper: unlink an empty room and wipe its key
+// ========================================================================
+static void room_destroy(Reactor *r, Room *room)
+{
+    Room **pp = &r->rooms;
+    while (*pp != room) pp = &(*pp)->next;
+    *pp = room->next;
+    free(room->members);
+    memset(room, 0, sizeof(*room));
+    free(room);
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int room_join(Reactor *r, Connection *c, const char *name)
+{
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > ROOM_NAME_MAX) return -1;
+
+    Room *room = room_find(r, name);
+    if (room != NULL && room == c->room) return 0;  // Already a member
+    room_leave(r, c);
+
+    if (room == NULL) {
+        room = calloc(1, sizeof(*room));
+        if (room == NULL) return -1;
+        memcpy(room->name, name, name_len + 1);
+        if (room_rekey(room) != 0) {
+            free(room);
+            return -1;
+        }
+        room->next = r->rooms;
+        r->rooms = room;
+    }
+
+    if (room->count == room->cap) {
+        size_t cap = room->cap ? room->cap * 2 : 8;
+        Connection **m = realloc(room->members, cap * sizeof(*m));
+        if (m == NULL) {
+            if (room->count == 0) room_destroy(r, room);  // Just created
+            return -1;
+        }
+        room->members = m;
+        room->cap = cap;
+    }
+    c->room = room;
+    c->room_index = room->count;
+    room->members[room->count++] = c;
+
+    // Only the new member needs the key of the current epoch
+    room_send_key(r, room, c);
+    return 0;
+}
+
+void room_leave(Reactor *r, Connection *c)
+{
+    Room *room = c->room;
+    if (room == NULL) return;
+
+    // Move the last member into the free slot
+    Connection *last = room->members[--room->count];
+    room->members[c->room_index] = last;
+    last->room_index = c->room_index;
+    c->room = NULL;
+
+    if (room->count == 0) {
+        room_destroy(r, room);
+        return;
+    }
+
+    // The loop is shutting down: every member is about to leave
+    if (!r->running) return;
+
+    // New key for the members that stay
+    if (room_rekey(room) != 0) {
+        // Without a new key the member that left could read on: end the
+        // sessions of the room instead
+        for (size_t i = 0; i < room->count; i++) {
+            room->members[i]->state = CONN_CLOSING;
+            reactor_conn_wake(r, room->members[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < room->count; i++) {
+        if (room->members[i]->state != CONN_CLOSING) {
+            room_send_key(r, room, room->members[i]);
+        }
+    }
+}
+
+int room_broadcast(Reactor *r, Connection *from, const uint8_t *msg,
+                   size_t len)
+{
+    Room *room = from->room;
+    char text[ROOM_TEXT_MAX + 1];
+    uint8_t nonce[NONCE_SIZE];
+    uint64_t clen = 0;
+
+    int n = snprintf(text, sizeof(text), "[%s] Client %llu: %.*s",
+                     room->name, (unsigned long long)from->id, (int)len,
+                     (const char *)msg);
+    if (n < 0) return -1;
+    size_t tlen = (size_t)n < ROOM_TEXT_MAX ? (size_t)n : ROOM_TEXT_MAX;
+
+    // Build the frame once: header, epoch | seq, ciphertext
+    size_t plen = ROOM_HEADER + tlen + TAG_SIZE;
+    SharedBuf *b = shared_buf_new(FRAME_HEADER_MAX + 1 + plen);
+    if (b == NULL) return -1;
+
+    size_t hlen = frame_encode_header(b->data, FRAME_GROUP, plen);
+    uint8_t *header = b->data + hlen;
+    room_encode_header(header, room->epoch, room->seq);
+    room_nonce(nonce, header);
+    if (crypto_aead_encrypt(header + ROOM_HEADER, &clen,
+                            (const uint8_t *)text, tlen, nonce,
+                            room->key) != 0) {
+        shared_buf_unref(b);
+        return -1;
+    }
+    b->len = hlen + ROOM_HEADER + clen;
+    room->seq++;
+
+    // Every member gets a reference to the same bytes
+    for (size_t i = 0; i < room->count; i++) {
+        Connection *m = room->members[i];
+        if (m->state == CONN_CLOSING) continue;
+        if (reactor_conn_queue_shared(m, b) != 0) {
+            // Too far behind: drop it rather than buffer without limit
+            if (!r->quiet) {
+                log_warn("Client %llu: too slow for room %s, closing",
+                         (unsigned long long)m->id, room->name);
+            }
+            m->state = CONN_CLOSING;
+            reactor_conn_drop_output(m);
+        }
+        reactor_conn_wake(r, m);
+    }
+    shared_buf_unref(b);
+    return 0;
+}
+
+#endif // __linux__
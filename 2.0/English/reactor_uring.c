@@ -0,0 +1,606 @@
+#include "reactor.h"
+
+#ifdef __linux__
+#include <errno.h>            // For errno, ENOBUFS, ECANCELED, ENOSYS,
+                              // ETIME
+#endif
+
+#if defined(__linux__) && defined(REACTOR_HAVE_URING)
+
+#include <fcntl.h>            // For fcntl(), O_NONBLOCK
+#include <poll.h>             // For POLLIN
+#include <sys/mman.h>         // For mmap() of the rings
+#include <sys/syscall.h>      // For the io_uring system call numbers
+#include <linux/io_uring.h>   // For the io_uring UAPI structures
+
+// ========================================================================
+// io_uring backend of the reactor
+// ========================================================================
+// The same session state machine as the epoll loop (reactor_conn_input)
+// driven by completions instead of readiness:
+// - one multishot ACCEPT produces every new connection;
+// - one multishot RECV per connection receives into buffers taken by the
+//   kernel from a provided buffer ring, so no buffer is reserved for an
+//   idle connection;
+// - all replies produced during one batch of completions are written
+//   with one SEND per connection (SENDMSG when shared room frames are
+//   queued in between); when the session is closing, a
+//   SHUTDOWN is linked behind the SEND (IOSQE_IO_LINK) so it runs only
+//   after the last byte has been sent;
+// - submissions are batched: io_uring_enter() is called once per loop
+//   iteration to submit everything and wait for new completions.
+// ========================================================================
+
+#define URING_ENTRIES 1024          // Submission queue size
+#define URING_BUFS 1024             // Buffers in the provided ring
+#define URING_BUF_SIZE BUFFER_SIZE  // Bytes per receive (frames are
+                                    // reassembled across receives)
+#define URING_BGID 0                // Buffer group id of the ring
+
+// Operation tags stored in the low bits of user_data (Connection
+// pointers are at least 8-byte aligned)
+#define OP_RECV     1
+#define OP_SEND     2
+#define OP_SHUTDOWN 3
+#define OP_ACCEPT   4
+#define OP_WAKE     5
+#define OP_HS       6
+#define OP_MASK     7
+
+typedef struct {
+    int ring_fd;                          // io_uring instance
+
+    // Submission ring
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned to_submit;                   // SQEs queued since last enter
+
+    // Completion ring
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Mappings (for munmap)
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+
+    // Provided buffer ring
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint8_t *bufs;
+    unsigned short br_tail;               // Local copy of the ring tail
+
+    Connection *dirty;                    // Connections with work left
+    uint64_t wake_value;                  // Drained eventfd counter
+    int ext_arg;                          // Waits can time out
+                                          // (IORING_FEAT_EXT_ARG)
+} UringState;
+
+// ========================================================================
+// System call wrappers (no liburing dependency)
+// ========================================================================
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned submit, unsigned wait,
+                           unsigned flags, const void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags,
+                        arg, argsz);
+}
+
+static int sys_uring_register(int fd, unsigned op, void *arg,
+                              unsigned nargs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+// ========================================================================
+// Submission helpers
+// ========================================================================
+
+// Submits queued SQEs without waiting
+static void uring_submit(UringState *u)
+{
+    if (u->to_submit == 0) return;
+    int n = sys_uring_enter(u->ring_fd, u->to_submit, 0, 0, NULL, 0);
+    if (n > 0) u->to_submit -= (unsigned)n;
+}
+
+// Returns a zeroed SQE, submitting first if the ring is full
+static struct io_uring_sqe *uring_get_sqe(UringState *u)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= u->sq_entries) {
+        uring_submit(u);
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= u->sq_entries) return NULL;
+    }
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+    return sqe;
+}
+
+static void uring_prep_accept(UringState *u, int listen_fd)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;     // One SQE, many accepts
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static void uring_prep_recv(UringState *u, Connection *c)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;       // Re-arms itself
+    sqe->flags = IOSQE_BUFFER_SELECT;          // Kernel picks a buffer
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uint64_t)(uintptr_t)c | OP_RECV;
+    c->recv_armed = 1;
+}
+
+// Polls the wake-up eventfd (it is non-blocking, so a READ would
+// complete at once with EAGAIN)
+static void uring_prep_wake(UringState *u, Reactor *r)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = r->wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = OP_WAKE;
+}
+
+// Polls the eventfd of the handshake inbox
+static void uring_prep_hs(UringState *u, Reactor *r)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = r->hs_inbox.event_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = OP_HS;
+}
+
+// Returns buffer 'bid' to the provided buffer ring
+static void uring_recycle(UringState *u, unsigned short bid)
+{
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail &
+                                          (URING_BUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid *
+                                    URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+// Remembers that 'c' needs attention at the end of the batch
+static void uring_mark_dirty(UringState *u, Connection *c)
+{
+    if (c->dirty) return;
+    c->dirty = 1;
+    c->next_dirty = u->dirty;
+    u->dirty = c;
+}
+
+void reactor_uring_mark_dirty(Reactor *r, Connection *c)
+{
+    uring_mark_dirty(r->uring, c);
+}
+
+// SENDMSG arguments of a connection with shared frames queued; they
+// must stay valid until the send completes
+typedef struct {
+    struct msghdr hdr;
+    struct iovec iov[REACTOR_TX_IOV];
+} UringMsg;
+
+_Static_assert(sizeof(UringMsg) <= REACTOR_TX_MSG_SIZE,
+               "UringMsg must fit its pool buffer");
+
+// Fills 'sqe' with one send of all pending output ('c->tx_msg' must be
+// allocated if shared frames are queued). Returns the number of bytes.
+static size_t uring_prep_output(struct io_uring_sqe *sqe, Connection *c)
+{
+    if (c->seg_count == 0) {
+        // Private output only: a plain SEND from tx
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)c->tx;
+        sqe->len = (unsigned)c->tx_len;
+        return c->tx_len;
+    }
+
+    // Shared frames in between: gather everything with one SENDMSG
+    UringMsg *m = c->tx_msg;
+    size_t total;
+    m->hdr.msg_iov = m->iov;
+    m->hdr.msg_iovlen = (size_t)reactor_conn_iov(c, m->iov, &total);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t)(uintptr_t)&m->hdr;
+    sqe->len = 1;
+    return total;
+}
+
+// ========================================================================
+// End of a batch: send pending output, shut down and free sessions
+// ========================================================================
+static void uring_progress(Reactor *r, UringState *u, Connection *c)
+{
+    int closing = (c->state == CONN_CLOSING);
+    int linked = 0;  // SEND with IOSQE_IO_LINK queued in this call
+
+    // A linked SEND + SHUTDOWN pair must not be split by a submission
+    // in between, so make room for both first
+    if (*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + 2 >
+        u->sq_entries) {
+        uring_submit(u);
+    }
+
+    // SENDMSG arguments for output with shared frames (put back into the
+    // pool with the last shared frame)
+    if (c->seg_count > 0 && c->tx_msg == NULL && c->tx_inflight == 0) {
+        c->tx_msg = buf_pool_get(c->bufs, REACTOR_TX_MSG_SIZE);
+        if (c->tx_msg == NULL) {
+            c->state = CONN_CLOSING;
+            closing = 1;
+            reactor_conn_drop_output(c);
+        } else {
+            memset(c->tx_msg, 0, sizeof(UringMsg));
+        }
+    }
+
+    if (c->tx_inflight == 0 && (c->tx_len > 0 || c->seg_count > 0) &&
+        !c->shutdown_sent) {
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+        if (sqe != NULL) {
+            // One send for everything produced in this batch; WAITALL
+            // makes a short send an error instead of a partial success
+            sqe->fd = c->fd;
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sqe->user_data = (uint64_t)(uintptr_t)c | OP_SEND;
+            c->tx_inflight = uring_prep_output(sqe, c);
+            if (closing) {
+                sqe->flags |= IOSQE_IO_LINK;  // Shutdown runs after it
+                linked = 1;
+            }
+        }
+    }
+
+    if (closing && !c->shutdown_sent && (c->tx_inflight == 0 || linked)) {
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+        if (sqe != NULL) {
+            // Shutdown ends the multishot recv with a final completion
+            sqe->opcode = IORING_OP_SHUTDOWN;
+            sqe->fd = c->fd;
+            sqe->len = SHUT_RDWR;
+            sqe->user_data = (uint64_t)(uintptr_t)c | OP_SHUTDOWN;
+            c->shutdown_sent = 1;
+            c->shutdown_inflight = 1;
+        }
+    }
+
+    // Free only when the kernel holds no more references to 'c'
+    if (closing && c->shutdown_sent && !c->shutdown_inflight &&
+        !c->recv_armed && c->tx_inflight == 0) {
+        close(c->fd);
+        reactor_conn_free(r, c);
+    }
+}
+
+// ========================================================================
+// Completion handlers
+// ========================================================================
+static void uring_on_accept(Reactor *r, UringState *u,
+                            struct io_uring_cqe *cqe)
+{
+    if (cqe->res >= 0) {
+        Connection *c = reactor_conn_new(r, cqe->res);
+        if (c == NULL) {
+            close(cqe->res);
+        } else {
+            uring_prep_recv(u, c);
+            uring_mark_dirty(u, c);  // Send the queued server key
+        }
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE) && r->running) {
+        uring_prep_accept(u, r->listen_fd);  // Multishot ended: re-arm
+    }
+}
+
+static void uring_on_recv(Reactor *r, UringState *u, Connection *c,
+                          struct io_uring_cqe *cqe)
+{
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (c->state != CONN_CLOSING) {
+            // A reply that does not fit into tx closes the session
+            reactor_conn_input(r, c, u->bufs + (size_t)bid *
+                               URING_BUF_SIZE, (size_t)cqe->res);
+        }
+        uring_recycle(u, bid);
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        c->recv_armed = 0;
+        if (cqe->res == -ENOBUFS && c->state != CONN_CLOSING) {
+            uring_prep_recv(u, c);  // Ring was empty for a moment
+        } else if (c->state != CONN_CLOSING) {
+            // Peer closed (res == 0) or a socket error
+            c->state = CONN_CLOSING;
+            reactor_conn_drop_output(c);  // Nobody will read it (unless
+                                          // a send is still running)
+        }
+    }
+    uring_mark_dirty(u, c);
+}
+
+static void uring_on_send(UringState *u, Connection *c,
+                          struct io_uring_cqe *cqe)
+{
+    size_t sent = c->tx_inflight;
+
+    c->tx_inflight = 0;
+    if (cqe->res < 0 || (size_t)cqe->res != sent) {
+        c->state = CONN_CLOSING;  // Linked shutdown was cancelled too
+        reactor_conn_drop_output(c);
+    } else {
+        // Keep output produced while the send was in flight
+        reactor_conn_consume(c, sent);
+    }
+    uring_mark_dirty(u, c);
+}
+
+static void uring_on_shutdown(UringState *u, Connection *c,
+                              struct io_uring_cqe *cqe)
+{
+    if (cqe->res == -ECANCELED) {
+        // The linked send failed, so the shutdown never ran
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    c->shutdown_inflight = 0;
+    uring_mark_dirty(u, c);
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+int reactor_uring_init(Reactor *r)
+{
+    UringState *u = calloc(1, sizeof(*u));
+    if (u == NULL) return -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->ring_fd = sys_uring_setup(URING_ENTRIES, &p);
+    if (u->ring_fd < 0) {
+        free(u);
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(u->ring_fd);  // Kernels this old lack multishot anyway
+        free(u);
+        errno = ENOSYS;
+        return -1;
+    }
+    u->ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+
+    // Map the shared rings
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes +
+                 p.cq_entries * sizeof(struct io_uring_cqe);
+    if (u->cq_size > u->sq_size) u->sq_size = u->cq_size;
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->ring_fd,
+                     IORING_OFF_SQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->ring_fd,
+                   IORING_OFF_SQES);
+    if (u->sq_ptr == MAP_FAILED || u->sqes == MAP_FAILED) {
+        if (u->sq_ptr != MAP_FAILED) munmap(u->sq_ptr, u->sq_size);
+        if (u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+        close(u->ring_fd);
+        free(u);
+        return -1;
+    }
+    u->cq_ptr = u->sq_ptr;  // Single mmap holds both rings
+
+    uint8_t *sq = u->sq_ptr, *cq = u->cq_ptr;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Provided buffer ring: the kernel takes a buffer per received
+    // chunk, we give it back after the chunk has been processed
+    u->br_size = URING_BUFS * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (u->br == MAP_FAILED || u->bufs == NULL ||
+        sys_uring_register(u->ring_fd, IORING_REGISTER_PBUF_RING,
+                           &reg, 1) < 0) {
+        if (u->br != MAP_FAILED) munmap(u->br, u->br_size);
+        free(u->bufs);
+        munmap(u->sq_ptr, u->sq_size);
+        munmap(u->sqes, u->sqes_size);
+        close(u->ring_fd);
+        free(u);
+        return -1;
+    }
+    for (unsigned short i = 0; i < URING_BUFS; i++) {
+        uring_recycle(u, i);
+    }
+
+    // The listener stays registered with epoll but is no longer waited
+    // on; accepts now come from the multishot ACCEPT, which must block
+    // in the kernel instead of failing with EAGAIN
+    int flags = fcntl(r->listen_fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(r->listen_fd, F_SETFL, flags & ~O_NONBLOCK);
+    r->uring = u;
+    uring_prep_accept(u, r->listen_fd);
+    uring_prep_wake(u, r);
+    return 0;
+}
+
+void reactor_uring_run(Reactor *r)
+{
+    UringState *u = r->uring;
+
+    if (r->hs_pool) uring_prep_hs(u, r);  // Results of the workers
+
+    while (r->running) {
+        // Submit everything queued in the last batch and wait for at
+        // least one completion or the next deadline, all in one system
+        // call (kernels without EXT_ARG check deadlines when woken)
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        unsigned flags = IORING_ENTER_GETEVENTS;
+        const void *argp = NULL;
+        size_t argsz = 0;
+        int timeout = reactor_timers_timeout(r);
+        if (timeout >= 0 && u->ext_arg) {
+            memset(&arg, 0, sizeof(arg));
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+        int n = sys_uring_enter(u->ring_fd, u->to_submit, 1, flags, argp,
+                                argsz);
+        if (n < 0 && errno == ETIME) n = 0;  // Only a deadline is due
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            perror("io_uring_enter");
+            return;
+        }
+        u->to_submit -= (unsigned)n;
+        r->now_ms = timer_now_ms();
+
+        // Drain the completion ring
+        unsigned head = *u->cq_head;
+        unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            unsigned op = (unsigned)(cqe->user_data & OP_MASK);
+            Connection *c = (Connection *)(uintptr_t)
+                            (cqe->user_data & ~(uint64_t)OP_MASK);
+
+            switch (op) {
+            case OP_ACCEPT:   uring_on_accept(r, u, cqe); break;
+            case OP_RECV:     uring_on_recv(r, u, c, cqe); break;
+            case OP_SEND:     uring_on_send(u, c, cqe); break;
+            case OP_SHUTDOWN: uring_on_shutdown(u, c, cqe); break;
+            case OP_WAKE:
+                if (read(r->wake_fd, &u->wake_value,
+                         sizeof(u->wake_value)) < 0) {
+                    // Already drained
+                }
+                if (r->running) uring_prep_wake(u, r);
+                break;
+            case OP_HS:
+                // Shared secrets computed by the handshake pool
+                hs_inbox_rearm(&r->hs_inbox);
+                while ((c = reactor_hs_next(r)) != NULL) {
+                    uring_mark_dirty(u, c);
+                }
+                if (r->running) uring_prep_hs(u, r);
+                break;
+            }
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+        // Deadlines that passed mark their sessions dirty
+        reactor_timers_run(r);
+
+        // Turn the work collected in this batch into submissions
+        while (u->dirty) {
+            Connection *c = u->dirty;
+            u->dirty = c->next_dirty;
+            c->dirty = 0;
+            uring_progress(r, u, c);
+        }
+    }
+}
+
+void reactor_uring_free(Reactor *r)
+{
+    UringState *u = r->uring;
+    if (u == NULL) return;
+
+    // Closing the ring cancels every request still in flight, after that
+    // the sessions can be released directly
+    close(u->ring_fd);
+    for (size_t fd = 0; fd < r->conns_cap; fd++) {
+        if (r->conns[fd]) {
+            close((int)fd);
+            reactor_conn_free(r, r->conns[fd]);
+        }
+    }
+    munmap(u->br, u->br_size);
+    free(u->bufs);
+    munmap(u->sq_ptr, u->sq_size);
+    munmap(u->sqes, u->sqes_size);
+    free(u);
+    r->uring = NULL;
+}
+
+#elif defined(__linux__)
+
+// ========================================================================
+// Built without <linux/io_uring.h>: the epoll loop is always used
+// ========================================================================
+int reactor_uring_init(Reactor *r)
+{
+    (void)r;
+    errno = ENOSYS;
+    return -1;
+}
+
+void reactor_uring_run(Reactor *r)
+{
+    (void)r;
+}
+
+void reactor_uring_free(Reactor *r)
+{
+    (void)r;
+}
+
+void reactor_uring_mark_dirty(Reactor *r, Connection *c)
+{
+    (void)r;
+    (void)c;
+}
+
+#endif
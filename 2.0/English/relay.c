@@ -0,0 +1,129 @@
+#include "relay.h"
+#include "room.h"         // For room_store32() and room_load32()
+
+// ========================================================================
+// Wire format of FRAME_RELAY
+// ========================================================================
+void relay_encode_header(uint8_t header[RELAY_HEADER], uint32_t pair,
+                         uint64_t seq)
+{
+    room_store32(header, pair);
+    room_store32(header + 4, (uint32_t)seq);
+    room_store32(header + 8, (uint32_t)(seq >> 32));
+}
+
+void relay_nonce(uint8_t nonce[NONCE_SIZE],
+                 const uint8_t header[RELAY_HEADER], uint8_t side)
+{
+    memcpy(nonce, header + 4, 8);
+    memcpy(nonce + 8, header, 4);
+    nonce[12] = side;
+    memset(nonce + 13, 0, NONCE_SIZE - 13);
+}
+
+// ========================================================================
+// Client side: send under the pair key
+// ========================================================================
+
+// Writes pair | seq | ciphertext to 'payload'; returns its length
+static size_t relay_seal_payload(ClientServerContext *ctx, uint8_t *payload,
+                                 const uint8_t *msg, size_t len)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint64_t clen = 0;
+
+    relay_encode_header(payload, ctx->relay_pair, ctx->relay_seq++);
+    relay_nonce(nonce, payload, ctx->relay_side);
+    crypto_aead_encrypt(payload + RELAY_HEADER, &clen, msg, len, nonce,
+                        ctx->relay_key);
+    return RELAY_HEADER + (size_t)clen;
+}
+
+size_t relay_seal(ClientServerContext *ctx, uint8_t *frame,
+                  const uint8_t *msg, size_t len)
+{
+    size_t hlen = frame_encode_header(frame, FRAME_RELAY,
+                                      RELAY_HEADER + len + TAG_SIZE);
+    return hlen + relay_seal_payload(ctx, frame + hlen, msg, len);
+}
+
+int relay_send(ClientServerContext *ctx, int fd, const uint8_t *msg,
+               size_t len)
+{
+    if (!ctx->relay_valid) return session_send(ctx, fd, msg, len);
+
+    uint8_t *payload = malloc(RELAY_HEADER + len + TAG_SIZE);
+    if (payload == NULL) return -1;
+    size_t n = relay_seal_payload(ctx, payload, msg, len);
+    int rc = frame_send(fd, FRAME_RELAY, payload, n);
+    free(payload);
+    return rc;
+}
+
+// ========================================================================
+// Client side: open a received frame
+// ========================================================================
+int relay_open_frame(ClientServerContext *ctx, const Frame *f)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t plain[RELAY_KEY_PLAIN];
+    uint64_t plen = 0;
+
+    if (f->type == FRAME_RELAY_KEY) {
+        // Pair key (or the end of the pair), a control frame of the
+        // session (control.h)
+        if (f->chain != NULL ||
+            f->len > CONTROL_HEADER + sizeof(plain) + CONTROL_TAG_SIZE ||
+            control_open(ctx->shared_secret, SHARED_SECRET_SIZE,
+                         CONTROL_KEYS, &ctx->control_rx, f->payload,
+                         f->len, plain, &plen) != 0 ||
+            (plen != 0 && plen != RELAY_KEY_PLAIN)) {
+            return -1;
+        }
+        ctx->relay_valid = plen != 0;
+        if (ctx->relay_valid) {
+            ctx->relay_pair = room_load32(plain);
+            ctx->relay_side = plain[4];
+            memcpy(ctx->relay_key, plain + 5, GROUP_KEY_SIZE);
+            ctx->relay_seq = 0;
+        }
+        memset(plain, 0, sizeof(plain));
+        return 0;
+    }
+
+    // FRAME_RELAY: pair | seq | ciphertext under the pair key
+    if (f->len < RELAY_HEADER + TAG_SIZE ||
+        session_reserve(ctx, f->len - RELAY_HEADER - TAG_SIZE) != 0) {
+        return -1;
+    }
+
+    // A large frame arrives in segments; the ciphertext is needed in one
+    // piece behind the header
+    const uint8_t *payload = f->payload;
+    uint8_t *flat = NULL;
+    if (f->chain != NULL) {
+        flat = malloc(f->len);
+        if (flat == NULL) return -1;
+        size_t off = 0;
+        for (const BufSeg *s = f->chain->head; s != NULL; s = s->next) {
+            memcpy(flat + off, s->data, s->len);
+            off += s->len;
+        }
+        payload = flat;
+    }
+
+    int rc = 0;
+    if (!ctx->relay_valid || room_load32(payload) != ctx->relay_pair) {
+        rc = 0;  // Sent to an earlier pair: dropped
+    } else {
+        relay_nonce(nonce, payload, (uint8_t)(ctx->relay_side ^ 1));
+        rc = crypto_aead_decrypt(ctx->decrypted_msg,
+                                 &ctx->decrypted_msglen, ctx->nsec,
+                                 payload + RELAY_HEADER,
+                                 f->len - RELAY_HEADER, nonce,
+                                 ctx->relay_key) == 0 ? 1 : -1;
+    }
+    free(flat);
+    if (rc == 1) ctx->decrypted_msg[ctx->decrypted_msglen] = '\0';
+    return rc;
+}
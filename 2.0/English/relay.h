@@ -0,0 +1,136 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For ClientServerContext and the frame layer
+
+// ========================================================================
+// Relay (two clients talking through the server)
+// ========================================================================
+// With --relay the event loop pairs its clients two by two, in the
+// order their sessions are established, and forwards what one sends to
+// the other. Each hop used to cost a decryption into a plaintext buffer
+// and an encryption out of it. There are two cheaper paths now:
+//
+// - Shared key: the server gives both members of a pair one key:
+//
+//     FRAME_RELAY_KEY  payload = AEAD(session key, pair | side | key)
+//     FRAME_RELAY      payload = pair | seq | AEAD(pair key, text)
+//
+//   pair (4 bytes) numbers the pairs of the loop, seq (8 bytes, both
+//   little-endian) counts the messages of one side, and the nonce is
+//   seq | pair | side | 000 (side is 0 or 1), so the two directions
+//   never share a nonce. The server does not hold the plaintext of
+//   these frames and does not need it: it moves them from one socket
+//   to the other with splice() through a pipe, and the bytes never
+//   enter user space. A FRAME_RELAY_KEY with an empty plaintext ends
+//   the pair (the peer left).
+//
+// - Session keys: a FRAME_DATA (sent before the pair key arrived, or
+//   too large for a client batch) is re-encrypted from the key of the
+//   sender to the key of the receiver in one pass (chain_reseal()): the
+//   plaintext of a block exists only in registers.
+//
+// A client that waits for a peer gets its messages echoed, as without
+// --relay.
+// ========================================================================
+
+#define RELAY_HEADER 12                   // pair + seq before the
+                                          // ciphertext of FRAME_RELAY
+#define RELAY_KEY_PLAIN (4 + 1 + GROUP_KEY_SIZE)
+                                          // Plaintext of FRAME_RELAY_KEY
+
+// ========================================================================
+// Wire format helpers and client side (relay.c)
+// ========================================================================
+
+// Writes the header of a FRAME_RELAY payload (pair | seq)
+void relay_encode_header(uint8_t header[RELAY_HEADER], uint32_t pair,
+                         uint64_t seq);
+
+// Builds the nonce of a message sent by 'side' from its header
+void relay_nonce(uint8_t nonce[NONCE_SIZE],
+                 const uint8_t header[RELAY_HEADER], uint8_t side);
+
+// Encrypts 'len' bytes under the pair key into 'frame' (room for
+// FRAME_HEADER_MAX + 1 + RELAY_HEADER + len + TAG_SIZE bytes) as a
+// FRAME_RELAY. Returns the frame size.
+size_t relay_seal(ClientServerContext *ctx, uint8_t *frame,
+                  const uint8_t *msg, size_t len);
+
+// Sends 'len' bytes to the peer: as FRAME_RELAY when a pair key is
+// held, otherwise with session_send(). Returns 0 or -1.
+int relay_send(ClientServerContext *ctx, int fd, const uint8_t *msg,
+               size_t len);
+
+// Handles FRAME_RELAY_KEY and FRAME_RELAY like room_open_frame() (which
+// calls it): 1 with a message in ctx->decrypted_msg, 0 for none, -1 if
+// a frame does not authenticate.
+int relay_open_frame(ClientServerContext *ctx, const Frame *f);
+
+// ========================================================================
+// Server side (reactor_relay.c, event loop only)
+// ========================================================================
+#ifdef __linux__
+#include <sys/types.h>    // For ssize_t
+#include "reactor.h"      // For Reactor and Connection
+
+// Relay state of one connection
+typedef struct RelayLink {
+    Connection *peer;                     // Other member (NULL: waiting)
+    uint32_t pair;                        // Pair number (0: none)
+    uint8_t side;                         // 0 or 1 within the pair
+    int mode;                             // What the rest of the current
+                                          // frame is for (RELAY_*)
+    size_t left;                          // Its bytes still in the socket
+    int pipe[2];                          // Pipe feeding this socket
+                                          // (-1: not created yet)
+    size_t pipe_len;                      // Bytes waiting in it
+    size_t pipe_cap;                      // Its capacity
+} RelayLink;
+
+// Modes of RelayLink
+#define RELAY_READ 0                      // Read and handled by the loop
+#define RELAY_SPLICE 1                    // Spliced to the peer's pipe
+#define RELAY_SKIP 2                      // Read and dropped
+
+// Gives a new connection of a relay loop its link (from the buffer
+// pool). Returns 0 or -1.
+int relay_attach(Reactor *r, Connection *c);
+
+// Ends the pair of 'c' and puts its link back. The peer is told and
+// waits for the next client; a frame it was receiving from 'c' is lost,
+// so it is closed in that case.
+void relay_detach(Reactor *r, Connection *c);
+
+// Pairs a connection whose session was just established with the one
+// waiting, or lets it wait
+void relay_established(Reactor *r, Connection *c);
+
+// Reads the next piece of input of 'c', never past the end of the
+// current frame, and hands it to the loop, to the peer's pipe or to
+// nothing. Returns like read(): > 0 on progress, 0 when the peer
+// closed, -1 with errno set (EAGAIN: wait for input, or for the peer's
+// output to drain, then c->rx_blocked is set).
+ssize_t relay_read(Reactor *r, Connection *c, uint8_t *buf, size_t len);
+
+// Forwards a FRAME_DATA of a paired connection to its peer, re-encrypted
+// in one pass. Returns 1 if it was forwarded (or 'c' was closed because
+// it does not authenticate), 0 if 'c' has no peer.
+int relay_forward(Reactor *r, Connection *c, const Frame *f);
+
+// Writes the bytes waiting in the pipe of 'c' to its socket (before its
+// other output, which is newer). Returns like the loop's flush: 0 when
+// the pipe is empty, 1 when the socket is full, -1 on error.
+int relay_flush(Connection *c);
+
+// Drops the bytes waiting in the pipe of 'c' (nobody will read them)
+void relay_drop_output(Connection *c);
+
+// Lets the peer of 'c' read again once the output of 'c' has drained
+void relay_resume(Reactor *r, Connection *c);
+#endif
+
+#endif // RELAY_H
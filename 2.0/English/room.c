@@ -0,0 +1,101 @@
+#include "room.h"
+#include "relay.h"        // For the frames of a relay pair
+
+// ========================================================================
+// Little-endian fields of the room frames
+// ========================================================================
+void room_store32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+uint32_t room_load32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+void room_encode_header(uint8_t header[ROOM_HEADER], uint32_t epoch,
+                        uint64_t seq)
+{
+    room_store32(header, epoch);
+    room_store32(header + 4, (uint32_t)seq);
+    room_store32(header + 8, (uint32_t)(seq >> 32));
+}
+
+void room_nonce(uint8_t nonce[NONCE_SIZE], const uint8_t header[ROOM_HEADER])
+{
+    memcpy(nonce, header + 4, 8);
+    memcpy(nonce + 8, header, 4);
+    memset(nonce + 12, 0, NONCE_SIZE - 12);
+}
+
+// ========================================================================
+// Client side: open a received frame
+// ========================================================================
+int room_open_frame(ClientServerContext *ctx, const Frame *f)
+{
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t plain[4 + GROUP_KEY_SIZE + ROOM_NAME_MAX];
+    uint64_t plen = 0;
+
+    switch (f->type) {
+    case FRAME_DATA:
+        // Message under the session key, of any size (the output buffer
+        // grows to fit and is NUL-terminated)
+        return session_open(ctx, f) == 0 ? 1 : -1;
+
+    case FRAME_REKEY:
+        // The server moved to its next message key
+        return ratchet_accept(&ctx->ratchet.rx, f) == 0 ? 0 : -1;
+
+    case FRAME_GROUP_KEY:
+        // New room key, a control frame of the session (control.h)
+        if (f->len < CONTROL_HEADER + 4 + GROUP_KEY_SIZE + TAG_SIZE ||
+            f->len > CONTROL_HEADER + sizeof(plain) + TAG_SIZE ||
+            control_open(ctx->shared_secret, SHARED_SECRET_SIZE,
+                         CONTROL_KEYS, &ctx->control_rx, f->payload,
+                         f->len, plain, &plen) != 0) {
+            return -1;
+        }
+        ctx->group_epoch = room_load32(plain);
+        memcpy(ctx->group_key, plain + 4, GROUP_KEY_SIZE);
+        ctx->group_valid = 1;
+        memset(plain, 0, sizeof(plain));
+        return 0;
+
+    case FRAME_GROUP:
+        // Room broadcast: epoch | seq | ciphertext under the room key.
+        // The server cuts room messages to ROOM_TEXT_MAX, so they are
+        // never received into a chain.
+        if (f->chain != NULL || f->len < ROOM_HEADER + TAG_SIZE ||
+            f->len - ROOM_HEADER - TAG_SIZE > ROOM_TEXT_MAX ||
+            session_reserve(ctx, f->len - ROOM_HEADER - TAG_SIZE) != 0) {
+            return -1;
+        }
+        if (!ctx->group_valid ||
+            room_load32(f->payload) != ctx->group_epoch) {
+            return 0;  // Sent before we joined or before a rekey
+        }
+        room_nonce(nonce, f->payload);
+        if (crypto_aead_decrypt(ctx->decrypted_msg, &ctx->decrypted_msglen,
+                                ctx->nsec, f->payload + ROOM_HEADER,
+                                f->len - ROOM_HEADER, nonce,
+                                ctx->group_key) != 0) {
+            return -1;
+        }
+        break;
+
+    case FRAME_RELAY_KEY:
+    case FRAME_RELAY:
+        // From the peer of a --relay server (see relay.h)
+        return relay_open_frame(ctx, f);
+
+    default:
+        return 0;  // Unknown frame type
+    }
+
+    ctx->decrypted_msg[ctx->decrypted_msglen] = '\0';
+    return 1;
+}
@@ -0,0 +1,103 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For ClientServerContext and the frame layer
+#include "control.h"      // For the FRAME_GROUP_KEY payload
+
+// ========================================================================
+// Rooms (group chat)
+// ========================================================================
+// A client sends "/join <name>" to enter a room and "/leave" to leave it.
+// Every message it sends while in a room goes to all members (itself
+// included) instead of being echoed.
+//
+// A room has its own key, derived with Ascon-XOF128 from a random seed.
+// The server sends it to each member as a control frame of the member's
+// own session (control.h):
+//
+//   FRAME_GROUP_KEY  payload = seq | AEAD(control key, epoch | key | name)
+//
+// A broadcast is then encrypted once under the room key and the same
+// frame is queued (by reference) on every member connection:
+//
+//   FRAME_GROUP      payload = epoch | seq | AEAD(room key, text)
+//
+// epoch (4 bytes) and seq (8 bytes) are little-endian and form the nonce
+// (seq | epoch | 0000), so no two messages of a room share a nonce. When
+// a member leaves, the room draws a new seed, increments the epoch and
+// sends the new key to the remaining members; the member that left
+// cannot read what follows. A new member receives the current key and
+// could read earlier messages of the epoch if it had recorded them.
+//
+// Rooms live in one event loop: with --threads > 1, clients accepted by
+// different loops see different rooms of the same name.
+// ========================================================================
+
+#define ROOM_NAME_MAX 32                  // Longest room name
+#define ROOM_HEADER 12                    // epoch + seq before the
+                                          // ciphertext of FRAME_GROUP
+#define ROOM_TEXT_MAX (BUFFER_SIZE - ROOM_HEADER - TAG_SIZE - 1)
+                                          // Longest broadcast text (the
+                                          // frame fits the client buffer
+                                          // and leaves room for '\0')
+
+// ========================================================================
+// Wire format helpers (room.c)
+// ========================================================================
+
+// Little-endian 32-bit fields
+void room_store32(uint8_t *p, uint32_t v);
+uint32_t room_load32(const uint8_t *p);
+
+// Writes the header of a FRAME_GROUP payload (epoch | seq)
+void room_encode_header(uint8_t header[ROOM_HEADER], uint32_t epoch,
+                        uint64_t seq);
+
+// Builds the nonce of a room message from its header
+void room_nonce(uint8_t nonce[NONCE_SIZE], const uint8_t header[ROOM_HEADER]);
+
+// ========================================================================
+// Client side (room.c)
+// ========================================================================
+
+// Handles a frame received by a client. Returns 1 when it carried a
+// message (decrypted into ctx->decrypted_msg, NUL-terminated), 0 when it
+// carried none (a room key, stored in 'ctx', a message of an old epoch
+// or an unknown frame type) and -1 if it could not be decrypted.
+int room_open_frame(ClientServerContext *ctx, const Frame *f);
+
+// ========================================================================
+// Server side (reactor_room.c, event loop only)
+// ========================================================================
+#ifdef __linux__
+#include "reactor.h"      // For Reactor and Connection
+
+typedef struct Room {
+    char name[ROOM_NAME_MAX + 1];         // Room name
+    uint8_t key[GROUP_KEY_SIZE];          // Current room key
+    uint32_t epoch;                       // Incremented with every key
+    uint64_t seq;                         // Messages sent in this epoch
+    Connection **members;                 // Member connections
+    size_t count;                         // Members
+    size_t cap;                           // Size of the member array
+    struct Room *next;                    // Next room of the loop
+} Room;
+
+// Adds 'c' to the room 'name' (created if needed, after leaving the
+// current one) and sends it the room key. Returns 0 or -1 on error.
+int room_join(Reactor *r, Connection *c, const char *name);
+
+// Removes 'c' from its room. The remaining members get a new key; an
+// empty room is freed.
+void room_leave(Reactor *r, Connection *c);
+
+// Encrypts "[room] Client N: msg" once and queues it on every member.
+// Members that cannot take it are closed. Returns 0 or -1 on error.
+int room_broadcast(Reactor *r, Connection *from, const uint8_t *msg,
+                   size_t len);
+#endif
+
+#endif // ROOM_H
@@ -1,5 +1,48 @@
 #include "session.h"
 #include "error.h"
+#include "dispatch.h"       // For --print-dispatch
+#include "reactor.h"
+#include "duplex.h"
+#include "ticket.h"
+#include "early.h"
+#include "drng.h"
+#include "audio.h"        // For the waiting music
+#include <errno.h>        // For EAGAIN (handshake timeout)
+
+// ========================================================================
+// Command-line options of the server
+// ========================================================================
+typedef struct {
+    int epoll;      // --epoll: serve many clients with the event loop
+    int threads;    // --threads N: N event loops with SO_REUSEPORT
+    int uring;      // --uring: io_uring backend instead of epoll
+    int hs_workers; // --hs-workers N: key exchanges on N threads
+    int duplex;     // --duplex: full-duplex chat with a single client
+    int zerocopy;   // --zerocopy: large frames and files leave with
+                    // MSG_ZEROCOPY
+    int relay;      // --relay: pair the clients and forward between them
+    int hs_timeout; // --handshake-timeout SEC: seconds for the key
+                    // exchange (0: no limit)
+    int idle;       // --idle-timeout SEC: close silent sessions
+    int keepalive;  // --keepalive SEC: FRAME_KEEPALIVE after silence
+    int quiet;      // --quiet: do not print the messages (load tests)
+    int no_audio;   // --no-audio: no waiting music
+    int trace;      // --trace: phase latencies (SIGUSR1, exit)
+    const char *trace_json;  // --trace-json FILE: Chrome trace
+    const char *metrics;     // --metrics PORT|PATH: admin listener
+} ServerOptions;
+
+// Printed when the port is missing or an argument is unknown
+#define SERVER_USAGE                                                      \
+    "Server usage format:\n"                                              \
+    "./server <port> [--duplex] [--epoll] [--threads N] [--uring] "       \
+    "[--hs-workers N] [--max-frame BYTES] [--recv-dir DIR] [--zerocopy] " \
+    "[--relay] [--handshake-timeout SEC] [--idle-timeout SEC] "           \
+    "[--keepalive SEC] [--rekey-messages N] [--rekey-bytes N] "           \
+    "[--rekey-interval SEC] [--quiet] [--no-audio] [--log-level LEVEL] "  \
+    "[--log-keys] [--trace] [--trace-json FILE] [--metrics PORT|PATH] "   \
+    "[--drng-stats SEC]\n"                                                \
+    "./server --print-dispatch\n"
 
 
 int main(int argc, char *argv[]) {
@@ -10,6 +53,7 @@ int main(int argc, char *argv[]) {
     ClientServerContext ctx;
     initializeContext(&ctx); // Initialize the context struct to manage
                               // communication settings
+    ctx.file_dir = FILE_S2C;  // "/send" in --duplex goes to the client
 
     // ====================================================================
     // Platform-specific socket initialization for Windows
@@ -22,6 +66,14 @@ int main(int argc, char *argv[]) {
         }
     #endif
 
+    // ====================================================================
+    // --print-dispatch: the crypto kernels picked for this CPU
+    // ====================================================================
+    if (argc == 2 && strcmp(argv[1], "--print-dispatch") == 0) {
+        dispatch_print(stdout);
+        return 0;
+    }
+
     // ====================================================================
     // Argument check for the port number
     // ====================================================================
@@ -29,20 +81,150 @@ int main(int argc, char *argv[]) {
         error("Checking...\n"
                     "User has not read the server usage documentation.\n"
                     "Missing port\n"
-                    "Server usage format:\n"
-                    "./server <port>\n"
+                    SERVER_USAGE
+                    "Departing into oblivion");
+    }
+    ServerOptions opts = {0};
+    opts.hs_timeout = HANDSHAKE_TIMEOUT;
+    int drng_stats = 0;  // --drng-stats SEC: RDRAND counters every SEC s
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--drng-stats") == 0 && i + 1 < argc &&
+            atoi(argv[i + 1]) > 0) {
+            drng_stats = atoi(argv[++i]);  // Printed to stderr
+        } else if (strcmp(argv[i], "--epoll") == 0) {
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) > 0) {
+            opts.threads = atoi(argv[++i]);  // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--uring") == 0) {
+            opts.uring = 1;                  // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--hs-workers") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) > 0) {
+            opts.hs_workers = atoi(argv[++i]);  // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--duplex") == 0) {
+            opts.duplex = 1;
+        } else if (strcmp(argv[i], "--max-frame") == 0 && i + 1 < argc) {
+            // Largest message frame of the single-client modes (the
+            // event loop uses REACTOR_MSG_MAX)
+            long max = atol(argv[++i]);
+            if (max < BUFFER_SIZE || max > MSG_MAX_LIMIT) {
+                error("Checking...\n"
+                      "--max-frame must be between 256 and 16777216");
+            }
+            ctx.max_frame = (size_t)max;
+        } else if (strcmp(argv[i], "--recv-dir") == 0 && i + 1 < argc) {
+            ctx.files.dir = argv[++i];  // Where "/send" files are stored
+        } else if (strcmp(argv[i], "--zerocopy") == 0) {
+            opts.zerocopy = 1;    // Event loop: large frames; --duplex:
+            ctx.zc.on = 1;        // files sent with "/send"
+        } else if (strcmp(argv[i], "--relay") == 0) {
+            opts.relay = 1;                  // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--handshake-timeout") == 0 &&
+                   i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            opts.hs_timeout = atoi(argv[++i]);  // Every mode
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 &&
+                   i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            opts.idle = atoi(argv[++i]);     // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--keepalive") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) > 0) {
+            opts.keepalive = atoi(argv[++i]);  // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--no-audio") == 0) {
+            opts.no_audio = 1;
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc &&
+                   log_parse_level(argv[i + 1]) >= 0) {
+            log_level = log_parse_level(argv[++i]);
+        } else if (strcmp(argv[i], "--log-keys") == 0) {
+            log_keys = 1;         // Keys in hex: debugging only
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            opts.trace = 1;
+        } else if (strcmp(argv[i], "--trace-json") == 0 && i + 1 < argc) {
+            opts.trace_json = argv[++i];     // Implies --trace
+            opts.trace = 1;
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            opts.metrics = argv[++i];  // Loopback port or Unix socket
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            opts.quiet = 1;                  // Implies the event loop
+            opts.epoll = 1;
+        } else if (strcmp(argv[i], "--rekey-messages") == 0 &&
+                   i + 1 < argc && atoll(argv[i + 1]) >= 0) {
+            ctx.rekey.messages = (uint64_t)atoll(argv[++i]);  // Every
+        } else if (strcmp(argv[i], "--rekey-bytes") == 0 && i + 1 < argc &&
+                   atoll(argv[i + 1]) >= 0) {                 // mode,
+            ctx.rekey.bytes = (uint64_t)atoll(argv[++i]);     // 0: off
+        } else if (strcmp(argv[i], "--rekey-interval") == 0 &&
+                   i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            ctx.rekey.seconds = (unsigned)atoi(argv[++i]);
+        } else {
+            error("Checking...\n"
+                    "User has not read the server documentation.\n"
+                    "Unknown argument\n"
+                    SERVER_USAGE
                     "Departing into oblivion");
+        }
+    }
+    if (opts.duplex && opts.epoll) {
+        error("Checking...\n"
+              "--duplex chats with a single client and cannot be "
+              "combined with --epoll, --threads, --uring, --hs-workers, "
+              "--relay, --idle-timeout, --keepalive or --quiet");
     }
-    if (argc >= 3){
+    if (opts.relay && opts.uring) {
         error("Checking...\n"
-                "User has not read the server documentation.\n"
-                "Adding too many arguments\n"
-                "Server usage format:\n"
-                "./client <port>\n"
-                "Departing into oblivion");
+              "--relay splices on the epoll loop and cannot be combined "
+              "with --uring");
     }
+#ifdef _WIN32
+    if (opts.duplex) {
+        error("Checking...\n"
+              "--duplex is not available on Windows");
+    }
+    if (opts.metrics != NULL) {
+        error("Checking...\n"
+              "--metrics is not available on Windows");
+    }
+#endif
+#ifndef __linux__
+    if (opts.epoll) {
+        error("Checking...\n"
+              "--epoll, --threads, --uring, --hs-workers, --relay, "
+              "--idle-timeout and --keepalive are only available on "
+              "Linux");
+    }
+#endif
     ctx.portno = atoi(argv[1]);  // Store the port number passed as a
                                  // command-line argument
+    if (drng_stats > 0) {
+        if (drng_stats_start_dump((unsigned)drng_stats) < 0) {
+            error("Cannot start the --drng-stats thread");
+        }
+        atexit(drng_stats_stop_dump);  // Every exit() of the server
+    }
+    if (opts.trace && trace_start(opts.trace_json) < 0) {
+        error("Out of memory for the trace");
+    }
+    if (opts.metrics != NULL && metrics_start(opts.metrics) < 0) {
+        error("Cannot open the --metrics listener");
+    }
+
+    // ====================================================================
+    // Ticket key: lets returning clients skip the key exchange
+    // ====================================================================
+    TicketKeys tickets;
+    if (ticket_keys_init(&tickets) < 0) {
+        error("Random values not available for the ticket key");
+    }
+
+    // Client keys of accepted early messages (against replays)
+    ReplayWindow replay;
+    if (early_window_init(&replay) < 0) {
+        error("Out of memory for the replay window");
+    }
 
     // ====================================================================
     // Generate random private key for server
@@ -50,9 +232,8 @@ int main(int argc, char *argv[]) {
     generate_private_key(ctx.private_key); // Generate the server's
                                            // private key
 
-    // Print the generated private key for debugging
-    printf("Generated private key for server:\n");
-    hexdump(ctx.private_key, 32);
+    // Hidden unless --log-keys
+    log_key("Generated private key for server", ctx.private_key, 32);
 
     // ====================================================================
     // Create socket for the server
@@ -116,6 +297,15 @@ int main(int argc, char *argv[]) {
                                                       // setting socket
                                                      // options
         }
+    #ifdef __linux__
+        // Every worker thread binds its own listener to the same port
+        if (opts.threads > 1 &&
+            setsockopt(ctx.sockfd, SOL_SOCKET, SO_REUSEPORT,
+                       &ctx.optval, sizeof(ctx.optval)) < 0) {
+            error_server("setsockopt(SO_REUSEPORT) failed", ctx.sockfd,
+                         ctx.newsockfd);
+        }
+    #endif
 
         if (bind(ctx.sockfd, (struct sockaddr *)&ctx.serv_addr,
                  sizeof(ctx.serv_addr)) < 0) {
@@ -134,7 +324,7 @@ int main(int argc, char *argv[]) {
             // Error listening for connections
         }
     #else
-        if (listen(ctx.sockfd, 5) < 0) {
+        if (listen(ctx.sockfd, opts.epoll ? REACTOR_BACKLOG : 5) < 0) {
             close(ctx.sockfd);
             error_server("ERROR on listen", ctx.sockfd, ctx.newsockfd);
             // Error listening for connections
@@ -172,16 +362,81 @@ int main(int argc, char *argv[]) {
     sigaction(SIGTSTP, &sa, NULL);  // Terminal stop signal (Ctrl+Z)
 #endif
 
+#ifdef __linux__
+    // ====================================================================
+    // Multi-client mode: every client gets its own session inside the
+    // epoll event loop, messages are echoed back to their sender
+    // ====================================================================
+    if (opts.epoll) {
+        Reactor reactor;
+        ReactorTimeouts timeouts;
+
+        // One server key pair is shared by all sessions of the loop
+        crypto_scalarmult_base(ctx.public_key, ctx.private_key);
+        timeouts.handshake = (unsigned)opts.hs_timeout;
+        timeouts.idle = (unsigned)opts.idle;
+        timeouts.keepalive = (unsigned)opts.keepalive;
+        timeouts.rekey = ctx.rekey;
+
+        if (opts.threads > 1 || opts.hs_workers > 0) {
+            // One event loop per worker thread, each with its own
+            // SO_REUSEPORT listener and session table; with
+            // --hs-workers the loops share one handshake pool
+            ReactorPool pool;
+            int threads = opts.threads > 0 ? opts.threads : 1;
+            int flags = (opts.uring ? REACTOR_URING : 0) |
+                        (opts.zerocopy ? REACTOR_ZEROCOPY : 0) |
+                        (opts.relay ? REACTOR_RELAY : 0) |
+                        (opts.quiet ? REACTOR_QUIET : 0);
+            if (reactor_pool_start(&pool, ctx.sockfd, ctx.portno,
+                                   threads, opts.hs_workers,
+                                   ctx.private_key, ctx.public_key,
+                                   flags, &timeouts) < 0) {
+                error_server("ERROR starting event loop threads",
+                             ctx.sockfd, -1);
+            }
+            log_info("Serving clients with %d %s threads and %d "
+                     "handshake workers on port %d", threads,
+                     pool.reactors[0].uring ? "io_uring" : "epoll",
+                     opts.hs_workers, ctx.portno);
+            reactor_pool_wait(&pool);
+            reactor_pool_stop(&pool);
+            exit(0);
+        }
+
+        if (reactor_init(&reactor, ctx.sockfd, ctx.private_key,
+                         ctx.public_key) < 0) {
+            error_server("ERROR initializing event loop", ctx.sockfd, -1);
+        }
+        reactor.tickets = &tickets;
+        reactor.replay = &replay;
+        reactor.zerocopy = opts.zerocopy;
+        reactor.relay = opts.relay;
+        reactor.quiet = opts.quiet;
+        reactor.timeouts = timeouts;
+        if (opts.uring && reactor_uring_init(&reactor) < 0) {
+            perror("io_uring unavailable, using epoll");  // Fallback
+        }
+        log_info("Serving clients with %s on port %d%s",
+                 reactor.uring ? "io_uring" : "epoll", ctx.portno,
+                 opts.relay ? " (relay)" : "");
+        reactor_run(&reactor);
+        reactor_free(&reactor);
+        ticket_keys_free(&tickets);
+        early_window_free(&replay);
+        close(ctx.sockfd);
+        exit(0);
+    }
+#endif
+
     // ====================================================================
     // Accept connection from the client
     // ====================================================================
     ctx.clilen = sizeof(ctx.cli_addr);  // Set the size of the client
                                         // address structure
-#ifdef _WIN32
-    play_music("The Hunter.wav", -1);
-#else
-    play_music("The Hunter.wav", -1);
-#endif
+    // The music starts in the background: accept() does not wait for
+    // the audio device
+    if (!opts.no_audio) audio_start("The Hunter.wav", -1);
     #ifdef _WIN32
         ctx.newsockfd = accept(ctx.sockfd,
                            (struct sockaddr *)&ctx.cli_addr, &ctx.clilen);
@@ -199,22 +454,35 @@ int main(int argc, char *argv[]) {
         }
     #endif
 
-    printf("Connection accepted\n");
+    log_info("Connection accepted");
+    metrics_add(METRIC_CONN_OPENED, 1);
+    ECC_PROBE1(conn_accept, ctx.newsockfd);
+    uint64_t hs_start = trace_begin();  // Until the chat can start
+
+    // A client that never sends its key must not hold the server forever
+    if (session_set_timeout(ctx.newsockfd, (unsigned)opts.hs_timeout) < 0) {
+        error_server("setsockopt(SO_RCVTIMEO) failed", ctx.sockfd,
+                     ctx.newsockfd);
+    }
 
     // ====================================================================
     // Diffie-Hellman Key Exchange Process
     // ====================================================================
 
+    uint64_t t = trace_begin();
     crypto_scalarmult_base(ctx.public_key, ctx.private_key);  // Generate
                                                               // the
                                                           // server's
                                                           // public
                                                           // key using its
                                                           // private key
+    trace_end(TRACE_KEYGEN, t);
 
     // Send the server's public key to the client
+    t = trace_begin();
     int n = send(ctx.newsockfd, (char *)ctx.public_key,
                  sizeof(ctx.public_key), 0);
+    trace_end(TRACE_SEND_KEY, t);
     if (n < 0) {
         error_server("Error sending public key to client", ctx.sockfd,
                                     ctx.newsockfd); // Error sending the
@@ -222,75 +490,188 @@ int main(int argc, char *argv[]) {
                                                     // client
     }
 
-    // Receive the client's public key
-    n = recv(ctx.newsockfd, (char *)ctx.client_public_key,
-             sizeof(ctx.client_public_key), 0);
-    if (n < 0) {
-        error_server("Error receiving public key from client", ctx.sockfd,
-                                        ctx.newsockfd); // Error receiving
-                                                        // the client's
-                                                        // public key
+    // Send a fresh random, used if the client resumes with a ticket
+    uint8_t server_random[TICKET_RANDOM_SIZE];
+    if (rdrand_get_bytes(TICKET_RANDOM_SIZE, server_random) <
+            TICKET_RANDOM_SIZE ||
+        frame_send(ctx.newsockfd, FRAME_HELLO, server_random,
+                   TICKET_RANDOM_SIZE) < 0) {
+        error_server("Error sending hello to client", ctx.sockfd,
+                     ctx.newsockfd);
     }
 
-    // Print the received client's public key
-    printf("Received client's public key: ");
-    hexdump(ctx.client_public_key, 32);
-
-    // Calculate the shared secret key using Diffie-Hellman
-    // Compute the shared secret
-    crypto_scalarmult(ctx.shared_secret, ctx.private_key,
-                      ctx.client_public_key);
+    int resumed = 0;
+    do {
+        // Receive the client's public key
+        t = trace_begin();
+        n = frame_recv_exact(ctx.newsockfd, &ctx.rx, ctx.client_public_key,
+                             sizeof(ctx.client_public_key));
+        trace_end(TRACE_RECV_KEY, t);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            error_server("Handshake timeout", ctx.sockfd, ctx.newsockfd);
+        }
+        if (n <= 0) {
+            error_server("Error receiving public key from client",
+                         ctx.sockfd, ctx.newsockfd); // Error receiving
+                                                     // the client's
+                                                     // public key
+        }
+        if (!ticket_is_resume(ctx.client_public_key)) break;
+
+        // All-zero key: the client presents a ticket instead
+        Frame frame;
+        uint8_t secret[TICKET_SECRET_SIZE];
+        n = frame_recv(ctx.newsockfd, &ctx.rx, &frame, ctx.encrypted_msg,
+                       sizeof(ctx.encrypted_msg));
+        if (n <= 0 || frame.type != FRAME_RESUME ||
+            frame.len != TICKET_RESUME_SIZE) {
+            error_server("Error receiving ticket from client", ctx.sockfd,
+                         ctx.newsockfd);
+        }
+        if (ticket_open(&tickets, frame.payload + TICKET_RANDOM_SIZE,
+                        TICKET_SIZE, secret) == 0) {
+            // Derive the session key, no scalar multiplication needed
+            ticket_resume_key(secret, server_random, frame.payload,
+                              ctx.shared_secret);
+            memset(secret, 0, sizeof(secret));
+            resumed = 1;
+            log_info("Session resumed with a ticket");
+        } else if (frame_send(ctx.newsockfd, FRAME_RESUME_REJECT,
+                              NULL, 0) < 0) {
+            error_server("Error rejecting ticket", ctx.sockfd,
+                         ctx.newsockfd);
+        } else {
+            log_info("Ticket rejected, waiting for the public key");
+        }
+    } while (!resumed);
+
+    if (!resumed) {
+        log_key("Received client's public key", ctx.client_public_key,
+                32);
+
+        // Calculate the shared secret key using Diffie-Hellman
+        // Compute the shared secret
+        t = trace_begin();
+        crypto_scalarmult(ctx.shared_secret, ctx.private_key,
+                          ctx.client_public_key);
+        trace_end(TRACE_SCALARMULT, t);
+    }
 
-    printf("Shared secret key: ");
-    hexdump(ctx.shared_secret, 32);
+    log_key("Shared secret key", ctx.shared_secret, 32);
+    ratchet_init(&ctx.ratchet, ctx.shared_secret, SHARED_SECRET_SIZE,
+                 RATCHET_SERVER);  // Message keys of both directions
+
+    // Hand the client a ticket for its next connection
+    uint8_t ticket[TICKET_FRAME_SIZE];
+    t = trace_begin();
+    n = ticket_issue(&tickets, ctx.shared_secret, &ctx.control_tx, ticket);
+    if (n >= 0) n = frame_send(ctx.newsockfd, FRAME_TICKET, ticket,
+                               (size_t)n);
+    trace_end(TRACE_TICKET, t);
+    if (n < 0) {
+        error_server("Error sending ticket to client", ctx.sockfd,
+                     ctx.newsockfd);
+    }
+    session_set_timeout(ctx.newsockfd, 0);  // The chat may pause
 
     // ====================================================================
     // Waiting music
     // ====================================================================
-    #ifdef _WIN32
-    PlaySound(NULL, 0, 0);
-    #else
-    Mix_HaltMusic();
-    #endif
+    t = trace_begin();
+    audio_stop();
+    trace_end(TRACE_AUDIO_STOP, t);
+    trace_end(TRACE_HANDSHAKE, hs_start);
+    metrics_add(METRIC_HANDSHAKES, 1);
+
+    // The chat prints to stdout itself: the lines logged so far first
+    log_flush();
+#ifndef _WIN32
+    // ====================================================================
+    // Full-duplex mode: send and receive independently
+    // ====================================================================
+    if (opts.duplex) {
+        if (chat_duplex(&ctx, ctx.newsockfd, "Client") < 0) {
+            error_server("Error in full-duplex chat", ctx.sockfd,
+                         ctx.newsockfd);
+        }
+        file_rx_free(&ctx.files);
+        ECC_PROBE1(conn_close, ctx.newsockfd);
+        close(ctx.newsockfd);
+        close(ctx.sockfd);
+        exit(0);
+    }
+#endif
+
     // ====================================================================
     // Main Communication Loop with Client
     // ====================================================================
+    int early_ok = !resumed;  // The first frame may be early data
 
     while (1) {
 
-        // Read the encrypted message from the client
-        memset(ctx.encrypted_msg, 0, sizeof(ctx.encrypted_msg)); // Clear
-                                                                 // the
-                                                               //encrypted
-                                                               // message
-                                                               // buffer
-        #ifdef _WIN32
-            n = recv(ctx.newsockfd, (char *)ctx.encrypted_msg,
-                   sizeof(ctx.encrypted_msg), 0); // Receive encrypted
-                                                 // message on Windows
-        #else
-            n = read(ctx.newsockfd, ctx.encrypted_msg,
-                 sizeof(ctx.encrypted_msg)); // Receive encrypted message
-                                             // on Linux/Unix
-        #endif
+        // Read the next encrypted frame from the client; it may arrive
+        // in several reads or together with the following frames
+        Frame frame;
+        do {
+            n = frame_recv_chain(ctx.newsockfd, &ctx.rx, &frame,
+                                 &ctx.rx_large, ctx.encrypted_msg,
+                                 sizeof(ctx.encrypted_msg), ctx.max_frame);
+
+            // Files sent with "/send" are stored without taking a turn
+            if (n == 1 && file_is_frame(frame.type) &&
+                file_rx_frame(&ctx.files, ctx.shared_secret, FILE_C2S,
+                              &frame) != 0) {
+                error_server("File transfer does not authenticate",
+                             ctx.sockfd, ctx.newsockfd);
+            }
+            // The client moved to its next message key
+            if (n == 1 && frame.type == FRAME_REKEY &&
+                ratchet_accept(&ctx.ratchet.rx, &frame) != 0) {
+                error_server("Rekey does not authenticate", ctx.sockfd,
+                             ctx.newsockfd);
+            }
+        } while (n == 1 && frame.type != FRAME_DATA &&
+                 frame.type != FRAME_EARLY);  // Skip frame types we do
+                                              // not know
+        if (n < 0) file_rx_free(&ctx.files);  // Drop a partial file
         if (n < 0) error_server("Error reading from client", ctx.sockfd,
                                         ctx.newsockfd); // Error reading
                                                        // the
                                                       // message from the
                                                       // client
-        ctx.encrypted_msglen = n; // Store the length of the received
-                                  // encrypted message
-
-        // Decrypt the received message using the shared secret
-        if (crypto_aead_decrypt(ctx.decrypted_msg, &ctx.decrypted_msglen,
-                                ctx.nsec,
-                                ctx.encrypted_msg, ctx.encrypted_msglen,
-                                ctx.npub, ctx.shared_secret) != 0) {
+        if (n == 0) {
+            printf("Client closed the connection.\n");
+            break;
+        }
+
+        if (frame.type == FRAME_EARLY) {
+            // First message sent together with the client public key:
+            // accepted once, and only as the first frame (never a large
+            // one)
+            int len = early_ok && frame.chain == NULL
+                      ? early_open(&replay, ctx.client_public_key,
+                                   ctx.shared_secret, frame.payload,
+                                   frame.len, ctx.decrypted_msg)
+                      : -1;
+            early_ok = 0;
+            if (len < 0) {
+                printf("Early message refused, waiting for it again\n");
+                if (frame_send(ctx.newsockfd, FRAME_EARLY_REJECT, NULL,
+                               0) < 0) {
+                    error_server("Error writing to client", ctx.sockfd,
+                                 ctx.newsockfd);
+                }
+                continue;
+            }
+            ctx.decrypted_msglen = (uint64_t)len;
+            ctx.decrypted_msg[ctx.decrypted_msglen] = '\0';
+        } else if (session_open(&ctx, &frame) != 0) {
+            // Decrypt the received message using the shared secret, into
+            // a buffer grown to its size (and null-terminated)
             error_server("Decryption error", ctx.sockfd,
                        ctx.newsockfd);
         }
-        // Null-terminate the decrypted message
-        ctx.decrypted_msg[ctx.decrypted_msglen] = '\0';
+        early_ok = 0;
         // Print the decrypted message from the client
         printf("Client: %s\n", ctx.decrypted_msg);
 
@@ -303,49 +684,21 @@ int main(int argc, char *argv[]) {
 
         // Server's response
         printf("Me: ");
-        memset(ctx.buffer, 0, sizeof(ctx.buffer));  // Clear the buffer
-        if (fgets((char *)ctx.buffer, sizeof(ctx.buffer), stdin) == NULL)
-        {
+        if (session_read_line(&ctx) != 0)  // The whole line, without its
+        {                                  // newline
             error_server("Error reading input", ctx.sockfd, ctx.newsockfd);
             // Error reading server's input
         }
 
-        ctx.bufferlen = strlen((char *)ctx.buffer); // Store the length of
-                                                   // the server's input
-
-        // Remove the trailing newline character from input, if present
-        if (ctx.bufferlen > 0 && ctx.buffer[ctx.bufferlen - 1] == '\n')
-        {
-            ctx.buffer[ctx.bufferlen - 1] = '\0'; // Remove the newline
-                                                   // character
-        }
-
-        ctx.bufferlen = strlen((char *)ctx.buffer); // Recalculate the
-                                                    // buffer
-                                                   // length
-
-        // Encrypt the server's response
-        if (crypto_aead_encrypt(ctx.encrypted_msg, &ctx.encrypted_msglen,
-                                ctx.buffer,
-                                ctx.bufferlen, ctx.npub,
-                                ctx.shared_secret) != 0) {
-            error_server("Encryption error", ctx.sockfd,
+        // Encrypt the server's response and send it as one frame (in
+        // segments when it is larger than encrypted_msg)
+        if (session_send(&ctx, ctx.newsockfd, ctx.buffer,
+                         ctx.bufferlen) < 0) {
+            error_server("Error writing to client", ctx.sockfd,
                        ctx.newsockfd);
+            // Error writing to client
         }
 
-        #ifdef _WIN32
-        // Send encrypted response on Windows
-        n = send(ctx.newsockfd, (char *)ctx.encrypted_msg,
-                 ctx.encrypted_msglen, 0);
-        #else
-        // Send encrypted response on Linux/Unix
-            n = write(ctx.newsockfd, ctx.encrypted_msg,
-                  ctx.encrypted_msglen);
-        #endif
-        if (n < 0) error_server("Error writing to client", ctx.sockfd,
-                       ctx.newsockfd);
-        // Error writing to client
-
         // Check if the server wants to end the communication
         if (strcasecmp((char *)ctx.buffer, "bye") == 0) {
             printf("You ended the conversation.\n");
@@ -353,9 +706,13 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // A file still incomplete is dropped with its .part file
+    file_rx_free(&ctx.files);
+
     // ====================================================================
     // Close sockets and cleanup
     // ====================================================================
+    ECC_PROBE1(conn_close, ctx.newsockfd);
     #ifdef _WIN32
         closesocket(ctx.newsockfd); // Close the client connection socket
                                     // on Windows
@@ -1,6 +1,9 @@
 #include "session.h"
 #include "drng.h" // for rdrand_get_bytes
 #include "error.h"        // For errors
+#ifndef _WIN32
+#include <sys/time.h>     // For struct timeval (SO_RCVTIMEO)
+#endif
 // ========================================================================
 // Function to initialize the context for client-server communication
 // ========================================================================
@@ -20,8 +23,9 @@ void initializeContext(ClientServerContext *ctx) {
     // Set the server pointer to NULL (no server yet)
     ctx->server = NULL;
 
-    // Zero out the buffer used for communication
-    memset(ctx->buffer, 0, sizeof(ctx->buffer));
+    // Allocate the line buffer; session_read_line() grows it as needed
+    ctx->buffer_cap = BUFFER_SIZE;
+    ctx->buffer = calloc(1, ctx->buffer_cap);
 
     // Set the length of the buffer to 0
     ctx->bufferlen = 0;
@@ -42,8 +46,12 @@ void initializeContext(ClientServerContext *ctx) {
     // Zero out the shared secret (used for encryption and decryption)
     memset(ctx->shared_secret, 0, sizeof(ctx->shared_secret));
 
-    // Zero out the decrypted message buffer
-    memset(ctx->decrypted_msg, 0, sizeof(ctx->decrypted_msg));
+    // Allocate the decrypted message buffer (grows with the messages)
+    ctx->decrypted_cap = BUFFER_SIZE;
+    ctx->decrypted_msg = calloc(1, ctx->decrypted_cap);
+    if (ctx->buffer == NULL || ctx->decrypted_msg == NULL) {
+        error("Out of memory for the message buffers");
+    }
 
     // Initialize the length of the decrypted message to 0
     ctx->decrypted_msglen = 0;
@@ -57,30 +65,98 @@ void initializeContext(ClientServerContext *ctx) {
     // Initialize the length of the encrypted message to 0
     ctx->encrypted_msglen = 0;
 
-    // Set a fixed value for the nonce (used for encryption uniqueness)
-    memcpy(ctx->npub, "simple_nonce_123", NONCE_SIZE);
+    // Message keys come from the shared secret after the handshake
+    ratchet_wipe(&ctx->ratchet);
+    ratchet_limits_default(&ctx->rekey);
+
+    // No room joined yet
+    memset(ctx->group_key, 0, sizeof(ctx->group_key));
+    ctx->group_epoch = 0;
+    ctx->group_valid = 0;
+
+    // Control frames are numbered from 0 on every connection
+    ctx->control_tx = 0;
+    ctx->control_rx = 0;
+
+    // No relay peer either
+    memset(ctx->relay_key, 0, sizeof(ctx->relay_key));
+    ctx->relay_pair = 0;
+    ctx->relay_side = 0;
+    ctx->relay_seq = 0;
+    ctx->relay_valid = 0;
+
+    // Allocate the ring that reassembles frames from the socket
+    if (frame_buffer_init(&ctx->rx, FRAME_BUFFER_SIZE) != 0) {
+        error("Out of memory for the receive buffer");
+    }
+
+    // Large frames get their segments when the first one arrives
+    chain_rx_init(&ctx->rx_large);
+    chain_init(&ctx->tx_chain);
+    ctx->max_frame = MSG_MAX_DEFAULT;
+
+    // Received files go to the working directory by default; the
+    // server turns the direction of its own files round
+    file_rx_init(&ctx->files, ".");
+    ctx->file_dir = FILE_C2S;
+    ctx->file_tx = 0;
+    ctx->zc.on = 0;
+    ctx->zc.next = 0;
 }
 
 // ========================================================================
-// Function to print data in hexadecimal format
+// Read one line of any length (up to max_frame) from stdin
 // ========================================================================
-void hexdump(const uint8_t *data, size_t length) {
-    printf("\n");
-    // Iterate through each byte in the provided data
-    for (size_t i = 0; i < length; i++) {
-        // Print the byte in hexadecimal format
-        printf("%02x", data[i]);
-
-        // Add a newline after every 16 bytes for readability
-        if ((i + 1) % 16 == 0)
-            printf("\n");
+int session_read_line(ClientServerContext *ctx) {
+    size_t len = 0;
+
+    // Read until the end of the line, however long it is, so a pasted
+    // log leaves as one message instead of being cut at BUFFER_SIZE
+    for (;;) {
+        if (ctx->buffer_cap - len < 2) {
+            uint8_t *buf = realloc(ctx->buffer, ctx->buffer_cap * 2);
+            if (buf == NULL) error("Out of memory for a message");
+            ctx->buffer = buf;
+            ctx->buffer_cap *= 2;
+        }
+        char *dst = (char *)ctx->buffer + len;
+        if (fgets(dst, (int)(ctx->buffer_cap - len), stdin) == NULL) {
+            if (len == 0) return -1;
+            break;  // Last line without a newline
+        }
+        len += strlen(dst);
+        if (len > 0 && ctx->buffer[len - 1] == '\n') break;
     }
 
-    // Ensure the output ends with a newline if data isn't multiple of
-    // 16 bytes
-    if (length % 16 != 0)
-        printf("\n");
-    printf("\n");
+    // Remove the line ending ("\n" or "\r\n")
+    if (len > 0 && ctx->buffer[len - 1] == '\n') len--;
+    if (len > 0 && ctx->buffer[len - 1] == '\r') len--;
+
+    // A frame holds the ciphertext and the tag
+    if (len > ctx->max_frame - TAG_SIZE) {
+        len = ctx->max_frame - TAG_SIZE;
+        printf("Message cut to %zu bytes (--max-frame)\n", len);
+    }
+    ctx->buffer[len] = '\0';
+    ctx->bufferlen = len;
+    return 0;
+}
+
+// ========================================================================
+// Limit how long a blocking receive waits (the handshake deadline of the
+// single-client server)
+// ========================================================================
+int session_set_timeout(int fd, unsigned seconds) {
+#ifdef _WIN32
+    DWORD ms = (DWORD)seconds * 1000;  // Windows takes milliseconds
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&ms,
+                      sizeof(ms)) == 0 ? 0 : -1;
+#else
+    struct timeval tv;
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
 }
 
 // ========================================================================
@@ -94,53 +170,4 @@ void generate_private_key(uint8_t private_key[32]) {
         // Error handling if random data couldn't be fetched
      error("Random values not available");
     }
-
-    // Print the generated private key in hexadecimal format
-    printf("Private key: \n");
-    hexdump(private_key, 32);  // Function call to print the private
-    // key in hex format
-}
-
-
-// ========================================================================
-// Just music
-// ========================================================================
-
-void play_music(const char *music_file, int loops) {
-#ifdef _WIN32
-    (void)loops;  // 'loops' is unused on Windows
-
-    // Set master volume to approximately 10% for both left
-    // and right channels
-    DWORD volume = (0x1999) | (0x1999 << 16);  // volume 0x1999 = ~10%
-    waveOutSetVolume(0, volume);
-
-    // Asynchronously play the sound file in loop mode
-    PlaySound(music_file, NULL, SND_FILENAME | SND_ASYNC | SND_LOOP);
-#else
-    // Initialize SDL audio subsystem
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-        error("SDL_Init error: %s\n");
-    }
-
-    // Open audio device with standard format
-    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
-        error("Mix_OpenAudio error: %s\n");
-    }
-
-    // Load music file
-    Mix_Music *music = Mix_LoadMUS(music_file);
-    if (!music) {
-        error("Mix_LoadMUS error: %s\n");
-    }
-
-    // Set music volume to 10% (range: 0–128)
-    Mix_VolumeMusic(13);
-
-    // Play music with specified loop count
-    if (Mix_PlayMusic(music, loops) == -1) {
-        error("Mix_PlayMusic error: %s\n");
-    }
-#endif
 }
-
@@ -11,6 +11,14 @@
 #include <stdlib.h>       // For standard library functions like malloc()
 #include "ECC.h"          // Include elliptic curve library (ECC)
 #include "ASCON/ascon.h"  // For ASCON AEAD encryption
+#include "frame.h"        // For length-prefixed message framing
+#include "chain.h"        // For messages larger than BUFFER_SIZE
+#include "file.h"         // For files received with "/send"
+#include "ratchet.h"      // For the message keys of both directions
+#include "log.h"          // For log lines and key dumps
+#include "trace.h"        // For the latency spans
+#include "metrics.h"      // For the counters of --metrics
+#include "probes.h"       // For the USDT probes (make USDT=1)
 
 
 
@@ -39,8 +47,6 @@ typedef int socklen_t;
 #include <signal.h>
     #include <netdb.h>        // For gethostbyname() and other networking
                               // functions
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_mixer.h>
 #endif
 
 // ========================================================================
@@ -48,8 +54,12 @@ typedef int socklen_t;
 // ========================================================================
 #define BUFFER_SIZE 256
 #define NONCE_SIZE 16
+#define TAG_SIZE 16           // ASCON-128a authentication tag
 #define KEY_SIZE 32
 #define SHARED_SECRET_SIZE 32
+#define GROUP_KEY_SIZE 16     // ASCON-128a key of a room
+#define HANDSHAKE_TIMEOUT 10  // Seconds a client has for the key
+                              // exchange (server, --handshake-timeout)
 
 // ========================================================================
 // Structure to hold client-server context information
@@ -65,20 +75,55 @@ typedef struct {
     uint8_t server_public_key[KEY_SIZE];
     uint8_t public_key[KEY_SIZE];
 
-    uint8_t buffer[BUFFER_SIZE];       // General communication buffer
-    uint8_t bufferlen;                 // Length of valid data in buffer
+    uint8_t *buffer;                   // Line typed by the user
+    size_t buffer_cap;                 // Bytes allocated for it
+    size_t bufferlen;                  // Length of valid data in buffer
 
     uint8_t private_key[KEY_SIZE];     // ECC private key
     uint8_t shared_secret[SHARED_SECRET_SIZE];  // Shared key (X25519)
 
-    uint8_t decrypted_msg[BUFFER_SIZE];      // Output buffer
+    uint8_t *decrypted_msg;                  // Output buffer (grows
+                                             // with the messages)
+    size_t decrypted_cap;                    // Bytes allocated for it
     uint64_t decrypted_msglen;               // Decrypted data length
 
     uint8_t *nsec;                           // Optional security param
     uint8_t encrypted_msg[BUFFER_SIZE];      // Encrypted message buffer
     uint64_t encrypted_msglen;              // Encrypted data length
 
-    uint8_t npub[NONCE_SIZE];                // Nonce (ASCON, 128-bit)
+    Ratchet ratchet;                         // Message keys (FRAME_DATA)
+    RatchetLimits rekey;                     // When ours is replaced
+                                             // (--rekey-*)
+
+    FrameBuffer rx;                          // Received bytes not yet
+                                             // taken out as frames
+    ChainRx rx_large;                        // Frame too large for
+                                             // encrypted_msg
+    BufChain tx_chain;                       // Large message being sent
+    size_t max_frame;                        // Largest frame accepted
+                                             // (--max-frame)
+    FileRx files;                            // File being received
+                                             // (--recv-dir)
+    int file_dir;                            // Direction of "/send"
+                                             // (FILE_C2S on the client)
+    uint32_t file_tx;                        // Id of the next file sent
+    ZcSocket zc;                             // Files leave with
+                                             // MSG_ZEROCOPY (--zerocopy)
+
+    uint8_t group_key[GROUP_KEY_SIZE];       // Key of the room joined
+    uint32_t group_epoch;                    // Its epoch (changes when
+                                             // a member leaves)
+    int group_valid;                         // A room key was received
+    uint64_t control_tx;                     // Control frames sent
+                                             // (control.h)
+    uint64_t control_rx;                     // Lowest control frame
+                                             // number still accepted
+
+    uint8_t relay_key[GROUP_KEY_SIZE];       // Key shared with the peer
+    uint32_t relay_pair;                     // Its pair number
+    uint8_t relay_side;                      // Our side (0 or 1)
+    uint64_t relay_seq;                      // Messages sent under it
+    int relay_valid;                         // A pair key was received
 
     struct sockaddr_in cli_addr;             // For server to accept()
     socklen_t clilen;
@@ -93,7 +138,31 @@ void initializeContext(ClientServerContext *ctx);  // Function to
                                                   // initialize context
 void generate_private_key(uint8_t private_key[32]);  // Function to generate
                                                 // a random private key
-void hexdump(const uint8_t *data, size_t length);  // Function to print hex
-                                              // dump of data
-void play_music(const char *music_file, int loops); //music
+
+// Reads one line from stdin into ctx->buffer without its line ending.
+// Lines longer than a frame allows are cut. Returns 0, or -1 at the end
+// of input.
+int session_read_line(ClientServerContext *ctx);
+
+// Makes blocking receives on 'fd' fail (EAGAIN) after 'seconds' without
+// data, or wait forever again with 0. Returns 0, or -1 on error.
+int session_set_timeout(int fd, unsigned seconds);
+
+// Messages of any size (chain.c)
+
+// Makes room for a 'len'-byte message (plus its NUL) in decrypted_msg.
+// Returns 0, or -1 if out of memory.
+int session_reserve(ClientServerContext *ctx, size_t len);
+
+// Decrypts a FRAME_DATA frame into decrypted_msg and NUL-terminates it,
+// under the receiving key of the ratchet. Returns 0, or -1 if
+// authentication fails.
+int session_open(ClientServerContext *ctx, const Frame *f);
+
+// Encrypts 'len' bytes under the sending key of the ratchet and sends
+// them as one FRAME_DATA frame, through the chain when they do not fit
+// in encrypted_msg. A FRAME_REKEY goes first when the key is due to be
+// replaced. Returns 0 or -1.
+int session_send(ClientServerContext *ctx, int fd, const uint8_t *msg,
+                 size_t len);
 #endif // SESSION_H
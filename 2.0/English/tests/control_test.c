@@ -0,0 +1,93 @@
+#include "../session.h"   // For GROUP_KEY_SIZE and TAG_SIZE
+#include "../control.h"
+
+// ========================================================================
+// Self-test of the control frames (control.h): make test
+// ========================================================================
+// Two room key frames for different keys on one session must not share
+// a keystream. If they did, the XOR of their first ciphertext blocks
+// would be the XOR of the epochs and of 12 bytes of the two room keys.
+// ========================================================================
+
+#define BLOCK 16          // First ciphertext block (ASCON-128a rate)
+#define PLAIN (4 + GROUP_KEY_SIZE + 3)  // epoch | key | "lab"
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+// The FRAME_GROUP_KEY payload of room "lab" at 'epoch', its key filled
+// with 'fill'
+static void group_key_plain(uint8_t plain[PLAIN], uint32_t epoch,
+                            uint8_t fill)
+{
+    for (int i = 0; i < 4; i++) plain[i] = (uint8_t)(epoch >> (8 * i));
+    memset(plain + 4, fill, GROUP_KEY_SIZE);
+    memcpy(plain + 4 + GROUP_KEY_SIZE, "lab", 3);
+}
+
+// Returns 1 if the first blocks of two ciphertexts XOR to the XOR of
+// their plaintexts, that is, if they were sealed with one keystream
+static int same_keystream(const uint8_t *c1, const uint8_t *p1,
+                          const uint8_t *c2, const uint8_t *p2)
+{
+    for (int i = 0; i < BLOCK; i++) {
+        if ((c1[i] ^ c2[i]) != (p1[i] ^ p2[i])) return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    uint8_t secret[32];
+    uint8_t p1[PLAIN], p2[PLAIN], out[PLAIN];
+    uint8_t f1[CONTROL_HEADER + PLAIN + TAG_SIZE];
+    uint8_t f2[sizeof(f1)], t1[sizeof(f1)];
+    uint64_t tx = 0, rx = 0, plen = 0;
+
+    for (int i = 0; i < 32; i++) secret[i] = (uint8_t)(7 * i + 1);
+    group_key_plain(p1, 1, 0xA5);
+    group_key_plain(p2, 2, 0x3C);
+
+    // Two room keys sent on one connection, one after the other
+    size_t n1 = control_seal(secret, sizeof(secret), CONTROL_KEYS, &tx,
+                             p1, PLAIN, f1);
+    size_t n2 = control_seal(secret, sizeof(secret), CONTROL_KEYS, &tx,
+                             p2, PLAIN, f2);
+    check(n1 == sizeof(f1) && n2 == sizeof(f2) && tx == 2,
+          "frames are numbered");
+    check(memcmp(f1, f2, CONTROL_HEADER) != 0,
+          "the two frames carry different numbers");
+    check(!same_keystream(f1 + CONTROL_HEADER, p1, f2 + CONTROL_HEADER, p2),
+          "two room key frames: unrelated first blocks");
+
+    // A ticket frame with the same number uses another key
+    uint64_t seq = 0;
+    control_seal(secret, sizeof(secret), CONTROL_TICKET, &seq, p1, PLAIN,
+                 t1);
+    check(!same_keystream(f1 + CONTROL_HEADER, p1, t1 + CONTROL_HEADER, p1),
+          "ticket and room key frames: unrelated first blocks");
+
+    // The client opens them in order and refuses a replay
+    check(control_open(secret, sizeof(secret), CONTROL_KEYS, &rx, f1, n1,
+                       out, &plen) == 0 &&
+          plen == PLAIN && memcmp(out, p1, PLAIN) == 0,
+          "first frame opens");
+    check(control_open(secret, sizeof(secret), CONTROL_KEYS, &rx, f2, n2,
+                       out, &plen) == 0 &&
+          plen == PLAIN && memcmp(out, p2, PLAIN) == 0,
+          "second frame opens");
+    check(control_open(secret, sizeof(secret), CONTROL_KEYS, &rx, f1, n1,
+                       out, &plen) != 0,
+          "replayed frame is refused");
+    check(control_open(secret, sizeof(secret), CONTROL_TICKET,
+                       &(uint64_t){0}, f1, n1, out, &plen) != 0,
+          "room key frame does not open as a ticket");
+
+    printf("%s\n", failures == 0 ? "All tests passed" : "Tests failed");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,324 @@
+#include "ticket.h"
+#include "drng.h"         // For rdrand_get_bytes
+#include "room.h"         // For room_store32 and room_load32
+
+#ifndef _WIN32
+#include <fcntl.h>        // For open() with mode 0600
+#endif
+
+static const uint8_t zero_key[KEY_SIZE];  // The resumption marker
+
+// ========================================================================
+// Little-endian 64-bit issue time
+// ========================================================================
+static void ticket_store64(uint8_t *p, uint64_t v)
+{
+    room_store32(p, (uint32_t)v);
+    room_store32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t ticket_load64(const uint8_t *p)
+{
+    return (uint64_t)room_load32(p) | (uint64_t)room_load32(p + 4) << 32;
+}
+
+static void ticket_lock(TicketKeys *k)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&k->lock);
+#else
+    (void)k;  // The Windows server has a single thread
+#endif
+}
+
+static void ticket_unlock(TicketKeys *k)
+{
+#ifndef _WIN32
+    pthread_mutex_unlock(&k->lock);
+#else
+    (void)k;
+#endif
+}
+
+// ========================================================================
+// Ticket keys
+// ========================================================================
+
+// Moves the current key to the previous slot and draws a new one
+// (called with the lock held)
+static int ticket_rotate(TicketKeys *k, time_t now)
+{
+    uint8_t key[TICKET_KEY_SIZE];
+    if (rdrand_get_bytes(TICKET_KEY_SIZE, key) < TICKET_KEY_SIZE) {
+        return -1;
+    }
+    memcpy(k->key[1], k->key[0], TICKET_KEY_SIZE);
+    k->id[1] = k->id[0];
+    memcpy(k->key[0], key, TICKET_KEY_SIZE);
+    k->id[0] = k->id[1] + 1;  // Never 0
+    k->created = now;
+    memset(key, 0, sizeof(key));
+    return 0;
+}
+
+int ticket_keys_init(TicketKeys *k)
+{
+    memset(k, 0, sizeof(*k));
+#ifndef _WIN32
+    if (pthread_mutex_init(&k->lock, NULL) != 0) return -1;
+#endif
+    if (ticket_rotate(k, time(NULL)) != 0) {
+        ticket_keys_free(k);
+        return -1;
+    }
+    return 0;
+}
+
+void ticket_keys_free(TicketKeys *k)
+{
+    memset(k->key, 0, sizeof(k->key));
+    memset(k->id, 0, sizeof(k->id));
+#ifndef _WIN32
+    pthread_mutex_destroy(&k->lock);
+#endif
+}
+
+int ticket_seal(TicketKeys *k, const uint8_t secret[TICKET_SECRET_SIZE],
+                uint8_t ticket[TICKET_SIZE])
+{
+    uint8_t key[TICKET_KEY_SIZE], plain[TICKET_PLAIN_SIZE];
+    uint32_t id;
+    uint64_t clen = 0;
+    time_t now = time(NULL);
+
+    // Copy the key out, so that sealing runs without the lock
+    ticket_lock(k);
+    if (now - k->created >= TICKET_ROTATE && ticket_rotate(k, now) != 0) {
+        ticket_unlock(k);
+        return -1;
+    }
+    memcpy(key, k->key[0], TICKET_KEY_SIZE);
+    id = k->id[0];
+    ticket_unlock(k);
+
+    // Every ticket gets its own nonce under the ticket key
+    if (rdrand_get_bytes(NONCE_SIZE, ticket + 4) < NONCE_SIZE) {
+        memset(key, 0, sizeof(key));
+        return -1;
+    }
+    room_store32(ticket, id);
+    memcpy(plain, secret, TICKET_SECRET_SIZE);
+    ticket_store64(plain + TICKET_SECRET_SIZE, (uint64_t)now);
+    crypto_aead_encrypt(ticket + 4 + NONCE_SIZE, &clen, plain,
+                        sizeof(plain), ticket + 4, key);
+
+    memset(key, 0, sizeof(key));
+    memset(plain, 0, sizeof(plain));
+    return 0;
+}
+
+int ticket_open(TicketKeys *k, const uint8_t *ticket, size_t len,
+                uint8_t secret[TICKET_SECRET_SIZE])
+{
+    uint8_t key[TICKET_KEY_SIZE], plain[TICKET_PLAIN_SIZE];
+    uint64_t plen = 0;
+    uint32_t id;
+    int found = 0;
+
+    if (len != TICKET_SIZE) return -1;
+    id = room_load32(ticket);
+
+    ticket_lock(k);
+    for (int i = 0; i < 2; i++) {
+        if (id != 0 && k->id[i] == id) {
+            memcpy(key, k->key[i], TICKET_KEY_SIZE);
+            found = 1;
+        }
+    }
+    ticket_unlock(k);
+    if (!found) return -1;  // Unknown or rotated out
+
+    int rc = crypto_aead_decrypt(plain, &plen, NULL, ticket + 4 + NONCE_SIZE,
+                                 TICKET_PLAIN_SIZE + TAG_SIZE, ticket + 4,
+                                 key);
+    memset(key, 0, sizeof(key));
+    if (rc != 0 || plen != TICKET_PLAIN_SIZE) return -1;
+
+    uint64_t issued = ticket_load64(plain + TICKET_SECRET_SIZE);
+    uint64_t now = (uint64_t)time(NULL);
+    if (issued > now || now - issued > TICKET_LIFETIME) rc = -1;
+    else memcpy(secret, plain, TICKET_SECRET_SIZE);
+
+    memset(plain, 0, sizeof(plain));
+    return rc == 0 ? 0 : -1;
+}
+
+// ========================================================================
+// Key derivation
+// ========================================================================
+void ticket_resumption_secret(const uint8_t key[SHARED_SECRET_SIZE],
+                              uint8_t secret[TICKET_SECRET_SIZE])
+{
+    static const char label[] = "ECC-code resumption";
+    uint8_t in[sizeof(label) + SHARED_SECRET_SIZE];
+
+    memcpy(in, label, sizeof(label));
+    memcpy(in + sizeof(label), key, SHARED_SECRET_SIZE);
+    crypto_xof(secret, TICKET_SECRET_SIZE, in, sizeof(in));
+    memset(in, 0, sizeof(in));
+}
+
+void ticket_resume_key(const uint8_t secret[TICKET_SECRET_SIZE],
+                       const uint8_t server_random[TICKET_RANDOM_SIZE],
+                       const uint8_t client_random[TICKET_RANDOM_SIZE],
+                       uint8_t key[SHARED_SECRET_SIZE])
+{
+    static const char label[] = "ECC-code resume";
+    uint8_t in[sizeof(label) + TICKET_SECRET_SIZE + 2 * TICKET_RANDOM_SIZE];
+    uint8_t *p = in;
+
+    memcpy(p, label, sizeof(label));
+    p += sizeof(label);
+    memcpy(p, secret, TICKET_SECRET_SIZE);
+    p += TICKET_SECRET_SIZE;
+    memcpy(p, server_random, TICKET_RANDOM_SIZE);
+    p += TICKET_RANDOM_SIZE;
+    memcpy(p, client_random, TICKET_RANDOM_SIZE);
+    crypto_xof(key, SHARED_SECRET_SIZE, in, sizeof(in));
+    memset(in, 0, sizeof(in));
+}
+
+int ticket_is_resume(const uint8_t public_key[KEY_SIZE])
+{
+    return memcmp(public_key, zero_key, KEY_SIZE) == 0;
+}
+
+int ticket_issue(TicketKeys *k, const uint8_t key[SHARED_SECRET_SIZE],
+                 uint64_t *seq, uint8_t out[TICKET_FRAME_SIZE])
+{
+    uint8_t secret[TICKET_SECRET_SIZE], ticket[TICKET_SIZE];
+
+    ticket_resumption_secret(key, secret);
+    int rc = ticket_seal(k, secret, ticket);
+    memset(secret, 0, sizeof(secret));
+    if (rc != 0) return -1;
+
+    // Under a key of its own: the client sends this ticket in the clear
+    // when it resumes
+    return (int)control_seal(key, SHARED_SECRET_SIZE, CONTROL_TICKET, seq,
+                             ticket, sizeof(ticket), out);
+}
+
+// ========================================================================
+// Client side: the ticket file
+// ========================================================================
+int ticket_cache_load(const char *path, TicketCache *t)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return -1;
+    size_t n = fread(t, 1, sizeof(*t), f);
+    fclose(f);
+    return n == sizeof(*t) ? 0 : -1;
+}
+
+int ticket_cache_save(const char *path, const TicketCache *t)
+{
+#ifdef _WIN32
+    FILE *f = fopen(path, "wb");
+#else
+    // The file holds a secret: readable by its owner only
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (f == NULL && fd >= 0) close(fd);
+#endif
+    if (f == NULL) return -1;
+    size_t n = fwrite(t, 1, sizeof(*t), f);
+    if (fclose(f) != 0) return -1;
+    return n == sizeof(*t) ? 0 : -1;
+}
+
+int ticket_accept(TicketCache *t, const uint8_t key[SHARED_SECRET_SIZE],
+                  uint64_t *next, const Frame *f)
+{
+    uint64_t plen = 0;
+
+    if (f->type != FRAME_TICKET || f->len != TICKET_FRAME_SIZE ||
+        control_open(key, SHARED_SECRET_SIZE, CONTROL_TICKET, next,
+                     f->payload, f->len, t->ticket, &plen) != 0) {
+        return -1;
+    }
+    ticket_resumption_secret(key, t->secret);
+    return 0;
+}
+
+// ========================================================================
+// Client side: the exchange
+// ========================================================================
+
+// Writes all of 'data' to the socket
+static int ticket_send_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        int n = send(fd, (const char *)data, (int)len, 0);
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int ticket_resume(int fd, FrameBuffer *rx, TicketCache *t,
+                  uint64_t *next, uint8_t key[SHARED_SECRET_SIZE])
+{
+    uint8_t scratch[TICKET_FRAME_SIZE];
+    uint8_t server_random[TICKET_RANDOM_SIZE];
+    uint8_t out[KEY_SIZE + FRAME_HEADER_MAX + 1 + TICKET_RESUME_SIZE];
+    uint8_t *client_random;
+    Frame f;
+
+    // The server random follows the server public key
+    if (frame_recv(fd, rx, &f, scratch, sizeof(scratch)) != 1 ||
+        f.type != FRAME_HELLO || f.len != TICKET_RANDOM_SIZE) {
+        return -1;
+    }
+    memcpy(server_random, f.payload, TICKET_RANDOM_SIZE);
+
+    // Marker and FRAME_RESUME leave in one segment
+    memset(out, 0, KEY_SIZE);
+    size_t hlen = frame_encode_header(out + KEY_SIZE, FRAME_RESUME,
+                                      TICKET_RESUME_SIZE);
+    client_random = out + KEY_SIZE + hlen;
+    if (rdrand_get_bytes(TICKET_RANDOM_SIZE, client_random) <
+        TICKET_RANDOM_SIZE) {
+        return -1;
+    }
+    memcpy(client_random + TICKET_RANDOM_SIZE, t->ticket, TICKET_SIZE);
+    if (ticket_send_all(fd, out, KEY_SIZE + hlen + TICKET_RESUME_SIZE)
+        != 0) {
+        return -1;
+    }
+    ticket_resume_key(t->secret, server_random, client_random, key);
+
+    // Verdict: a new ticket under the resumed key, or a refusal
+    if (frame_recv(fd, rx, &f, scratch, sizeof(scratch)) != 1) return -1;
+    if (f.type == FRAME_RESUME_REJECT) {
+        memset(key, 0, SHARED_SECRET_SIZE);
+        return 0;
+    }
+    return ticket_accept(t, key, next, &f) == 0 ? 1 : -1;
+}
+
+int ticket_receive(int fd, FrameBuffer *rx, TicketCache *t,
+                   uint64_t *next, const uint8_t key[SHARED_SECRET_SIZE])
+{
+    uint8_t scratch[TICKET_FRAME_SIZE];
+    Frame f;
+    int n;
+
+    // FRAME_HELLO comes first when it was not read yet
+    do {
+        n = frame_recv(fd, rx, &f, scratch, sizeof(scratch));
+    } while (n == 1 && f.type == FRAME_HELLO);
+    if (n != 1) return -1;
+    return ticket_accept(t, key, next, &f);
+}
@@ -0,0 +1,146 @@
+#ifndef TICKET_H
+#define TICKET_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include "session.h"      // For the frame layer and the crypto headers
+#include "control.h"      // For the FRAME_TICKET payload
+#include <time.h>         // For time_t
+
+#ifndef _WIN32
+#include <pthread.h>      // The ticket key is shared by all event loops
+#endif
+
+// ========================================================================
+// Session resumption tickets
+// ========================================================================
+// A full handshake costs a key generation and two X25519 scalar
+// multiplications per side. After one, the server hands the client a
+// ticket: the resumption secret of the session, sealed with a ticket key
+// that only the server knows. The server keeps no per-client state.
+//
+//   server -> client   public key (32) | FRAME_HELLO(server random)
+//   client -> server   32 zero bytes   | FRAME_RESUME(client random |
+//                                                     ticket)
+//   server -> client   FRAME_TICKET    (accepted: a new ticket, under
+//                                       the ticket frame key of the
+//                                       resumed session, see control.h)
+//                   or FRAME_RESUME_REJECT, then the server waits for
+//                      the client public key as in a full handshake
+//
+// The all-zero public key never comes from a real client (it is a point
+// of small order), so it marks a resumption. Both sides then derive the
+// session key with Ascon-XOF128, without any scalar multiplication:
+//
+//   resumption secret = XOF("ECC-code resumption" | session key)
+//   resumed key       = XOF("ECC-code resume" | resumption secret |
+//                           server random | client random)
+//
+// The randoms make every resumed key unique, so a recorded RESUME frame
+// replayed later yields a different key. The client waits for the
+// verdict before it sends anything.
+//
+// A ticket is key id (4) | nonce (16) | AEAD(ticket key, nonce,
+// resumption secret | issue time). The ticket key is replaced every
+// TICKET_ROTATE seconds; tickets sealed with the previous key are still
+// accepted, and none older than TICKET_LIFETIME.
+// ========================================================================
+
+#define TICKET_KEY_SIZE 16                // ASCON-128a key of the server
+#define TICKET_SECRET_SIZE 32             // Resumption secret
+#define TICKET_RANDOM_SIZE 16             // Server and client randoms
+#define TICKET_PLAIN_SIZE (TICKET_SECRET_SIZE + 8)
+#define TICKET_SIZE (4 + NONCE_SIZE + TICKET_PLAIN_SIZE + TAG_SIZE)
+#define TICKET_RESUME_SIZE (TICKET_RANDOM_SIZE + TICKET_SIZE)
+                                          // Payload of FRAME_RESUME
+#define TICKET_FRAME_SIZE (CONTROL_HEADER + TICKET_SIZE + TAG_SIZE)
+                                          // Payload of FRAME_TICKET
+#define TICKET_ROTATE 3600                // Seconds per ticket key
+#define TICKET_LIFETIME (2 * TICKET_ROTATE)  // Oldest accepted ticket
+
+// ========================================================================
+// Server side: the ticket keys
+// ========================================================================
+typedef struct {
+    uint8_t key[2][TICKET_KEY_SIZE];      // Current and previous key
+    uint32_t id[2];                       // Their ids (0: no key)
+    time_t created;                       // When the current one was drawn
+#ifndef _WIN32
+    pthread_mutex_t lock;                 // Sealing may rotate the keys
+#endif
+} TicketKeys;
+
+// Draws the first ticket key. Returns 0 or -1 if no random bytes.
+int ticket_keys_init(TicketKeys *k);
+
+// Wipes the keys
+void ticket_keys_free(TicketKeys *k);
+
+// Seals 'secret' into 'ticket', rotating the key when it is due.
+// Returns 0 or -1 if no random bytes were available.
+int ticket_seal(TicketKeys *k, const uint8_t secret[TICKET_SECRET_SIZE],
+                uint8_t ticket[TICKET_SIZE]);
+
+// Opens a ticket. Returns 0 and the resumption secret, or -1 if the
+// ticket is malformed, forged, expired or its key was rotated out.
+int ticket_open(TicketKeys *k, const uint8_t *ticket, size_t len,
+                uint8_t secret[TICKET_SECRET_SIZE]);
+
+// ========================================================================
+// Key derivation (both sides)
+// ========================================================================
+
+// The resumption secret of a session
+void ticket_resumption_secret(const uint8_t key[SHARED_SECRET_SIZE],
+                              uint8_t secret[TICKET_SECRET_SIZE]);
+
+// The key of a resumed session
+void ticket_resume_key(const uint8_t secret[TICKET_SECRET_SIZE],
+                       const uint8_t server_random[TICKET_RANDOM_SIZE],
+                       const uint8_t client_random[TICKET_RANDOM_SIZE],
+                       uint8_t key[SHARED_SECRET_SIZE]);
+
+// Returns 1 if 'public_key' is the resumption marker (all zero)
+int ticket_is_resume(const uint8_t public_key[KEY_SIZE]);
+
+// Builds the FRAME_TICKET payload that hands the client a ticket for
+// the session 'key', as control frame '*seq' of the connection (see
+// control.h). Returns the payload length or -1 if the ticket could not
+// be sealed.
+int ticket_issue(TicketKeys *k, const uint8_t key[SHARED_SECRET_SIZE],
+                 uint64_t *seq, uint8_t out[TICKET_FRAME_SIZE]);
+
+// ========================================================================
+// Client side
+// ========================================================================
+typedef struct {
+    uint8_t secret[TICKET_SECRET_SIZE];   // Resumption secret
+    uint8_t ticket[TICKET_SIZE];          // Opaque to the client
+} TicketCache;
+
+// Reads or writes the ticket file of the client (created with mode
+// 0600). Return 0 or -1.
+int ticket_cache_load(const char *path, TicketCache *t);
+int ticket_cache_save(const char *path, const TicketCache *t);
+
+// Opens a FRAME_TICKET payload received on the session 'key' and stores
+// the new ticket with its resumption secret in 't'. '*next' is the
+// lowest control frame number still accepted. Returns 0 or -1.
+int ticket_accept(TicketCache *t, const uint8_t key[SHARED_SECRET_SIZE],
+                  uint64_t *next, const Frame *f);
+
+// Client half of the exchange, after the server public key was read:
+// waits for FRAME_HELLO, sends the marker and FRAME_RESUME and waits
+// for the verdict. Returns 1 with the resumed key in 'key' and the next
+// ticket stored in 't', 0 if the server rejected the ticket (the client
+// must then send its public key) or -1 on a connection error.
+int ticket_resume(int fd, FrameBuffer *rx, TicketCache *t,
+                  uint64_t *next, uint8_t key[SHARED_SECRET_SIZE]);
+
+// Waits for the FRAME_TICKET the server sends after a full handshake
+// and stores it in 't'. Returns 0 or -1.
+int ticket_receive(int fd, FrameBuffer *rx, TicketCache *t,
+                   uint64_t *next, const uint8_t key[SHARED_SECRET_SIZE]);
+
+#endif // TICKET_H
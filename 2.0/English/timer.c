@@ -0,0 +1,220 @@
+#include "timer.h"
+#include <limits.h>       // For INT_MAX
+#include <string.h>       // For memset()
+
+#ifdef _WIN32
+#include <windows.h>      // For GetTickCount64()
+#else
+#include <time.h>         // For clock_gettime()
+#endif
+
+// Ticks covered by the whole wheel
+#define TIMER_RANGE ((uint64_t)1 << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+// ========================================================================
+// Clock
+// ========================================================================
+uint64_t timer_now_ms(void)
+{
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+}
+
+// ========================================================================
+// Helpers: slot lists (circular, the head is a sentinel)
+// ========================================================================
+static void timer_list_init(Timer *head)
+{
+    head->next = head->prev = head;
+}
+
+static void timer_link(Timer *head, Timer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void timer_unlink(Timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+// Moves every timer of slot 'level'/'index' to the list 'to' (which
+// must be empty) and marks the slot empty
+static void timer_take_slot(TimerWheel *w, int level, unsigned index,
+                            Timer *to)
+{
+    Timer *head = &w->slots[level][index];
+
+    timer_list_init(to);
+    w->occupied[level] &= ~((uint64_t)1 << index);
+    if (head->next == head) return;
+    to->next = head->next;
+    to->prev = head->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    timer_list_init(head);
+}
+
+// Links 't' into the slot of its deadline, counted from w->now
+static void timer_place(TimerWheel *w, Timer *t)
+{
+    if (t->expires < w->now) t->expires = w->now;  // Due: next tick
+    uint64_t delta = t->expires - w->now;
+    if (delta >= TIMER_RANGE) {
+        // Beyond the wheel: waits at its end (the owner arms it again)
+        delta = TIMER_RANGE - 1;
+        t->expires = w->now + delta;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 &&
+           delta >= (uint64_t)1 << (TIMER_SLOT_BITS * (level + 1))) {
+        level++;
+    }
+    unsigned index = (unsigned)(t->expires >> (TIMER_SLOT_BITS * level)) &
+                     (TIMER_SLOTS - 1);
+    t->slot = (unsigned)level * TIMER_SLOTS + index;
+    timer_link(&w->slots[level][index], t);
+    w->occupied[level] |= (uint64_t)1 << index;
+}
+
+// Level 0 wrapped: the timers of the current slot of 'level' are due
+// within the next TIMER_SLOTS^level ticks and move down
+static void timer_cascade(TimerWheel *w, int level, unsigned index)
+{
+    Timer list;
+
+    timer_take_slot(w, level, index, &list);
+    while (list.next != &list) {
+        Timer *t = list.next;
+        timer_unlink(t);
+        timer_place(w, t);
+    }
+}
+
+// ========================================================================
+// Public API
+// ========================================================================
+void timer_wheel_init(TimerWheel *w, uint64_t now_ms)
+{
+    memset(w, 0, sizeof(*w));
+    w->origin_ms = now_ms;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int i = 0; i < TIMER_SLOTS; i++) {
+            timer_list_init(&w->slots[level][i]);
+        }
+    }
+}
+
+void timer_add(TimerWheel *w, Timer *t, uint64_t at_ms)
+{
+    timer_cancel(w, t);
+    // Rounded up: a timer never fires before its time
+    t->expires = at_ms > w->origin_ms
+                 ? (at_ms - w->origin_ms + TIMER_TICK_MS - 1) /
+                   TIMER_TICK_MS
+                 : 0;
+    timer_place(w, t);
+    w->count++;
+}
+
+void timer_cancel(TimerWheel *w, Timer *t)
+{
+    if (t->next == NULL) return;
+
+    Timer *head = &w->slots[t->slot / TIMER_SLOTS][t->slot % TIMER_SLOTS];
+    timer_unlink(t);
+    if (head->next == head) {
+        w->occupied[t->slot / TIMER_SLOTS] &=
+            ~((uint64_t)1 << (t->slot % TIMER_SLOTS));
+    }
+    w->count--;
+}
+
+int timer_armed(const Timer *t)
+{
+    return t->next != NULL;
+}
+
+void timer_wheel_advance(TimerWheel *w, uint64_t now_ms, TimerFn fn,
+                         void *arg)
+{
+    if (now_ms < w->origin_ms) return;
+    uint64_t target = (now_ms - w->origin_ms) / TIMER_TICK_MS;  // Last
+                                                               // tick due
+    while (w->now <= target) {
+        if (w->count == 0) {
+            w->now = target + 1;  // Nothing to fire or to move down
+            break;
+        }
+
+        unsigned index = (unsigned)w->now & (TIMER_SLOTS - 1);
+        if (index == 0) {
+            // Level 0 wrapped: move the next slot of level 1 down, and
+            // of level 2 when level 1 wrapped too, ...
+            for (int level = 1; level < TIMER_LEVELS; level++) {
+                unsigned i = (unsigned)(w->now >>
+                                        (TIMER_SLOT_BITS * level)) &
+                             (TIMER_SLOTS - 1);
+                timer_cascade(w, level, i);
+                if (i != 0) break;
+            }
+        }
+
+        // Skip empty ticks, but never past the next wrap
+        uint64_t bits = w->occupied[0] >> index;
+        if (bits == 0) {
+            uint64_t wrap = (w->now | (TIMER_SLOTS - 1)) + 1;
+            w->now = wrap <= target + 1 ? wrap : target + 1;
+            continue;
+        }
+        uint64_t tick = w->now + (uint64_t)__builtin_ctzll(bits);
+        if (tick > target) {
+            w->now = target + 1;
+            break;
+        }
+
+        // Timers added by the callbacks go to later ticks
+        Timer work;
+        timer_take_slot(w, 0, (unsigned)tick & (TIMER_SLOTS - 1), &work);
+        w->now = tick + 1;
+        while (work.next != &work) {
+            Timer *t = work.next;
+            timer_unlink(t);
+            w->count--;
+            fn(t, arg);
+        }
+    }
+}
+
+int timer_wheel_timeout(const TimerWheel *w, uint64_t now_ms)
+{
+    if (w->count == 0) return -1;
+
+    // The next occupied tick of level 0, or the next wrap (which may
+    // bring timers down from the levels above)
+    unsigned index = (unsigned)w->now & (TIMER_SLOTS - 1);
+    uint64_t bits = w->occupied[0] >> index;
+    uint64_t tick;
+    if (bits != 0) {
+        tick = w->now + (uint64_t)__builtin_ctzll(bits);
+    } else if (index == 0) {
+        tick = w->now;  // Its wrap has not been processed yet
+    } else {
+        tick = (w->now | (TIMER_SLOTS - 1)) + 1;
+    }
+
+    uint64_t at = w->origin_ms + tick * TIMER_TICK_MS;
+    if (at <= now_ms) return 0;
+    return at - now_ms > INT_MAX ? INT_MAX : (int)(at - now_ms);
+}
@@ -0,0 +1,85 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint64_t
+
+// ========================================================================
+// Hierarchical timing wheel
+// ========================================================================
+// Every session of an event loop has deadlines (handshake, idle,
+// keepalive). Keeping them in a sorted structure costs O(log n) per
+// change, scanning the sessions on every tick costs O(n) per tick. A
+// timing wheel does both in O(1):
+//
+// - Time advances in ticks of TIMER_TICK_MS. Level 0 has one slot per
+//   tick for the next TIMER_SLOTS ticks, level 1 one slot per
+//   TIMER_SLOTS ticks, and so on: four levels of 64 slots cover 46 hours
+//   (later deadlines wait in the last slot and are armed again).
+// - A timer is a list node inside its owner (no allocation). Adding it
+//   links it into the slot of its deadline, cancelling unlinks it.
+// - When level 0 wraps, the next slot of level 1 is emptied into level 0
+//   (and so on upwards), so each timer moves at most once per level.
+// - One bit per slot tells which slots hold timers: the loop sleeps
+//   until the next occupied slot (or the next wrap), never tick by tick,
+//   and skips empty ticks when it wakes.
+//
+// A wheel is not locked: it belongs to one event loop.
+// ========================================================================
+
+#define TIMER_TICK_MS 10                  // Resolution (milliseconds)
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)  // Slots per level (64)
+#define TIMER_LEVELS 4                    // 64^4 ticks: 46.6 hours
+
+// A timer, embedded in the structure it belongs to
+typedef struct Timer {
+    struct Timer *next, *prev;            // In its slot (NULL: not armed)
+    uint64_t expires;                     // Tick it fires at
+    unsigned slot;                        // level * TIMER_SLOTS + index
+} Timer;
+
+typedef struct {
+    uint64_t now;                         // Next tick to process
+    uint64_t origin_ms;                   // Clock time of tick 0
+    Timer slots[TIMER_LEVELS][TIMER_SLOTS];  // List heads
+    uint64_t occupied[TIMER_LEVELS];      // Bit per slot holding timers
+    size_t count;                         // Timers armed
+} TimerWheel;
+
+// Called for a timer that expired (it is no longer armed and may be
+// added again)
+typedef void (*TimerFn)(Timer *t, void *arg);
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Milliseconds of a monotonic clock
+uint64_t timer_now_ms(void);
+
+// Prepares an empty wheel whose tick 0 is 'now_ms'
+void timer_wheel_init(TimerWheel *w, uint64_t now_ms);
+
+// Arms 't' (cancelling it first if it is armed) to fire at 'at_ms', or
+// at the next tick if that time has passed
+void timer_add(TimerWheel *w, Timer *t, uint64_t at_ms);
+
+// Disarms 't' if it is armed
+void timer_cancel(TimerWheel *w, Timer *t);
+
+// Returns 1 if 't' is armed
+int timer_armed(const Timer *t);
+
+// Fires every timer due at 'now_ms', in order of their ticks
+void timer_wheel_advance(TimerWheel *w, uint64_t now_ms, TimerFn fn,
+                         void *arg);
+
+// Milliseconds until the wheel needs to be advanced again (a timeout for
+// epoll_wait()), or -1 if no timer is armed
+int timer_wheel_timeout(const TimerWheel *w, uint64_t now_ms);
+
+#endif // TIMER_H
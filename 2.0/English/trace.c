@@ -0,0 +1,217 @@
+#include "trace.h"
+#include "hist.h"         // For the span histograms
+#include <stdio.h>        // For fprintf(), fopen()
+#include <stdlib.h>       // For calloc(), atexit()
+#include <string.h>       // For memset()
+
+#ifdef _WIN32
+#include <windows.h>      // For QueryPerformanceCounter()
+#include <process.h>      // For _getpid()
+#define getpid _getpid
+#else
+#include <pthread.h>      // For the SIGUSR1 dump thread
+#include <signal.h>       // For sigaction()
+#include <time.h>         // For clock_gettime(), nanosleep()
+#include <unistd.h>       // For getpid()
+#endif
+
+// One span kept for the Chrome trace
+typedef struct {
+    uint64_t start;                     // trace_now_ns()
+    uint64_t duration;                  // Nanoseconds
+    uint32_t span;                      // TraceSpan
+    uint32_t thread;                    // Small id of the thread
+} TraceEvent;
+
+static const char *const trace_names[TRACE_SPANS] = {
+    "handshake", "keygen", "send_key", "recv_key", "scalarmult",
+    "ticket", "audio_stop", "encrypt", "decrypt",
+};
+
+// ========================================================================
+// State
+// ========================================================================
+int trace_on = 0;
+
+static Histogram trace_hist[TRACE_SPANS];  // Shared by all threads
+static TraceEvent *trace_events;        // --trace-json: the last
+                                        // TRACE_EVENTS spans
+static uint64_t trace_next;             // Spans recorded into events
+static const char *trace_json;          // --trace-json FILE
+static uint32_t trace_threads;          // Thread ids given out
+static __thread uint32_t trace_thread;  // This thread (0: none yet)
+
+// ========================================================================
+// Clock
+// ========================================================================
+uint64_t trace_now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// ========================================================================
+// Recording
+// ========================================================================
+void trace_record(TraceSpan span, uint64_t start)
+{
+    uint64_t duration = trace_now_ns() - start;
+
+    hist_record_atomic(&trace_hist[span], duration);
+    if (trace_events == NULL) return;
+
+    if (trace_thread == 0) {
+        trace_thread = __atomic_add_fetch(&trace_threads, 1,
+                                          __ATOMIC_RELAXED);
+    }
+    uint64_t i = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+    TraceEvent *e = &trace_events[i % TRACE_EVENTS];
+    __atomic_store_n(&e->start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->duration, duration, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->span, (uint32_t)span, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->thread, trace_thread, __ATOMIC_RELAXED);
+}
+
+// ========================================================================
+// Output
+// ========================================================================
+
+// Copies a histogram that other threads may be recording into
+static void trace_snapshot(Histogram *to, const Histogram *from)
+{
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        to->counts[i] = __atomic_load_n(&from->counts[i], __ATOMIC_RELAXED);
+    }
+    to->total = __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+    to->sum = __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+    to->min = __atomic_load_n(&from->min, __ATOMIC_RELAXED);
+    to->max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+}
+
+void trace_print(void)
+{
+    static Histogram h;  // 58 KB: not on the stack of a small thread
+
+    fprintf(stderr, "Trace (us)        count       p50       p90       p99"
+                    "     p99.9       max      mean\n");
+    for (int s = 0; s < TRACE_SPANS; s++) {
+        trace_snapshot(&h, &trace_hist[s]);
+        if (h.total == 0) continue;
+        fprintf(stderr, "  %-11s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f"
+                "\n", trace_names[s], (unsigned long long)h.total,
+                hist_percentile(&h, 50.0) / 1e3,
+                hist_percentile(&h, 90.0) / 1e3,
+                hist_percentile(&h, 99.0) / 1e3,
+                hist_percentile(&h, 99.9) / 1e3, h.max / 1e3,
+                (double)h.sum / (double)h.total / 1e3);
+    }
+}
+
+int trace_write_json(void)
+{
+    if (trace_events == NULL) return 0;
+
+    FILE *out = fopen(trace_json, "w");
+    if (out == NULL) return -1;
+
+    uint64_t next = __atomic_load_n(&trace_next, __ATOMIC_RELAXED);
+    uint64_t first = next > TRACE_EVENTS ? next - TRACE_EVENTS : 0;
+    int pid = (int)getpid();
+
+    // Complete events ("ph": "X"), timestamps in microseconds
+    int written = 0;
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (uint64_t i = first; i < next; i++) {
+        const TraceEvent *e = &trace_events[i % TRACE_EVENTS];
+        uint32_t span = __atomic_load_n(&e->span, __ATOMIC_RELAXED);
+        if (span >= TRACE_SPANS) continue;
+        fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}\n",
+                written++ ? "," : "", trace_names[span],
+                span >= TRACE_ENCRYPT ? "message" : "handshake",
+                __atomic_load_n(&e->start, __ATOMIC_RELAXED) / 1e3,
+                __atomic_load_n(&e->duration, __ATOMIC_RELAXED) / 1e3,
+                pid, __atomic_load_n(&e->thread, __ATOMIC_RELAXED));
+    }
+    fprintf(out, "],\"displayTimeUnit\":\"ns\"}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+// At exit: the histograms, and the Chrome trace if asked for
+static void trace_exit(void)
+{
+    trace_print();
+    if (trace_write_json() != 0) perror("Cannot write the trace");
+}
+
+#ifndef _WIN32
+// ========================================================================
+// SIGUSR1: the handler only sets a flag, a thread prints
+// ========================================================================
+static volatile sig_atomic_t trace_dump_requested = 0;
+
+static void trace_on_signal(int sig)
+{
+    (void)sig;
+    trace_dump_requested = 1;
+}
+
+// Thread body: looks at the flag every 100 ms
+static void *trace_dump_main(void *arg)
+{
+    const struct timespec step = { 0, 100 * 1000 * 1000 };
+
+    (void)arg;
+    for (;;) {
+        nanosleep(&step, NULL);
+        if (trace_dump_requested) {
+            trace_dump_requested = 0;
+            trace_exit();
+        }
+    }
+    return NULL;
+}
+#endif
+
+// ========================================================================
+// Start
+// ========================================================================
+int trace_start(const char *json_path)
+{
+    for (int s = 0; s < TRACE_SPANS; s++) hist_init(&trace_hist[s]);
+    if (json_path != NULL) {
+        trace_events = calloc(TRACE_EVENTS, sizeof(*trace_events));
+        if (trace_events == NULL) return -1;
+        for (unsigned i = 0; i < TRACE_EVENTS; i++) {
+            trace_events[i].span = TRACE_SPANS;  // Not written yet
+        }
+        trace_json = json_path;
+    }
+#ifndef _WIN32
+    pthread_t thread;
+    pthread_attr_t attr;
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_on_signal;
+    sa.sa_flags = SA_RESTART;  // Blocking reads of the chat go on
+    sigemptyset(&sa.sa_mask);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, trace_dump_main, NULL) == 0) {
+        sigaction(SIGUSR1, &sa, NULL);
+    }
+    pthread_attr_destroy(&attr);
+#endif
+    atexit(trace_exit);
+    trace_on = 1;
+    return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stdint.h>       // For uint64_t
+
+// ========================================================================
+// Latency tracing
+// ========================================================================
+// Connection setup is a chain of phases (key generation, sending the
+// public key, waiting for the peer key, the scalar multiplication, the
+// ticket, stopping the music) and each message goes through the AEAD.
+// A span times one phase with the monotonic clock:
+//
+//     uint64_t t = trace_begin();
+//     crypto_scalarmult(...);
+//     trace_end(TRACE_SCALARMULT, t);
+//
+// Each span kind has a Histogram (hist.h) shared by all threads. With
+// --trace the histograms are printed to stderr on SIGUSR1 and at exit;
+// with --trace-json FILE the last TRACE_EVENTS spans are also written to
+// FILE as Chrome trace JSON (chrome://tracing, Perfetto).
+//
+// Without --trace, trace_begin() returns 0 and trace_end() returns at
+// once. Define NO_TRACE at compile time to remove the spans entirely.
+// ========================================================================
+
+typedef enum {
+    TRACE_HANDSHAKE,          // accept()/connect() to the shared secret
+    TRACE_KEYGEN,             // Private key and public key
+    TRACE_SEND_KEY,           // Sending the public key
+    TRACE_RECV_KEY,           // Waiting for and reading the peer key
+    TRACE_SCALARMULT,         // Shared secret (X25519)
+    TRACE_TICKET,             // Issuing and sending, or receiving, it
+    TRACE_AUDIO_STOP,         // Stopping the waiting music
+    TRACE_ENCRYPT,            // crypto_aead_encrypt() of a message
+    TRACE_DECRYPT,            // crypto_aead_decrypt() of a message
+    TRACE_SPANS
+} TraceSpan;
+
+#define TRACE_EVENTS 65536    // Spans kept for --trace-json (1.5 MiB)
+
+extern int trace_on;          // Set by trace_start()
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Monotonic clock in nanoseconds
+uint64_t trace_now_ns(void);
+
+// Starts collecting spans. 'json_path' (or NULL) receives the Chrome
+// trace at exit and on SIGUSR1. Returns 0, or -1 if out of memory.
+int trace_start(const char *json_path);
+
+// Counts a span of kind 'span' that started at 'start' (trace_begin())
+void trace_record(TraceSpan span, uint64_t start);
+
+// Prints count, percentiles and mean of every span kind to stderr
+void trace_print(void);
+
+// Writes the spans kept so far to the --trace-json file. Returns 0, or
+// -1 if it cannot be written.
+int trace_write_json(void);
+
+#ifdef NO_TRACE
+static inline uint64_t trace_begin(void) { return 0; }
+static inline void trace_end(TraceSpan span, uint64_t start)
+{
+    (void)span;
+    (void)start;
+}
+#else
+// Start of a span (0 when tracing is off)
+static inline uint64_t trace_begin(void)
+{
+    return trace_on ? trace_now_ns() : 0;
+}
+
+// End of a span started with trace_begin()
+static inline void trace_end(TraceSpan span, uint64_t start)
+{
+    if (start != 0) trace_record(span, start);
+}
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,70 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+// ========================================================================
+// Includes
+// ========================================================================
+#include <stddef.h>       // For size_t
+#include <stdint.h>       // For uint32_t
+
+// ========================================================================
+// Zero-copy transmit (MSG_ZEROCOPY)
+// ========================================================================
+// write() copies every byte of a frame into socket buffers. With
+// SO_ZEROCOPY enabled on a socket, send(..., MSG_ZEROCOPY) instead pins
+// the pages of the buffer and the network card reads them directly. The
+// buffer then belongs to the kernel until it reports completion: every
+// zero-copy send gets the next number of a per-socket counter (starting
+// at 0), and a notification on the socket error queue names the range
+// of numbers whose buffers may be reused. epoll reports it as EPOLLERR
+// and poll() as POLLERR.
+//
+// Pinning pages and reading the notification costs more than copying a
+// small frame, so only frames of ZC_MIN_SIZE bytes or more are sent this
+// way. When the kernel had to copy anyway (loopback, or a device without
+// scatter-gather), the notification says so, and the caller should go
+// back to plain writes on that socket.
+//
+// Linux only; zc_enable() fails elsewhere and callers keep copying.
+// ========================================================================
+
+#define ZC_MIN_SIZE 65536                 // Smallest frame sent without
+                                          // a copy (see zerocopy.md)
+#define ZC_MAX_RANGES 16                  // Notifications read per call
+
+// Zero-copy state of one socket
+typedef struct {
+    int on;                               // Large sends use MSG_ZEROCOPY
+    uint32_t next;                        // Number the kernel gives the
+                                          // next one
+} ZcSocket;
+
+// Completed sends first .. last (inclusive, the counter wraps)
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    int copied;                           // The kernel copied the data
+} ZcRange;
+
+// ========================================================================
+// Function Prototypes
+// ========================================================================
+
+// Enables SO_ZEROCOPY (and TCP_NODELAY) on the TCP socket 'fd'. Returns
+// 0, or -1 if the kernel or the socket does not support it.
+int zc_enable(int fd);
+
+// Sends 'len' bytes of 'buf' with MSG_ZEROCOPY ('flags' are added, e.g.
+// MSG_DONTWAIT). Returns like send(); a send of one byte or more takes
+// the next number of the counter. errno ENOBUFS means the socket is out
+// of option memory for pinned pages: send with a copy instead.
+long zc_send(int fd, const void *buf, size_t len, int flags);
+
+// Reads up to 'max' notifications from the error queue of 'fd' without
+// blocking. Returns how many were stored in 'out', or -1 on error.
+int zc_reap(int fd, ZcRange *out, int max);
+
+// Returns 1 if send number 'seq' is inside 'r'
+int zc_covers(const ZcRange *r, uint32_t seq);
+
+#endif // ZEROCOPY_H